@@ -0,0 +1,226 @@
+/**
+ * @file bench_passwd.c
+ * @brief Compare passwd lookups by name and uid across access methods.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../lib/service-passwd.h"
+
+#define PROGNAME "bench_passwd"
+#define FIRST_UID 10000
+#define SEED 2015
+
+static void usage(void);
+static double elapsed(const struct timespec *);
+static int load(const char *, DBTYPE, u_int32_t);
+static int lookup(const char *, u_int32_t, u_int32_t);
+static void make_line(char *, size_t, u_int32_t);
+
+static void
+usage(void)
+{
+    fprintf(stderr,
+            "usage: %s [-i access] [-n records] [-l lookups] directory\n",
+            PROGNAME);
+    _exit(1);
+}
+
+/*
+ * Load a new passwd database into an empty directory, then time lookups
+ * by name and by uid through a read-only, free-threaded handle, as the
+ * NSS module opens. The key filter and snapshot built by the commit are
+ * removed, so every lookup reaches the database. As passwd is enumerated,
+ * its primary is a btree either way, and only the uid index is hashed.
+ */
+int
+main(int argc, char *argv[])
+{
+    int option;
+    DBTYPE access = DB_BTREE;
+    u_int32_t nrecs = 1000000, nlookups = 1000000;
+    char path[1024];
+    struct stat st;
+
+    while((option = getopt(argc, argv, "i:n:l:")) != -1) {
+        switch(option) {
+        case 'i':
+            if(!strcasecmp(optarg, "btree"))
+                access = DB_BTREE;
+            else if(!strcasecmp(optarg, "hash"))
+                access = DB_HASH;
+            else
+                usage();
+            break;
+
+        case 'n':
+            nrecs = strtoul(optarg, NULL, 10);
+            break;
+
+        case 'l':
+            nlookups = strtoul(optarg, NULL, 10);
+            break;
+
+        default:
+            usage();
+        }
+    }
+
+    if(optind != argc - 1 || nrecs == 0)
+        usage();
+
+    /* The access method only applies to a database created here. */
+    snprintf(path, sizeof(path), "%s/%s", argv[optind], PASSWD_PRI);
+    if(stat(path, &st) == 0)
+        errx(1, "%s already exists", path);
+    if(mkdir(argv[optind], 0755) != 0 && errno != EEXIST)
+        err(1, "could not create %s", argv[optind]);
+
+    if(load(argv[optind], access, nrecs) != 0
+       || lookup(argv[optind], nrecs, nlookups) != 0)
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+static double
+elapsed(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec)
+        + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int
+load(const char *base, DBTYPE access, u_int32_t nrecs)
+{
+    int result = 0;
+    SERVICE passwd;
+    PASSWD_KEY key;
+    PASSWD_REC rec;
+    char line[SERVICE_REC_MAX], path[1024];
+    struct timespec start;
+    u_int32_t i;
+
+    make_line(line, sizeof(line), nrecs / 2);
+    dbng_set_access(access, nrecs, strlen(line));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(service_init(&passwd, TYPE_PASSWD, DBNG_RW, base) < 0) {
+        warnx("could not initialize passwd service");
+        return -1;
+    }
+
+    passwd.start_txn(&passwd);
+    for(i = 0; i < nrecs; i++) {
+        make_line(line, sizeof(line), i);
+        if(passwd.parse(&passwd, line, (KEY *) &key, (REC *) &rec) <= 0
+           || passwd.set(&passwd, (KEY *) &key, (REC *) &rec) != 0)
+        {
+            warnx("could not add %s", line);
+            passwd.rollback(&passwd);
+            result = -1;
+            goto cleanup;
+        }
+    }
+
+    if(passwd.commit(&passwd) != 0) {
+        warnx("could not commit");
+        result = -1;
+        goto cleanup;
+    }
+
+    printf("%s: %lu records loaded in %.3fs\n",
+           (access == DB_HASH ? "hash" : "btree"), (unsigned long) nrecs,
+           elapsed(&start));
+
+    snprintf(path, sizeof(path), "%s/%s%s", base, PASSWD_PRI, BLOOM_SUFFIX);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/%s%s", base, PASSWD_PRI,
+             SNAPSHOT_SUFFIX);
+    unlink(path);
+
+cleanup:
+    service_cleanup(&passwd);
+    return result;
+}
+
+static int
+lookup(const char *base, u_int32_t nrecs, u_int32_t nlookups)
+{
+    int result = 0;
+    SERVICE passwd;
+    PASSWD_KEY key;
+    PASSWD_REC rec;
+    char name[32];
+    struct timespec start;
+    double secs;
+    u_int32_t i, n;
+
+    if(service_init(&passwd, TYPE_PASSWD, DBNG_RO | DBNG_THREAD, base) < 0) {
+        warnx("could not initialize passwd service");
+        return -1;
+    }
+
+    /* Both passes look up the same users in the same order. */
+    srand48(SEED);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < nlookups; i++) {
+        n = lrand48() % nrecs;
+        snprintf(name, sizeof(name), "user%07lu", (unsigned long) n);
+        key.base.type = PRI;
+        key.data.pri = name;
+        if(passwd.get(&passwd, (KEY *) &key, (REC *) &rec) != 0) {
+            warnx("could not find %s", name);
+            result = -1;
+            goto cleanup;
+        }
+    }
+    secs = elapsed(&start);
+    printf("getpwnam: %lu lookups in %.3fs, %.0f/s\n",
+           (unsigned long) nlookups, secs, nlookups / secs);
+
+    srand48(SEED);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(i = 0; i < nlookups; i++) {
+        n = lrand48() % nrecs;
+        key.base.type = SEC;
+        key.data.sec = FIRST_UID + n;
+        if(passwd.get(&passwd, (KEY *) &key, (REC *) &rec) != 0
+           || rec.uid != FIRST_UID + n)
+        {
+            warnx("could not find uid %lu", (unsigned long) FIRST_UID + n);
+            result = -1;
+            goto cleanup;
+        }
+    }
+    secs = elapsed(&start);
+    printf("getpwuid: %lu lookups in %.3fs, %.0f/s\n",
+           (unsigned long) nlookups, secs, nlookups / secs);
+
+cleanup:
+    service_cleanup(&passwd);
+    return result;
+}
+
+static void
+make_line(char *line, size_t len, u_int32_t n)
+{
+    snprintf(line, len,
+             "user%07lu:x:%lu:100:Benchmark User %lu:/home/user%07lu:/bin/sh",
+             (unsigned long) n, (unsigned long) FIRST_UID + n,
+             (unsigned long) n, (unsigned long) n);
+}
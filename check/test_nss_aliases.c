@@ -0,0 +1,168 @@
+/**
+ * @file test_nss_aliases.c
+ * @brief Test mail alias lookups and enumeration through the aliases
+ * service.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <aliases.h>
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../nss/nss-dbng.h"
+#include "../lib/service-aliases.h"
+
+#define PASS 0
+#define FAIL 1
+#define MAX_BUF 2048
+#define SMALL_BUF 8
+
+extern enum nss_status _nss_dbng_getaliasbyname_r(const char *,
+                                                  struct aliasent *, char *,
+                                                  size_t, int *);
+extern enum nss_status _nss_dbng_setaliasent(void);
+extern enum nss_status _nss_dbng_endaliasent(void);
+extern enum nss_status _nss_dbng_getaliasent_r(struct aliasent *, char *,
+                                               size_t, int *);
+extern size_t _nss_dbng_getaliasent_size(void);
+
+static int setup_db(void);
+
+int
+main(int argc, char *argv[])
+{
+    int result = PASS, errnop, i;
+    enum nss_status status;
+    char buf[MAX_BUF], *big;
+    struct aliasent abuf;
+    size_t size;
+
+    if((result = setup_db()) != PASS)
+        return result;
+
+    /* First with an insufficient buffer size. */
+    status = _nss_dbng_getaliasbyname_r("staff", &abuf, buf, 1, &errnop);
+    if(status != NSS_STATUS_TRYAGAIN || errnop != ERANGE) {
+        warnx("expected out of space");
+        return FAIL;
+    }
+
+    status = _nss_dbng_getaliasbyname_r("non-existant-alias", &abuf, buf,
+                                        MAX_BUF, &errnop);
+    if(status != NSS_STATUS_NOTFOUND) {
+        warnx("expected to not find the alias");
+        result = FAIL;
+    }
+
+    /* Names are matched regardless of case. */
+    status = _nss_dbng_getaliasbyname_r("PostMaster", &abuf, buf, MAX_BUF,
+                                        &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(abuf.alias_name, "postmaster")
+       || abuf.alias_members_len != 1
+       || strcmp(abuf.alias_members[0], "root"))
+    {
+        warnx("unexpected alias details for postmaster");
+        result = FAIL;
+    }
+
+    /* Continuation lines and repeated names add to the member list. */
+    status = _nss_dbng_getaliasbyname_r("staff", &abuf, buf, MAX_BUF,
+                                        &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || abuf.alias_members_len != 4
+       || strcmp(abuf.alias_members[0], "mikey")
+       || strcmp(abuf.alias_members[1], "root@example.com")
+       || strcmp(abuf.alias_members[2], "\"|/usr/bin/log, -q\"")
+       || strcmp(abuf.alias_members[3], "ops"))
+    {
+        warnx("unexpected alias details for staff");
+        result = FAIL;
+    }
+
+    /* An entry which does not fit is returned again with the size given. */
+    if(_nss_dbng_setaliasent() != NSS_STATUS_SUCCESS) {
+        warnx("expected to setaliasent");
+        return FAIL;
+    }
+
+    status = _nss_dbng_getaliasent_r(&abuf, buf, SMALL_BUF, &errnop);
+    if(status != NSS_STATUS_TRYAGAIN || errnop != ERANGE
+       || (size = _nss_dbng_getaliasent_size()) == 0)
+    {
+        warnx("expected out of space from getaliasent_r");
+        _nss_dbng_endaliasent();
+        return FAIL;
+    }
+
+    /* Any alignment the buffer needs is at most a pointer's worth. */
+    big = malloc(size + sizeof(char *));
+    status = _nss_dbng_getaliasent_r(&abuf, big, size + sizeof(char *),
+                                     &errnop);
+    if(status != NSS_STATUS_SUCCESS || _nss_dbng_getaliasent_size() != 0) {
+        warnx("expected the entry to fit the size given");
+        result = FAIL;
+    }
+    free(big);
+
+    for(i = 1;
+        _nss_dbng_getaliasent_r(&abuf, buf, MAX_BUF, &errnop)
+            == NSS_STATUS_SUCCESS;
+        i++)
+        ;
+    _nss_dbng_endaliasent();
+
+    if(i != 3) {
+        warnx("unexpected number of iterations (%d), getaliasent_r", i);
+        result = FAIL;
+    }
+
+    return result;
+}
+
+static int
+setup_db(void)
+{
+    int result = PASS, i;
+    SERVICE aliases;
+    ALIASES_KEY key;
+    ALIASES_REC rec;
+    const char *lines[] = {
+        "postmaster: root",
+        "staff: mikey,",
+        "root@example.com , \"|/usr/bin/log, -q\"",
+        "ops:",
+        "staff: ops, mikey",
+        NULL
+    };
+
+    if(service_init(&aliases, TYPE_ALIASES, 0, TEST_BASE) < 0) {
+        warnx("could not initialize aliases service");
+        return FAIL;
+    }
+
+    if(aliases.truncate(&aliases) != 0) {
+        result = FAIL;
+        warnx("could not truncate aliases service");
+        goto err;
+    }
+
+    for(i = 0; lines[i] != NULL; i++) {
+        if(aliases.parse(&aliases, lines[i], (KEY *) &key,
+                         (REC *) &rec) <= 0
+           || aliases.set(&aliases, (KEY *) &key, (REC *) &rec) != 0)
+        {
+            result = FAIL;
+            warnx("could not add %s", lines[i]);
+            goto err;
+        }
+    }
+
+err:
+    service_cleanup(&aliases);
+    return result;
+}
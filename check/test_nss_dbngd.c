@@ -0,0 +1,242 @@
+/**
+ * @file test_nss_dbngd.c
+ * @brief Test lookups through the dbngd lookup daemon.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <pwd.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "../nss/nss-dbng.h"
+#include "../lib/service-passwd.h"
+#include "../lib/daemon.h"
+
+#define PASS 0
+#define FAIL 1
+#define MAX_BUF 2048
+#define NTHREADS 8
+#define NLOOKUPS 100
+#define DBNGD "../dbngd/dbngd"
+
+static int setup_db(void);
+static pid_t start_daemon(void);
+static int lookup(const char *, uid_t);
+static void *lookup_thread(void *);
+
+int
+main(int argc, char *argv[])
+{
+    int result = PASS, t, status;
+    char db[PATH_MAX], moved[PATH_MAX];
+    pthread_t threads[NTHREADS];
+    void *thread_result;
+    pid_t pid;
+
+    if((result = setup_db()) != PASS)
+        return result;
+
+    if((pid = start_daemon()) < 0)
+        return FAIL;
+
+    /*
+     * With the database moved aside, lookups can only be answered by the
+     * daemon, which opened it at startup.
+     */
+    snprintf(db, sizeof(db), "%s/%s", TEST_BASE, PASSWD_PRI);
+    snprintf(moved, sizeof(moved), "%s.moved", db);
+    if(rename(db, moved) < 0) {
+        warn("rename %s", db);
+        result = FAIL;
+        goto err;
+    }
+
+    if(lookup("test-dbng-user", 1001) != PASS) {
+        warnx("expected the daemon to find the user");
+        result = FAIL;
+    }
+
+    /* The second lookup of each key is answered from the shared table. */
+    if(lookup("test-dbng-user", 1001) != PASS) {
+        warnx("expected the shared table to find the user");
+        result = FAIL;
+    }
+
+    /* Concurrent lookups are batched over the shared connection. */
+    for(t = 0; t < NTHREADS; t++)
+        pthread_create(&threads[t], NULL, lookup_thread, NULL);
+
+    for(t = 0; t < NTHREADS; t++) {
+        pthread_join(threads[t], &thread_result);
+        if(thread_result != NULL) {
+            warnx("unexpected results from concurrent daemon lookups");
+            result = FAIL;
+        }
+    }
+
+    if(rename(moved, db) < 0) {
+        warn("rename %s", moved);
+        result = FAIL;
+    }
+
+err:
+    kill(pid, SIGTERM);
+    if(waitpid(pid, &status, 0) != pid
+       || !WIFEXITED(status)
+       || WEXITSTATUS(status) != 0)
+    {
+        warnx("daemon did not exit cleanly");
+        result = FAIL;
+    }
+
+    /* Once the daemon has gone, lookups fall back to the database. */
+    if(result == PASS && lookup("test-dbng-user", 1001) != PASS) {
+        warnx("expected to find the user without the daemon");
+        result = FAIL;
+    }
+
+    return result;
+}
+
+static pid_t
+start_daemon(void)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    pid_t pid;
+    int i;
+
+    snprintf(path, sizeof(path), "%s/%s", TEST_BASE, DAEMON_SOCKET);
+    unlink(path);
+
+    if((pid = fork()) < 0) {
+        warn("fork");
+        return -1;
+    }
+    else if(pid == 0) {
+        execl(DBNGD, DBNGD, "-f", "-b", TEST_BASE, (char *) NULL);
+        warn("exec %s", DBNGD);
+        _exit(1);
+    }
+
+    /* Wait for the daemon to start listening. */
+    for(i = 0; i < 100 && stat(path, &st) < 0; i++)
+        usleep(100000);
+
+    if(i == 100) {
+        warnx("daemon did not start");
+        kill(pid, SIGTERM);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+
+    return pid;
+}
+
+static int
+lookup(const char *name, uid_t uid)
+{
+    char buf[MAX_BUF];
+    struct passwd pwbuf;
+    enum nss_status status;
+    int errnop;
+
+    status = _nss_dbng_getpwnam_r(name, &pwbuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || pwbuf.pw_uid != uid
+       || strcmp(pwbuf.pw_name, name))
+    {
+        return FAIL;
+    }
+
+    status = _nss_dbng_getpwuid_r(uid, &pwbuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || pwbuf.pw_uid != uid
+       || strcmp(pwbuf.pw_name, name))
+    {
+        return FAIL;
+    }
+
+    status = _nss_dbng_getpwnam_r("non-existant-user-name", &pwbuf, buf,
+                                  MAX_BUF, &errnop);
+    if(status != NSS_STATUS_NOTFOUND)
+        return FAIL;
+
+    return PASS;
+}
+
+static void
+*lookup_thread(void *arg)
+{
+    int i;
+
+    for(i = 0; i < NLOOKUPS; i++) {
+        if(lookup((i % 2 ? "test-dbng-user" : "another-test-dbng-user"),
+                  (i % 2 ? 1001 : 2001)) != PASS)
+        {
+            return (void *) 1;
+        }
+    }
+
+    return NULL;
+}
+
+static int
+setup_db(void)
+{
+    int result = PASS;
+    SERVICE passwd;
+    PASSWD_KEY key;
+    PASSWD_REC rec;
+
+    if(service_init(&passwd, TYPE_PASSWD, 0, TEST_BASE) < 0) {
+        warnx("could not initialize passwd service");
+        return FAIL;
+    }
+
+    if(passwd.truncate(&passwd) != 0) {
+        result = FAIL;
+        warnx("could not truncate passwd service");
+        goto err;
+    }
+
+    passwd.start_txn(&passwd);
+
+    key.base.type = PRI;
+    key.data.pri = "test-dbng-user";
+    rec.base.type = TYPE_PASSWD;
+    rec.uid = 1001;
+    rec.gid = 1101;
+    rec.name = "test-dbng-user";
+    rec.passwd = "x";
+    rec.gecos = "test user";
+    rec.shell = "/bin/bash";
+    rec.homedir = "/home/test-dbng-user";
+    passwd.set(&passwd, (KEY *) &key, (REC *) &rec);
+
+    key.data.pri = "another-test-dbng-user";
+    rec.uid = 2001;
+    rec.gid = 2101;
+    rec.name = "another-test-dbng-user";
+    rec.gecos = "another test user";
+    rec.homedir = "/home/another-test-dbng-user";
+    passwd.set(&passwd, (KEY *) &key, (REC *) &rec);
+
+    if(passwd.commit(&passwd) != 0) {
+        result = FAIL;
+        warnx("could not commit txn");
+    }
+
+err:
+    service_cleanup(&passwd);
+    return result;
+}
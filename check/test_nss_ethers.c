@@ -0,0 +1,124 @@
+/**
+ * @file test_nss_ethers.c
+ * @brief Test address and host name lookups through the ethers service.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <netinet/ether.h>
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../nss/nss-dbng.h"
+#include "../lib/service-ethers.h"
+
+#define PASS 0
+#define FAIL 1
+#define MAX_BUF 1024
+
+struct etherent {
+    const char *e_name;
+    struct ether_addr e_addr;
+};
+
+extern enum nss_status _nss_dbng_gethostton_r(const char *,
+                                              struct etherent *, char *,
+                                              size_t, int *);
+extern enum nss_status _nss_dbng_getntohost_r(const struct ether_addr *,
+                                              struct etherent *, char *,
+                                              size_t, int *);
+
+static int setup_db(void);
+
+int
+main(int argc, char *argv[])
+{
+    int result = PASS, errnop;
+    enum nss_status status;
+    char buf[MAX_BUF];
+    struct etherent ebuf;
+    struct ether_addr addr;
+
+    if((result = setup_db()) != PASS)
+        return result;
+
+    status = _nss_dbng_gethostton_r("pluto", &ebuf, buf, 1, &errnop);
+    if(status != NSS_STATUS_TRYAGAIN || errnop != ERANGE) {
+        warnx("expected out of space");
+        return FAIL;
+    }
+
+    /* Names are matched regardless of case. */
+    status = _nss_dbng_gethostton_r("PLUTO", &ebuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(ebuf.e_name, "pluto")
+       || memcmp(&ebuf.e_addr, ether_aton("08:00:20:00:61:ca"),
+                 sizeof(addr)))
+    {
+        warnx("unexpected details from gethostton_r");
+        result = FAIL;
+    }
+
+    /* Every address of a host is indexed. */
+    memcpy(&addr, ether_aton("08:00:20:00:61:cb"), sizeof(addr));
+    status = _nss_dbng_getntohost_r(&addr, &ebuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(ebuf.e_name, "pluto")
+       || memcmp(&ebuf.e_addr, &addr, sizeof(addr)))
+    {
+        warnx("unexpected details from getntohost_r");
+        result = FAIL;
+    }
+
+    memcpy(&addr, ether_aton("00:16:3e:00:00:01"), sizeof(addr));
+    status = _nss_dbng_getntohost_r(&addr, &ebuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_NOTFOUND) {
+        warnx("expected to not find the address");
+        result = FAIL;
+    }
+
+    return result;
+}
+
+static int
+setup_db(void)
+{
+    int result = PASS, i;
+    SERVICE ethers;
+    ETHERS_KEY key;
+    ETHERS_REC rec;
+    const char *lines[] = {
+        "08:00:20:00:61:ca       pluto",
+        "8:0:20:0:61:cb          Pluto   # second interface",
+        "00:16:3e:12:34:56       build",
+        NULL
+    };
+
+    if(service_init(&ethers, TYPE_ETHERS, 0, TEST_BASE) < 0) {
+        warnx("could not initialize ethers service");
+        return FAIL;
+    }
+
+    if(ethers.truncate(&ethers) != 0) {
+        result = FAIL;
+        warnx("could not truncate ethers service");
+        goto err;
+    }
+
+    for(i = 0; lines[i] != NULL; i++) {
+        if(ethers.parse(&ethers, lines[i], (KEY *) &key,
+                        (REC *) &rec) <= 0
+           || ethers.set(&ethers, (KEY *) &key, (REC *) &rec) != 0)
+        {
+            result = FAIL;
+            warnx("could not add %s", lines[i]);
+            goto err;
+        }
+    }
+
+err:
+    service_cleanup(&ethers);
+    return result;
+}
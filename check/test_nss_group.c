@@ -9,6 +9,8 @@
 #include <err.h>
 #include <errno.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
 
 #include "../nss/nss-dbng.h"
 #include "../lib/service-group.h"
@@ -16,6 +18,9 @@
 #define PASS 0
 #define FAIL 1
 #define MAX_BUF 2048
+#define SMALL_BUF 8
+
+extern size_t _nss_dbng_getgrent_size(void);
 
 static char *mem1[] = { "member1", "member2", "member3", "member4", NULL };
 static char *mem2[] = { "member1", "member2", NULL };
@@ -25,6 +30,8 @@ main(int argc, char *argv[])
 {
     int result = PASS, errnop;
     enum nss_status status;
+    long int start, size;
+    gid_t *groups = NULL;
 
     if((result = setup_db()) != PASS)
         goto err;
@@ -96,6 +103,21 @@ main(int argc, char *argv[])
         goto err;
     }
 
+    /* The member pointers must be aligned within an unaligned buffer. */
+    memset(&gbuf, 0, sizeof(gbuf));
+    memset(buf, 0, sizeof(buf));
+    status = _nss_dbng_getgrgid_r(1101, &gbuf, buf + 1, MAX_BUF - 1, &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || ((uintptr_t) gbuf.gr_mem % sizeof(char *)) != 0
+       || strcmp(gbuf.gr_name, "test-dbng-group")
+       || strcmp(gbuf.gr_mem[3], "member4")
+       || gbuf.gr_mem[4] != NULL)
+    {
+        warnx("unexpected group details from an unaligned buffer");
+        result = FAIL;
+        goto err;
+    }
+
     /* Now with a non-existant group by uid. */
     memset(&gbuf, 0, sizeof(gbuf));
     memset(buf, 0, sizeof(buf));
@@ -106,6 +128,36 @@ main(int argc, char *argv[])
         goto err;
     }
 
+    /* Test the supplementary groups, skipping the primary group. */
+    start = 0;
+    size = 1;
+    groups = malloc(size * sizeof(gid_t));
+    status = _nss_dbng_initgroups_dyn("member1", 1101, &start, &size,
+                                      &groups, 0, &errnop);
+    if(status != NSS_STATUS_SUCCESS || start != 1 || groups[0] != 2101) {
+        warnx("unexpected groups from initgroups_dyn for member1");
+        result = FAIL;
+        goto err;
+    }
+
+    start = 0;
+    status = _nss_dbng_initgroups_dyn("member3", 0, &start, &size,
+                                      &groups, 0, &errnop);
+    if(status != NSS_STATUS_SUCCESS || start != 1 || groups[0] != 1101) {
+        warnx("unexpected groups from initgroups_dyn for member3");
+        result = FAIL;
+        goto err;
+    }
+
+    start = 0;
+    status = _nss_dbng_initgroups_dyn("non-existant-member", 0, &start,
+                                      &size, &groups, 0, &errnop);
+    if(status != NSS_STATUS_NOTFOUND || start != 0) {
+        warnx("expected to not find groups for a non-existant member");
+        result = FAIL;
+        goto err;
+    }
+
     /* Test the pwent interfaces. */
     status = _nss_dbng_setgrent();
     if(status != NSS_STATUS_SUCCESS) {
@@ -114,6 +166,45 @@ main(int argc, char *argv[])
         goto err;
     }
 
+    /*
+     * A group which does not fit is handed out again on the retry, with
+     * the exact size it needs.
+     */
+    char *retry;
+    size_t needed;
+    gid_t first;
+
+    status = _nss_dbng_getgrent_r(&gbuf, buf, SMALL_BUF, &errnop);
+    if(status != NSS_STATUS_TRYAGAIN || errnop != ERANGE
+       || (needed = _nss_dbng_getgrent_size()) <= SMALL_BUF)
+    {
+        warnx("expected getgrent_r to report the size it needs");
+        result = FAIL;
+        goto err;
+    }
+
+    if((retry = malloc(needed)) == NULL)
+        err(1, "malloc");
+    status = _nss_dbng_getgrent_r(&gbuf, retry, needed, &errnop);
+    first = gbuf.gr_gid;
+    free(retry);
+    if(status != NSS_STATUS_SUCCESS || _nss_dbng_getgrent_size() != 0) {
+        warnx("expected the retry to fit in exactly the size reported");
+        result = FAIL;
+        goto err;
+    }
+
+    /* Starting over, the first group is the one which was retried. */
+    _nss_dbng_setgrent();
+    status = _nss_dbng_getgrent_r(&gbuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_SUCCESS || gbuf.gr_gid != first) {
+        warnx("expected the retry to return the group which did not fit");
+        result = FAIL;
+        goto err;
+    }
+    _nss_dbng_setgrent();
+    memset(&gbuf, 0, sizeof(gbuf));
+
     int i;
     for(i = 0;
         _nss_dbng_getgrent_r(&gbuf, buf, MAX_BUF, &errnop);
@@ -154,6 +245,15 @@ main(int argc, char *argv[])
             goto err;
         }
 
+        /* Failing on the next group must neither skip nor repeat it. */
+        if(_nss_dbng_getgrent_r(&gbuf, buf, SMALL_BUF, &errnop)
+           == NSS_STATUS_SUCCESS)
+        {
+            warnx("unexpected success with a small buffer, getgrent_r");
+            result = FAIL;
+            goto err;
+        }
+
         memset(&gbuf, 0, sizeof(gbuf));
         memset(buf, 0, sizeof(buf));
     }
@@ -181,6 +281,7 @@ main(int argc, char *argv[])
 
 err:
     _nss_dbng_endgrent();
+    free(groups);
     return result;
 }
 
@@ -0,0 +1,178 @@
+/**
+ * @file test_nss_gshadow.c
+ * @brief Test gshadow lookups and enumeration through the gshadow service.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <gshadow.h>
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../nss/nss-dbng.h"
+#include "../lib/service-gshadow.h"
+
+#define PASS 0
+#define FAIL 1
+#define MAX_BUF 2048
+#define SMALL_BUF 8
+
+extern enum nss_status _nss_dbng_getsgnam_r(const char *, struct sgrp *,
+                                            char *, size_t, int *);
+extern enum nss_status _nss_dbng_setsgent(void);
+extern enum nss_status _nss_dbng_endsgent(void);
+extern enum nss_status _nss_dbng_getsgent_r(struct sgrp *, char *, size_t,
+                                            int *);
+extern size_t _nss_dbng_getsgent_size(void);
+
+static int setup_db(void);
+
+int
+main(int argc, char *argv[])
+{
+    int result = PASS, errnop, i;
+    enum nss_status status;
+    char buf[MAX_BUF], *big;
+    struct sgrp sgbuf;
+    size_t size;
+
+    if((result = setup_db()) != PASS)
+        return result;
+
+    /* First with an insufficient buffer size. */
+    status = _nss_dbng_getsgnam_r("wheel", &sgbuf, buf, 1, &errnop);
+    if(status != NSS_STATUS_TRYAGAIN || errnop != ERANGE) {
+        warnx("expected out of space");
+        return FAIL;
+    }
+
+    status = _nss_dbng_getsgnam_r("non-existant-group", &sgbuf, buf, MAX_BUF,
+                                  &errnop);
+    if(status != NSS_STATUS_NOTFOUND) {
+        warnx("expected to not find the group");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getsgnam_r("wheel", &sgbuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(sgbuf.sg_namp, "wheel")
+       || strcmp(sgbuf.sg_passwd, "!")
+       || strcmp(sgbuf.sg_adm[0], "root")
+       || sgbuf.sg_adm[1] != NULL
+       || strcmp(sgbuf.sg_mem[0], "mikey")
+       || strcmp(sgbuf.sg_mem[1], "root")
+       || sgbuf.sg_mem[2] != NULL)
+    {
+        warnx("unexpected group details from getsgnam_r");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getsgnam_r("audio", &sgbuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(sgbuf.sg_passwd, "")
+       || sgbuf.sg_adm[0] != NULL
+       || sgbuf.sg_mem[0] != NULL)
+    {
+        warnx("expected a group with empty lists");
+        result = FAIL;
+    }
+
+    /* An entry which does not fit is returned again with the size given. */
+    if(_nss_dbng_setsgent() != NSS_STATUS_SUCCESS) {
+        warnx("expected to setsgent");
+        return FAIL;
+    }
+
+    status = _nss_dbng_getsgent_r(&sgbuf, buf, SMALL_BUF, &errnop);
+    if(status != NSS_STATUS_TRYAGAIN || errnop != ERANGE
+       || (size = _nss_dbng_getsgent_size()) == 0)
+    {
+        warnx("expected out of space from getsgent_r");
+        _nss_dbng_endsgent();
+        return FAIL;
+    }
+
+    /* Any alignment the buffer needs is at most a pointer's worth. */
+    big = malloc(size + sizeof(char *));
+    status = _nss_dbng_getsgent_r(&sgbuf, big, size + sizeof(char *),
+                                  &errnop);
+    if(status != NSS_STATUS_SUCCESS || _nss_dbng_getsgent_size() != 0) {
+        warnx("expected the entry to fit the size given");
+        result = FAIL;
+    }
+    free(big);
+
+    for(i = 1;
+        _nss_dbng_getsgent_r(&sgbuf, buf, MAX_BUF, &errnop)
+            == NSS_STATUS_SUCCESS;
+        i++)
+    {
+        if(strcmp(sgbuf.sg_namp, "wheel") && strcmp(sgbuf.sg_namp, "audio")) {
+            warnx("unexpected group from getsgent_r: %s", sgbuf.sg_namp);
+            result = FAIL;
+        }
+    }
+    _nss_dbng_endsgent();
+
+    if(i != 2) {
+        warnx("unexpected number of iterations (%d), getsgent_r", i);
+        result = FAIL;
+    }
+
+    return result;
+}
+
+static int
+setup_db(void)
+{
+    int result = PASS, i;
+    SERVICE gshadow;
+    GSHADOW_KEY key;
+    GSHADOW_REC rec;
+    char path[1024];
+    struct stat st;
+    const char *lines[] = {
+        "wheel:!:root:mikey,,root,",
+        "audio:::",
+        NULL
+    };
+
+    if(service_init(&gshadow, TYPE_GSHADOW, 0, TEST_BASE) < 0) {
+        warnx("could not initialize gshadow service");
+        return FAIL;
+    }
+
+    if(strcmp(gshadow.pri, GSHADOW_PRI)
+       || gshadow.truncate(&gshadow) != 0)
+    {
+        result = FAIL;
+        warnx("could not truncate gshadow service");
+        goto err;
+    }
+
+    for(i = 0; lines[i] != NULL; i++) {
+        if(gshadow.parse(&gshadow, lines[i], (KEY *) &key,
+                         (REC *) &rec) <= 0
+           || gshadow.set(&gshadow, (KEY *) &key, (REC *) &rec) != 0)
+        {
+            result = FAIL;
+            warnx("could not add %s", lines[i]);
+            goto err;
+        }
+    }
+
+    /* Like shadow, the database is only readable by its owner. */
+    snprintf(path, sizeof(path), "%s/%s", TEST_BASE, GSHADOW_PRI);
+    if(stat(path, &st) != 0 || (st.st_mode & 077) != 0) {
+        result = FAIL;
+        warnx("expected %s to be readable by its owner only", path);
+    }
+
+err:
+    service_cleanup(&gshadow);
+    return result;
+}
@@ -0,0 +1,208 @@
+/**
+ * @file test_nss_hosts.c
+ * @brief Test host resolution through the hosts service.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "../nss/nss-dbng.h"
+#include "../lib/service-hosts.h"
+
+#define PASS 0
+#define FAIL 1
+#define MAX_BUF 2048
+
+extern enum nss_status _nss_dbng_gethostbyname2_r(const char *, int,
+                                                  struct hostent *, char *,
+                                                  size_t, int *, int *);
+extern enum nss_status _nss_dbng_gethostbyname4_r(const char *,
+                                                  struct gaih_addrtuple **,
+                                                  char *, size_t, int *,
+                                                  int *, int32_t *);
+extern enum nss_status _nss_dbng_gethostbyaddr2_r(const void *, socklen_t,
+                                                  int, struct hostent *,
+                                                  char *, size_t, int *,
+                                                  int *, int32_t *);
+
+static int setup_db(void);
+static int has_alias(const struct hostent *, const char *);
+
+int
+main(int argc, char *argv[])
+{
+    int result = PASS, errnop, h_errnop, n;
+    enum nss_status status;
+    char buf[MAX_BUF];
+    struct hostent hbuf;
+    struct gaih_addrtuple *pat, *tuple;
+    struct in_addr in;
+    struct in6_addr in6;
+    int32_t ttl;
+
+    if((result = setup_db()) != PASS)
+        return result;
+
+    inet_pton(AF_INET, "192.0.2.10", &in);
+    inet_pton(AF_INET6, "2001:db8::10", &in6);
+
+    /* First with an insufficient buffer size. */
+    status = _nss_dbng_gethostbyname2_r("test-dbng-host", AF_INET, &hbuf,
+                                        buf, 1, &errnop, &h_errnop);
+    if(status != NSS_STATUS_TRYAGAIN || errnop != ERANGE) {
+        warnx("expected out of space");
+        return FAIL;
+    }
+
+    /* Now with a non-existant host. */
+    status = _nss_dbng_gethostbyname2_r("non-existant-host", AF_INET, &hbuf,
+                                        buf, MAX_BUF, &errnop, &h_errnop);
+    if(status != NSS_STATUS_NOTFOUND || h_errnop != HOST_NOT_FOUND) {
+        warnx("expected to not find the host");
+        return FAIL;
+    }
+
+    /* Both entries for the host were merged under its canonical name. */
+    status = _nss_dbng_gethostbyname2_r("Test-DBNG-Host", AF_INET, &hbuf,
+                                        buf, MAX_BUF, &errnop, &h_errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(hbuf.h_name, "test-dbng-host")
+       || hbuf.h_addrtype != AF_INET
+       || hbuf.h_length != sizeof(in)
+       || memcmp(hbuf.h_addr_list[0], &in, sizeof(in))
+       || hbuf.h_addr_list[1] != NULL
+       || !has_alias(&hbuf, "alias-one")
+       || !has_alias(&hbuf, "alias-three"))
+    {
+        warnx("unexpected host details from gethostbyname2_r");
+        result = FAIL;
+    }
+
+    /* Aliases are resolved through their own index. */
+    status = _nss_dbng_gethostbyname2_r("alias-three", AF_INET6, &hbuf,
+                                        buf, MAX_BUF, &errnop, &h_errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(hbuf.h_name, "test-dbng-host")
+       || hbuf.h_length != sizeof(in6)
+       || memcmp(hbuf.h_addr_list[0], &in6, sizeof(in6)))
+    {
+        warnx("expected to find the host by alias");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_gethostbyname2_r("another-test-dbng-host", AF_INET6,
+                                        &hbuf, buf, MAX_BUF, &errnop,
+                                        &h_errnop);
+    if(status != NSS_STATUS_NOTFOUND || h_errnop != NO_DATA) {
+        warnx("expected no IPv6 address for the host");
+        result = FAIL;
+    }
+
+    /* Then by address. */
+    status = _nss_dbng_gethostbyaddr2_r(&in6, sizeof(in6), AF_INET6, &hbuf,
+                                        buf, MAX_BUF, &errnop, &h_errnop,
+                                        &ttl);
+    if(status != NSS_STATUS_SUCCESS || strcmp(hbuf.h_name, "test-dbng-host")) {
+        warnx("expected to find the host by address");
+        result = FAIL;
+    }
+
+    inet_pton(AF_INET, "192.0.2.99", &in);
+    status = _nss_dbng_gethostbyaddr2_r(&in, sizeof(in), AF_INET, &hbuf,
+                                        buf, MAX_BUF, &errnop, &h_errnop,
+                                        &ttl);
+    if(status != NSS_STATUS_NOTFOUND) {
+        warnx("expected to not find a non-existant address");
+        result = FAIL;
+    }
+
+    /* All of the addresses at once, as getaddrinfo asks for them. */
+    pat = NULL;
+    status = _nss_dbng_gethostbyname4_r("alias-one", &pat, buf, MAX_BUF,
+                                        &errnop, &h_errnop, &ttl);
+    for(n = 0, tuple = pat;
+        status == NSS_STATUS_SUCCESS && tuple != NULL;
+        tuple = tuple->next)
+    {
+        n++;
+    }
+
+    if(status != NSS_STATUS_SUCCESS
+       || n != 2
+       || strcmp(pat->name, "test-dbng-host")
+       || pat->family != AF_INET
+       || pat->next->family != AF_INET6
+       || memcmp(pat->next->addr, &in6, sizeof(in6)))
+    {
+        warnx("unexpected tuples from gethostbyname4_r");
+        result = FAIL;
+    }
+
+    return result;
+}
+
+static int
+has_alias(const struct hostent *hbuf, const char *alias)
+{
+    char **p;
+
+    for(p = hbuf->h_aliases; *p != NULL; p++) {
+        if(!strcmp(*p, alias))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int
+setup_db(void)
+{
+    int result = PASS, i;
+    SERVICE hosts;
+    HOSTS_KEY key;
+    HOSTS_REC rec;
+    const char *lines[] = {
+        "192.0.2.10   test-dbng-host alias-one alias-two",
+        "2001:db8::10 test-dbng-host alias-three  # a comment",
+        "192.0.2.20   another-test-dbng-host",
+        NULL
+    };
+
+    if(service_init(&hosts, TYPE_HOSTS, 0, TEST_BASE) < 0) {
+        warnx("could not initialize hosts service");
+        return FAIL;
+    }
+
+    if(strcmp(hosts.pri, HOSTS_PRI) || hosts.truncate(&hosts) != 0) {
+        result = FAIL;
+        warnx("could not truncate hosts service");
+        goto err;
+    }
+
+    for(i = 0; lines[i] != NULL; i++) {
+        if(hosts.parse(&hosts, lines[i], (KEY *) &key, (REC *) &rec) <= 0
+           || hosts.set(&hosts, (KEY *) &key, (REC *) &rec) != 0)
+        {
+            result = FAIL;
+            warnx("could not add %s", lines[i]);
+            goto err;
+        }
+    }
+
+    if(hosts.parse(&hosts, "not-an-address host", (KEY *) &key,
+                   (REC *) &rec) > 0)
+    {
+        result = FAIL;
+        warnx("expected an invalid address not to parse");
+    }
+
+err:
+    service_cleanup(&hosts);
+    return result;
+}
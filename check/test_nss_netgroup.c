@@ -0,0 +1,220 @@
+/**
+ * @file test_nss_netgroup.c
+ * @brief Test netgroup enumeration and membership through the netgroup
+ *        service.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <string.h>
+
+#include "../nss/nss-dbng.h"
+#include "../nss/netgrent.h"
+#include "../lib/service-netgroup.h"
+
+#define PASS 0
+#define FAIL 1
+#define MAX_BUF 1024
+
+extern enum nss_status _nss_dbng_setnetgrent(const char *,
+                                             struct __netgrent *);
+extern enum nss_status _nss_dbng_getnetgrent_r(struct __netgrent *, char *,
+                                               size_t, int *);
+extern enum nss_status _nss_dbng_endnetgrent(struct __netgrent *);
+extern enum nss_status _nss_dbng_innetgr(const char *, const char *,
+                                         const char *, const char *);
+
+static int setup_db(void);
+static int count_triples(SERVICE *, const char *);
+
+int
+main(int argc, char *argv[])
+{
+    int result = PASS, errnop, count = 0;
+    enum nss_status status;
+    struct __netgrent ent;
+    char buf[MAX_BUF];
+
+    if((result = setup_db()) != PASS)
+        return result;
+
+    /* Every netgroup around the cycle holds all five triples. */
+    memset(&ent, 0, sizeof(ent));
+    if(_nss_dbng_setnetgrent("all", &ent) != NSS_STATUS_SUCCESS) {
+        warnx("expected to find netgroup all");
+        return FAIL;
+    }
+
+    status = _nss_dbng_getnetgrent_r(&ent, buf, 1, &errnop);
+    if(status != NSS_STATUS_TRYAGAIN || errnop != ERANGE) {
+        warnx("expected out of space");
+        result = FAIL;
+    }
+
+    while((status = _nss_dbng_getnetgrent_r(&ent, buf, MAX_BUF, &errnop))
+          == NSS_STATUS_SUCCESS)
+    {
+        if(ent.type != triple_val) {
+            warnx("expected only triples");
+            result = FAIL;
+        }
+
+        /* Wildcards sort first, so the first triple has no host. */
+        if(count++ == 0
+           && (ent.val.triple.host != NULL
+               || strcmp(ent.val.triple.user, "mikey")
+               || ent.val.triple.domain != NULL))
+        {
+            warnx("unexpected first triple");
+            result = FAIL;
+        }
+    }
+
+    if(status != NSS_STATUS_RETURN || count != 5) {
+        warnx("expected 5 triples, found %d", count);
+        result = FAIL;
+    }
+    _nss_dbng_endnetgrent(&ent);
+
+    if(_nss_dbng_setnetgrent("lonely", &ent) != NSS_STATUS_SUCCESS
+       || _nss_dbng_getnetgrent_r(&ent, buf, MAX_BUF, &errnop)
+       != NSS_STATUS_NOTFOUND)
+    {
+        warnx("expected an empty netgroup");
+        result = FAIL;
+    }
+    _nss_dbng_endnetgrent(&ent);
+
+    if(_nss_dbng_setnetgrent("missing", &ent) != NSS_STATUS_NOTFOUND) {
+        warnx("expected to not find a non-existant netgroup");
+        result = FAIL;
+    }
+
+    /* Fully given triples, matching wildcards and regardless of case. */
+    if(_nss_dbng_innetgr("all", "web1", "anyone", "EXAMPLE.com")
+       != NSS_STATUS_SUCCESS
+       || _nss_dbng_innetgr("ops", "WEB2", "anyone", "example.com")
+       != NSS_STATUS_SUCCESS
+       || _nss_dbng_innetgr("web", "somehost", "mikey", "other.org")
+       != NSS_STATUS_SUCCESS)
+    {
+        warnx("expected to find members by triple");
+        result = FAIL;
+    }
+
+    if(_nss_dbng_innetgr("all", "web1", "anyone", "other.org")
+       != NSS_STATUS_NOTFOUND
+       || _nss_dbng_innetgr("all", "somehost", "root", "example.com")
+       != NSS_STATUS_NOTFOUND
+       || _nss_dbng_innetgr("all", "somehost", "Mikey", "example.com")
+       != NSS_STATUS_NOTFOUND
+       || _nss_dbng_innetgr("missing", "web1", "anyone", "example.com")
+       != NSS_STATUS_NOTFOUND)
+    {
+        warnx("expected to not find non-members by triple");
+        result = FAIL;
+    }
+
+    /* Partially given triples, matching anything for the missing parts. */
+    if(_nss_dbng_innetgr("web", NULL, "root", NULL) != NSS_STATUS_SUCCESS
+       || _nss_dbng_innetgr("ops", "admin", NULL, "example.com")
+       != NSS_STATUS_SUCCESS)
+    {
+        warnx("expected to find members by partial triple");
+        result = FAIL;
+    }
+
+    if(_nss_dbng_innetgr("lonely", NULL, "mikey", NULL)
+       != NSS_STATUS_NOTFOUND)
+    {
+        warnx("expected to not find a member of an empty netgroup");
+        result = FAIL;
+    }
+
+    return result;
+}
+
+static int
+count_triples(SERVICE *netgroup, const char *name)
+{
+    NETGROUP_KEY key;
+    NETGROUP_REC rec;
+
+    key.base.type = PRI;
+    key.data.pri = (char *) name;
+    if(netgroup->get(netgroup, (KEY *) &key, (REC *) &rec) != 0)
+        return -1;
+
+    return rec.ntriples;
+}
+
+static int
+setup_db(void)
+{
+    int result = PASS, i;
+    SERVICE netgroup;
+    NETGROUP_KEY key;
+    NETGROUP_REC rec;
+    const char *lines[] = {
+        /* Netgroups included before they are stored, around a cycle. */
+        "all     web (admin,,)",
+        "web     (web1,,example.com) (WEB2, ,example.com) ops",
+        "ops     (,mikey,) all",
+        "ops     (,root,-)",
+        "lonely",
+        "outer   inner",
+        "inner   (inner,,)",
+        NULL
+    };
+
+    if(service_init(&netgroup, TYPE_NETGROUP, 0, TEST_BASE) < 0) {
+        warnx("could not initialize netgroup service");
+        return FAIL;
+    }
+
+    if(strcmp(netgroup.pri, NETGROUP_PRI)
+       || netgroup.truncate(&netgroup) != 0)
+    {
+        result = FAIL;
+        warnx("could not truncate netgroup service");
+        goto err;
+    }
+
+    for(i = 0; lines[i] != NULL; i++) {
+        if(netgroup.parse(&netgroup, lines[i], (KEY *) &key,
+                          (REC *) &rec) <= 0
+           || netgroup.set(&netgroup, (KEY *) &key, (REC *) &rec) != 0)
+        {
+            result = FAIL;
+            warnx("could not add %s", lines[i]);
+            goto err;
+        }
+    }
+
+    if(netgroup.parse(&netgroup, "bad (host,user", (KEY *) &key,
+                      (REC *) &rec) > 0)
+    {
+        result = FAIL;
+        warnx("expected an unterminated triple not to parse");
+    }
+
+    /* Deleting an included netgroup drops its triples from the others. */
+    if(count_triples(&netgroup, "outer") != 1) {
+        result = FAIL;
+        warnx("expected outer to include the triple of inner");
+    }
+
+    netgroup.key_init(&netgroup, (KEY *) &key, PRI, "inner");
+    if(netgroup.delete(&netgroup, (KEY *) &key) != 0
+       || count_triples(&netgroup, "outer") != 0)
+    {
+        result = FAIL;
+        warnx("expected outer to be empty once inner is deleted");
+    }
+
+err:
+    service_cleanup(&netgroup);
+    return result;
+}
@@ -9,6 +9,9 @@
 #include <err.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "../nss/nss-dbng.h"
 #include "../lib/service-passwd.h"
@@ -16,6 +19,14 @@
 #define PASS 0
 #define FAIL 1
 #define MAX_BUF 2048
+#define NTHREADS 8
+#define NLOOKUPS 100
+#define NFORKS 10
+
+static void *lookup_thread(void *);
+static void *enumerate_thread(void *);
+static int add_user(const char *, uid_t);
+static int fork_lookup(void);
 
 int
 main(int argc, char *argv[])
@@ -102,6 +113,49 @@ main(int argc, char *argv[])
         goto err;
     }
 
+    /* Test concurrent lookups through the shared handle. */
+    pthread_t threads[NTHREADS];
+    void *thread_result;
+    int t, i;
+
+    for(t = 0; t < NTHREADS; t++) {
+        pthread_create(&threads[t], NULL,
+                       (t % 2 ? enumerate_thread : lookup_thread), NULL);
+    }
+
+    for(t = 0; t < NTHREADS; t++) {
+        pthread_join(threads[t], &thread_result);
+        if(thread_result != NULL) {
+            warnx("unexpected results from concurrent lookups");
+            result = FAIL;
+        }
+    }
+
+    if(result != PASS)
+        goto err;
+
+    /* Fork while other threads are using the shared handle. */
+    for(t = 0; t < NTHREADS; t++)
+        pthread_create(&threads[t], NULL, lookup_thread, NULL);
+
+    for(i = 0; i < NFORKS; i++) {
+        if(fork_lookup() != PASS) {
+            warnx("unexpected results from a lookup in a forked child");
+            result = FAIL;
+        }
+    }
+
+    for(t = 0; t < NTHREADS; t++) {
+        pthread_join(threads[t], &thread_result);
+        if(thread_result != NULL) {
+            warnx("unexpected results from lookups across a fork");
+            result = FAIL;
+        }
+    }
+
+    if(result != PASS)
+        goto err;
+
     /* Test the pwent interfaces. */
     status = _nss_dbng_setpwent();
     if(status != NSS_STATUS_SUCCESS) {
@@ -110,7 +164,6 @@ main(int argc, char *argv[])
         goto err;
     }
 
-    int i;
     for(i = 0;
         _nss_dbng_getpwent_r(&pwbuf, buf, MAX_BUF, &errnop);
         i++)
@@ -192,12 +245,155 @@ main(int argc, char *argv[])
     }
     _nss_dbng_endpwent();
 
+    /*
+     * Modify the database behind the open handle, both between lookups
+     * and in the middle of an enumeration.
+     */
+    char first[MAX_BUF];
+
+    if(_nss_dbng_setpwent() != NSS_STATUS_SUCCESS
+       || _nss_dbng_getpwent_r(&pwbuf, buf, MAX_BUF, &errnop)
+           != NSS_STATUS_SUCCESS)
+    {
+        warnx("could not start enumeration");
+        result = FAIL;
+        goto err;
+    }
+    strcpy(first, pwbuf.pw_name);
+
+    if(add_user("late-test-dbng-user", 4001) != PASS) {
+        result = FAIL;
+        goto err;
+    }
+
+    for(i = 1;
+        _nss_dbng_getpwent_r(&pwbuf, buf, MAX_BUF, &errnop);
+        i++)
+    {
+        if(!strcmp(pwbuf.pw_name, first)) {
+            warnx("enumeration repeated %s after a reopen", first);
+            result = FAIL;
+            goto err;
+        }
+    }
+    _nss_dbng_endpwent();
+
+    if(i < 3) {
+        warnx("enumeration ended early after a reopen");
+        result = FAIL;
+        goto err;
+    }
+
+    status = _nss_dbng_getpwnam_r("late-test-dbng-user", &pwbuf, buf,
+                                  MAX_BUF, &errnop);
+    if(status != NSS_STATUS_SUCCESS || pwbuf.pw_uid != 4001) {
+        warnx("expected to find a user added after the handle was opened");
+        result = FAIL;
+        goto err;
+    }
+
+    /*
+     * An enumeration, which always reads the database, neither waits on
+     * a writer's transaction nor sees its changes before the commit.
+     */
+    SERVICE writer;
+    PASSWD_KEY key;
+    PASSWD_REC rec;
+
+    if(service_init(&writer, TYPE_PASSWD, DBNG_RW, TEST_BASE) < 0) {
+        warnx("could not open passwd service for writing");
+        result = FAIL;
+        goto err;
+    }
+
+    key.base.type = PRI;
+    key.data.pri = "uncommitted-test-dbng-user";
+    memset(&rec, 0, sizeof(rec));
+    rec.base.type = TYPE_PASSWD;
+    rec.uid = rec.gid = 5001;
+    rec.name = key.data.pri;
+    rec.passwd = "x";
+    rec.gecos = "uncommitted test user";
+    rec.shell = "/bin/bash";
+    rec.homedir = "/home/uncommitted-test-dbng-user";
+
+    writer.start_txn(&writer);
+    if(writer.set(&writer, (KEY *) &key, (REC *) &rec) != 0) {
+        warnx("could not add an uncommitted user");
+        result = FAIL;
+    }
+
+    if(result == PASS && _nss_dbng_setpwent() == NSS_STATUS_SUCCESS) {
+        while(_nss_dbng_getpwent_r(&pwbuf, buf, MAX_BUF, &errnop)
+              == NSS_STATUS_SUCCESS)
+        {
+            if(pwbuf.pw_uid == 5001) {
+                warnx("enumeration saw an uncommitted user");
+                result = FAIL;
+                break;
+            }
+        }
+        _nss_dbng_endpwent();
+    }
+
+    writer.rollback(&writer);
+    service_cleanup(&writer);
+
 err:
     _nss_dbng_endpwent();
 
     return result;
 }
 
+static void
+*lookup_thread(void *arg)
+{
+    char buf[MAX_BUF];
+    struct passwd pwbuf;
+    enum nss_status status;
+    int i, errnop;
+
+    for(i = 0; i < NLOOKUPS; i++) {
+        status = (i % 2
+                  ? _nss_dbng_getpwuid_r(2001, &pwbuf, buf, MAX_BUF, &errnop)
+                  : _nss_dbng_getpwnam_r("another-test-dbng-user", &pwbuf,
+                                         buf, MAX_BUF, &errnop));
+        if(status != NSS_STATUS_SUCCESS
+           || pwbuf.pw_uid != 2001
+           || strcmp(pwbuf.pw_name, "another-test-dbng-user"))
+        {
+            return (void *) 1;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+*enumerate_thread(void *arg)
+{
+    char buf[MAX_BUF];
+    struct passwd pwbuf;
+    int i, n, errnop;
+
+    for(i = 0; i < NLOOKUPS / 10; i++) {
+        if(_nss_dbng_setpwent() != NSS_STATUS_SUCCESS)
+            return (void *) 1;
+
+        /* Every thread must see the full iteration. */
+        for(n = 0;
+            _nss_dbng_getpwent_r(&pwbuf, buf, MAX_BUF, &errnop);
+            n++)
+            ;
+        _nss_dbng_endpwent();
+
+        if(n != 3)
+            return (void *) 1;
+    }
+
+    return NULL;
+}
+
 int
 setup_db(void)
 {
@@ -281,3 +477,63 @@ setup_db(void)
 err:
     return result;
 }
+
+/*
+ * Add a user through a writable handle, as dbngctl would.
+ */
+static int
+add_user(const char *name, uid_t uid)
+{
+    int result = PASS;
+    SERVICE passwd;
+    PASSWD_KEY key;
+    PASSWD_REC rec;
+
+    if(service_init(&passwd, TYPE_PASSWD, DBNG_RW, TEST_BASE) < 0) {
+        warnx("could not open passwd service for writing");
+        return FAIL;
+    }
+
+    key.base.type = PRI;
+    key.data.pri = (char *) name;
+
+    rec.base.type = TYPE_PASSWD;
+    rec.uid = uid;
+    rec.gid = uid;
+    rec.name = (char *) name;
+    rec.passwd = "x";
+    rec.gecos = "late test user";
+    rec.shell = "/bin/bash";
+    rec.homedir = "/home/late-test-dbng-user";
+
+    if(passwd.set(&passwd, (KEY *) &key, (REC *) &rec) != 0) {
+        warnx("could not add user %s", name);
+        result = FAIL;
+    }
+
+    service_cleanup(&passwd);
+    return result;
+}
+
+/*
+ * Look up a user in a child process, which reopens the handle it inherited.
+ */
+static int
+fork_lookup(void)
+{
+    pid_t pid;
+    int status;
+
+    if((pid = fork()) < 0) {
+        warn("fork");
+        return FAIL;
+    }
+    else if(pid == 0) {
+        _exit(lookup_thread(NULL) == NULL ? PASS : FAIL);
+    }
+
+    if(waitpid(pid, &status, 0) != pid)
+        return FAIL;
+
+    return (WIFEXITED(status) && WEXITSTATUS(status) == PASS ? PASS : FAIL);
+}
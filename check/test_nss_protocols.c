@@ -0,0 +1,133 @@
+/**
+ * @file test_nss_protocols.c
+ * @brief Test protocol lookups through the protocols service.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <netdb.h>
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../nss/nss-dbng.h"
+#include "../lib/service-numbered.h"
+
+#define PASS 0
+#define FAIL 1
+#define MAX_BUF 1024
+
+extern enum nss_status _nss_dbng_getprotobyname_r(const char *,
+                                                  struct protoent *, char *,
+                                                  size_t, int *);
+extern enum nss_status _nss_dbng_getprotobynumber_r(int, struct protoent *,
+                                                    char *, size_t, int *);
+
+static int setup_db(void);
+
+int
+main(int argc, char *argv[])
+{
+    int result = PASS, errnop;
+    enum nss_status status;
+    char buf[MAX_BUF];
+    struct protoent pbuf;
+
+    if((result = setup_db()) != PASS)
+        return result;
+
+    /* First with an insufficient buffer size. */
+    status = _nss_dbng_getprotobyname_r("tcp", &pbuf, buf, 1, &errnop);
+    if(status != NSS_STATUS_TRYAGAIN || errnop != ERANGE) {
+        warnx("expected out of space");
+        return FAIL;
+    }
+
+    status = _nss_dbng_getprotobyname_r("non-existant-protocol", &pbuf, buf,
+                                        MAX_BUF, &errnop);
+    if(status != NSS_STATUS_NOTFOUND) {
+        warnx("expected to not find the protocol");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getprotobyname_r("tcp", &pbuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(pbuf.p_name, "tcp")
+       || pbuf.p_proto != 6
+       || strcmp(pbuf.p_aliases[0], "TCP")
+       || pbuf.p_aliases[1] != NULL)
+    {
+        warnx("unexpected protocol details from getprotobyname_r");
+        result = FAIL;
+    }
+
+    /* Aliases are found through the auxiliary index. */
+    status = _nss_dbng_getprotobyname_r("UDP", &pbuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_SUCCESS || strcmp(pbuf.p_name, "udp")) {
+        warnx("expected to find udp by its alias");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getprotobynumber_r(58, &pbuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(pbuf.p_name, "ipv6-icmp")
+       || pbuf.p_proto != 58
+       || strcmp(pbuf.p_aliases[0], "IPv6-ICMP")
+       || strcmp(pbuf.p_aliases[1], "icmpv6")
+       || pbuf.p_aliases[2] != NULL)
+    {
+        warnx("unexpected protocol details from getprotobynumber_r");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getprotobynumber_r(255, &pbuf, buf, MAX_BUF, &errnop);
+    if(status != NSS_STATUS_NOTFOUND) {
+        warnx("expected to not find protocol 255");
+        result = FAIL;
+    }
+
+    return result;
+}
+
+static int
+setup_db(void)
+{
+    int result = PASS, i;
+    SERVICE protocols;
+    NUMBERED_KEY key;
+    NUMBERED_REC rec;
+    const char *lines[] = {
+        "ip      0       IP              # internet protocol",
+        "tcp     6       TCP",
+        "udp     17      UDP",
+        "ipv6-icmp 58    IPv6-ICMP icmpv6",
+        NULL
+    };
+
+    if(service_init(&protocols, TYPE_PROTOCOLS, 0, TEST_BASE) < 0) {
+        warnx("could not initialize protocols service");
+        return FAIL;
+    }
+
+    if(protocols.truncate(&protocols) != 0) {
+        result = FAIL;
+        warnx("could not truncate protocols service");
+        goto err;
+    }
+
+    for(i = 0; lines[i] != NULL; i++) {
+        if(protocols.parse(&protocols, lines[i], (KEY *) &key,
+                           (REC *) &rec) <= 0
+           || protocols.set(&protocols, (KEY *) &key, (REC *) &rec) != 0)
+        {
+            result = FAIL;
+            warnx("could not add %s", lines[i]);
+            goto err;
+        }
+    }
+
+err:
+    service_cleanup(&protocols);
+    return result;
+}
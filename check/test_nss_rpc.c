@@ -0,0 +1,119 @@
+/**
+ * @file test_nss_rpc.c
+ * @brief Test RPC program lookups through the rpc service.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <netdb.h>
+#include <rpc/netdb.h>
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../nss/nss-dbng.h"
+#include "../lib/service-numbered.h"
+
+#define PASS 0
+#define FAIL 1
+#define MAX_BUF 1024
+
+extern enum nss_status _nss_dbng_getrpcbyname_r(const char *,
+                                                struct rpcent *, char *,
+                                                size_t, int *);
+extern enum nss_status _nss_dbng_getrpcbynumber_r(int, struct rpcent *,
+                                                  char *, size_t, int *);
+
+static int setup_db(void);
+
+int
+main(int argc, char *argv[])
+{
+    int result = PASS, errnop;
+    enum nss_status status;
+    char buf[MAX_BUF];
+    struct rpcent rbuf;
+
+    if((result = setup_db()) != PASS)
+        return result;
+
+    status = _nss_dbng_getrpcbyname_r("nfs", &rbuf, buf, 1, &errnop);
+    if(status != NSS_STATUS_TRYAGAIN || errnop != ERANGE) {
+        warnx("expected out of space");
+        return FAIL;
+    }
+
+    status = _nss_dbng_getrpcbyname_r("rpcbind", &rbuf, buf, MAX_BUF,
+                                      &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(rbuf.r_name, "portmapper")
+       || rbuf.r_number != 100000
+       || strcmp(rbuf.r_aliases[0], "portmap")
+       || strcmp(rbuf.r_aliases[1], "sunrpc")
+       || strcmp(rbuf.r_aliases[2], "rpcbind")
+       || rbuf.r_aliases[3] != NULL)
+    {
+        warnx("unexpected program details from getrpcbyname_r");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getrpcbynumber_r(100003, &rbuf, buf, MAX_BUF,
+                                        &errnop);
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(rbuf.r_name, "nfs")
+       || strcmp(rbuf.r_aliases[0], "nfsprog")
+       || rbuf.r_aliases[1] != NULL)
+    {
+        warnx("unexpected program details from getrpcbynumber_r");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getrpcbynumber_r(100004, &rbuf, buf, MAX_BUF,
+                                        &errnop);
+    if(status != NSS_STATUS_NOTFOUND) {
+        warnx("expected to not find program 100004");
+        result = FAIL;
+    }
+
+    return result;
+}
+
+static int
+setup_db(void)
+{
+    int result = PASS, i;
+    SERVICE rpc;
+    NUMBERED_KEY key;
+    NUMBERED_REC rec;
+    const char *lines[] = {
+        "portmapper      100000  portmap sunrpc rpcbind",
+        "nfs             100003  nfsprog",
+        NULL
+    };
+
+    if(service_init(&rpc, TYPE_RPC, 0, TEST_BASE) < 0) {
+        warnx("could not initialize rpc service");
+        return FAIL;
+    }
+
+    if(rpc.truncate(&rpc) != 0) {
+        result = FAIL;
+        warnx("could not truncate rpc service");
+        goto err;
+    }
+
+    for(i = 0; lines[i] != NULL; i++) {
+        if(rpc.parse(&rpc, lines[i], (KEY *) &key, (REC *) &rec) <= 0
+           || rpc.set(&rpc, (KEY *) &key, (REC *) &rec) != 0)
+        {
+            result = FAIL;
+            warnx("could not add %s", lines[i]);
+            goto err;
+        }
+    }
+
+err:
+    service_cleanup(&rpc);
+    return result;
+}
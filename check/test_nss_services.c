@@ -0,0 +1,187 @@
+/**
+ * @file test_nss_services.c
+ * @brief Test network service lookups through the services service.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <netdb.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "../nss/nss-dbng.h"
+#include "../lib/service-services.h"
+
+#define PASS 0
+#define FAIL 1
+#define MAX_BUF 2048
+
+extern enum nss_status _nss_dbng_getservbyname_r(const char *, const char *,
+                                                 struct servent *, char *,
+                                                 size_t, int *);
+extern enum nss_status _nss_dbng_getservbyport_r(int, const char *,
+                                                 struct servent *, char *,
+                                                 size_t, int *);
+
+static int setup_db(void);
+static int check(enum nss_status, const struct servent *, const char *,
+                 int, const char *);
+
+int
+main(int argc, char *argv[])
+{
+    int result = PASS, errnop;
+    enum nss_status status;
+    char buf[MAX_BUF];
+    struct servent sbuf;
+
+    if((result = setup_db()) != PASS)
+        return result;
+
+    /* First with an insufficient buffer size. */
+    status = _nss_dbng_getservbyname_r("http", "tcp", &sbuf, buf, 1,
+                                       &errnop);
+    if(status != NSS_STATUS_TRYAGAIN || errnop != ERANGE) {
+        warnx("expected out of space");
+        return FAIL;
+    }
+
+    status = _nss_dbng_getservbyname_r("http", "udp", &sbuf, buf, MAX_BUF,
+                                       &errnop);
+    if(check(status, &sbuf, "http", 80, "udp")
+       || strcmp(sbuf.s_aliases[0], "www")
+       || sbuf.s_aliases[1] != NULL)
+    {
+        warnx("unexpected service details from getservbyname_r");
+        result = FAIL;
+    }
+
+    /* By alias, and for any protocol. */
+    status = _nss_dbng_getservbyname_r("www", "tcp", &sbuf, buf, MAX_BUF,
+                                       &errnop);
+    if(check(status, &sbuf, "http", 80, "tcp")) {
+        warnx("expected to find the service by alias");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getservbyname_r("domain", NULL, &sbuf, buf, MAX_BUF,
+                                       &errnop);
+    if(check(status, &sbuf, "domain", 53, "tcp")) {
+        warnx("expected to find the service for any protocol");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getservbyname_r("www", NULL, &sbuf, buf, MAX_BUF,
+                                       &errnop);
+    if(check(status, &sbuf, "http", 80, "tcp")) {
+        warnx("expected to find the service by alias for any protocol");
+        result = FAIL;
+    }
+
+    /* A name must match whole, not just as a prefix. */
+    status = _nss_dbng_getservbyname_r("dom", NULL, &sbuf, buf, MAX_BUF,
+                                       &errnop);
+    if(status != NSS_STATUS_NOTFOUND) {
+        warnx("expected to not find a partial name");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getservbyname_r("domain", "udp", &sbuf, buf, MAX_BUF,
+                                       &errnop);
+    if(status != NSS_STATUS_NOTFOUND) {
+        warnx("expected to not find the service for another protocol");
+        result = FAIL;
+    }
+
+    /* Then by port, given in network byte order. */
+    status = _nss_dbng_getservbyport_r(htons(80), "udp", &sbuf, buf,
+                                       MAX_BUF, &errnop);
+    if(check(status, &sbuf, "http", 80, "udp")) {
+        warnx("expected to find the service by port");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getservbyport_r(htons(53), NULL, &sbuf, buf,
+                                       MAX_BUF, &errnop);
+    if(check(status, &sbuf, "domain", 53, "tcp")) {
+        warnx("expected to find the service by port for any protocol");
+        result = FAIL;
+    }
+
+    status = _nss_dbng_getservbyport_r(htons(8080), NULL, &sbuf, buf,
+                                       MAX_BUF, &errnop);
+    if(status != NSS_STATUS_NOTFOUND) {
+        warnx("expected to not find a non-existant port");
+        result = FAIL;
+    }
+
+    return result;
+}
+
+static int
+check(enum nss_status status, const struct servent *sbuf, const char *name,
+      int port, const char *proto)
+{
+    if(status != NSS_STATUS_SUCCESS
+       || strcmp(sbuf->s_name, name)
+       || sbuf->s_port != htons(port)
+       || strcmp(sbuf->s_proto, proto))
+    {
+        return FAIL;
+    }
+
+    return PASS;
+}
+
+static int
+setup_db(void)
+{
+    int result = PASS, i;
+    SERVICE services;
+    SERVICES_KEY key;
+    SERVICES_REC rec;
+    const char *lines[] = {
+        "http    80/tcp  www   # WorldWideWeb HTTP",
+        "http    80/udp  www",
+        "domain  53/tcp",
+        "domainx 54/tcp",
+        NULL
+    };
+
+    if(service_init(&services, TYPE_SERVICES, 0, TEST_BASE) < 0) {
+        warnx("could not initialize services service");
+        return FAIL;
+    }
+
+    if(strcmp(services.pri, SERVICES_PRI)
+       || services.truncate(&services) != 0)
+    {
+        result = FAIL;
+        warnx("could not truncate services service");
+        goto err;
+    }
+
+    for(i = 0; lines[i] != NULL; i++) {
+        if(services.parse(&services, lines[i], (KEY *) &key,
+                          (REC *) &rec) <= 0
+           || services.set(&services, (KEY *) &key, (REC *) &rec) != 0)
+        {
+            result = FAIL;
+            warnx("could not add %s", lines[i]);
+            goto err;
+        }
+    }
+
+    if(services.parse(&services, "bad 70000/tcp", (KEY *) &key,
+                      (REC *) &rec) > 0)
+    {
+        result = FAIL;
+        warnx("expected an out of range port not to parse");
+    }
+
+err:
+    service_cleanup(&services);
+    return result;
+}
@@ -71,7 +71,36 @@ main(int argc, char *argv[])
         goto err;
     }
 
+    /* Test the spent interfaces. */
+    status = _nss_dbng_setspent();
+    if(status != NSS_STATUS_SUCCESS) {
+        warnx("expected to setspent");
+        result = FAIL;
+        goto err;
+    }
+
+    int i;
+    for(i = 0;
+        _nss_dbng_getspent_r(&spbuf, buf, MAX_BUF, &errnop);
+        i++)
+    {
+        if(strcmp(spbuf.sp_namp, "test-dbng-user")
+           && strcmp(spbuf.sp_namp, "another-test-dbng-user"))
+        {
+            warnx("unexpected user from getspent_r: %s", spbuf.sp_namp);
+            result = FAIL;
+            goto err;
+        }
+    }
+
+    if(i != 2) {
+        warnx("unexpected number of iterations (%d), getspent_r", i);
+        result = FAIL;
+        goto err;
+    }
+
 err:
+    _nss_dbng_endspent();
     return result;
 }
 
@@ -6,12 +6,15 @@
  */
 
 #include <err.h>
+#include <stdio.h>
 #include <string.h>
+#include <limits.h>
 
 #include "../lib/service-passwd.h"
 
 #define PASS 0
 #define FAIL 1
+#define NBULK 5000
 
 static int reccmp(PASSWD_REC *, PASSWD_REC *);
 
@@ -287,7 +290,233 @@ main(int argc, char *argv[])
         goto err;
     }
 
+    /*
+     * Test that a record set in a transaction which is rolled back is
+     * never stored.
+     */
+    key4.base.type = PRI;
+    key4.data.pri = "rolled-back-test-dbng-user";
+    rec4 = rec;
+    rec4.name = key4.data.pri;
+    rec4.uid = 4001;
+
+    if(passwd.start_txn(&passwd) != 0
+       || passwd.set(&passwd, (KEY *) &key4, (REC *) &rec4) != 0
+       || passwd.rollback(&passwd) != 0)
+    {
+        _result = FAIL;
+        warnx("could not set and roll back passwd record");
+        goto err;
+    }
+
+    if(passwd.get(&passwd, (KEY *) &key4, (REC *) &rec4) != DB_NOTFOUND) {
+        _result = FAIL;
+        warnx("expected rolled back record to be absent");
+        goto err;
+    }
+
+    /*
+     * Test iterating through a bulk cursor over several chunks of records,
+     * detaching it part way through as when the service is reopened.
+     */
+    char name[32], seen[NBULK];
+    SERVICE_CURSOR cursor;
+
+    passwd.start_txn(&passwd);
+    for(i = 0; i < NBULK; i++) {
+        snprintf(name, sizeof(name), "bulk-test-user-%05d", i);
+        key4.base.type = PRI;
+        key4.data.pri = name;
+        rec4 = rec;
+        rec4.name = name;
+        rec4.uid = 10000 + i;
+        if(passwd.set(&passwd, (KEY *) &key4, (REC *) &rec4) != 0) {
+            _result = FAIL;
+            warnx("could not add bulk test user %d", i);
+            goto err;
+        }
+    }
+
+    /* Until the commit, readers are answered from the last snapshot. */
+    SERVICE reader;
+    if(service_init(&reader, TYPE_PASSWD, DBNG_RO, TEST_BASE) < 0) {
+        _result = FAIL;
+        warnx("could not open a reader during the import");
+        goto err;
+    }
+
+    if(!snapshot_valid(&reader.db.snap)
+       || reader.get(&reader, (KEY *) &key4, (REC *) &rec4) != DB_NOTFOUND)
+    {
+        _result = FAIL;
+        warnx("expected the committed snapshot during the import");
+    }
+    service_cleanup(&reader);
+    if(_result == FAIL)
+        goto err;
+
+    passwd.commit(&passwd);
+
+    memset(seen, 0, sizeof(seen));
+    memset(&cursor, 0, sizeof(cursor));
+    for(i = 0;
+        (ret = service_cursor_next(&passwd, &cursor, (KEY *) &key4,
+                                   (REC *) &rec4)) == 0;
+        i++)
+    {
+        if(i == NBULK / 2)
+            service_cursor_detach(&cursor);
+
+        if(rec4.uid < 10000)
+            continue;
+
+        if(rec4.uid >= 10000 + NBULK || seen[rec4.uid - 10000]++) {
+            _result = FAIL;
+            warnx("unexpected or repeated uid %d from cursor", rec4.uid);
+            goto err;
+        }
+    }
+    service_cursor_close(&cursor);
+
+    if(ret != DB_NOTFOUND || i != NBULK + 3) {
+        _result = FAIL;
+        warnx("expecting %d records from cursor, seen %d", NBULK + 3, i);
+        goto err;
+    }
+
+    /*
+     * Test lookups through the key filter and snapshot.
+     */
+    if(service_build_filter(&passwd) != 0) {
+        _result = FAIL;
+        warnx("could not build key filter");
+        goto err;
+    }
+
+    if(service_build_snapshot(&passwd) != 0) {
+        _result = FAIL;
+        warnx("could not build snapshot");
+        goto err;
+    }
+
     service_cleanup(&passwd);
+    if(service_init(&passwd, TYPE_PASSWD, DBNG_RO, TEST_BASE) < 0) {
+        _result = FAIL;
+        warnx("could not reopen service read-only");
+        goto err;
+    }
+
+    if(passwd.db.filter.hdr == NULL || !passwd.db.filter.hdr->valid) {
+        _result = FAIL;
+        warnx("expected a valid key filter");
+        goto err;
+    }
+
+    if(!snapshot_valid(&passwd.db.snap)) {
+        _result = FAIL;
+        warnx("expected a valid snapshot");
+        goto err;
+    }
+
+    key4.base.type = SEC;
+    key4.data.sec = 3001;
+    if(passwd.get(&passwd, (KEY *) &key2, (REC *) &rec4) != 0
+       || passwd.get(&passwd, (KEY *) &key4, (REC *) &rec4) != 0
+       || reccmp(&rec4, &rec3))
+    {
+        _result = FAIL;
+        warnx("could not fetch passwd record through the snapshot");
+        goto err;
+    }
+
+    key4.base.type = PRI;
+    key4.data.pri = "non-existant-user";
+    if(passwd.get(&passwd, (KEY *) &key4, (REC *) &rec4) != DB_NOTFOUND) {
+        _result = FAIL;
+        warnx("expected a miss through the key filter and snapshot");
+        goto err;
+    }
+
+    service_cleanup(&passwd);
+
+    /*
+     * Until a writer builds the uid index, lookups by uid scan the
+     * primary. The snapshot, which would answer them, is moved away too.
+     */
+    char index[PATH_MAX], snap[PATH_MAX], moved_index[PATH_MAX],
+        moved_snap[PATH_MAX];
+
+    snprintf(index, sizeof(index), "%s/%s", TEST_BASE, PASSWD_SEC);
+    snprintf(snap, sizeof(snap), "%s/%s%s", TEST_BASE, PASSWD_PRI,
+             SNAPSHOT_SUFFIX);
+    snprintf(moved_index, sizeof(moved_index), "%s.moved", index);
+    snprintf(moved_snap, sizeof(moved_snap), "%s.moved", snap);
+    if(rename(index, moved_index) != 0 || rename(snap, moved_snap) != 0) {
+        _result = FAIL;
+        warn("could not move the uid index and snapshot");
+        goto err;
+    }
+
+    ret = service_init(&passwd, TYPE_PASSWD, DBNG_RO, TEST_BASE);
+    if(ret == 0) {
+        key4.base.type = SEC;
+        key4.data.sec = 3001;
+        memset(&rec4, 0, sizeof(rec4));
+        ret = passwd.get(&passwd, (KEY *) &key4, (REC *) &rec4);
+        if(ret == 0 && reccmp(&rec4, &rec3))
+            ret = -1;
+
+        key4.data.sec = 9999;
+        if(ret == 0
+           && passwd.get(&passwd, (KEY *) &key4, (REC *) &rec4)
+              != DB_NOTFOUND)
+        {
+            ret = -1;
+        }
+        service_cleanup(&passwd);
+    }
+
+    if(rename(moved_index, index) != 0 || rename(moved_snap, snap) != 0) {
+        _result = FAIL;
+        warn("could not restore the uid index and snapshot");
+        goto err;
+    }
+
+    if(ret != 0) {
+        _result = FAIL;
+        warnx("could not fetch passwd record by uid without the index");
+        goto err;
+    }
+
+    /*
+     * A database without a recorded format predates the record layout,
+     * so is not opened.
+     */
+    char format[PATH_MAX], moved[PATH_MAX];
+
+    snprintf(format, sizeof(format), "%s/%s%s", TEST_BASE, PASSWD_PRI,
+             DBNG_FORMAT_SUFFIX);
+    snprintf(moved, sizeof(moved), "%s.moved", format);
+    if(rename(format, moved) != 0) {
+        _result = FAIL;
+        warn("could not move %s", format);
+        goto err;
+    }
+
+    ret = service_init(&passwd, TYPE_PASSWD, DBNG_RO, TEST_BASE);
+    if(ret == 0)
+        service_cleanup(&passwd);
+    if(rename(moved, format) != 0) {
+        _result = FAIL;
+        warn("could not restore %s", format);
+        goto err;
+    }
+
+    if(ret == 0) {
+        _result = FAIL;
+        warnx("opened a database without a recorded format");
+        goto err;
+    }
 
 err:
     return _result;
@@ -9,7 +9,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "../lib/service.h"
 
@@ -21,6 +23,7 @@ static void usage(void);
 static void list(SERVICE *);
 static void add(SERVICE *);
 static void delete(SERVICE *, const char *);
+static void import_size(u_int32_t *, u_int32_t *);
 
 enum CMD {
     ADD,
@@ -33,7 +36,8 @@ static void
 usage(void)
 {
     fprintf(stderr,
-            "usage: %s -s service [-b base] [-d key] [-atly]\n",
+            "usage: %s -s service [-b base] [-i access] [-m kbytes] "
+            "[-w durability] [-d key] [-atly]\n",
             PROGNAME);
     _exit(1);
 }
@@ -44,10 +48,8 @@ list(SERVICE *service)
     KEY *key = service->new_key(service);
     REC *rec = service->new_rec(service);
 
-    service->start_txn(service);
     while(service->next(service, key, rec) != DB_NOTFOUND)
         service->print(service, key, rec);
-    service->commit(service);
 
     xfree(&key);
     xfree(&rec);
@@ -91,7 +93,8 @@ add(SERVICE *service)
         while(sp != dp && isspace(*sp))
             sp++ ;
 
-        if(*sp == '\0')
+        /* Skip comment lines, as found in hosts files. */
+        if(*sp == '\0' || *sp == '#')
             continue;
 
         /* Now we have a non-empty line. */
@@ -106,7 +109,11 @@ add(SERVICE *service)
         }
     }
 
-    service->commit(service);
+    /* The whole import becomes visible at once, or not at all. */
+    if(service->commit(service) != 0) {
+        printf("could not commit, no records added\n");
+        nparsed = 0;
+    }
 
     if(nparsed > 0 || nfailed > 0) {
         printf("%d parsed, %d failed\n", nparsed, nfailed);
@@ -116,15 +123,49 @@ add(SERVICE *service)
     xfree(&rec);
 }
 
+/*
+ * Count the records to be imported and their average size, when they are
+ * read from a file which can be read again. Otherwise both are left 0.
+ */
+static void
+import_size(u_int32_t *nrecs, u_int32_t *rec_size)
+{
+    char raw[SERVICE_REC_MAX];
+    unsigned long long bytes = 0;
+    struct stat st;
+    char *sp;
+
+    *nrecs = *rec_size = 0;
+    if(fstat(fileno(stdin), &st) != 0 || !S_ISREG(st.st_mode))
+        return;
+
+    while(fgets(raw, sizeof(raw), stdin) != NULL) {
+        for(sp = raw; isspace(*sp); sp++)
+            ;
+        if(*sp != '\0' && *sp != '#') {
+            (*nrecs)++;
+            bytes += strlen(sp);
+        }
+    }
+
+    if(*nrecs > 0)
+        *rec_size = bytes / *nrecs;
+    rewind(stdin);
+}
+
 static void
 delete(SERVICE *service, const char *data)
 {
     KEY *key = service->new_key(service);
 
     service->key_init(service, key, PRI, (void *) data);
-    if(service->delete(service, key) == 0) {
+    service->start_txn(service);
+    if(service->delete(service, key) == 0 && service->commit(service) == 0) {
         printf("deleted %s\n", data);
     }
+    else {
+        service->rollback(service);
+    }
 
     xfree(&key);
 }
@@ -133,11 +174,14 @@ int
 main(int argc, char *argv[])
 {
     int option, sset = 0, flags = 0, c, prev = '\n', yes = 0;
-    char *base = DEFAULT_BASE, *key;
+    char *base = DEFAULT_BASE, *key, *end;
+    unsigned long kbytes;
+    u_int32_t nrecs, rec_size;
+    DBTYPE access = DB_BTREE;
     enum CMD cmd = LIST;
     enum TYPE stype;
 
-    while((option = getopt(argc, argv, "s:b:d:atly")) != -1) {
+    while((option = getopt(argc, argv, "s:b:i:m:w:d:atly")) != -1) {
         switch(option) {
         case 's':
             sset = 1;
@@ -150,6 +194,30 @@ main(int argc, char *argv[])
             else if(!strcasecmp(optarg, "group")) {
                 stype = TYPE_GROUP;
             }
+            else if(!strcasecmp(optarg, "hosts")) {
+                stype = TYPE_HOSTS;
+            }
+            else if(!strcasecmp(optarg, "services")) {
+                stype = TYPE_SERVICES;
+            }
+            else if(!strcasecmp(optarg, "netgroup")) {
+                stype = TYPE_NETGROUP;
+            }
+            else if(!strcasecmp(optarg, "gshadow")) {
+                stype = TYPE_GSHADOW;
+            }
+            else if(!strcasecmp(optarg, "protocols")) {
+                stype = TYPE_PROTOCOLS;
+            }
+            else if(!strcasecmp(optarg, "rpc")) {
+                stype = TYPE_RPC;
+            }
+            else if(!strcasecmp(optarg, "ethers")) {
+                stype = TYPE_ETHERS;
+            }
+            else if(!strcasecmp(optarg, "aliases")) {
+                stype = TYPE_ALIASES;
+            }
             else {
                 fprintf(stderr, "unknown service %s\n\n", optarg);
                 usage();
@@ -161,6 +229,44 @@ main(int argc, char *argv[])
             base = optarg;
             break;
 
+        case 'i':
+            if(!strcasecmp(optarg, "btree")) {
+                access = DB_BTREE;
+            }
+            else if(!strcasecmp(optarg, "hash")) {
+                access = DB_HASH;
+            }
+            else {
+                fprintf(stderr, "unknown access method %s\n\n", optarg);
+                usage();
+            }
+            break;
+
+        case 'm':
+            kbytes = strtoul(optarg, &end, 10);
+            if(*optarg == '\0' || *end != '\0' || kbytes > UINT32_MAX) {
+                fprintf(stderr, "invalid cache size %s\n\n", optarg);
+                usage();
+            }
+            dbng_set_cache_size(kbytes);
+            break;
+
+        case 'w':
+            if(!strcasecmp(optarg, "sync")) {
+                dbng_set_durability(DBNG_SYNC);
+            }
+            else if(!strcasecmp(optarg, "write-nosync")) {
+                dbng_set_durability(DBNG_WRITE_NOSYNC);
+            }
+            else if(!strcasecmp(optarg, "nosync")) {
+                dbng_set_durability(DBNG_NOSYNC);
+            }
+            else {
+                fprintf(stderr, "unknown durability %s\n\n", optarg);
+                usage();
+            }
+            break;
+
         case 'y':
             yes = 1;
             break;
@@ -179,7 +285,6 @@ main(int argc, char *argv[])
             break;
 
         case 'l':
-            flags = DBNG_RO;
             cmd = LIST;
             break;
 
@@ -193,6 +298,20 @@ main(int argc, char *argv[])
         usage();
     }
 
+    /*
+     * Listing, the default, reads the committed records in the writers'
+     * environment. Opening for writing would invalidate the key filter
+     * and snapshot, which only a write rebuilds.
+     */
+    if(cmd == LIST)
+        flags = DBNG_RO;
+
+    /* New databases are sized for the records about to be added. */
+    nrecs = rec_size = 0;
+    if(cmd == ADD && access == DB_HASH)
+        import_size(&nrecs, &rec_size);
+    dbng_set_access(access, nrecs, rec_size);
+
     SERVICE service;
     if(service_init(&service, stype, flags, base) < 0) {
         errx(1, "could not initialize service...");
@@ -237,14 +356,24 @@ main(int argc, char *argv[])
 
     confirmed:
         if(c == 'y') {
-            if(service.truncate(&service) == 0) {
+            service.start_txn(&service);
+            if(service.truncate(&service) == 0
+               && service.commit(&service) == 0)
+            {
                 printf("database truncated...\n");
             }
+            else {
+                service.rollback(&service);
+            }
         }
         break;
     }
 
 cleanup:
+    /*
+     * Each change was committed in a transaction, which rebuilt the key
+     * filter and snapshot and told readers their cached records are stale.
+     */
     service_cleanup(&service);
     return 0;
 }
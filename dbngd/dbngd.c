@@ -0,0 +1,539 @@
+/**
+ * @file dbngd.c
+ * @brief Lookup daemon serving the databases to the NSS module.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <limits.h>
+#include <signal.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "../lib/service.h"
+#include "../lib/stamp.h"
+#include "../lib/table.h"
+#include "../lib/daemon.h"
+#include "../lib/utils.h"
+
+#define PROGNAME      "dbngd"
+#define MAX_CLIENTS   128
+#define DEFAULT_SLOTS 8192
+
+/* The largest well-formed request. */
+#define REQUEST_MAX (sizeof(DAEMON_REQUEST)                             \
+                     + DAEMON_BATCH_MAX                                 \
+                     * (sizeof(DAEMON_QUERY) + DAEMON_KEY_MAX))
+
+extern char *optarg;
+
+/*
+ * The maps served by the daemon. Shadow entries are never served, so that
+ * no secret ends up in the world-readable table or on the socket.
+ */
+static enum TYPE Types[] = { TYPE_PASSWD, TYPE_GROUP };
+#define NSERVICES (sizeof(Types) / sizeof(Types[0]))
+
+/*
+ * Clients are never waited on. Each is read into its own buffer as data
+ * arrives, and only complete requests are answered. A reply the client
+ * is not yet reading is held until it can be written, and no more of the
+ * client's requests are read meanwhile.
+ */
+typedef struct CLIENT {
+    unsigned char in[REQUEST_MAX];
+    size_t in_len;
+    unsigned char *out;
+    size_t out_len;
+    size_t out_off;
+    size_t out_size;
+    time_t active;          /* Last time the client made progress. */
+} CLIENT;
+
+static SERVICE Services[NSERVICES];
+static int Open[NSERVICES];
+static int Stale = 1;
+static u_int64_t Gen;
+static STAMP Stamp;
+static TABLE Table;
+static char Base[PATH_MAX];
+
+/* Replies are assembled here, so each batch is written at once. */
+static unsigned char *Reply;
+static size_t Reply_len, Reply_size;
+
+/* Indexed as the poll descriptors, the first being the listening socket. */
+static CLIENT Clients[MAX_CLIENTS + 1];
+
+static volatile sig_atomic_t Quit;
+
+static void usage(void);
+static void on_signal(int);
+static int listen_socket(const char *);
+static void refresh(void);
+static int client_read(int, CLIENT *);
+static int client_write(int, CLIENT *);
+static int request_size(const unsigned char *, size_t, size_t *);
+static int serve(int, CLIENT *);
+static void answer(const unsigned char *);
+static void lookup(const unsigned char *, size_t);
+static void reply(const void *, size_t);
+static void drop(struct pollfd *, int *, int);
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: %s [-b base] [-n slots] [-m kbytes] [-f]\n", PROGNAME);
+    _exit(1);
+}
+
+static void
+on_signal(int sig)
+{
+    Quit = 1;
+}
+
+static int
+listen_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        warnx("socket path %s is too long", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        warn("socket");
+        return -1;
+    }
+
+    /* Any socket left behind by a previous daemon is replaced. */
+    unlink(path);
+    if(bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+       || chmod(path, 0666) < 0
+       || listen(fd, SOMAXCONN) < 0)
+    {
+        warn("listen %s", path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/*
+ * Reopen the services once dbngctl has modified the databases, so every
+ * answer is at least as recent as the generation it is published under.
+ */
+static void
+refresh(void)
+{
+    u_int64_t gen;
+    int i;
+
+    if(Stamp.hdr == NULL)
+        stamp_open(&Stamp, Base);
+    gen = stamp_read(&Stamp);
+
+    if(!Stale && gen == Gen)
+        return;
+
+    for(i = 0; i < NSERVICES; i++) {
+        if(Open[i])
+            service_cleanup(&Services[i]);
+        Open[i] = (service_init(&Services[i], Types[i], DBNG_RO, Base) == 0);
+        if(!Open[i])
+            syslog(LOG_ERR, "could not open service %d in %s", Types[i], Base);
+    }
+
+    Gen = gen;
+    Stale = 0;
+}
+
+/*
+ * Read whatever a client has sent so far. Returns -1 if the client
+ * should be disconnected.
+ */
+static int
+client_read(int fd, CLIENT *client)
+{
+    ssize_t n;
+
+    n = read(fd, client->in + client->in_len,
+             sizeof(client->in) - client->in_len);
+    if(n < 0) {
+        return ((errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+                ? 0 : -1);
+    }
+    else if(n == 0) {
+        return -1;
+    }
+
+    client->in_len += n;
+    client->active = time(NULL);
+
+    return 0;
+}
+
+/*
+ * Write as much of a pending reply as the client will take. Returns -1 if
+ * the client should be disconnected.
+ */
+static int
+client_write(int fd, CLIENT *client)
+{
+    ssize_t n;
+
+    /* A client which has gone away must not kill the daemon. */
+    while(client->out_off < client->out_len) {
+        n = send(fd, client->out + client->out_off,
+                 client->out_len - client->out_off, MSG_NOSIGNAL);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            return ((errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1);
+        }
+
+        client->out_off += n;
+        client->active = time(NULL);
+    }
+
+    client->out_len = client->out_off = 0;
+    return 0;
+}
+
+/*
+ * Returns 1 and the size of the request at the start of buf if it is
+ * complete, 0 if more is to come and -1 if it is malformed.
+ */
+static int
+request_size(const unsigned char *buf, size_t len, size_t *size)
+{
+    DAEMON_REQUEST req;
+    DAEMON_QUERY query;
+    size_t off;
+    u_int32_t i;
+
+    if(len < sizeof(req))
+        return 0;
+
+    memcpy(&req, buf, sizeof(req));
+    if(req.count == 0 || req.count > DAEMON_BATCH_MAX)
+        return -1;
+
+    for(i = 0, off = sizeof(req); i < req.count; i++) {
+        if(len < off + sizeof(query))
+            return 0;
+
+        memcpy(&query, buf + off, sizeof(query));
+        if(query.klen <= DAEMON_KEY_HDR || query.klen > DAEMON_KEY_MAX)
+            return -1;
+
+        off += sizeof(query) + query.klen;
+        if(len < off)
+            return 0;
+    }
+
+    *size = off;
+    return 1;
+}
+
+/*
+ * Answer each complete request a client has sent, for as long as the
+ * replies can be written. Returns -1 if the client should be disconnected.
+ */
+static int
+serve(int fd, CLIENT *client)
+{
+    unsigned char *out;
+    size_t len, out_size;
+    int ret;
+
+    while(client->out_len == 0) {
+        if((ret = request_size(client->in, client->in_len, &len)) <= 0)
+            return ret;
+
+        answer(client->in);
+        client->in_len -= len;
+        memmove(client->in, client->in + len, client->in_len);
+
+        /* The reply becomes the client's, which gives up its old buffer. */
+        out = client->out;
+        out_size = client->out_size;
+        client->out = Reply;
+        client->out_size = Reply_size;
+        client->out_len = Reply_len;
+        client->out_off = 0;
+        Reply = out;
+        Reply_size = out_size;
+        Reply_len = 0;
+
+        if(client_write(fd, client) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Assemble the reply to a complete, well-formed request.
+ */
+static void
+answer(const unsigned char *buf)
+{
+    DAEMON_REQUEST req;
+    DAEMON_QUERY query;
+    u_int32_t i;
+
+    refresh();
+    Reply_len = 0;
+
+    memcpy(&req, buf, sizeof(req));
+    buf += sizeof(req);
+
+    for(i = 0; i < req.count; i++) {
+        memcpy(&query, buf, sizeof(query));
+        buf += sizeof(query);
+        lookup(buf, query.klen);
+        buf += query.klen;
+    }
+}
+
+/*
+ * Append the answer to a single query to the reply, publishing any record
+ * found in the shared table.
+ */
+static void
+lookup(const unsigned char *key, size_t klen)
+{
+    DAEMON_ANSWER answer;
+    SERVICE *service = NULL;
+    DBT dbkey, dbval;
+    int i;
+
+    for(i = 0; i < NSERVICES; i++) {
+        if(Open[i] && Types[i] == key[0])
+            service = &Services[i];
+    }
+
+    memset(&answer, 0, sizeof(answer));
+    answer.gen = Gen;
+
+    /* Only keyed lookups are served; clients do the rest themselves. */
+    if(service == NULL || (key[1] != PRI && key[1] != SEC)) {
+        answer.status = -1;
+        reply(&answer, sizeof(answer));
+        return;
+    }
+
+    memset(&dbkey, 0, sizeof(dbkey));
+    memset(&dbval, 0, sizeof(dbval));
+    dbkey.data = (void *) (key + DAEMON_KEY_HDR);
+    dbkey.size = klen - DAEMON_KEY_HDR;
+
+    answer.status = service_get_packed(service, key[1], &dbkey, &dbval);
+    if(answer.status == 0 && dbval.size > DAEMON_REC_MAX)
+        answer.status = -1;
+
+    if(answer.status != 0) {
+        reply(&answer, sizeof(answer));
+        return;
+    }
+
+    answer.vlen = dbval.size;
+    reply(&answer, sizeof(answer));
+    reply(dbval.data, dbval.size);
+    table_put(&Table, Gen, key, klen, dbval.data, dbval.size);
+}
+
+static void
+reply(const void *data, size_t len)
+{
+    if(Reply_len + len > Reply_size) {
+        Reply_size = 2 * (Reply_len + len);
+        Reply = xrealloc(Reply, Reply_size);
+    }
+
+    memcpy(Reply + Reply_len, data, len);
+    Reply_len += len;
+}
+
+static void
+drop(struct pollfd *fds, int *nfds, int i)
+{
+    close(fds[i].fd);
+    free(Clients[i].out);
+
+    (*nfds)--;
+    fds[i] = fds[*nfds];
+    Clients[i] = Clients[*nfds];
+    memset(&Clients[*nfds], 0, sizeof(Clients[*nfds]));
+}
+
+int
+main(int argc, char *argv[])
+{
+    int option, foreground = 0, i, j, fd, nfds = 1;
+    long nslots = DEFAULT_SLOTS;
+    unsigned long kbytes;
+    char *base = DEFAULT_BASE, *end;
+    char sock_path[PATH_MAX], table_path[PATH_MAX];
+    struct pollfd fds[MAX_CLIENTS + 1];
+    struct sigaction sa;
+
+    while((option = getopt(argc, argv, "b:n:m:f")) != -1) {
+        switch(option) {
+        case 'b':
+            base = optarg;
+            break;
+
+        case 'n':
+            nslots = strtol(optarg, &end, 10);
+            if(*end != '\0' || nslots <= 0 || nslots > (1L << 24)) {
+                fprintf(stderr, "invalid number of slots %s\n\n", optarg);
+                usage();
+            }
+            break;
+
+        case 'm':
+            kbytes = strtoul(optarg, &end, 10);
+            if(*optarg == '\0' || *end != '\0' || kbytes > UINT32_MAX) {
+                fprintf(stderr, "invalid cache size %s\n\n", optarg);
+                usage();
+            }
+            dbng_set_cache_size(kbytes);
+            break;
+
+        case 'f':
+            foreground = 1;
+            break;
+
+        default:
+            usage();
+        }
+    }
+
+    /* The daemon leaves its working directory once running. */
+    if(realpath(base, Base) == NULL)
+        err(1, "%s", base);
+
+    snprintf(sock_path, sizeof(sock_path), "%s/%s", Base, DAEMON_SOCKET);
+    snprintf(table_path, sizeof(table_path), "%s/%s", Base, TABLE_FILE);
+
+    openlog(PROGNAME, LOG_PID | (foreground ? LOG_PERROR : 0), LOG_DAEMON);
+
+    if(table_create(&Table, table_path, nslots, 0644) < 0)
+        errx(1, "could not create table %s", table_path);
+
+    if((fds[0].fd = listen_socket(sock_path)) < 0) {
+        table_invalidate(&Table);
+        errx(1, "could not listen on %s", sock_path);
+    }
+    fds[0].events = POLLIN;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &sa, NULL);
+
+    if(!foreground && daemon(0, 0) < 0)
+        err(1, "daemon");
+
+    /*
+     * Berkeley DB handles do not survive a fork, and the environment
+     * registers the pid which opened it, so nothing is opened until the
+     * process which serves is running.
+     */
+    refresh();
+
+    while(!Quit) {
+        if(poll(fds, nfds, -1) < 0) {
+            if(errno == EINTR)
+                continue;
+            syslog(LOG_ERR, "poll: %m");
+            break;
+        }
+
+        for(i = nfds - 1; i > 0; i--) {
+            if(fds[i].revents == 0)
+                continue;
+
+            if((Clients[i].out_len > 0
+                ? client_write(fds[i].fd, &Clients[i])
+                : client_read(fds[i].fd, &Clients[i])) < 0
+               || serve(fds[i].fd, &Clients[i]) < 0)
+            {
+                drop(fds, &nfds, i);
+                continue;
+            }
+
+            fds[i].events = (Clients[i].out_len > 0 ? POLLOUT : POLLIN);
+        }
+
+        if(fds[0].revents & POLLIN) {
+            if((fd = accept(fds[0].fd, NULL, NULL)) < 0)
+                continue;
+
+            if(fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) {
+                close(fd);
+                continue;
+            }
+
+            /* Idle connections must not lock the rest out. */
+            if(nfds > MAX_CLIENTS) {
+                for(i = j = 1; i < nfds; i++) {
+                    if(Clients[i].active < Clients[j].active)
+                        j = i;
+                }
+                drop(fds, &nfds, j);
+            }
+
+            fds[nfds].fd = fd;
+            fds[nfds].events = POLLIN;
+            fds[nfds].revents = 0;
+            memset(&Clients[nfds], 0, sizeof(Clients[nfds]));
+            Clients[nfds].active = time(NULL);
+            nfds++;
+        }
+    }
+
+    /* Readers still mapping the table must stop trusting it. */
+    table_invalidate(&Table);
+    table_close(&Table);
+    unlink(sock_path);
+
+    for(i = 0; i < nfds; i++) {
+        close(fds[i].fd);
+        free(Clients[i].out);
+    }
+
+    for(i = 0; i < NSERVICES; i++) {
+        if(Open[i])
+            service_cleanup(&Services[i]);
+    }
+
+    stamp_close(&Stamp);
+    free(Reply);
+
+    return 0;
+}
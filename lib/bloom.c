@@ -0,0 +1,145 @@
+/**
+ * @file bloom.c
+ * @brief Implements the memory-mapped Bloom filter.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bloom.h"
+#include "utils.h"
+
+#define BITS_PER_KEY 10 /* Roughly a 1% false positive rate. */
+#define NHASH        7
+#define MIN_BITS     64
+
+extern int
+bloom_open(BLOOM *bloom, const char *path)
+{
+    int fd;
+    struct stat st;
+    void *map;
+    BLOOM_HDR *hdr;
+
+    memset(bloom, 0, sizeof(*bloom));
+
+    if((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    if(fstat(fd, &st) < 0 || st.st_size < sizeof(BLOOM_HDR)) {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+
+    hdr = map;
+    if(hdr->magic != BLOOM_MAGIC
+       || hdr->version != BLOOM_VERSION
+       || hdr->nbits == 0
+       || hdr->nbits / 8 > st.st_size - sizeof(*hdr))
+    {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    bloom->hdr = hdr;
+    bloom->bits = (unsigned char *) map + sizeof(*hdr);
+    bloom->len = st.st_size;
+    bloom->mapped = 1;
+
+    return 0;
+}
+
+extern void
+bloom_create(BLOOM *bloom, size_t nkeys)
+{
+    u_int64_t nbits;
+
+    nbits = (u_int64_t) nkeys * BITS_PER_KEY;
+    if(nbits < MIN_BITS)
+        nbits = MIN_BITS;
+    nbits = (nbits + 63) & ~((u_int64_t) 63);
+
+    memset(bloom, 0, sizeof(*bloom));
+    bloom->len = sizeof(BLOOM_HDR) + nbits / 8;
+    bloom->hdr = xcalloc(1, bloom->len);
+    bloom->bits = (unsigned char *) bloom->hdr + sizeof(BLOOM_HDR);
+    bloom->mapped = 0;
+
+    bloom->hdr->magic = BLOOM_MAGIC;
+    bloom->hdr->version = BLOOM_VERSION;
+    bloom->hdr->valid = 0;
+    bloom->hdr->nhash = NHASH;
+    bloom->hdr->nbits = nbits;
+}
+
+extern void
+bloom_add(BLOOM *bloom, int index, const void *key, size_t len)
+{
+    u_int64_t h = hash64(index, key, len), bit;
+    u_int32_t h1 = (u_int32_t) h, h2 = (u_int32_t) (h >> 32) | 1, i;
+
+    for(i = 0; i < bloom->hdr->nhash; i++) {
+        bit = (h1 + (u_int64_t) i * h2) % bloom->hdr->nbits;
+        bloom->bits[bit >> 3] |= (1 << (bit & 7));
+    }
+}
+
+extern int
+bloom_check(const BLOOM *bloom, int index, const void *key, size_t len)
+{
+    u_int64_t h, bit;
+    u_int32_t h1, h2, i;
+
+    /* Without a trusted filter, every key may be present. */
+    if(bloom->hdr == NULL || !bloom->hdr->valid)
+        return 1;
+
+    h = hash64(index, key, len);
+    h1 = (u_int32_t) h;
+    h2 = (u_int32_t) (h >> 32) | 1;
+
+    for(i = 0; i < bloom->hdr->nhash; i++) {
+        bit = (h1 + (u_int64_t) i * h2) % bloom->hdr->nbits;
+        if(!(bloom->bits[bit >> 3] & (1 << (bit & 7))))
+            return 0;
+    }
+
+    return 1;
+}
+
+extern int
+bloom_write(BLOOM *bloom, const char *path, int perms)
+{
+    bloom->hdr->valid = 1;
+    return replace_file(path, bloom->hdr, bloom->len, perms);
+}
+
+extern int
+bloom_invalidate(const char *path)
+{
+    return clear_flag(path, offsetof(BLOOM_HDR, valid));
+}
+
+extern void
+bloom_close(BLOOM *bloom)
+{
+    if(bloom->hdr != NULL) {
+        if(bloom->mapped)
+            munmap(bloom->hdr, bloom->len);
+        else
+            free(bloom->hdr);
+    }
+
+    memset(bloom, 0, sizeof(*bloom));
+}
@@ -0,0 +1,75 @@
+/**
+ * @file bloom.h
+ * @brief Memory-mapped Bloom filter over a database's keys.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define BLOOM_SUFFIX  ".bloom"
+#define BLOOM_MAGIC   0x424e4244  /* "DBNB" */
+#define BLOOM_VERSION 2
+
+/*
+ * The filter file is a header followed by the bit array. Writers clear the
+ * valid flag in place before modifying the databases, so that readers still
+ * mapping an old filter stop trusting it.
+ */
+typedef struct BLOOM_HDR {
+    u_int32_t magic;
+    u_int32_t version;
+    volatile u_int32_t valid;
+    u_int32_t nhash;
+    u_int64_t nbits;
+} BLOOM_HDR;
+
+typedef struct BLOOM {
+    BLOOM_HDR *hdr;
+    unsigned char *bits;
+    size_t len;
+    int mapped;
+} BLOOM;
+
+/**
+ * Map an existing filter read-only. Returns -1 if there is no usable filter,
+ * in which case every check answers "maybe".
+ */
+extern int bloom_open(BLOOM *bloom, const char *path);
+
+/**
+ * Allocate an empty in-memory filter sized for nkeys keys.
+ */
+extern void bloom_create(BLOOM *bloom, size_t nkeys);
+
+/**
+ * Add a key from the given index (primary, secondary, ...) to the filter.
+ */
+extern void bloom_add(BLOOM *bloom, int index, const void *key, size_t len);
+
+/**
+ * Returns 0 only if the key is definitely not present.
+ */
+extern int bloom_check(const BLOOM *bloom, int index, const void *key,
+                       size_t len);
+
+/**
+ * Atomically replace the filter at path with an in-memory filter.
+ */
+extern int bloom_write(BLOOM *bloom, const char *path, int perms);
+
+/**
+ * Mark the filter at path as stale, if it exists.
+ */
+extern int bloom_invalidate(const char *path);
+
+/**
+ *
+ */
+extern void bloom_close(BLOOM *bloom);
+
+#endif
@@ -0,0 +1,79 @@
+/**
+ * @file daemon.c
+ * @brief Implements the dbngd wire protocol helpers.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "daemon.h"
+
+extern size_t
+daemon_key_size(SERVICE *service, const KEY *key)
+{
+    return DAEMON_KEY_HDR + service->key_size(service, key);
+}
+
+extern void
+daemon_key(SERVICE *service, const KEY *key, unsigned char *buf)
+{
+    DBT dbkey;
+    size_t ksize = service->key_size(service, key);
+
+    buf[0] = (unsigned char) service->type;
+    buf[1] = (unsigned char) key->type;
+
+    memset(buf + DAEMON_KEY_HDR, 0, ksize);
+    memset(&dbkey, 0, sizeof(dbkey));
+    dbkey.data = buf + DAEMON_KEY_HDR;
+    dbkey.size = ksize;
+    service->pack_key(service, key, &dbkey);
+}
+
+extern int
+daemon_read(int fd, void *buf, size_t len)
+{
+    unsigned char *p = buf;
+    ssize_t n;
+
+    while(len > 0) {
+        if((n = read(fd, p, len)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        else if(n == 0) {
+            return -1;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+extern int
+daemon_write(int fd, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    ssize_t n;
+
+    /* A client which has gone away must not kill the writer. */
+    while(len > 0) {
+        if((n = send(fd, p, len, MSG_NOSIGNAL)) < 0) {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
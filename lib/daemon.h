@@ -0,0 +1,66 @@
+/**
+ * @file daemon.h
+ * @brief Wire protocol spoken between the NSS module and dbngd.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include "service.h"
+
+#define DAEMON_SOCKET    "dbngd.sock"
+#define DAEMON_BATCH_MAX 32         /* Queries per request. */
+#define DAEMON_KEY_MAX   512
+#define DAEMON_REC_MAX   65536
+
+/*
+ * A request is a DAEMON_REQUEST followed by count queries, each a
+ * DAEMON_QUERY and its key. The daemon replies with a DAEMON_ANSWER and
+ * the packed record for each query in turn, in the order they were asked.
+ * Records are returned as stored, leaving the client to validate them for
+ * its own user.
+ */
+typedef struct DAEMON_REQUEST {
+    u_int32_t count;
+} DAEMON_REQUEST;
+
+typedef struct DAEMON_QUERY {
+    u_int32_t klen;
+} DAEMON_QUERY;
+
+typedef struct DAEMON_ANSWER {
+    int32_t status;         /* 0, DB_NOTFOUND or another database error. */
+    u_int32_t vlen;
+    u_int64_t gen;          /* Generation the record was read at. */
+} DAEMON_ANSWER;
+
+/*
+ * Keys on the wire, and in the shared table, are the service type and
+ * key type followed by the packed key.
+ */
+#define DAEMON_KEY_HDR 2
+
+/**
+ * Return the encoded size of a key.
+ */
+extern size_t daemon_key_size(SERVICE *service, const KEY *key);
+
+/**
+ * Encode a key into buf, which must hold daemon_key_size bytes.
+ */
+extern void daemon_key(SERVICE *service, const KEY *key, unsigned char *buf);
+
+/**
+ * Read exactly len bytes, retrying interrupted and short reads. Returns -1
+ * on error or end of file.
+ */
+extern int daemon_read(int fd, void *buf, size_t len);
+
+/**
+ * Write exactly len bytes, retrying interrupted and short writes.
+ */
+extern int daemon_write(int fd, const void *buf, size_t len);
+
+#endif
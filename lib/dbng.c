@@ -6,103 +6,906 @@
  */
 
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "dbng.h"
 #include "utils.h"
 
-#define MAX_PATH 256
+#define MAX_PATH DBNG_MAX_PATH
+
+#ifndef DB_CACHE_SIZE
+#  define DB_CACHE_SIZE 0
+#endif
+
+/*
+ * Page locks one transaction may hold. An import of a million records
+ * touches well under this many pages across its databases.
+ */
+#define MAX_LOCKS (1 << 17)
+
+/*
+ * Hash databases are created with this page size, for which the fill
+ * factor is worked out. Index entries are a short key and the primary key.
+ */
+#define HASH_PAGESIZE  4096
+#define HASH_SEC_ENTRY 32
+
+/*
+ * Every process reading the databases directly joins the environment, so
+ * must be able to open its regions for writing. They take the group of the
+ * base directory, when it is set-group-ID. The logs, which hold records of
+ * every map, stay with their owner.
+ */
+#define ENV_PERMS 0660
+#define LOG_PERMS 0600
+
+/* Threads tracked in the environment, so that those which died are found. */
+#define THREAD_COUNT 1024
+
+#define FORMAT_MAGIC 0x464e4244  /* "DBNF" */
+
+typedef struct FORMAT_HDR {
+    u_int32_t magic;
+    u_int32_t format;
+} FORMAT_HDR;
+
+/*
+ * Every database under a base directory is opened in one transactional
+ * environment, so all the services of a process share a single memory
+ * pool, and readers see the last committed state of the writers' pages.
+ * A process holds one handle on it for writing and another for reading.
+ */
+typedef struct ENV {
+    char home[MAX_PATH];
+    int writer;
+    int retired;            /* Panicked, so no longer handed out. */
+    DB_ENV *env;
+    int refs;
+    struct ENV *next;
+} ENV;
+
+static ENV *Envs = NULL;
+static pthread_mutex_t Env_lock = PTHREAD_MUTEX_INITIALIZER;
+static u_int32_t Cache_kbytes = DB_CACHE_SIZE;
+static int Durability = DBNG_SYNC;
+static DBTYPE Access = DB_BTREE;
+static u_int32_t Nrecs = 0;
+static u_int32_t Rec_size = 0;
+
+static DB_ENV *env_acquire(const char *, int);
+static void env_retire(DB_ENV *);
+static u_int32_t open_flags(int);
+static void env_release(DB_ENV *);
+static void make_path(char *, const char *, const char *);
+static void sidecar_path(char *, const DBNG *, const char *);
+static int add_keys(BLOOM *, DB *, u_int32_t, int, size_t *);
+static int open_db(DBNG *, DB **, const char *, const char *, int, int, int);
+static int hash_hints(DB *, int);
+static void invalidate(DBNG *);
+static int check_format(DBNG *);
+static int read_format(const char *, u_int32_t *);
+static int open_sec(DBNG *, DB **, const char *, const char *,
+                    int (*)(DB *, const DBT *, const DBT *, DBT *),
+                    int, int);
 
 extern int
 dbng_init(DBNG *handle, const char *base, const char *pri, const char *sec,
           int (*key_creator)(DB *, const DBT *, const DBT *,DBT *),
           int flags, int perms)
 {
-    int db_flags, ret;
     char pri_path[MAX_PATH];
     char sec_path[MAX_PATH];
-    char *sep;
+    char bloom_path[MAX_PATH];
+    char snap_path[MAX_PATH];
+    struct stat st;
 
-    strncpy(pri_path, base, MAX_PATH);
-    if((sep = strrchr(base, '/')) != NULL && *(sep + 1))
-        strncat(pri_path, "/", MAX_PATH);
-    strncat(pri_path, pri, MAX_PATH);
+    make_path(pri_path, base, pri);
 
     memset(handle, 0, sizeof(*handle));
+    strncpy(handle->path, pri_path, MAX_PATH - 1);
+    handle->flags  = flags;
+    handle->perms  = perms;
     handle->txn    = NULL;
     handle->cursor = NULL;
     handle->env    = NULL;
     handle->pri    = NULL;
     handle->sec    = NULL;
+    handle->aux    = NULL;
 
-    /* Open & setup primary database. */
-    ret = db_create(&handle->pri, handle->env, 0);
-    if(ret != 0) {
-        warnx("error opening primary db: %s",
-              db_strerror(ret));
+    if(check_format(handle) != 0)
+        return -1;
+
+    if((handle->env = env_acquire(base, !(flags & DBNG_RO))) == NULL)
         goto err;
-    }
 
-    db_flags = (flags & DBNG_RO ? DB_RDONLY : DB_CREATE);
-    ret = handle->pri->open(handle->pri, NULL, pri_path, NULL, DB_BTREE,
-                            db_flags, perms);
-    if(ret != 0) {
-        warnx("db open (%s) failed: %s", pri_path, db_strerror(ret));
+    /* Open & setup primary database. */
+    if(open_db(handle, &handle->pri, pri, pri_path, 0, flags, perms) != 0)
         goto err;
-    }
 
-    /* Open & setup secondary database if it exists. */
+    /*
+     * Open & setup secondary database if it exists. One not yet built by
+     * a writer, as after an upgrade renaming it, is left unset and lookups
+     * by its keys scan the primary until the next writer builds it.
+     */
     if(sec != NULL) {
-        strncpy(sec_path, base, MAX_PATH);
-        if((sep = strrchr(base, '/')) != NULL && *(sep + 1))
-            strncat(sec_path, "/", MAX_PATH);
-        strncat(sec_path, sec, MAX_PATH);
-
-        ret = db_create(&handle->sec, handle->env, 0);
-        if(ret != 0) {
-            warnx("error opening secondary db: %s", db_strerror(ret));
-            goto err;
-        }
-
-        ret = handle->sec->set_flags(handle->sec, DB_DUPSORT);
-        if(ret != 0) {
-            warnx("set_flags secondary db: %s", db_strerror(ret));
-            goto err;
+        make_path(sec_path, base, sec);
+        if((flags & DBNG_RO) && stat(sec_path, &st) != 0
+           && errno == ENOENT)
+        {
+            warnx("%s is not built yet, so lookups by it scan %s until the "
+                  "next dbngctl write", sec_path, pri_path);
+            handle->sec = NULL;
         }
-
-        ret = handle->sec->open(handle->sec, NULL, sec_path, NULL, DB_BTREE,
-                                db_flags, perms);
-        if(ret != 0) {
-            warnx("db open (%s) failed: %s", sec_path, db_strerror(ret));
+        else if(open_sec(handle, &handle->sec, sec, sec_path, key_creator,
+                         flags, perms) != 0)
+        {
             goto err;
         }
+    }
 
-        /* Associate the secondary with the primary. */
-        handle->pri->associate(
-            handle->pri, NULL, handle->sec,
-            (flags & DBNG_RO ? NULL : key_creator), 0);
+    /*
+     * Readers short-circuit misses with the key filter and serve hits from
+     * the snapshot. Writers leave both in place until a change of theirs
+     * is committed, see dbng_touch and dbng_txn_commit.
+     */
+    if(flags & DBNG_RO) {
+        sidecar_path(bloom_path, handle, BLOOM_SUFFIX);
+        sidecar_path(snap_path, handle, SNAPSHOT_SUFFIX);
+        bloom_open(&handle->filter, bloom_path);
+        snapshot_open(&handle->snap, snap_path);
+    }
+    else {
+        /*
+         * Without a stamp, readers simply do not notice the changes. The
+         * writer may have just recovered the environment, which readers
+         * must then join again.
+         */
+        if(stamp_create(&handle->stamp, base) == 0)
+            stamp_incr(&handle->stamp);
     }
 
     return 0;
 
 err:
-    if(handle->pri != NULL)
-        handle->pri->close(handle->pri, 0);
     if(handle->sec != NULL)
         handle->sec->close(handle->sec, 0);
-    if(handle->env != NULL)
-        handle->env->close(handle->env, 0);
+    if(handle->pri != NULL)
+        handle->pri->close(handle->pri, 0);
+    env_release(handle->env);
+    handle->env = NULL;
     return -1;
 }
 
+extern int
+dbng_init_aux(DBNG *handle, const char *base, const char *aux,
+              int (*key_creator)(DB *, const DBT *, const DBT *,DBT *),
+              int flags, int perms)
+{
+    char aux_path[MAX_PATH];
+    struct stat st;
+
+    make_path(aux_path, base, aux);
+
+    /*
+     * Databases created before this index existed will not have it until
+     * they are next opened for writing, at which point it is populated.
+     */
+    if((flags & DBNG_RO) && stat(aux_path, &st) != 0 && errno == ENOENT) {
+        handle->aux = NULL;
+        return 0;
+    }
+
+    return open_sec(handle, &handle->aux, aux, aux_path, key_creator,
+                    flags, perms);
+}
+
+extern int
+dbng_build_filter(DBNG *handle)
+{
+    BLOOM bloom;
+    DB *dbs[] = { handle->pri, handle->sec, handle->aux };
+    char path[MAX_PATH];
+    size_t nkeys = 0;
+    u_int32_t flags = dbng_cursor_flags(handle);
+    int i, ret = 0;
+
+    /* Count the keys first so that the filter can be sized. */
+    for(i = 0; i < sizeof(dbs) / sizeof(*dbs); i++) {
+        if(dbs[i] != NULL && add_keys(NULL, dbs[i], flags, i, &nkeys) != 0)
+            return -1;
+    }
+
+    bloom_create(&bloom, nkeys);
+    for(i = 0; i < sizeof(dbs) / sizeof(*dbs); i++) {
+        if(dbs[i] != NULL
+           && (ret = add_keys(&bloom, dbs[i], flags, i, NULL)) != 0)
+        {
+            goto cleanup;
+        }
+    }
+
+    sidecar_path(path, handle, BLOOM_SUFFIX);
+    ret = bloom_write(&bloom, path, handle->perms);
+
+cleanup:
+    bloom_close(&bloom);
+    return (ret == 0 ? 0 : -1);
+}
+
+extern int
+dbng_build_snapshot(DBNG *handle)
+{
+    SNAPSHOT_BUILD build;
+    DBC *cursor;
+    DBT dbkey, dbpkey, dbval;
+    char path[MAX_PATH];
+    int ret = -1;
+
+    snapshot_build_init(&build);
+
+    if(handle->pri->cursor(handle->pri, NULL, &cursor,
+                           dbng_cursor_flags(handle)) != 0)
+    {
+        warnx("db cursor failed");
+        goto cleanup;
+    }
+
+    memset(&dbkey, 0, sizeof(dbkey));
+    memset(&dbval, 0, sizeof(dbval));
+    while((ret = cursor->get(cursor, &dbkey, &dbval, DB_NEXT)) == 0)
+        snapshot_build_add(&build, dbkey.data, dbkey.size,
+                           dbval.data, dbval.size);
+
+    cursor->close(cursor);
+    if(ret != DB_NOTFOUND) {
+        warnx("db cursor get failed: %s", db_strerror(ret));
+        goto cleanup;
+    }
+
+    /* Secondary keys only refer to their primary key's record. */
+    if(handle->sec != NULL) {
+        if(handle->sec->cursor(handle->sec, NULL, &cursor,
+                               dbng_cursor_flags(handle)) != 0)
+        {
+            warnx("db cursor failed");
+            goto cleanup;
+        }
+
+        memset(&dbkey, 0, sizeof(dbkey));
+        memset(&dbpkey, 0, sizeof(dbpkey));
+        memset(&dbval, 0, sizeof(dbval));
+        dbval.flags = DB_DBT_PARTIAL;
+
+        while((ret = cursor->pget(cursor, &dbkey, &dbpkey, &dbval,
+                                  DB_NEXT)) == 0)
+        {
+            snapshot_build_ref(&build, 1, dbkey.data, dbkey.size,
+                               dbpkey.data, dbpkey.size);
+        }
+
+        cursor->close(cursor);
+        if(ret != DB_NOTFOUND) {
+            warnx("db cursor get failed: %s", db_strerror(ret));
+            goto cleanup;
+        }
+    }
+
+    sidecar_path(path, handle, SNAPSHOT_SUFFIX);
+    ret = snapshot_build_write(&build, path, handle->perms);
+
+cleanup:
+    snapshot_build_free(&build);
+    return (ret == 0 ? 0 : -1);
+}
+
+extern void
+dbng_touch(DBNG *handle)
+{
+    if(handle->txn != NULL) {
+        handle->dirty = 1;
+        return;
+    }
+
+    /* The change is already visible, so the sidecars no longer hold. */
+    invalidate(handle);
+    stamp_incr(&handle->stamp);
+}
+
 extern void
 dbng_cleanup(DBNG *handle)
 {
     if(handle != NULL) {
+        /* Changes never committed are rolled back. */
+        dbng_txn_abort(handle);
+        bloom_close(&handle->filter);
+        snapshot_close(&handle->snap);
+        stamp_close(&handle->stamp);
+        if(handle->aux != NULL)
+            handle->aux->close(handle->aux, 0);
         if(handle->sec != NULL)
             handle->sec->close(handle->sec, 0);
         if(handle->pri != NULL)
             handle->pri->close(handle->pri, 0);
-        if(handle->env != NULL)
-            handle->env->close(handle->env, 0);
+        env_release(handle->env);
+        handle->env = NULL;
+    }
+}
+
+extern void
+dbng_forget(DBNG *handle)
+{
+    if(handle != NULL) {
+        bloom_close(&handle->filter);
+        snapshot_close(&handle->snap);
+        stamp_close(&handle->stamp);
+        env_retire(handle->env);
+        memset(handle, 0, sizeof(*handle));
+    }
+}
+
+extern int
+dbng_txn_begin(DBNG *handle)
+{
+    int ret;
+
+    /* Readers have no transactions; their reads need no grouping. */
+    if((handle->flags & DBNG_RO) || handle->txn != NULL)
+        return 0;
+
+    ret = handle->env->txn_begin(handle->env, NULL, &handle->txn, 0);
+    if(ret != 0) {
+        warnx("txn begin failed: %s", db_strerror(ret));
+        handle->txn = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+extern int
+dbng_txn_commit(DBNG *handle)
+{
+    int ret;
+
+    if(handle->txn == NULL)
+        return 0;
+
+    ret = handle->txn->commit(handle->txn, 0);
+    handle->txn = NULL;
+    if(ret != 0) {
+        handle->dirty = 0;
+        warnx("txn commit failed: %s", db_strerror(ret));
+        return -1;
+    }
+
+    /*
+     * Until the rebuilt filter and snapshot replace them, readers are
+     * still answered from the ones holding the last committed state.
+     * Readers only look at the databases again once the changes are in.
+     */
+    if(handle->dirty) {
+        handle->dirty = 0;
+        if(dbng_build_filter(handle) != 0
+           || dbng_build_snapshot(handle) != 0)
+        {
+            warnx("could not rebuild the key filter and snapshot");
+            invalidate(handle);
+        }
+        else {
+            handle->stale = 0;
+        }
+        stamp_incr(&handle->stamp);
     }
+
+    return 0;
+}
+
+extern int
+dbng_txn_abort(DBNG *handle)
+{
+    int ret = 0;
+
+    if(handle->txn != NULL) {
+        ret = handle->txn->abort(handle->txn);
+        handle->txn = NULL;
+        handle->dirty = 0;
+        if(ret != 0)
+            warnx("txn abort failed: %s", db_strerror(ret));
+    }
+
+    return (ret == 0 ? 0 : -1);
+}
+
+extern int
+dbng_get(DBNG *handle, DB *db, DBT *key, DBT *val)
+{
+    DB_TXN *txn;
+    int ret;
+
+    if(handle->txn != NULL)
+        return db->get(db, handle->txn, key, val, 0);
+
+    ret = handle->env->txn_begin(handle->env, NULL, &txn, DB_TXN_SNAPSHOT);
+    if(ret == 0) {
+        ret = db->get(db, txn, key, val, 0);
+        txn->commit(txn, 0);
+    }
+    else {
+        warnx("txn begin failed: %s", db_strerror(ret));
+    }
+
+    /* A writer has recovered the environment, so it is joined afresh. */
+    if(ret == DB_RUNRECOVERY)
+        env_retire(handle->env);
+
+    return ret;
+}
+
+extern u_int32_t
+dbng_cursor_flags(const DBNG *handle)
+{
+    /* The cursor's snapshot transaction is committed when it is closed. */
+    return (handle->txn == NULL ? DB_TXN_SNAPSHOT : 0);
+}
+
+extern void
+dbng_set_durability(int durability)
+{
+    pthread_mutex_lock(&Env_lock);
+    Durability = durability;
+    pthread_mutex_unlock(&Env_lock);
+}
+
+extern void
+dbng_set_cache_size(u_int32_t kbytes)
+{
+    pthread_mutex_lock(&Env_lock);
+    Cache_kbytes = kbytes;
+    pthread_mutex_unlock(&Env_lock);
+}
+
+extern void
+dbng_set_access(DBTYPE type, u_int32_t nrecs, u_int32_t rec_size)
+{
+    pthread_mutex_lock(&Env_lock);
+    Access = type;
+    Nrecs = nrecs;
+    Rec_size = rec_size;
+    pthread_mutex_unlock(&Env_lock);
+}
+
+/*
+ * Returns non-zero if a process which joined the environment is still
+ * running, so that what dead ones left behind can be released.
+ */
+#ifdef DB_FAILCHK
+static int
+is_alive(DB_ENV *env, pid_t pid, db_threadid_t tid, u_int32_t flags)
+{
+    return (kill(pid, 0) == 0 || errno == EPERM);
+}
+#endif
+
+/*
+ * Join the environment of the base directory.
+ *
+ * Writers create the environment, so that an import is committed at once
+ * and an interrupted one is rolled back by the next writer, which also
+ * releases the snapshots of readers which died mid-lookup. Readers, which
+ * run as arbitrary users and may not create files in the base directory,
+ * join it as it is and never recover it, so one crashing inside a lookup
+ * cannot hold up the others. A reader which may not join the environment
+ * cannot read the databases at all.
+ */
+static DB_ENV
+*env_acquire(const char *base, int writer)
+{
+    ENV *entry;
+    DB_ENV *env = NULL;
+    u_int32_t env_flags;
+    int ret;
+
+    pthread_mutex_lock(&Env_lock);
+    for(entry = Envs; entry != NULL; entry = entry->next) {
+        if(!strcmp(entry->home, base) && entry->writer == writer
+           && !entry->retired)
+        {
+            entry->refs++;
+            env = entry->env;
+            goto cleanup;
+        }
+    }
+
+    if((ret = db_env_create(&env, 0)) != 0) {
+        warnx("error creating environment: %s", db_strerror(ret));
+        env = NULL;
+        goto cleanup;
+    }
+
+    if(Cache_kbytes > 0
+       && (ret = env->set_cachesize(env, Cache_kbytes / (1024 * 1024),
+                                    (Cache_kbytes % (1024 * 1024)) * 1024,
+                                    1)) != 0)
+    {
+        warnx("set_cachesize (%luK) failed: %s",
+              (unsigned long) Cache_kbytes, db_strerror(ret));
+        goto err;
+    }
+
+    env_flags = DB_INIT_MPOOL | DB_INIT_TXN | DB_INIT_LOG | DB_INIT_LOCK
+        | DB_THREAD;
+    env->set_lk_detect(env, DB_LOCK_DEFAULT);
+    env->set_lk_max_locks(env, MAX_LOCKS);
+    env->set_lk_max_objects(env, MAX_LOCKS);
+#ifdef DB_FAILCHK
+    env->set_thread_count(env, THREAD_COUNT);
+    env->set_isalive(env, is_alive);
+#endif
+
+    if(writer) {
+        env_flags |= DB_CREATE;
+#ifdef DB_REGISTER
+        /* Recover only when a writer died, never under a live one. */
+        env_flags |= DB_REGISTER | DB_RECOVER;
+#endif
+
+        if(Durability == DBNG_WRITE_NOSYNC)
+            env->set_flags(env, DB_TXN_WRITE_NOSYNC, 1);
+        else if(Durability == DBNG_NOSYNC)
+            env->set_flags(env, DB_TXN_NOSYNC, 1);
+#ifdef DB_LOG_AUTO_REMOVE
+        env->log_set_config(env, DB_LOG_AUTO_REMOVE, 1);
+        env->set_lg_filemode(env, LOG_PERMS);
+#endif
+    }
+
+    if((ret = env->open(env, base, env_flags, ENV_PERMS)) != 0) {
+        warnx("environment open (%s) failed: %s", base, db_strerror(ret));
+        goto err;
+    }
+
+#ifdef DB_FAILCHK
+    if(writer && (ret = env->failchk(env, 0)) != 0)
+        warnx("environment check (%s) failed: %s", base, db_strerror(ret));
+#endif
+
+    entry = xcalloc(1, sizeof(*entry));
+    strncpy(entry->home, base, MAX_PATH - 1);
+    entry->writer = writer;
+    entry->env = env;
+    entry->refs = 1;
+    entry->next = Envs;
+    Envs = entry;
+    goto cleanup;
+
+err:
+    env->close(env, 0);
+    env = NULL;
+
+cleanup:
+    pthread_mutex_unlock(&Env_lock);
+    return env;
+}
+
+/*
+ * Drop a handle's reference to its environment, closing it once the last
+ * database opened in it has been closed. A transactional environment is
+ * checkpointed first, so the next writer has no log to replay.
+ */
+static void
+env_release(DB_ENV *env)
+{
+    ENV **entry, *found;
+
+    if(env == NULL)
+        return;
+
+    pthread_mutex_lock(&Env_lock);
+    for(entry = &Envs; *entry != NULL; entry = &(*entry)->next) {
+        if((*entry)->env == env) {
+            found = *entry;
+            if(--found->refs == 0) {
+                *entry = found->next;
+                if(found->writer)
+                    found->env->txn_checkpoint(found->env, 0, 0, 0);
+                found->env->close(found->env, 0);
+                xfree((void **) &found);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&Env_lock);
+}
+
+/*
+ * Stop handing out an environment which must be joined again, leaving it
+ * to be closed along with the last database opened in it.
+ */
+static void
+env_retire(DB_ENV *env)
+{
+    ENV *entry;
+
+    pthread_mutex_lock(&Env_lock);
+    for(entry = Envs; entry != NULL; entry = entry->next) {
+        if(entry->env == env)
+            entry->retired = 1;
+    }
+    pthread_mutex_unlock(&Env_lock);
+}
+
+/*
+ * Databases are multiversion, so that a writer copies the pages it changes
+ * and reads outside its transaction never wait on it.
+ */
+static u_int32_t
+open_flags(int flags)
+{
+    return (flags & DBNG_RO ? DB_RDONLY : DB_CREATE)
+        | DB_AUTO_COMMIT | DB_MULTIVERSION
+        | (flags & DBNG_THREAD ? DB_THREAD : 0);
+}
+
+static void
+make_path(char *path, const char *base, const char *name)
+{
+    char *sep;
+
+    strncpy(path, base, MAX_PATH);
+    if((sep = strrchr(base, '/')) != NULL && *(sep + 1))
+        strncat(path, "/", MAX_PATH);
+    strncat(path, name, MAX_PATH);
+}
+
+static int
+open_sec(DBNG *handle, DB **sec, const char *name, const char *path,
+         int (*key_creator)(DB *, const DBT *, const DBT *,DBT *),
+         int flags, int perms)
+{
+    int ret;
+
+    if(open_db(handle, sec, name, path, 1, flags, perms) != 0)
+        goto err;
+
+    /*
+     * Associate the secondary with the primary. When writable, an empty
+     * secondary is built from the existing primary records.
+     */
+    ret = handle->pri->associate(
+        handle->pri, NULL, *sec,
+        (flags & DBNG_RO ? NULL : key_creator),
+        (flags & DBNG_RO ? 0 : DB_CREATE));
+    if(ret != 0) {
+        warnx("db associate (%s) failed: %s", path, db_strerror(ret));
+        goto err;
+    }
+
+    return 0;
+
+err:
+    if(*sec != NULL)
+        (*sec)->close(*sec, 0);
+    *sec = NULL;
+    return -1;
+}
+
+/*
+ * Open a database, sorting the duplicates of a secondary. An existing
+ * database keeps the access method it was created with, so only a new one
+ * takes the method set with dbng_set_access.
+ */
+static int
+open_db(DBNG *handle, DB **db, const char *name, const char *path, int sec,
+        int flags, int perms)
+{
+    u_int32_t db_flags = open_flags(flags);
+    DBTYPE type = DB_UNKNOWN;
+    int ret;
+
+create:
+    ret = db_create(db, handle->env, 0);
+    if(ret != 0) {
+        warnx("error opening %s db: %s", (sec ? "secondary" : "primary"),
+              db_strerror(ret));
+        goto err;
+    }
+
+    if(sec && (ret = (*db)->set_flags(*db, DB_DUPSORT)) != 0) {
+        warnx("set_flags secondary db: %s", db_strerror(ret));
+        goto err;
+    }
+
+    if(type == DB_HASH && (ret = hash_hints(*db, sec)) != 0) {
+        warnx("hash setup (%s) failed: %s", path, db_strerror(ret));
+        goto err;
+    }
+
+    ret = (*db)->open(*db, NULL, name, NULL, type,
+                      (type == DB_UNKNOWN ? db_flags & ~DB_CREATE : db_flags),
+                      perms);
+    if(ret == ENOENT && type == DB_UNKNOWN && (db_flags & DB_CREATE)) {
+        /* A handle may not be reused once its open has failed. */
+        (*db)->close(*db, 0);
+        *db = NULL;
+        type = ((flags & DBNG_ORDERED) || (!sec && (flags & DBNG_SCANNED))
+                ? DB_BTREE : Access);
+        goto create;
+    }
+    else if(ret != 0) {
+        warnx("db open (%s) failed: %s", path, db_strerror(ret));
+        goto err;
+    }
+
+    return 0;
+
+err:
+    if(*db != NULL)
+        (*db)->close(*db, 0);
+    *db = NULL;
+    return -1;
+}
+
+/*
+ * Size a new hash database for the expected records, so that it is not
+ * split bucket by bucket as it is loaded. The fill factor follows the
+ * Berkeley DB guideline of (pagesize - 32) / (entry size + 8).
+ */
+static int
+hash_hints(DB *db, int sec)
+{
+    u_int32_t entry = (sec ? HASH_SEC_ENTRY : Rec_size), ffactor;
+    int ret;
+
+    if(Nrecs == 0 || entry == 0)
+        return 0;
+
+    if((ret = db->set_pagesize(db, HASH_PAGESIZE)) != 0)
+        return ret;
+
+    ffactor = (HASH_PAGESIZE - 32) / (entry + 8);
+    if((ret = db->set_h_ffactor(db, (ffactor > 0 ? ffactor : 1))) != 0)
+        return ret;
+
+    return db->set_h_nelem(db, Nrecs);
+}
+
+/*
+ * Mark the key filter and snapshot as stale, so readers still mapping them
+ * stop trusting them until they are rebuilt.
+ */
+static void
+invalidate(DBNG *handle)
+{
+    char path[MAX_PATH];
+
+    if(handle->stale)
+        return;
+
+    sidecar_path(path, handle, BLOOM_SUFFIX);
+    if(bloom_invalidate(path) < 0)
+        warnx("could not invalidate filter %s", path);
+
+    sidecar_path(path, handle, SNAPSHOT_SUFFIX);
+    if(snapshot_invalidate(path) < 0)
+        warnx("could not invalidate snapshot %s", path);
+
+    handle->stale = 1;
+}
+
+/*
+ * Records of one layout cannot be read as another, so a database is only
+ * opened in the format it was written in. Databases written before the
+ * format was recorded have none. The format of a new database is written
+ * before the database itself, so that no database is left without one.
+ */
+static int
+check_format(DBNG *handle)
+{
+    char path[MAX_PATH];
+    struct stat st;
+    FORMAT_HDR hdr;
+    u_int32_t format;
+
+    sidecar_path(path, handle, DBNG_FORMAT_SUFFIX);
+
+    /* A reader finds a missing primary when it opens it. */
+    if(stat(handle->path, &st) != 0 && errno == ENOENT) {
+        if(handle->flags & DBNG_RO)
+            return 0;
+
+        hdr.magic = FORMAT_MAGIC;
+        hdr.format = DBNG_FORMAT;
+        return replace_file(path, &hdr, sizeof(hdr), handle->perms);
+    }
+
+    if(read_format(path, &format) != 0)
+        return -1;
+
+    if(format == 0) {
+        warnx("%s was written by an earlier release; dump it with that "
+              "release's dbngctl -l and import it again", handle->path);
+        return -1;
+    }
+    else if(format != DBNG_FORMAT) {
+        warnx("%s is in format %lu, but only format %d can be read",
+              handle->path, (unsigned long) format, DBNG_FORMAT);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Read the recorded format of a database, or 0 if it has none.
+ */
+static int
+read_format(const char *path, u_int32_t *format)
+{
+    FORMAT_HDR hdr;
+    ssize_t n;
+    int fd;
+
+    *format = 0;
+    if((fd = open(path, O_RDONLY)) < 0) {
+        if(errno == ENOENT)
+            return 0;
+        warn("open %s", path);
+        return -1;
+    }
+
+    n = read(fd, &hdr, sizeof(hdr));
+    close(fd);
+    if(n == sizeof(hdr) && hdr.magic == FORMAT_MAGIC)
+        *format = hdr.format;
+
+    return 0;
+}
+
+static void
+sidecar_path(char *path, const DBNG *handle, const char *suffix)
+{
+    strncpy(path, handle->path, MAX_PATH);
+    strncat(path, suffix, MAX_PATH - strlen(path) - 1);
+}
+
+/*
+ * Walk each distinct key of a database, adding it to the filter or just
+ * counting it when no filter is given.
+ */
+static int
+add_keys(BLOOM *bloom, DB *db, u_int32_t flags, int index, size_t *nkeys)
+{
+    DBC *cursor;
+    DBT dbkey, dbval;
+    int ret;
+
+    if((ret = db->cursor(db, NULL, &cursor, flags)) != 0) {
+        warnx("db cursor failed: %s", db_strerror(ret));
+        return -1;
+    }
+
+    /* Only the keys are needed. */
+    memset(&dbkey, 0, sizeof(dbkey));
+    memset(&dbval, 0, sizeof(dbval));
+    dbval.flags = DB_DBT_PARTIAL;
+
+    while((ret = cursor->get(cursor, &dbkey, &dbval, DB_NEXT_NODUP)) == 0) {
+        if(bloom != NULL)
+            bloom_add(bloom, index, dbkey.data, dbkey.size);
+        else
+            (*nkeys)++;
+    }
+
+    cursor->close(cursor);
+    if(ret != DB_NOTFOUND) {
+        warnx("db cursor get failed: %s", db_strerror(ret));
+        return -1;
+    }
+
+    return 0;
 }
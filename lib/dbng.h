@@ -24,19 +24,58 @@
 #  include <db.h>
 #endif
 
-#define DBNG_RW 0
-#define DBNG_RO 1
+#include "bloom.h"
+#include "snapshot.h"
+#include "stamp.h"
+
+#define DBNG_MAX_PATH 256
+
+#define DBNG_RW     0
+#define DBNG_RO     1
+#define DBNG_THREAD 2   /* Free-threaded handle, usable from many threads. */
+#define DBNG_ORDERED 8  /* Keys are scanned in order, so always a btree. */
+#define DBNG_SCANNED 16 /* The primary is enumerated, so always a btree. */
+
+/*
+ * The layout of records and index keys written by this release. Each
+ * primary database has its format recorded in a file alongside it, and
+ * one without predates the layout, so is refused.
+ */
+#define DBNG_FORMAT        1
+#define DBNG_FORMAT_SUFFIX ".format"
+
+#ifndef DB_TXN_SNAPSHOT
+   /* Berkeley DB before 4.5 reads with locks instead. */
+#  define DB_MULTIVERSION 0
+#  define DB_TXN_SNAPSHOT 0
+#endif
+
+/* How far a commit is written before it returns. */
+#define DBNG_SYNC         0   /* Log flushed to disk. */
+#define DBNG_WRITE_NOSYNC 1   /* Log written to the OS, survives a crash. */
+#define DBNG_NOSYNC       2   /* Log kept in memory until it fills. */
 
 typedef struct DBNG {
+    int flags;
+    int perms;
+    char path[DBNG_MAX_PATH];   /* Primary database path. */
+    BLOOM filter;
+    SNAPSHOT snap;
+    STAMP stamp;                /* Mapped for writing by writers only. */
     DB_TXN *txn;
+    int dirty;                  /* Changed within the transaction. */
+    int stale;                  /* Key filter and snapshot invalidated. */
     DB_ENV *env;
     DB *pri;
     DB *sec;
+    DB *aux;
     DBC *cursor;
 } DBNG;
 
 /**
- *
+ * Open the primary and secondary databases of a map. A database whose
+ * recorded format is not DBNG_FORMAT, or which has none, is not opened;
+ * a writer creating the primary records its format first.
  */
 extern int dbng_init(DBNG *handle,
                      const char *base,
@@ -46,9 +85,104 @@ extern int dbng_init(DBNG *handle,
                      int flags,
                      int perms);
 
+/**
+ * Open an auxiliary secondary index and associate it with an already
+ * initialized handle's primary database. A missing index is not an error
+ * for read-only handles; the aux database is simply left unset.
+ */
+extern int dbng_init_aux(DBNG *handle,
+                         const char *base,
+                         const char *aux,
+                         int (*key_creator)(DB *, const DBT *, const DBT *, DBT *),
+                         int flags,
+                         int perms);
+
+/**
+ * Rebuild the Bloom filter over the keys of every open database of the
+ * handle. The primary, secondary and auxiliary keys are added under
+ * indexes 0, 1 and 2 respectively.
+ */
+extern int dbng_build_filter(DBNG *handle);
+
+/**
+ * Rebuild the read-only snapshot of the primary records, indexed by the
+ * primary and secondary keys.
+ */
+extern int dbng_build_snapshot(DBNG *handle);
+
+/**
+ * Advance the generation stamp of a writable handle, telling readers that
+ * the databases have changed, and invalidate the key filter and snapshot
+ * until they are rebuilt. Within a transaction, both wait for the commit.
+ */
+extern void dbng_touch(DBNG *handle);
+
 /**
  *
  */
 extern void dbng_cleanup(DBNG *handle);
 
+/**
+ * Drop a handle inherited across fork() without closing its databases or
+ * environment, which Berkeley DB does not allow the child to use and whose
+ * closing could flush the parent's state. Only the key filter, snapshot
+ * and stamp mappings are released; the environment is joined afresh by the
+ * next handle opened. No other thread may have been using libdbng when the
+ * process forked.
+ */
+extern void dbng_forget(DBNG *handle);
+
+/**
+ * Set the size in kilobytes of the memory pool of environments opened from
+ * now on, shared by every database under the same base directory. Zero
+ * keeps the Berkeley DB default.
+ */
+extern void dbng_set_cache_size(u_int32_t kbytes);
+
+/**
+ * Set the access method of databases created from now on, DB_BTREE or
+ * DB_HASH, with the expected number of records and their average size in
+ * bytes, or 0 if unknown. Hash databases are sized from these. Existing
+ * databases keep the method they were created with.
+ */
+extern void dbng_set_access(DBTYPE type, u_int32_t nrecs, u_int32_t rec_size);
+
+/**
+ * Begin a transaction on a writable handle, which every change made
+ * through the handle joins until it is committed or aborted. Read-only
+ * handles have no transactions.
+ */
+extern int dbng_txn_begin(DBNG *handle);
+
+/**
+ * Commit the handle's transaction. If it changed the databases, the key
+ * filter and snapshot are rebuilt, then the generation stamp advanced.
+ */
+extern int dbng_txn_commit(DBNG *handle);
+
+/**
+ *
+ */
+extern int dbng_txn_abort(DBNG *handle);
+
+/**
+ * Read a record from one of the handle's databases. Reads outside the
+ * handle's transaction see the last committed state without taking read
+ * locks, for writers and readers alike, so never wait on a writer's
+ * transaction.
+ */
+extern int dbng_get(DBNG *handle, DB *db, DBT *key, DBT *val);
+
+/**
+ * The flags with which to open a cursor outside the handle's transaction,
+ * so that it too reads the last committed state without read locks.
+ */
+extern u_int32_t dbng_cursor_flags(const DBNG *handle);
+
+/**
+ * Set how durable the commits of writers opened from now on are, as one
+ * of DBNG_SYNC, DBNG_WRITE_NOSYNC or DBNG_NOSYNC.
+ */
+extern void dbng_set_durability(int durability);
+
 #endif
@@ -0,0 +1,371 @@
+/**
+ * @file service-aliases.c
+ * @brief Implements mail aliases service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "service-aliases.h"
+#include "utils.h"
+
+static void print(SERVICE *, const KEY *, const REC *);
+static int parse(SERVICE *, const char *, KEY *, REC *);
+static int set(SERVICE *, KEY *, REC *);
+static KEY *new_key(SERVICE *);
+static REC *new_rec(SERVICE *);
+static void key_init(SERVICE *, KEY *, enum KEY_TYPE, void *);
+static void pack_key(SERVICE *, const KEY *, DBT *);
+static void pack_rec(SERVICE *, const REC *, DBT *);
+static void unpack_key(SERVICE *, KEY *, const DBT *);
+static void unpack_rec(SERVICE *, REC *, const DBT *);
+static size_t rec_size(SERVICE *, const REC *);
+static size_t key_size(SERVICE *, const KEY *);
+static u_int32_t split_members(char *, char **);
+
+extern void
+service_aliases_init(SERVICE *service)
+{
+    memset(service, 0, sizeof(*service));
+    service->type = TYPE_ALIASES;
+    service->pri = ALIASES_PRI;
+    service->sec = NULL;
+
+    /* Set implemented functions. */
+    service->print = print;
+    service->parse = parse;
+    service->set = set;
+    service->pack_key = pack_key;
+    service->unpack_key = unpack_key;
+    service->pack_rec = pack_rec;
+    service->unpack_rec = unpack_rec;
+    service->rec_size = rec_size;
+    service->key_size = key_size;
+    service->new_key = new_key;
+    service->new_rec = new_rec;
+    service->key_init = key_init;
+    service->cleanup = NULL;
+    service->key_creator = NULL;
+
+    /* Set inherited functions. */
+    service->get = service_get_rec;
+    service->get_dups = service_get_dups;
+    service->get_prefix = service_get_prefix;
+    service->next = service_next_rec;
+    service->delete = service_delete_rec;
+    service->truncate = service_truncate;
+    service->start_txn = service_start_txn;
+    service->commit = service_commit_txn;
+    service->rollback = service_rollback_txn;
+    service->validate = service_validate;
+}
+
+static void
+print(SERVICE *service, const KEY *key, const REC *rec)
+{
+    const ALIASES_REC *arec = (const ALIASES_REC *) rec;
+    int i;
+
+    printf("%s:", arec->name);
+    for(i = 0; i < arec->count && arec->members[i] != NULL; i++)
+        printf("%s %s", (i > 0 ? "," : ""), arec->members[i]);
+    printf("\n");
+}
+
+/*
+ * Parse a "name: member, member" line. As in an aliases file, a line
+ * without a name continues the member list of the alias before it.
+ */
+static int
+parse(SERVICE *service, const char *raw, KEY *key, REC *rec)
+{
+    ALIASES_KEY *akey = (ALIASES_KEY *) key;
+    ALIASES_REC *arec = (ALIASES_REC *) rec;
+    static char buf[SERVICE_REC_MAX];
+    static char current[SERVICE_REC_MAX];
+    static char *members[SERVICE_REC_MAX / 2];
+    char *name, *list, *p;
+
+    memset(akey, 0, sizeof(*akey));
+    memset(arec, 0, sizeof(*arec));
+    akey->base.type = PRI;
+    arec->base.type = TYPE_ALIASES;
+
+    if(strlen(raw) >= sizeof(buf)) {
+        warnx("parse: record too large");
+        return 0;
+    }
+    strcpy(buf, raw);
+
+    /* A name may not hold white space, commas, quotes or colons. */
+    for(p = buf; *p != '\0' && !strchr(" \t,:\"", *p); p++)
+        ;
+    name = buf;
+    list = p;
+    while(isspace((unsigned char) *list))
+        list++;
+
+    if(p > buf && *list == ':') {
+        *p = '\0';
+        list++;
+        strcpy(current, name);
+    }
+    else if(current[0] != '\0') {
+        name = current;
+        list = buf;
+    }
+    else {
+        warnx("parse: continuation line without an alias");
+        return 0;
+    }
+
+    akey->data.pri = arec->name = name;
+    arec->members = members;
+    arec->count = split_members(list, members);
+
+    return 1;
+}
+
+/*
+ * Store an alias, appending its members to those of any record already
+ * stored under the same name, so continuation lines and repeated names
+ * accumulate.
+ */
+static int
+set(SERVICE *service, KEY *key, REC *rec)
+{
+    ALIASES_REC *arec = (ALIASES_REC *) rec, old, merged;
+    int i, j;
+
+    if(service_get_rec(service, key, (REC *) &old) != 0)
+        return service_set_rec(service, key, rec);
+
+    char *members[old.count + arec->count + 1];
+
+    /* The name keeps the spelling it was first stored with. */
+    memcpy(&merged, arec, sizeof(merged));
+    merged.name = old.name;
+    merged.members = members;
+    for(merged.count = 0;
+        merged.count < old.count && old.members[merged.count] != NULL;
+        merged.count++)
+    {
+        members[merged.count] = old.members[merged.count];
+    }
+
+    for(i = 0; i < arec->count && arec->members[i] != NULL; i++) {
+        for(j = 0; j < merged.count; j++) {
+            if(!strcmp(members[j], arec->members[i]))
+                break;
+        }
+
+        if(j == merged.count)
+            members[merged.count++] = arec->members[i];
+    }
+    members[merged.count] = NULL;
+
+    return service_set_rec(service, key, (REC *) &merged);
+}
+
+static KEY
+*new_key(SERVICE *service)
+{
+    return xmalloc(sizeof(ALIASES_KEY));
+}
+
+static REC
+*new_rec(SERVICE *service)
+{
+    return xmalloc(sizeof(ALIASES_REC));
+}
+
+static void
+key_init(SERVICE *service, KEY *key, enum KEY_TYPE type, void *data)
+{
+    ALIASES_KEY *akey = (ALIASES_KEY *) key;
+    akey->base.type = type;
+    akey->data.pri = (char *) data;
+}
+
+static size_t
+rec_size(SERVICE *service, const REC *rec)
+{
+    ALIASES_REC *arec = (ALIASES_REC *) rec;
+    size_t size;
+    int i;
+
+    size = sizeof(arec->count)
+        + sizeof(u_int32_t)
+        + ((arec->count + 1) * sizeof(char *))
+        + (arec->count * sizeof(u_int32_t))
+        + strlen(arec->name) + 1;
+
+    for(i = 0;
+        i < arec->count && arec->members != NULL && arec->members[i] != NULL;
+        i++)
+    {
+        size += strlen(arec->members[i]) + 1;
+    }
+
+    return size;
+}
+
+static size_t
+key_size(SERVICE *service, const KEY *key)
+{
+    ALIASES_KEY *akey = (ALIASES_KEY *) key;
+
+    return sizeof(akey->base.type)
+        + strlen(akey->data.pri) + 1;
+}
+
+/*
+ * Alias names are matched regardless of case, so names are keyed in lower
+ * case.
+ */
+static void
+pack_key(SERVICE *service, const KEY *key, DBT *dbkey)
+{
+    ALIASES_KEY *akey = (ALIASES_KEY *) key;
+    char *buf = (char *) dbkey->data + sizeof(akey->base.type);
+    const char *name;
+
+    for(name = akey->data.pri; *name != '\0'; name++)
+        *buf++ = tolower((unsigned char) *name);
+    *buf = '\0';
+}
+
+static void
+pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
+{
+    ALIASES_REC *arec = (ALIASES_REC *) rec;
+    char *buf = NULL, *s, *block;
+    u_int32_t block_len, offset;
+    int i, end, len, slen = 0;
+
+    buf = dbrec->data;
+    len = dbrec->size;
+
+    s = buf;
+    memcpy(s, &arec->count, (slen = sizeof(arec->count)));
+    s += slen;
+
+    /*
+     * The block_len follows, then space reserved for the member pointers
+     * set by unpack_rec, then the member offsets.
+     */
+    block = s + sizeof(block_len)
+        + ((arec->count + 1) * sizeof(char *))
+        + (arec->count * sizeof(offset));
+
+    memcpy(block, arec->name, (block_len = strlen(arec->name) + 1));
+    s += sizeof(block_len) + ((arec->count + 1) * sizeof(char *));
+
+    /* A count past the end of the member list stores out of range offsets. */
+    for(i = 0, end = (arec->members == NULL); i < arec->count; i++) {
+        end = end || arec->members[i] == NULL;
+        offset = (end ? (u_int32_t) -1 : block_len);
+        memcpy(s, &offset, sizeof(offset));
+        s += sizeof(offset);
+
+        if(!end) {
+            memcpy(block + block_len, arec->members[i],
+                   (slen = strlen(arec->members[i]) + 1));
+            block_len += slen;
+        }
+    }
+
+    memcpy(buf + sizeof(arec->count), &block_len, sizeof(block_len));
+
+    memset(dbrec, 0, sizeof(*dbrec));
+    dbrec->data = buf;
+    dbrec->size = len;
+}
+
+static void
+unpack_key(SERVICE *service, KEY *key, const DBT *dbkey)
+{
+    ALIASES_KEY *akey = (ALIASES_KEY *) key;
+    char *buf = (char *) dbkey->data;
+
+    memset(akey, 0, sizeof(*akey));
+    akey->base.type = *((enum KEY_TYPE *) buf);
+    buf += sizeof(akey->base.type);
+    akey->data.pri = buf;
+}
+
+static void
+unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
+{
+    ALIASES_REC *arec = (ALIASES_REC *) rec;
+    char *buf = (char *) dbrec->data, *offsets;
+    u_int32_t block_len, offset;
+    int i;
+
+    memset(arec, 0, sizeof(*arec));
+    arec->base.type = TYPE_ALIASES;
+
+    memcpy(&arec->count, buf, sizeof(arec->count));
+    buf += sizeof(arec->count);
+
+    memcpy(&block_len, buf, sizeof(block_len));
+    buf += sizeof(block_len);
+
+    arec->members = (char **) buf;
+    buf += (arec->count + 1) * sizeof(char *);
+
+    offsets = buf;
+    buf += arec->count * sizeof(offset);
+
+    arec->base.block = buf;
+    arec->base.block_len = block_len;
+    arec->name = buf;
+
+    for(i = 0; i < arec->count; i++) {
+        memcpy(&offset, offsets + (i * sizeof(offset)), sizeof(offset));
+        if(offset >= block_len)
+            break;
+        arec->members[i] = buf + offset;
+    }
+
+    arec->members[i] = NULL;
+}
+
+/*
+ * Split a comma separated member list in place, trimming white space and
+ * skipping empty members. Commas within double quotes, as in a quoted
+ * pipe or file recipient, do not separate members. The list is NULL
+ * terminated.
+ */
+static u_int32_t
+split_members(char *raw, char **list)
+{
+    u_int32_t n = 0;
+    char *p = raw, *start, *end;
+    int quoted;
+
+    while(*p != '\0') {
+        while(isspace((unsigned char) *p) || *p == ',')
+            p++;
+        if(*p == '\0')
+            break;
+
+        for(start = p, quoted = 0; *p != '\0' && (quoted || *p != ','); p++) {
+            if(*p == '"')
+                quoted = !quoted;
+        }
+
+        for(end = p; end > start && isspace((unsigned char) end[-1]); end--)
+            ;
+        if(*p != '\0')
+            p++;
+        *end = '\0';
+        list[n++] = start;
+    }
+    list[n] = NULL;
+
+    return n;
+}
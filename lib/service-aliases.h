@@ -0,0 +1,34 @@
+/**
+ * @file service-aliases.h
+ * @brief Defines mail aliases service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef SERVICE_ALIASES_H
+#define SERVICE_ALIASES_H
+
+#include "service.h"
+
+#define ALIASES_PRI "aliases.db"
+
+typedef struct ALIASES_REC {
+    REC base;
+    char *name;
+    u_int32_t count;
+    char **members;
+} ALIASES_REC;
+
+typedef struct ALIASES_KEY {
+    KEY base;
+    union {
+        char *pri;
+    } data;
+} ALIASES_KEY;
+
+/**
+ *
+ */
+extern void service_aliases_init(SERVICE *service);
+
+#endif
@@ -0,0 +1,344 @@
+/**
+ * @file service-ethers.c
+ * @brief Implements ethers service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <netinet/ether.h>
+
+#include "service-ethers.h"
+#include "utils.h"
+
+#define SEPARATORS " \t"
+
+static void print(SERVICE *, const KEY *, const REC *);
+static int parse(SERVICE *, const char *, KEY *, REC *);
+static int set(SERVICE *, KEY *, REC *);
+static KEY *new_key(SERVICE *);
+static REC *new_rec(SERVICE *);
+static void key_init(SERVICE *, KEY *, enum KEY_TYPE, void *);
+static void pack_key(SERVICE *, const KEY *, DBT *);
+static void pack_rec(SERVICE *, const REC *, DBT *);
+static void unpack_key(SERVICE *, KEY *, const DBT *);
+static void unpack_rec(SERVICE *, REC *, const DBT *);
+static int key_creator(DB *, const DBT *, const DBT *, DBT *);
+static size_t rec_size(SERVICE *, const REC *);
+static size_t key_size(SERVICE *, const KEY *);
+
+extern void
+service_ethers_init(SERVICE *service)
+{
+    memset(service, 0, sizeof(*service));
+    service->type = TYPE_ETHERS;
+    service->pri = ETHERS_PRI;
+    service->sec = ETHERS_SEC;
+
+    /* Set implemented functions. */
+    service->print = print;
+    service->parse = parse;
+    service->set = set;
+    service->key_creator = key_creator;
+    service->pack_key = pack_key;
+    service->unpack_key = unpack_key;
+    service->pack_rec = pack_rec;
+    service->unpack_rec = unpack_rec;
+    service->rec_size = rec_size;
+    service->key_size = key_size;
+    service->new_key = new_key;
+    service->new_rec = new_rec;
+    service->key_init = key_init;
+    service->cleanup = NULL;
+
+    /* Set inherited functions. */
+    service->validate = service_validate;
+    service->get = service_get_rec;
+    service->get_dups = service_get_dups;
+    service->get_prefix = service_get_prefix;
+    service->next = service_next_rec;
+    service->delete = service_delete_rec;
+    service->truncate = service_truncate;
+    service->start_txn = service_start_txn;
+    service->commit = service_commit_txn;
+    service->rollback = service_rollback_txn;
+}
+
+/*
+ * Print a line per address, in the ethers file format parse accepts.
+ */
+static void
+print(SERVICE *service, const KEY *key, const REC *rec)
+{
+    const ETHERS_REC *erec = (const ETHERS_REC *) rec;
+    char addr[sizeof("ff:ff:ff:ff:ff:ff")];
+    int i;
+
+    for(i = 0; i < erec->naddrs; i++) {
+        ether_ntoa_r((const struct ether_addr *) &erec->addrs[i], addr);
+        printf("%s\t%s\n", addr, erec->name);
+    }
+}
+
+static int
+parse(SERVICE *service, const char *raw, KEY *key, REC *rec)
+{
+    ETHERS_KEY *ekey = (ETHERS_KEY *) key;
+    ETHERS_REC *erec = (ETHERS_REC *) rec;
+    static char buf[SERVICE_REC_MAX];
+    static ETHERS_ADDR addr;
+    char *tok, *comment, *last;
+
+    memset(ekey, 0, sizeof(*ekey));
+    memset(erec, 0, sizeof(*erec));
+    ekey->base.type = PRI;
+    erec->base.type = TYPE_ETHERS;
+
+    if(strlen(raw) >= sizeof(buf)) {
+        warnx("parse: record too large");
+        return 0;
+    }
+    strcpy(buf, raw);
+    if((comment = strchr(buf, '#')) != NULL)
+        *comment = '\0';
+
+    /* The address comes first, followed by the host name. */
+    if((tok = strtok_r(buf, SEPARATORS, &last)) == NULL)
+        return 0;
+
+    if(ether_aton_r(tok, (struct ether_addr *) &addr) == NULL) {
+        warnx("parse: invalid address %s", tok);
+        return 0;
+    }
+
+    if((erec->name = strtok_r(NULL, SEPARATORS, &last)) == NULL)
+        return 0;
+
+    ekey->data.pri = erec->name;
+    erec->naddrs = 1;
+    erec->addrs = &addr;
+
+    return 1;
+}
+
+/*
+ * Store a host, merging its addresses with those of any record already
+ * stored under the same name.
+ */
+static int
+set(SERVICE *service, KEY *key, REC *rec)
+{
+    ETHERS_REC *erec = (ETHERS_REC *) rec, old, merged;
+    int i, j;
+
+    if(service_get_rec(service, key, (REC *) &old) != 0)
+        return service_set_rec(service, key, rec);
+
+    ETHERS_ADDR addrs[old.naddrs + erec->naddrs];
+
+    /* The name keeps the spelling it was first stored with. */
+    memcpy(&merged, erec, sizeof(merged));
+    merged.name = old.name;
+    memcpy(addrs, old.addrs, old.naddrs * sizeof(ETHERS_ADDR));
+    merged.addrs = addrs;
+    merged.naddrs = old.naddrs;
+
+    for(i = 0; i < erec->naddrs; i++) {
+        for(j = 0; j < merged.naddrs; j++) {
+            if(!memcmp(&addrs[j], &erec->addrs[i], sizeof(ETHERS_ADDR)))
+                break;
+        }
+
+        if(j == merged.naddrs)
+            addrs[merged.naddrs++] = erec->addrs[i];
+    }
+
+    return service_set_rec(service, key, (REC *) &merged);
+}
+
+static KEY
+*new_key(SERVICE *service)
+{
+    return xmalloc(sizeof(ETHERS_KEY));
+}
+
+static REC
+*new_rec(SERVICE *service)
+{
+    return xmalloc(sizeof(ETHERS_REC));
+}
+
+static void
+key_init(SERVICE *service, KEY *key, enum KEY_TYPE type, void *data)
+{
+    ETHERS_KEY *ekey = (ETHERS_KEY *) key;
+    ekey->base.type = type;
+    ekey->data.pri = (char *) data;
+}
+
+static int
+key_creator(DB *dbp, const DBT *ekey, const DBT *edata, DBT *skey)
+{
+    ETHERS_KEY key;
+    ETHERS_REC rec;
+    DBT copy;
+    DBT *keys;
+    int i, size;
+
+    /* Index the host under each of its addresses. */
+    service_copy_rec(edata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
+    if(rec.naddrs == 0) {
+        free(copy.data);
+        return DB_DONOTINDEX;
+    }
+
+    keys = xcalloc(rec.naddrs, sizeof(DBT));
+    memset(&key, 0, sizeof(key));
+    key.base.type = SEC;
+    size = key_size(NULL, (KEY *) &key);
+    for(i = 0; i < rec.naddrs; i++) {
+        key.data.sec = rec.addrs[i];
+        keys[i].data = xcalloc(1, size);
+        keys[i].size = size;
+        keys[i].flags = DB_DBT_APPMALLOC;
+        pack_key(NULL, (KEY *) &key, &keys[i]);
+    }
+
+    memset(skey, 0, sizeof(*skey));
+    skey->data = keys;
+    skey->size = rec.naddrs;
+    skey->flags = DB_DBT_MULTIPLE | DB_DBT_APPMALLOC;
+
+    free(copy.data);
+    return 0;
+}
+
+static size_t
+rec_size(SERVICE *service, const REC *rec)
+{
+    ETHERS_REC *erec = (ETHERS_REC *) rec;
+
+    return sizeof(erec->naddrs)
+        + sizeof(u_int32_t)
+        + (erec->naddrs * sizeof(ETHERS_ADDR))
+        + strlen(erec->name) + 1;
+}
+
+static size_t
+key_size(SERVICE *service, const KEY *key)
+{
+    ETHERS_KEY *ekey = (ETHERS_KEY *) key;
+
+    return sizeof(ekey->base.type)
+        + (ekey->base.type == SEC
+           ? sizeof(ekey->data.sec)
+           : (strlen(ekey->data.pri) + 1));
+}
+
+/*
+ * Host names are matched regardless of case, so names are keyed in lower
+ * case.
+ */
+static void
+pack_key(SERVICE *service, const KEY *key, DBT *dbkey)
+{
+    ETHERS_KEY *ekey = (ETHERS_KEY *) key;
+    char *buf = (char *) dbkey->data + sizeof(ekey->base.type);
+    const char *name;
+
+    switch(ekey->base.type) {
+    case PRI:
+        for(name = ekey->data.pri; *name != '\0'; name++)
+            *buf++ = tolower((unsigned char) *name);
+        *buf = '\0';
+        break;
+
+    case SEC:
+        memcpy(buf, &ekey->data.sec, sizeof(ekey->data.sec));
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void
+pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
+{
+    ETHERS_REC *erec = (ETHERS_REC *) rec;
+    char *buf = NULL, *s;
+    u_int32_t block_len;
+    int len, slen = 0;
+
+    buf = dbrec->data;
+    len = dbrec->size;
+
+    s = buf;
+    memcpy(s, &erec->naddrs, (slen = sizeof(erec->naddrs)));
+    s += slen;
+
+    /* The string block holds only the name. */
+    block_len = strlen(erec->name) + 1;
+    memcpy(s, &block_len, (slen = sizeof(block_len)));
+    s += slen;
+
+    memcpy(s, erec->addrs, (slen = erec->naddrs * sizeof(ETHERS_ADDR)));
+    s += slen;
+
+    memcpy(s, erec->name, block_len);
+
+    memset(dbrec, 0, sizeof(*dbrec));
+    dbrec->data = buf;
+    dbrec->size = len;
+}
+
+static void
+unpack_key(SERVICE *service, KEY *key, const DBT *dbkey)
+{
+    ETHERS_KEY *ekey = (ETHERS_KEY *) key;
+    char *buf = (char *) dbkey->data;
+
+    memset(ekey, 0, sizeof(*ekey));
+    ekey->base.type = *((enum KEY_TYPE *) buf);
+    buf += sizeof(ekey->base.type);
+
+    switch(ekey->base.type) {
+    case PRI:
+        ekey->data.pri = buf;
+        break;
+
+    case SEC:
+        memcpy(&ekey->data.sec, buf, sizeof(ekey->data.sec));
+        break;
+
+    default:
+        break;
+    }
+}
+
+static void
+unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
+{
+    ETHERS_REC *erec = (ETHERS_REC *) rec;
+    char *buf = (char *) dbrec->data;
+    u_int32_t block_len;
+
+    memset(erec, 0, sizeof(*erec));
+    erec->base.type = TYPE_ETHERS;
+
+    memcpy(&erec->naddrs, buf, sizeof(erec->naddrs));
+    buf += sizeof(erec->naddrs);
+
+    memcpy(&block_len, buf, sizeof(block_len));
+    buf += sizeof(block_len);
+
+    erec->addrs = (ETHERS_ADDR *) buf;
+    buf += erec->naddrs * sizeof(ETHERS_ADDR);
+
+    erec->base.block = buf;
+    erec->base.block_len = block_len;
+    erec->name = buf;
+}
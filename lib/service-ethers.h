@@ -0,0 +1,46 @@
+/**
+ * @file service-ethers.h
+ * @brief Defines ethers service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef SERVICE_ETHERS_H
+#define SERVICE_ETHERS_H
+
+#include "service.h"
+
+#define ETHERS_PRI "ethers.db"
+#define ETHERS_SEC "ethers-addr.db"
+
+#define ETHERS_ADDR_LEN 6
+
+typedef struct ETHERS_ADDR {
+    unsigned char octet[ETHERS_ADDR_LEN];
+} ETHERS_ADDR;
+
+/*
+ * A host may have several interfaces, so each record holds every address
+ * given for its name.
+ */
+typedef struct ETHERS_REC {
+    REC base;
+    char *name;
+    u_int32_t naddrs;
+    ETHERS_ADDR *addrs;
+} ETHERS_REC;
+
+typedef struct ETHERS_KEY {
+    KEY base;
+    union {
+        char *pri;
+        ETHERS_ADDR sec;
+    } data;
+} ETHERS_KEY;
+
+/**
+ *
+ */
+extern void service_ethers_init(SERVICE *service);
+
+#endif
@@ -25,6 +25,7 @@ static void pack_rec(SERVICE *, const REC *, DBT *);
 static void unpack_key(SERVICE *, KEY *, const DBT *);
 static void unpack_rec(SERVICE *, REC *, const DBT *);
 static int key_creator(DB *, const DBT *, const DBT *, DBT *);
+static int aux_key_creator(DB *, const DBT *, const DBT *, DBT *);
 static size_t rec_size(SERVICE *, const REC *);
 static size_t key_size(SERVICE *, const KEY *);
 
@@ -35,12 +36,14 @@ service_group_init(SERVICE *service)
     service->type = TYPE_GROUP;
     service->pri = GROUP_PRI;
     service->sec = GROUP_SEC;
+    service->aux = GROUP_AUX;
 
     /* Set implemented functions. */
     service->print = print;
     service->validate = validate;
     service->parse = parse;
     service->key_creator = key_creator;
+    service->aux_key_creator = aux_key_creator;
     service->pack_key = pack_key;
     service->unpack_key = unpack_key;
     service->pack_rec = pack_rec;
@@ -54,6 +57,8 @@ service_group_init(SERVICE *service)
 
     /* Set inherited functions. */
     service->get = service_get_rec;
+    service->get_dups = service_get_dups;
+    service->get_prefix = service_get_prefix;
     service->set = service_set_rec;
     service->next = service_next_rec;
     service->delete = service_delete_rec;
@@ -240,9 +245,11 @@ key_creator(DB *dbp, const DBT *gkey, const DBT *gdata, DBT *skey)
 {
     GROUP_KEY key;
     GROUP_REC rec;
+    DBT copy;
 
     /* Create the secondary index on the gid. */
-    unpack_rec(NULL, (REC *) &rec, gdata);
+    service_copy_rec(gdata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
     key.base.type = SEC;
     key.data.sec = rec.gid;
     int size = key_size(NULL, (KEY *) &key);
@@ -252,6 +259,45 @@ key_creator(DB *dbp, const DBT *gkey, const DBT *gdata, DBT *skey)
     skey->flags = DB_DBT_APPMALLOC;
     pack_key(NULL, (KEY *) &key, skey);
 
+    free(copy.data);
+    return 0;
+}
+
+static int
+aux_key_creator(DB *dbp, const DBT *gkey, const DBT *gdata, DBT *skey)
+{
+    GROUP_KEY key;
+    GROUP_REC rec;
+    DBT copy;
+    DBT *keys;
+    int i, size;
+
+    /* Index the group under each of its members. */
+    service_copy_rec(gdata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
+    if(rec.count == 0) {
+        free(copy.data);
+        return DB_DONOTINDEX;
+    }
+
+    keys = xcalloc(rec.count, sizeof(DBT));
+    key.base.type = AUX;
+    for(i = 0; i < rec.count; i++) {
+        key.data.aux = rec.members[i];
+        size = key_size(NULL, (KEY *) &key);
+
+        keys[i].data = xcalloc(1, size);
+        keys[i].size = size;
+        keys[i].flags = DB_DBT_APPMALLOC;
+        pack_key(NULL, (KEY *) &key, &keys[i]);
+    }
+
+    memset(skey, 0, sizeof(*skey));
+    skey->data = keys;
+    skey->size = rec.count;
+    skey->flags = DB_DBT_MULTIPLE | DB_DBT_APPMALLOC;
+
+    free(copy.data);
     return 0;
 }
 
@@ -264,7 +310,9 @@ rec_size(SERVICE *service, const REC *rec)
 
     size = sizeof(grec->gid)
         + sizeof(grec->count)
+        + sizeof(u_int32_t) * 2
         + ((grec->count + 1) * sizeof(char *))
+        + (grec->count * sizeof(u_int32_t))
         + strlen(grec->name) + 1
         + strlen(grec->passwd) + 1;
 
@@ -284,16 +332,20 @@ key_size(SERVICE *service, const KEY *key)
     GROUP_KEY *gkey = (GROUP_KEY *) key;
 
     return sizeof(gkey->base.type)
-        + (gkey->base.type == PRI
-           ? (strlen(gkey->data.pri) + 1)
-           : sizeof(gkey->data.sec));
+        + (gkey->base.type == SEC
+           ? sizeof(gkey->data.sec)
+           : (strlen(gkey->data.pri) + 1));
 }
 
+/*
+ * Gids are packed most significant byte first, so that they sort
+ * numerically.
+ */
 static void
 pack_key(SERVICE *service, const KEY *key, DBT *dbkey)
 {
     GROUP_KEY *gkey = (GROUP_KEY *) key;
-    char *buf = dbkey->data, *s;
+    unsigned char *buf = dbkey->data, *s;
 
     switch(gkey->base.type) {
     case PRI:
@@ -302,8 +354,16 @@ pack_key(SERVICE *service, const KEY *key, DBT *dbkey)
         break;
 
     case SEC:
-        memcpy(buf + sizeof(gkey->base.type), &gkey->data.sec,
-               sizeof(gkey->data.sec));
+        s = buf + sizeof(gkey->base.type);
+        s[0] = (gkey->data.sec >> 24) & 0xff;
+        s[1] = (gkey->data.sec >> 16) & 0xff;
+        s[2] = (gkey->data.sec >> 8) & 0xff;
+        s[3] = gkey->data.sec & 0xff;
+        break;
+
+    case AUX:
+        memcpy(buf + sizeof(gkey->base.type), gkey->data.aux,
+               strlen(gkey->data.aux) + 1);
         break;
     }
 }
@@ -312,10 +372,10 @@ static void
 pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
 {
     GROUP_REC *grec = (GROUP_REC *) rec;
-    char *buf = NULL, *s, **member;
-    int len, slen = 0;
+    char *buf = NULL, *s, *block;
+    u_int32_t block_len, offset;
+    int i, end, len, slen = 0;
 
-    /* Reserve space for the record and the number of group members. */
     buf = dbrec->data;
     len = dbrec->size;
 
@@ -323,24 +383,43 @@ pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
     memcpy(s, &grec->gid, (slen = sizeof(grec->gid)));
     s += slen;
 
-    memcpy(s, grec->name, (slen = (strlen(grec->name) + 1)));
-    s += slen;
-
-    memcpy(s, grec->passwd, (slen = (strlen(grec->passwd) + 1)));
-    s += slen;
-
-    /* Reserve space for count and member pointers. */
     memcpy(s, &grec->count, (slen = sizeof(grec->count)));
-    s += slen + ((grec->count + 1) * sizeof(char *));
+    s += slen;
 
-    for(member = grec->members;
-        member != NULL && *member != NULL;
-        member++)
-    {
-        memcpy(s, *member, (slen = (strlen(*member) + 1)));
-        s += slen;
+    /*
+     * The block_len and password offset follow, then space reserved for
+     * the member pointers set by unpack_rec, then the member offsets.
+     */
+    block = s + sizeof(block_len) + sizeof(offset)
+        + ((grec->count + 1) * sizeof(char *))
+        + (grec->count * sizeof(offset));
+
+    memcpy(block, grec->name, (block_len = strlen(grec->name) + 1));
+    offset = block_len;
+    memcpy(block + block_len, grec->passwd, (slen = strlen(grec->passwd) + 1));
+    block_len += slen;
+
+    memcpy(s + sizeof(block_len), &offset, sizeof(offset));
+    s += sizeof(block_len) + sizeof(offset)
+        + ((grec->count + 1) * sizeof(char *));
+
+    /* A count past the end of the member list stores out of range offsets. */
+    for(i = 0, end = (grec->members == NULL); i < grec->count; i++) {
+        end = end || grec->members[i] == NULL;
+        offset = (end ? (u_int32_t) -1 : block_len);
+        memcpy(s, &offset, sizeof(offset));
+        s += sizeof(offset);
+
+        if(!end) {
+            memcpy(block + block_len, grec->members[i],
+                   (slen = strlen(grec->members[i]) + 1));
+            block_len += slen;
+        }
     }
 
+    memcpy(buf + sizeof(grec->gid) + sizeof(grec->count), &block_len,
+           sizeof(block_len));
+
     memset(dbrec, 0, sizeof(*dbrec));
     dbrec->data = buf;
     dbrec->size = len;
@@ -350,7 +429,7 @@ static void
 unpack_key(SERVICE *service, KEY *key, const DBT *dbkey)
 {
     GROUP_KEY *gkey = (GROUP_KEY *) key;
-    char *buf = (char *) dbkey->data;
+    unsigned char *buf = (unsigned char *) dbkey->data;
 
     memset(gkey, 0, sizeof(*gkey));
     gkey->base.type = *((enum KEY_TYPE *) buf);
@@ -358,11 +437,16 @@ unpack_key(SERVICE *service, KEY *key, const DBT *dbkey)
 
     switch(gkey->base.type) {
     case PRI:
-        gkey->data.pri = buf;
+        gkey->data.pri = (char *) buf;
         break;
 
     case SEC:
-        memcpy(&gkey->data.sec, buf, sizeof(gkey->data.sec));
+        gkey->data.sec = ((gid_t) buf[0] << 24) | (buf[1] << 16)
+            | (buf[2] << 8) | buf[3];
+        break;
+
+    case AUX:
+        gkey->data.aux = (char *) buf;
         break;
     }
 }
@@ -371,36 +455,41 @@ static void
 unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
 {
     GROUP_REC *grec = (GROUP_REC *) rec;
-    char *buf = (char *) dbrec->data;
-    int i, len, remaining = dbrec->size;
+    char *buf = (char *) dbrec->data, *offsets;
+    u_int32_t block_len, offset;
+    int i;
 
     memset(grec, 0, sizeof(*grec));
     grec->base.type = TYPE_GROUP;
 
     memcpy(&grec->gid, buf, sizeof(grec->gid));
     buf += sizeof(grec->gid);
-    remaining -= sizeof(grec->gid);
-
-    grec->name = buf;
-    buf += (len = (strlen(grec->name) + 1));
-    remaining -= len;
-
-    grec->passwd = buf;
-    buf += (len = (strlen(grec->passwd) + 1));
-    remaining -= len;
 
     memcpy(&grec->count, buf, sizeof(grec->count));
     buf += sizeof(grec->count);
-    remaining -= sizeof(grec->count);
+
+    memcpy(&block_len, buf, sizeof(block_len));
+    buf += sizeof(block_len);
+
+    memcpy(&offset, buf, sizeof(offset));
+    buf += sizeof(offset);
 
     grec->members = (char **) buf;
-    buf += (len = ((grec->count + 1) * sizeof(char *)));
-    remaining -= len;
+    buf += (grec->count + 1) * sizeof(char *);
+
+    offsets = buf;
+    buf += grec->count * sizeof(offset);
+
+    grec->base.block = buf;
+    grec->base.block_len = block_len;
+    grec->name = buf;
+    grec->passwd = buf + offset;
 
-    for(i = 0; i < grec->count && remaining > 0; i++) {
-        grec->members[i] = buf;
-        buf += (len = (strlen(grec->members[i]) + 1));
-        remaining -= len;
+    for(i = 0; i < grec->count; i++) {
+        memcpy(&offset, offsets + (i * sizeof(offset)), sizeof(offset));
+        if(offset >= block_len)
+            break;
+        grec->members[i] = buf + offset;
     }
 
     grec->members[i] = NULL;
@@ -12,8 +12,10 @@
 
 #include "service.h"
 
+/* Named for its key format, as is the passwd uid index. */
 #define GROUP_PRI "group.db"
-#define GROUP_SEC "group-gid.db"
+#define GROUP_SEC "group-gid2.db"
+#define GROUP_AUX "group-member.db"
 
 typedef struct GROUP_REC {
     REC base;
@@ -29,6 +31,7 @@ typedef struct GROUP_KEY {
     union {
         char *pri;
         gid_t sec;
+        char *aux;    /* Member name. */
     } data;
 } GROUP_KEY;
 
@@ -0,0 +1,414 @@
+/**
+ * @file service-gshadow.c
+ * @brief Implements gshadow service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <regex.h>
+
+#include "service-gshadow.h"
+#include "utils.h"
+
+#define ERRBUFLEN 256
+#define NMATCH    4   /* A match per gshadow column. */
+
+static void print(SERVICE *, const KEY *, const REC *);
+static int parse(SERVICE *, const char *, KEY *, REC *);
+static KEY *new_key(SERVICE *);
+static REC *new_rec(SERVICE *);
+static void key_init(SERVICE *, KEY *, enum KEY_TYPE, void *);
+static void pack_key(SERVICE *, const KEY *, DBT *);
+static void pack_rec(SERVICE *, const REC *, DBT *);
+static void unpack_key(SERVICE *, KEY *, const DBT *);
+static void unpack_rec(SERVICE *, REC *, const DBT *);
+static size_t rec_size(SERVICE *, const REC *);
+static size_t key_size(SERVICE *, const KEY *);
+static void print_list(char **, u_int32_t);
+static u_int32_t split_list(char *, char **);
+static size_t list_size(char **, u_int32_t);
+static char *pack_offsets(char *, char *, u_int32_t *, char **, u_int32_t);
+static char *unpack_offsets(char *, char *, u_int32_t, char **, u_int32_t);
+
+extern void
+service_gshadow_init(SERVICE *service)
+{
+    memset(service, 0, sizeof(*service));
+    service->type = TYPE_GSHADOW;
+    service->pri = GSHADOW_PRI;
+    service->sec = NULL;
+
+    /* Set implemented functions. */
+    service->print = print;
+    service->parse = parse;
+    service->pack_key = pack_key;
+    service->unpack_key = unpack_key;
+    service->pack_rec = pack_rec;
+    service->unpack_rec = unpack_rec;
+    service->rec_size = rec_size;
+    service->key_size = key_size;
+    service->new_key = new_key;
+    service->new_rec = new_rec;
+    service->key_init = key_init;
+    service->cleanup = NULL;
+    service->key_creator = NULL;
+
+    /* Set inherited functions. */
+    service->get = service_get_rec;
+    service->get_dups = service_get_dups;
+    service->get_prefix = service_get_prefix;
+    service->set = service_set_rec;
+    service->next = service_next_rec;
+    service->delete = service_delete_rec;
+    service->truncate = service_truncate;
+    service->start_txn = service_start_txn;
+    service->commit = service_commit_txn;
+    service->rollback = service_rollback_txn;
+    service->validate = service_validate;
+}
+
+static void
+print(SERVICE *service, const KEY *key, const REC *rec)
+{
+    const GSHADOW_REC *grec = (const GSHADOW_REC *) rec;
+
+    printf("%s:%s:", grec->name, grec->passwd);
+    print_list(grec->admins, grec->nadmins);
+    printf(":");
+    print_list(grec->members, grec->count);
+    printf("\n");
+}
+
+static int
+parse(SERVICE *service, const char *raw, KEY *key, REC *rec)
+{
+    GSHADOW_KEY *gkey = (GSHADOW_KEY *) key;
+    GSHADOW_REC *grec = (GSHADOW_REC *) rec;
+    int ret, res = 0, i, len;
+    regex_t regex;
+    regmatch_t matches[NMATCH + 1];
+    char err_buf[ERRBUFLEN];
+    static char buf[SERVICE_REC_MAX];
+    static char *admins[SERVICE_REC_MAX / 2];
+    static char *members[SERVICE_REC_MAX / 2];
+    size_t remaining = sizeof(buf);
+    char *p_buf = buf;
+
+    memset(&regex, 0, sizeof(regex));
+    memset(gkey, 0, sizeof(*gkey));
+    memset(grec, 0, sizeof(*grec));
+    memset(&buf, 0, sizeof(buf));
+    gkey->base.type = PRI;
+    grec->base.type = TYPE_GSHADOW;
+
+    ret = regcomp(&regex,
+                  "([^:]+):"    /* group. */
+                  "([^:]*):"    /* passwd. */
+                  "([^:]*):"    /* administrators (may be empty). */
+                  "([^:]*)$",   /* members (may be empty). */
+                  REG_EXTENDED);
+    if(ret != 0) {
+        regerror(ret, &regex, err_buf, ERRBUFLEN);
+        warnx("regcomp: %s", err_buf);
+        goto cleanup;
+    }
+
+    ret = regexec(&regex, raw, NMATCH + 1, matches, 0);
+    if(ret != 0) {
+        if(ret != REG_NOMATCH) {
+            regerror(ret, &regex, err_buf, ERRBUFLEN);
+            warnx("regcomp: %s", err_buf);
+        }
+        goto cleanup;
+    }
+    else {
+        /* Successful match. */
+        for(i = 1; i < NMATCH + 1; i++) {
+            len = matches[i].rm_eo - matches[i].rm_so;
+            if((remaining -= (len + 1)) <= 0) {
+                warnx("regexec: parsed record too large");
+                goto cleanup;
+            }
+            strncpy(p_buf, (raw + matches[i].rm_so), len);
+            p_buf[len] = '\0';
+
+            switch(i) {
+            case 1:
+                gkey->data.pri = grec->name = p_buf;
+                break;
+
+            case 2:
+                grec->passwd = p_buf;
+                break;
+
+            case 3:
+                grec->admins = admins;
+                grec->nadmins = split_list(p_buf, admins);
+                break;
+
+            case 4:
+                grec->members = members;
+                grec->count = split_list(p_buf, members);
+                break;
+            }
+
+            p_buf += (len + 1);
+        }
+
+        res = 1;
+    }
+
+cleanup:
+    regfree(&regex);
+    return res;
+}
+
+static KEY
+*new_key(SERVICE *service)
+{
+    return xmalloc(sizeof(GSHADOW_KEY));
+}
+
+static REC
+*new_rec(SERVICE *service)
+{
+    return xmalloc(sizeof(GSHADOW_REC));
+}
+
+static void
+key_init(SERVICE *service, KEY *key, enum KEY_TYPE type, void *data)
+{
+    GSHADOW_KEY *gkey = (GSHADOW_KEY *) key;
+    gkey->base.type = type;
+    gkey->data.pri = (char *) data;
+}
+
+static size_t
+rec_size(SERVICE *service, const REC *rec)
+{
+    GSHADOW_REC *grec = (GSHADOW_REC *) rec;
+
+    return sizeof(grec->nadmins)
+        + sizeof(grec->count)
+        + sizeof(u_int32_t) * 2
+        + ((grec->nadmins + 1) * sizeof(char *))
+        + ((grec->count + 1) * sizeof(char *))
+        + ((grec->nadmins + grec->count) * sizeof(u_int32_t))
+        + strlen(grec->name) + 1
+        + strlen(grec->passwd) + 1
+        + list_size(grec->admins, grec->nadmins)
+        + list_size(grec->members, grec->count);
+}
+
+static size_t
+key_size(SERVICE *service, const KEY *key)
+{
+    GSHADOW_KEY *gkey = (GSHADOW_KEY *) key;
+
+    return sizeof(gkey->base.type)
+        + strlen(gkey->data.pri) + 1;
+}
+
+static void
+pack_key(SERVICE *service, const KEY *key, DBT *dbkey)
+{
+    GSHADOW_KEY *gkey = (GSHADOW_KEY *) key;
+    char *buf = dbkey->data;
+
+    memcpy(buf, &(gkey->base.type), sizeof(gkey->base.type));
+    memcpy(buf + sizeof(gkey->base.type), gkey->data.pri,
+           strlen(gkey->data.pri) + 1);
+}
+
+static void
+pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
+{
+    GSHADOW_REC *grec = (GSHADOW_REC *) rec;
+    char *buf = NULL, *s, *block;
+    u_int32_t block_len, offset;
+    int len, slen = 0;
+
+    buf = dbrec->data;
+    len = dbrec->size;
+
+    s = buf;
+    memcpy(s, &grec->nadmins, (slen = sizeof(grec->nadmins)));
+    s += slen;
+
+    memcpy(s, &grec->count, (slen = sizeof(grec->count)));
+    s += slen;
+
+    /*
+     * The block_len and password offset follow, then space reserved for
+     * the administrator and member pointers set by unpack_rec, then the
+     * offsets of each.
+     */
+    block = s + sizeof(block_len) + sizeof(offset)
+        + ((grec->nadmins + 1) * sizeof(char *))
+        + ((grec->count + 1) * sizeof(char *))
+        + ((grec->nadmins + grec->count) * sizeof(offset));
+
+    /* The string block holds the name and password, then the lists. */
+    offset = strlen(grec->name) + 1;
+    memcpy(block, grec->name, offset);
+    memcpy(block + offset, grec->passwd,
+           (slen = strlen(grec->passwd) + 1));
+    block_len = offset + slen;
+
+    memcpy(s + sizeof(block_len), &offset, sizeof(offset));
+    s += sizeof(block_len) + sizeof(offset)
+        + ((grec->nadmins + 1) * sizeof(char *))
+        + ((grec->count + 1) * sizeof(char *));
+
+    s = pack_offsets(s, block, &block_len, grec->admins, grec->nadmins);
+    pack_offsets(s, block, &block_len, grec->members, grec->count);
+
+    memcpy(buf + sizeof(grec->nadmins) + sizeof(grec->count), &block_len,
+           sizeof(block_len));
+
+    memset(dbrec, 0, sizeof(*dbrec));
+    dbrec->data = buf;
+    dbrec->size = len;
+}
+
+static void
+unpack_key(SERVICE *service, KEY *key, const DBT *dbkey)
+{
+    GSHADOW_KEY *gkey = (GSHADOW_KEY *) key;
+    char *buf = (char *) dbkey->data;
+
+    memset(gkey, 0, sizeof(*gkey));
+    gkey->base.type = *((enum KEY_TYPE *) buf);
+    buf += sizeof(gkey->base.type);
+    gkey->data.pri = buf;
+}
+
+static void
+unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
+{
+    GSHADOW_REC *grec = (GSHADOW_REC *) rec;
+    char *buf = (char *) dbrec->data, *offsets;
+    u_int32_t block_len, offset;
+
+    memset(grec, 0, sizeof(*grec));
+    grec->base.type = TYPE_GSHADOW;
+
+    memcpy(&grec->nadmins, buf, sizeof(grec->nadmins));
+    buf += sizeof(grec->nadmins);
+
+    memcpy(&grec->count, buf, sizeof(grec->count));
+    buf += sizeof(grec->count);
+
+    memcpy(&block_len, buf, sizeof(block_len));
+    buf += sizeof(block_len);
+
+    memcpy(&offset, buf, sizeof(offset));
+    buf += sizeof(offset);
+
+    grec->admins = (char **) buf;
+    buf += (grec->nadmins + 1) * sizeof(char *);
+
+    grec->members = (char **) buf;
+    buf += (grec->count + 1) * sizeof(char *);
+
+    offsets = buf;
+    buf += (grec->nadmins + grec->count) * sizeof(offset);
+
+    grec->base.block = buf;
+    grec->base.block_len = block_len;
+    grec->name = buf;
+    grec->passwd = buf + offset;
+
+    offsets = unpack_offsets(offsets, buf, block_len, grec->admins,
+                             grec->nadmins);
+    unpack_offsets(offsets, buf, block_len, grec->members, grec->count);
+}
+
+static void
+print_list(char **list, u_int32_t n)
+{
+    int i;
+
+    for(i = 0; i < n && list[i] != NULL; i++)
+        printf("%s%s", (i > 0 ? "," : ""), list[i]);
+}
+
+/*
+ * Split a comma separated list in place, skipping empty entries. The list
+ * is NULL terminated.
+ */
+static u_int32_t
+split_list(char *raw, char **list)
+{
+    u_int32_t n = 0;
+    char *entry, *last;
+
+    for(entry = strtok_r(raw, ",", &last);
+        entry != NULL;
+        entry = strtok_r(NULL, ",", &last))
+    {
+        list[n++] = entry;
+    }
+    list[n] = NULL;
+
+    return n;
+}
+
+static size_t
+list_size(char **list, u_int32_t n)
+{
+    size_t size = 0;
+    int i;
+
+    for(i = 0; i < n && list != NULL && list[i] != NULL; i++)
+        size += strlen(list[i]) + 1;
+
+    return size;
+}
+
+/*
+ * Append a list's strings to the block, storing their offsets at s. A
+ * count past the end of the list stores out of range offsets.
+ */
+static char
+*pack_offsets(char *s, char *block, u_int32_t *block_len, char **list,
+              u_int32_t n)
+{
+    u_int32_t offset;
+    int i, end, slen;
+
+    for(i = 0, end = (list == NULL); i < n; i++) {
+        end = end || list[i] == NULL;
+        offset = (end ? (u_int32_t) -1 : *block_len);
+        memcpy(s, &offset, sizeof(offset));
+        s += sizeof(offset);
+
+        if(!end) {
+            memcpy(block + *block_len, list[i],
+                   (slen = strlen(list[i]) + 1));
+            *block_len += slen;
+        }
+    }
+
+    return s;
+}
+
+static char
+*unpack_offsets(char *offsets, char *block, u_int32_t block_len,
+                char **list, u_int32_t n)
+{
+    u_int32_t offset;
+    int i;
+
+    for(i = 0; i < n; i++) {
+        memcpy(&offset, offsets + (i * sizeof(offset)), sizeof(offset));
+        if(offset >= block_len)
+            break;
+        list[i] = block + offset;
+    }
+    list[i] = NULL;
+
+    return offsets + (n * sizeof(offset));
+}
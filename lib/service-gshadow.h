@@ -0,0 +1,37 @@
+/**
+ * @file service-gshadow.h
+ * @brief Defines gshadow service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef SERVICE_GSHADOW_H
+#define SERVICE_GSHADOW_H
+
+#include "service.h"
+
+#define GSHADOW_PRI "gshadow.db"
+
+typedef struct GSHADOW_REC {
+    REC base;
+    char *name;
+    char *passwd;
+    u_int32_t nadmins;
+    char **admins;
+    u_int32_t count;
+    char **members;
+} GSHADOW_REC;
+
+typedef struct GSHADOW_KEY {
+    KEY base;
+    union {
+        char *pri;
+    } data;
+} GSHADOW_KEY;
+
+/**
+ *
+ */
+extern void service_gshadow_init(SERVICE *service);
+
+#endif
@@ -0,0 +1,525 @@
+/**
+ * @file service-hosts.c
+ * @brief Implements hosts service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "service-hosts.h"
+#include "utils.h"
+
+#define SEPARATORS " \t"
+
+static void print(SERVICE *, const KEY *, const REC *);
+static int parse(SERVICE *, const char *, KEY *, REC *);
+static int set(SERVICE *, KEY *, REC *);
+static KEY *new_key(SERVICE *);
+static REC *new_rec(SERVICE *);
+static void key_init(SERVICE *, KEY *, enum KEY_TYPE, void *);
+static void pack_key(SERVICE *, const KEY *, DBT *);
+static void pack_rec(SERVICE *, const REC *, DBT *);
+static void unpack_key(SERVICE *, KEY *, const DBT *);
+static void unpack_rec(SERVICE *, REC *, const DBT *);
+static int key_creator(DB *, const DBT *, const DBT *, DBT *);
+static int aux_key_creator(DB *, const DBT *, const DBT *, DBT *);
+static size_t rec_size(SERVICE *, const REC *);
+static size_t key_size(SERVICE *, const KEY *);
+static size_t addrs_size(u_int32_t);
+static void pack_name(char *, const char *);
+
+extern void
+service_hosts_init(SERVICE *service)
+{
+    memset(service, 0, sizeof(*service));
+    service->type = TYPE_HOSTS;
+    service->pri = HOSTS_PRI;
+    service->sec = HOSTS_SEC;
+    service->aux = HOSTS_AUX;
+
+    /* Set implemented functions. */
+    service->print = print;
+    service->parse = parse;
+    service->set = set;
+    service->key_creator = key_creator;
+    service->aux_key_creator = aux_key_creator;
+    service->pack_key = pack_key;
+    service->unpack_key = unpack_key;
+    service->pack_rec = pack_rec;
+    service->unpack_rec = unpack_rec;
+    service->rec_size = rec_size;
+    service->key_size = key_size;
+    service->new_key = new_key;
+    service->new_rec = new_rec;
+    service->key_init = key_init;
+    service->cleanup = NULL;
+
+    /* Set inherited functions. */
+    service->validate = service_validate;
+    service->get = service_get_rec;
+    service->get_dups = service_get_dups;
+    service->get_prefix = service_get_prefix;
+    service->next = service_next_rec;
+    service->delete = service_delete_rec;
+    service->truncate = service_truncate;
+    service->start_txn = service_start_txn;
+    service->commit = service_commit_txn;
+    service->rollback = service_rollback_txn;
+}
+
+extern size_t
+hosts_addr_len(int family)
+{
+    switch(family) {
+    case AF_INET:
+        return sizeof(struct in_addr);
+
+    case AF_INET6:
+        return sizeof(struct in6_addr);
+
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Print a line per address, in the hosts file format parse accepts.
+ */
+static void
+print(SERVICE *service, const KEY *key, const REC *rec)
+{
+    const HOSTS_REC *hrec = (const HOSTS_REC *) rec;
+    char addr[INET6_ADDRSTRLEN];
+    int i, j;
+
+    for(i = 0; i < hrec->naddrs; i++) {
+        if(inet_ntop(hrec->addrs[i].family, hrec->addrs[i].addr,
+                     addr, sizeof(addr)) == NULL)
+        {
+            continue;
+        }
+
+        printf("%s\t%s", addr, hrec->name);
+        for(j = 0; j < hrec->count && hrec->aliases[j] != NULL; j++)
+            printf(" %s", hrec->aliases[j]);
+        printf("\n");
+    }
+}
+
+static int
+parse(SERVICE *service, const char *raw, KEY *key, REC *rec)
+{
+    HOSTS_KEY *hkey = (HOSTS_KEY *) key;
+    HOSTS_REC *hrec = (HOSTS_REC *) rec;
+    static char buf[SERVICE_REC_MAX];
+    static char *aliases[SERVICE_REC_MAX / 2];
+    static HOSTS_ADDR addr;
+    char *p_buf, *tok, *comment, *last;
+
+    memset(hkey, 0, sizeof(*hkey));
+    memset(hrec, 0, sizeof(*hrec));
+    memset(&addr, 0, sizeof(addr));
+    hkey->base.type = PRI;
+    hrec->base.type = TYPE_HOSTS;
+
+    if(strlen(raw) >= sizeof(buf)) {
+        warnx("parse: record too large");
+        return 0;
+    }
+    strcpy(buf, raw);
+    if((comment = strchr(buf, '#')) != NULL)
+        *comment = '\0';
+
+    /* The address comes first, followed by the canonical name. */
+    if((tok = strtok_r(buf, SEPARATORS, &last)) == NULL)
+        return 0;
+
+    if(inet_pton(AF_INET, tok, addr.addr) == 1) {
+        addr.family = AF_INET;
+    }
+    else if(inet_pton(AF_INET6, tok, addr.addr) == 1) {
+        addr.family = AF_INET6;
+    }
+    else {
+        warnx("parse: invalid address %s", tok);
+        return 0;
+    }
+
+    if((p_buf = strtok_r(NULL, SEPARATORS, &last)) == NULL)
+        return 0;
+
+    hkey->data.pri = hrec->name = p_buf;
+    hrec->naddrs = 1;
+    hrec->addrs = &addr;
+    hrec->aliases = aliases;
+
+    while((tok = strtok_r(NULL, SEPARATORS, &last)) != NULL)
+        aliases[hrec->count++] = tok;
+    aliases[hrec->count] = NULL;
+
+    return 1;
+}
+
+/*
+ * Store a host, merging its addresses and aliases with those of any
+ * record already stored under the same canonical name.
+ */
+static int
+set(SERVICE *service, KEY *key, REC *rec)
+{
+    HOSTS_REC *hrec = (HOSTS_REC *) rec, old, merged;
+    int i, j;
+
+    if(service_get_rec(service, key, (REC *) &old) != 0)
+        return service_set_rec(service, key, rec);
+
+    HOSTS_ADDR addrs[old.naddrs + hrec->naddrs];
+    char *aliases[old.count + hrec->count + 1];
+
+    memcpy(&merged, hrec, sizeof(merged));
+    memcpy(addrs, old.addrs, old.naddrs * sizeof(HOSTS_ADDR));
+    merged.addrs = addrs;
+    merged.naddrs = old.naddrs;
+
+    for(i = 0; i < hrec->naddrs; i++) {
+        for(j = 0; j < merged.naddrs; j++) {
+            if(!memcmp(&addrs[j], &hrec->addrs[i], sizeof(HOSTS_ADDR)))
+                break;
+        }
+
+        if(j == merged.naddrs)
+            addrs[merged.naddrs++] = hrec->addrs[i];
+    }
+
+    merged.aliases = aliases;
+    for(merged.count = 0;
+        merged.count < old.count && old.aliases[merged.count] != NULL;
+        merged.count++)
+    {
+        aliases[merged.count] = old.aliases[merged.count];
+    }
+
+    for(i = 0; i < hrec->count && hrec->aliases[i] != NULL; i++) {
+        for(j = 0; j < merged.count; j++) {
+            if(!strcasecmp(aliases[j], hrec->aliases[i]))
+                break;
+        }
+
+        if(j == merged.count)
+            aliases[merged.count++] = hrec->aliases[i];
+    }
+    aliases[merged.count] = NULL;
+
+    return service_set_rec(service, key, (REC *) &merged);
+}
+
+static KEY
+*new_key(SERVICE *service)
+{
+    return xmalloc(sizeof(HOSTS_KEY));
+}
+
+static REC
+*new_rec(SERVICE *service)
+{
+    return xmalloc(sizeof(HOSTS_REC));
+}
+
+static void
+key_init(SERVICE *service, KEY *key, enum KEY_TYPE type, void *data)
+{
+    HOSTS_KEY *hkey = (HOSTS_KEY *) key;
+    hkey->base.type = type;
+    hkey->data.pri = (char *) data;
+}
+
+static int
+key_creator(DB *dbp, const DBT *hkey, const DBT *hdata, DBT *skey)
+{
+    HOSTS_KEY key;
+    HOSTS_REC rec;
+    DBT copy;
+    DBT *keys;
+    int i, size;
+
+    /* Index the host under each of its addresses. */
+    service_copy_rec(hdata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
+    if(rec.naddrs == 0) {
+        free(copy.data);
+        return DB_DONOTINDEX;
+    }
+
+    keys = xcalloc(rec.naddrs, sizeof(DBT));
+    memset(&key, 0, sizeof(key));
+    key.base.type = SEC;
+    size = key_size(NULL, (KEY *) &key);
+    for(i = 0; i < rec.naddrs; i++) {
+        memcpy(&key.data.sec, &rec.addrs[i], sizeof(key.data.sec));
+        keys[i].data = xcalloc(1, size);
+        keys[i].size = size;
+        keys[i].flags = DB_DBT_APPMALLOC;
+        pack_key(NULL, (KEY *) &key, &keys[i]);
+    }
+
+    memset(skey, 0, sizeof(*skey));
+    skey->data = keys;
+    skey->size = rec.naddrs;
+    skey->flags = DB_DBT_MULTIPLE | DB_DBT_APPMALLOC;
+
+    free(copy.data);
+    return 0;
+}
+
+static int
+aux_key_creator(DB *dbp, const DBT *hkey, const DBT *hdata, DBT *skey)
+{
+    HOSTS_KEY key;
+    HOSTS_REC rec;
+    DBT copy;
+    DBT *keys;
+    int i, size;
+
+    /* Index the host under each of its aliases. */
+    service_copy_rec(hdata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
+    if(rec.count == 0) {
+        free(copy.data);
+        return DB_DONOTINDEX;
+    }
+
+    keys = xcalloc(rec.count, sizeof(DBT));
+    key.base.type = AUX;
+    for(i = 0; i < rec.count; i++) {
+        key.data.aux = rec.aliases[i];
+        size = key_size(NULL, (KEY *) &key);
+
+        keys[i].data = xcalloc(1, size);
+        keys[i].size = size;
+        keys[i].flags = DB_DBT_APPMALLOC;
+        pack_key(NULL, (KEY *) &key, &keys[i]);
+    }
+
+    memset(skey, 0, sizeof(*skey));
+    skey->data = keys;
+    skey->size = rec.count;
+    skey->flags = DB_DBT_MULTIPLE | DB_DBT_APPMALLOC;
+
+    free(copy.data);
+    return 0;
+}
+
+static size_t
+rec_size(SERVICE *service, const REC *rec)
+{
+    HOSTS_REC *hrec = (HOSTS_REC *) rec;
+    size_t size;
+    char **alias;
+
+    size = sizeof(hrec->naddrs)
+        + sizeof(hrec->count)
+        + sizeof(u_int32_t)
+        + addrs_size(hrec->naddrs)
+        + ((hrec->count + 1) * sizeof(char *))
+        + (hrec->count * sizeof(u_int32_t))
+        + strlen(hrec->name) + 1;
+
+    for(alias = hrec->aliases;
+        alias != NULL && *alias != NULL;
+        alias++)
+    {
+        size += strlen(*alias) + 1;
+    }
+
+    return size;
+}
+
+static size_t
+key_size(SERVICE *service, const KEY *key)
+{
+    HOSTS_KEY *hkey = (HOSTS_KEY *) key;
+
+    return sizeof(hkey->base.type)
+        + (hkey->base.type == SEC
+           ? sizeof(hkey->data.sec)
+           : (strlen(hkey->data.pri) + 1));
+}
+
+static void
+pack_key(SERVICE *service, const KEY *key, DBT *dbkey)
+{
+    HOSTS_KEY *hkey = (HOSTS_KEY *) key;
+    char *buf = dbkey->data;
+
+    switch(hkey->base.type) {
+    case PRI:
+        pack_name(buf + sizeof(hkey->base.type), hkey->data.pri);
+        break;
+
+    case SEC:
+        memcpy(buf + sizeof(hkey->base.type), &hkey->data.sec,
+               sizeof(hkey->data.sec));
+        break;
+
+    case AUX:
+        pack_name(buf + sizeof(hkey->base.type), hkey->data.aux);
+        break;
+    }
+}
+
+static void
+pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
+{
+    HOSTS_REC *hrec = (HOSTS_REC *) rec;
+    char *buf = NULL, *s, *block;
+    u_int32_t block_len, offset;
+    int i, end, len, slen = 0;
+
+    buf = dbrec->data;
+    len = dbrec->size;
+
+    s = buf;
+    memcpy(s, &hrec->naddrs, (slen = sizeof(hrec->naddrs)));
+    s += slen;
+
+    memcpy(s, &hrec->count, (slen = sizeof(hrec->count)));
+    s += slen;
+
+    /*
+     * The block_len and the addresses follow, padded so the space reserved
+     * for the alias pointers set by unpack_rec is aligned, then the alias
+     * offsets.
+     */
+    block = s + sizeof(block_len)
+        + addrs_size(hrec->naddrs)
+        + ((hrec->count + 1) * sizeof(char *))
+        + (hrec->count * sizeof(offset));
+
+    memcpy(block, hrec->name, (block_len = strlen(hrec->name) + 1));
+
+    memset(s + sizeof(block_len), 0, addrs_size(hrec->naddrs));
+    memcpy(s + sizeof(block_len), hrec->addrs,
+           hrec->naddrs * sizeof(HOSTS_ADDR));
+    s += sizeof(block_len) + addrs_size(hrec->naddrs)
+        + ((hrec->count + 1) * sizeof(char *));
+
+    /* A count past the end of the alias list stores out of range offsets. */
+    for(i = 0, end = (hrec->aliases == NULL); i < hrec->count; i++) {
+        end = end || hrec->aliases[i] == NULL;
+        offset = (end ? (u_int32_t) -1 : block_len);
+        memcpy(s, &offset, sizeof(offset));
+        s += sizeof(offset);
+
+        if(!end) {
+            memcpy(block + block_len, hrec->aliases[i],
+                   (slen = strlen(hrec->aliases[i]) + 1));
+            block_len += slen;
+        }
+    }
+
+    memcpy(buf + sizeof(hrec->naddrs) + sizeof(hrec->count), &block_len,
+           sizeof(block_len));
+
+    memset(dbrec, 0, sizeof(*dbrec));
+    dbrec->data = buf;
+    dbrec->size = len;
+}
+
+static void
+unpack_key(SERVICE *service, KEY *key, const DBT *dbkey)
+{
+    HOSTS_KEY *hkey = (HOSTS_KEY *) key;
+    char *buf = (char *) dbkey->data;
+
+    memset(hkey, 0, sizeof(*hkey));
+    hkey->base.type = *((enum KEY_TYPE *) buf);
+    buf += sizeof(hkey->base.type);
+
+    switch(hkey->base.type) {
+    case PRI:
+        hkey->data.pri = buf;
+        break;
+
+    case SEC:
+        memcpy(&hkey->data.sec, buf, sizeof(hkey->data.sec));
+        break;
+
+    case AUX:
+        hkey->data.aux = buf;
+        break;
+    }
+}
+
+static void
+unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
+{
+    HOSTS_REC *hrec = (HOSTS_REC *) rec;
+    char *buf = (char *) dbrec->data, *offsets;
+    u_int32_t block_len, offset;
+    int i;
+
+    memset(hrec, 0, sizeof(*hrec));
+    hrec->base.type = TYPE_HOSTS;
+
+    memcpy(&hrec->naddrs, buf, sizeof(hrec->naddrs));
+    buf += sizeof(hrec->naddrs);
+
+    memcpy(&hrec->count, buf, sizeof(hrec->count));
+    buf += sizeof(hrec->count);
+
+    memcpy(&block_len, buf, sizeof(block_len));
+    buf += sizeof(block_len);
+
+    hrec->addrs = (HOSTS_ADDR *) buf;
+    buf += addrs_size(hrec->naddrs);
+
+    hrec->aliases = (char **) buf;
+    buf += (hrec->count + 1) * sizeof(char *);
+
+    offsets = buf;
+    buf += hrec->count * sizeof(offset);
+
+    hrec->base.block = buf;
+    hrec->base.block_len = block_len;
+    hrec->name = buf;
+
+    for(i = 0; i < hrec->count; i++) {
+        memcpy(&offset, offsets + (i * sizeof(offset)), sizeof(offset));
+        if(offset >= block_len)
+            break;
+        hrec->aliases[i] = buf + offset;
+    }
+
+    hrec->aliases[i] = NULL;
+}
+
+/*
+ * The space taken by a record's addresses, padded so that the alias
+ * pointers after them are aligned. The three words before the addresses
+ * keep them aligned for their own fields.
+ */
+static size_t
+addrs_size(u_int32_t naddrs)
+{
+    size_t off = (3 * sizeof(u_int32_t)) + (naddrs * sizeof(HOSTS_ADDR));
+
+    return (naddrs * sizeof(HOSTS_ADDR))
+        + ((sizeof(char *) - (off % sizeof(char *))) % sizeof(char *));
+}
+
+/*
+ * Host names are matched regardless of case, so names are keyed in lower
+ * case.
+ */
+static void
+pack_name(char *buf, const char *name)
+{
+    while(*name != '\0')
+        *buf++ = tolower((unsigned char) *name++);
+    *buf = '\0';
+}
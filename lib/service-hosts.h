@@ -0,0 +1,60 @@
+/**
+ * @file service-hosts.h
+ * @brief Defines hosts service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef SERVICE_HOSTS_H
+#define SERVICE_HOSTS_H
+
+#include <netinet/in.h>
+
+#include "service.h"
+
+#define HOSTS_PRI "hosts.db"
+#define HOSTS_SEC "hosts-addr.db"
+#define HOSTS_AUX "hosts-alias.db"
+
+#define HOSTS_ADDR_MAX 16   /* Large enough for an IPv6 address. */
+
+/* A binary address, zero padded past its family's length. */
+typedef struct HOSTS_ADDR {
+    u_int32_t family;
+    unsigned char addr[HOSTS_ADDR_MAX];
+} HOSTS_ADDR;
+
+/*
+ * Every address of a host is kept in the one record under its canonical
+ * name, so entries repeating a name for another address are merged.
+ */
+typedef struct HOSTS_REC {
+    REC base;
+    char *name;
+    u_int32_t naddrs;
+    HOSTS_ADDR *addrs;
+    u_int32_t count;
+    char **aliases;
+} HOSTS_REC;
+
+typedef struct HOSTS_KEY {
+    KEY base;
+    union {
+        char *pri;
+        HOSTS_ADDR sec;
+        char *aux;    /* Alias. */
+    } data;
+} HOSTS_KEY;
+
+/**
+ *
+ */
+extern void service_hosts_init(SERVICE *service);
+
+/**
+ * Return the length of an address of the given family, or 0 if the family
+ * is not supported.
+ */
+extern size_t hosts_addr_len(int family);
+
+#endif
@@ -0,0 +1,923 @@
+/**
+ * @file service-netgroup.c
+ * @brief Implements netgroup service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "service-netgroup.h"
+#include "utils.h"
+
+#define SEPARATORS " \t"
+#define NFIELDS 3   /* Host, user and domain. */
+
+/*
+ * Growable lists of heap copies, holding netgroups while the records they
+ * were read from are overwritten by further reads.
+ */
+typedef struct TRIPLES {
+    NETGROUP_TRIPLE *list;
+    u_int32_t n;
+    u_int32_t size;
+} TRIPLES;
+
+typedef struct NAMES {
+    char **list;
+    u_int32_t n;
+    u_int32_t size;
+} NAMES;
+
+static void print(SERVICE *, const KEY *, const REC *);
+static int parse(SERVICE *, const char *, KEY *, REC *);
+static int set(SERVICE *, KEY *, REC *);
+static int delete(SERVICE *, KEY *);
+static KEY *new_key(SERVICE *);
+static REC *new_rec(SERVICE *);
+static void key_init(SERVICE *, KEY *, enum KEY_TYPE, void *);
+static void pack_key(SERVICE *, const KEY *, DBT *);
+static void pack_rec(SERVICE *, const REC *, DBT *);
+static void unpack_key(SERVICE *, KEY *, const DBT *);
+static void unpack_rec(SERVICE *, REC *, const DBT *);
+static int key_creator(DB *, const DBT *, const DBT *, DBT *);
+static int aux_key_creator(DB *, const DBT *, const DBT *, DBT *);
+static size_t rec_size(SERVICE *, const REC *);
+static size_t key_size(SERVICE *, const KEY *);
+static int store(SERVICE *, char *, NETGROUP_TRIPLE *, u_int32_t, char **,
+                 u_int32_t, int);
+static int update_including(SERVICE *, const char *, int);
+static int collect_name(SERVICE *, const REC *, void *);
+static int parse_triple(char *, NETGROUP_TRIPLE *);
+static void print_field(const char *);
+static char *pack_field(char *, const char *, int);
+static char *copy_string(const char *);
+static int compare_field(const char *, const char *);
+static int compare_triple(const void *, const void *);
+static void triples_add(TRIPLES *, const NETGROUP_TRIPLE *);
+static void triples_sort(TRIPLES *);
+static int triples_equal(const TRIPLES *, const NETGROUP_TRIPLE *,
+                         u_int32_t);
+static void triples_free(TRIPLES *);
+static void names_add(NAMES *, const char *);
+static void names_free(NAMES *);
+
+extern void
+service_netgroup_init(SERVICE *service)
+{
+    memset(service, 0, sizeof(*service));
+    service->type = TYPE_NETGROUP;
+    service->pri = NETGROUP_PRI;
+    service->sec = NETGROUP_SEC;
+    service->aux = NETGROUP_AUX;
+
+    /* Set implemented functions. */
+    service->print = print;
+    service->parse = parse;
+    service->set = set;
+    service->delete = delete;
+    service->key_creator = key_creator;
+    service->aux_key_creator = aux_key_creator;
+    service->pack_key = pack_key;
+    service->unpack_key = unpack_key;
+    service->pack_rec = pack_rec;
+    service->unpack_rec = unpack_rec;
+    service->rec_size = rec_size;
+    service->key_size = key_size;
+    service->new_key = new_key;
+    service->new_rec = new_rec;
+    service->key_init = key_init;
+    service->cleanup = NULL;
+
+    /* Set inherited functions. */
+    service->validate = service_validate;
+    service->get = service_get_rec;
+    service->get_dups = service_get_dups;
+    service->get_prefix = service_get_prefix;
+    service->next = service_next_rec;
+    service->truncate = service_truncate;
+    service->start_txn = service_start_txn;
+    service->commit = service_commit_txn;
+    service->rollback = service_rollback_txn;
+}
+
+/*
+ * Print a line per member, in the netgroup file format parse accepts.
+ */
+static void
+print(SERVICE *service, const KEY *key, const REC *rec)
+{
+    const NETGROUP_REC *nrec = (const NETGROUP_REC *) rec;
+    int i;
+
+    if(nrec->nown == 0 && nrec->ngroups == 0)
+        printf("%s\n", nrec->name);
+
+    for(i = 0; i < nrec->nown; i++) {
+        printf("%s\t(", nrec->name);
+        print_field(nrec->own[i].host);
+        printf(",");
+        print_field(nrec->own[i].user);
+        printf(",");
+        print_field(nrec->own[i].domain);
+        printf(")\n");
+    }
+
+    for(i = 0; i < nrec->ngroups && nrec->groups[i] != NULL; i++)
+        printf("%s\t%s\n", nrec->name, nrec->groups[i]);
+}
+
+static int
+parse(SERVICE *service, const char *raw, KEY *key, REC *rec)
+{
+    NETGROUP_KEY *nkey = (NETGROUP_KEY *) key;
+    NETGROUP_REC *nrec = (NETGROUP_REC *) rec;
+    static char buf[SERVICE_REC_MAX];
+    static NETGROUP_TRIPLE own[SERVICE_REC_MAX / 4];
+    static char *groups[SERVICE_REC_MAX / 2];
+    char *p_buf, *end, *comment;
+
+    memset(nkey, 0, sizeof(*nkey));
+    memset(nrec, 0, sizeof(*nrec));
+    nkey->base.type = PRI;
+    nrec->base.type = TYPE_NETGROUP;
+
+    if(strlen(raw) >= sizeof(buf)) {
+        warnx("parse: record too large");
+        return 0;
+    }
+    strcpy(buf, raw);
+    if((comment = strchr(buf, '#')) != NULL)
+        *comment = '\0';
+
+    /* The netgroup's name comes first, followed by its members. */
+    p_buf = buf + strspn(buf, SEPARATORS);
+    if(*p_buf == '\0' || *p_buf == '(')
+        return 0;
+
+    nkey->data.pri = nrec->name = p_buf;
+    p_buf += strcspn(p_buf, SEPARATORS);
+    nrec->own = own;
+    nrec->groups = groups;
+
+    while(*p_buf != '\0') {
+        if(strchr(SEPARATORS, *p_buf) != NULL) {
+            *p_buf++ = '\0';
+        }
+        else if(*p_buf == '(') {
+            /* A triple, which may have white space within it. */
+            if((end = strchr(p_buf, ')')) == NULL
+               || parse_triple(p_buf + 1, &own[nrec->nown]) != 0)
+            {
+                warnx("parse: invalid triple in netgroup %s", nrec->name);
+                return 0;
+            }
+            *end = '\0';
+            nrec->nown++;
+            p_buf = end + 1;
+        }
+        else {
+            /* The name of an included netgroup. */
+            groups[nrec->ngroups++] = p_buf;
+            p_buf += strcspn(p_buf, SEPARATORS);
+        }
+    }
+    groups[nrec->ngroups] = NULL;
+
+    return 1;
+}
+
+/*
+ * Store a netgroup, merging its members with those already stored under
+ * the same name, so that a large netgroup may be given over many lines.
+ */
+static int
+set(SERVICE *service, KEY *key, REC *rec)
+{
+    NETGROUP_REC *nrec = (NETGROUP_REC *) rec, old;
+    TRIPLES own;
+    NAMES groups;
+    int ret, i;
+
+    memset(&own, 0, sizeof(own));
+    memset(&groups, 0, sizeof(groups));
+
+    if(service_get_rec(service, key, (REC *) &old) == 0) {
+        for(i = 0; i < old.nown; i++)
+            triples_add(&own, &old.own[i]);
+        for(i = 0; i < old.ngroups && old.groups[i] != NULL; i++)
+            names_add(&groups, old.groups[i]);
+    }
+
+    for(i = 0; i < nrec->nown; i++)
+        triples_add(&own, &nrec->own[i]);
+    for(i = 0; i < nrec->ngroups && nrec->groups[i] != NULL; i++)
+        names_add(&groups, nrec->groups[i]);
+    triples_sort(&own);
+
+    ret = store(service, nrec->name, own.list, own.n, groups.list, groups.n,
+                0);
+
+    triples_free(&own);
+    names_free(&groups);
+    return ret;
+}
+
+/*
+ * Delete a netgroup, then drop its triples from the netgroups including
+ * it. They keep listing it by name, so it may be stored again later.
+ */
+static int
+delete(SERVICE *service, KEY *key)
+{
+    NETGROUP_KEY *nkey = (NETGROUP_KEY *) key;
+    char *name = copy_string(nkey->data.pri);
+    int ret;
+
+    if((ret = service_delete_rec(service, key)) == 0)
+        ret = update_including(service, name, 0);
+
+    free(name);
+    return ret;
+}
+
+static KEY
+*new_key(SERVICE *service)
+{
+    return xmalloc(sizeof(NETGROUP_KEY));
+}
+
+static REC
+*new_rec(SERVICE *service)
+{
+    return xmalloc(sizeof(NETGROUP_REC));
+}
+
+static void
+key_init(SERVICE *service, KEY *key, enum KEY_TYPE type, void *data)
+{
+    NETGROUP_KEY *nkey = (NETGROUP_KEY *) key;
+    nkey->base.type = type;
+    nkey->data.pri = (char *) data;
+}
+
+static int
+key_creator(DB *dbp, const DBT *nkey, const DBT *ndata, DBT *skey)
+{
+    NETGROUP_KEY key;
+    NETGROUP_REC rec;
+    DBT copy;
+    DBT *keys;
+    int i, size;
+
+    /* Index the netgroup under each triple of its expansion. */
+    service_copy_rec(ndata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
+    if(rec.ntriples == 0) {
+        free(copy.data);
+        return DB_DONOTINDEX;
+    }
+
+    keys = xcalloc(rec.ntriples, sizeof(DBT));
+    key.base.type = SEC;
+    key.data.sec.name = rec.name;
+    for(i = 0; i < rec.ntriples; i++) {
+        key.data.sec.triple = rec.triples[i];
+        size = key_size(NULL, (KEY *) &key);
+
+        keys[i].data = xcalloc(1, size);
+        keys[i].size = size;
+        keys[i].flags = DB_DBT_APPMALLOC;
+        pack_key(NULL, (KEY *) &key, &keys[i]);
+    }
+
+    memset(skey, 0, sizeof(*skey));
+    skey->data = keys;
+    skey->size = rec.ntriples;
+    skey->flags = DB_DBT_MULTIPLE | DB_DBT_APPMALLOC;
+
+    free(copy.data);
+    return 0;
+}
+
+static int
+aux_key_creator(DB *dbp, const DBT *nkey, const DBT *ndata, DBT *skey)
+{
+    NETGROUP_KEY key;
+    NETGROUP_REC rec;
+    DBT copy;
+    DBT *keys;
+    int i, size;
+
+    /* Index the netgroup under each netgroup it includes. */
+    service_copy_rec(ndata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
+    if(rec.ngroups == 0) {
+        free(copy.data);
+        return DB_DONOTINDEX;
+    }
+
+    keys = xcalloc(rec.ngroups, sizeof(DBT));
+    key.base.type = AUX;
+    for(i = 0; i < rec.ngroups; i++) {
+        key.data.aux = rec.groups[i];
+        size = key_size(NULL, (KEY *) &key);
+
+        keys[i].data = xcalloc(1, size);
+        keys[i].size = size;
+        keys[i].flags = DB_DBT_APPMALLOC;
+        pack_key(NULL, (KEY *) &key, &keys[i]);
+    }
+
+    memset(skey, 0, sizeof(*skey));
+    skey->data = keys;
+    skey->size = rec.ngroups;
+    skey->flags = DB_DBT_MULTIPLE | DB_DBT_APPMALLOC;
+
+    free(copy.data);
+    return 0;
+}
+
+static size_t
+rec_size(SERVICE *service, const REC *rec)
+{
+    NETGROUP_REC *nrec = (NETGROUP_REC *) rec;
+    const NETGROUP_TRIPLE *triple;
+    size_t size;
+    int i;
+
+    size = sizeof(nrec->nown)
+        + sizeof(nrec->ngroups)
+        + sizeof(nrec->ntriples)
+        + sizeof(u_int32_t)
+        + ((nrec->nown + nrec->ntriples) * sizeof(NETGROUP_TRIPLE))
+        + ((nrec->ngroups + 1) * sizeof(char *))
+        + ((nrec->nown + nrec->ntriples) * NFIELDS * sizeof(u_int32_t))
+        + (nrec->ngroups * sizeof(u_int32_t))
+        + strlen(nrec->name) + 1;
+
+    for(i = 0; i < nrec->ngroups; i++)
+        size += strlen(nrec->groups[i]) + 1;
+
+    for(i = 0; i < nrec->nown + nrec->ntriples; i++) {
+        triple = (i < nrec->nown
+                  ? &nrec->own[i]
+                  : &nrec->triples[i - nrec->nown]);
+        size += (triple->host != NULL ? strlen(triple->host) + 1 : 0)
+            + (triple->user != NULL ? strlen(triple->user) + 1 : 0)
+            + (triple->domain != NULL ? strlen(triple->domain) + 1 : 0);
+    }
+
+    return size;
+}
+
+/*
+ * Secondary keys hold a field per part of the triple, with a wildcard as
+ * an empty field.
+ */
+static size_t
+key_size(SERVICE *service, const KEY *key)
+{
+    NETGROUP_KEY *nkey = (NETGROUP_KEY *) key;
+    const NETGROUP_TRIPLE *triple = &nkey->data.sec.triple;
+
+    if(nkey->base.type != SEC)
+        return sizeof(nkey->base.type) + strlen(nkey->data.pri) + 1;
+
+    return sizeof(nkey->base.type)
+        + strlen(nkey->data.sec.name) + 1
+        + (triple->host != NULL ? strlen(triple->host) : 0) + 1
+        + (triple->user != NULL ? strlen(triple->user) : 0) + 1
+        + (triple->domain != NULL ? strlen(triple->domain) : 0) + 1;
+}
+
+static void
+pack_key(SERVICE *service, const KEY *key, DBT *dbkey)
+{
+    NETGROUP_KEY *nkey = (NETGROUP_KEY *) key;
+    const NETGROUP_TRIPLE *triple = &nkey->data.sec.triple;
+    char *buf = dbkey->data;
+
+    buf += sizeof(nkey->base.type);
+
+    switch(nkey->base.type) {
+    case PRI:
+        strcpy(buf, nkey->data.pri);
+        break;
+
+    case SEC:
+        buf = pack_field(buf, nkey->data.sec.name, 0);
+        buf = pack_field(buf, triple->host, 1);
+        buf = pack_field(buf, triple->user, 0);
+        pack_field(buf, triple->domain, 1);
+        break;
+
+    case AUX:
+        strcpy(buf, nkey->data.aux);
+        break;
+    }
+}
+
+static void
+pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
+{
+    NETGROUP_REC *nrec = (NETGROUP_REC *) rec;
+    const NETGROUP_TRIPLE *triple;
+    const char *fields[NFIELDS];
+    char *buf = NULL, *s, *block;
+    u_int32_t block_len, offset;
+    int i, j, end, len, slen = 0;
+
+    buf = dbrec->data;
+    len = dbrec->size;
+
+    s = buf;
+    memcpy(s, &nrec->nown, (slen = sizeof(nrec->nown)));
+    s += slen;
+
+    memcpy(s, &nrec->ngroups, (slen = sizeof(nrec->ngroups)));
+    s += slen;
+
+    memcpy(s, &nrec->ntriples, (slen = sizeof(nrec->ntriples)));
+    s += slen;
+
+    /*
+     * The block_len follows, then space reserved for the triples and the
+     * netgroup pointers set by unpack_rec, then the string offsets.
+     */
+    block = s + sizeof(block_len)
+        + ((nrec->nown + nrec->ntriples) * sizeof(NETGROUP_TRIPLE))
+        + ((nrec->ngroups + 1) * sizeof(char *))
+        + ((nrec->nown + nrec->ntriples) * NFIELDS * sizeof(offset))
+        + (nrec->ngroups * sizeof(offset));
+
+    memcpy(block, nrec->name, (block_len = strlen(nrec->name) + 1));
+
+    s += sizeof(block_len)
+        + ((nrec->nown + nrec->ntriples) * sizeof(NETGROUP_TRIPLE))
+        + ((nrec->ngroups + 1) * sizeof(char *));
+
+    /* A wildcard is stored as an out of range offset. */
+    for(i = 0; i < nrec->nown + nrec->ntriples; i++) {
+        triple = (i < nrec->nown
+                  ? &nrec->own[i]
+                  : &nrec->triples[i - nrec->nown]);
+        fields[0] = triple->host;
+        fields[1] = triple->user;
+        fields[2] = triple->domain;
+
+        for(j = 0; j < NFIELDS; j++) {
+            offset = (fields[j] == NULL ? (u_int32_t) -1 : block_len);
+            memcpy(s, &offset, sizeof(offset));
+            s += sizeof(offset);
+
+            if(fields[j] != NULL) {
+                memcpy(block + block_len, fields[j],
+                       (slen = strlen(fields[j]) + 1));
+                block_len += slen;
+            }
+        }
+    }
+
+    for(i = 0, end = (nrec->groups == NULL); i < nrec->ngroups; i++) {
+        end = end || nrec->groups[i] == NULL;
+        offset = (end ? (u_int32_t) -1 : block_len);
+        memcpy(s, &offset, sizeof(offset));
+        s += sizeof(offset);
+
+        if(!end) {
+            memcpy(block + block_len, nrec->groups[i],
+                   (slen = strlen(nrec->groups[i]) + 1));
+            block_len += slen;
+        }
+    }
+
+    memcpy(buf + sizeof(nrec->nown) + sizeof(nrec->ngroups)
+           + sizeof(nrec->ntriples), &block_len, sizeof(block_len));
+
+    memset(dbrec, 0, sizeof(*dbrec));
+    dbrec->data = buf;
+    dbrec->size = len;
+}
+
+static void
+unpack_key(SERVICE *service, KEY *key, const DBT *dbkey)
+{
+    NETGROUP_KEY *nkey = (NETGROUP_KEY *) key;
+    char *buf = (char *) dbkey->data;
+
+    memset(nkey, 0, sizeof(*nkey));
+    nkey->base.type = *((enum KEY_TYPE *) buf);
+    buf += sizeof(nkey->base.type);
+
+    switch(nkey->base.type) {
+    case PRI:
+        nkey->data.pri = buf;
+        break;
+
+    case SEC:
+        nkey->data.sec.name = buf;
+        buf += strlen(buf) + 1;
+        nkey->data.sec.triple.host = (*buf != '\0' ? buf : NULL);
+        buf += strlen(buf) + 1;
+        nkey->data.sec.triple.user = (*buf != '\0' ? buf : NULL);
+        buf += strlen(buf) + 1;
+        nkey->data.sec.triple.domain = (*buf != '\0' ? buf : NULL);
+        break;
+
+    case AUX:
+        nkey->data.aux = buf;
+        break;
+    }
+}
+
+static void
+unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
+{
+    NETGROUP_REC *nrec = (NETGROUP_REC *) rec;
+    NETGROUP_TRIPLE *triples;
+    char *buf = (char *) dbrec->data, *offsets, **fields[NFIELDS];
+    u_int32_t block_len, offset;
+    int i, j;
+
+    memset(nrec, 0, sizeof(*nrec));
+    nrec->base.type = TYPE_NETGROUP;
+
+    memcpy(&nrec->nown, buf, sizeof(nrec->nown));
+    buf += sizeof(nrec->nown);
+
+    memcpy(&nrec->ngroups, buf, sizeof(nrec->ngroups));
+    buf += sizeof(nrec->ngroups);
+
+    memcpy(&nrec->ntriples, buf, sizeof(nrec->ntriples));
+    buf += sizeof(nrec->ntriples);
+
+    memcpy(&block_len, buf, sizeof(block_len));
+    buf += sizeof(block_len);
+
+    triples = (NETGROUP_TRIPLE *) buf;
+    nrec->own = triples;
+    nrec->triples = triples + nrec->nown;
+    buf += (nrec->nown + nrec->ntriples) * sizeof(NETGROUP_TRIPLE);
+
+    nrec->groups = (char **) buf;
+    buf += (nrec->ngroups + 1) * sizeof(char *);
+
+    offsets = buf;
+    buf += ((nrec->nown + nrec->ntriples) * NFIELDS + nrec->ngroups)
+        * sizeof(offset);
+
+    nrec->base.block = buf;
+    nrec->base.block_len = block_len;
+    nrec->name = buf;
+
+    for(i = 0; i < nrec->nown + nrec->ntriples; i++) {
+        fields[0] = &triples[i].host;
+        fields[1] = &triples[i].user;
+        fields[2] = &triples[i].domain;
+
+        for(j = 0; j < NFIELDS; j++) {
+            memcpy(&offset, offsets, sizeof(offset));
+            offsets += sizeof(offset);
+            *fields[j] = (offset < block_len ? buf + offset : NULL);
+        }
+    }
+
+    for(i = 0; i < nrec->ngroups; i++) {
+        memcpy(&offset, offsets + (i * sizeof(offset)), sizeof(offset));
+        if(offset >= block_len)
+            break;
+        nrec->groups[i] = buf + offset;
+    }
+
+    nrec->ngroups = i;
+    nrec->groups[i] = NULL;
+}
+
+/*
+ * Store a netgroup listing the given triples and netgroups, along with
+ * its expansion. The netgroups it includes are expanded already, so only
+ * their own records are read. The expansions of the netgroups including
+ * this one are then brought up to date in turn.
+ */
+static int
+store(SERVICE *service, char *name, NETGROUP_TRIPLE *own, u_int32_t nown,
+      char **groups, u_int32_t ngroups, int depth)
+{
+    NETGROUP_KEY key;
+    NETGROUP_REC rec, sub;
+    TRIPLES all;
+    int ret, i, j;
+
+    memset(&all, 0, sizeof(all));
+    for(i = 0; i < nown; i++)
+        triples_add(&all, &own[i]);
+
+    key.base.type = PRI;
+    for(i = 0; i < ngroups; i++) {
+        key.data.pri = groups[i];
+        if(strcmp(groups[i], name) != 0
+           && service_get_rec(service, (KEY *) &key, (REC *) &sub) == 0)
+        {
+            for(j = 0; j < sub.ntriples; j++)
+                triples_add(&all, &sub.triples[j]);
+        }
+    }
+    triples_sort(&all);
+
+    /*
+     * An expansion left unchanged by an included netgroup need go no
+     * further, which also ends the updates around a cycle.
+     */
+    key.data.pri = name;
+    if(depth > 0
+       && service_get_rec(service, (KEY *) &key, (REC *) &sub) == 0
+       && triples_equal(&all, sub.triples, sub.ntriples))
+    {
+        ret = 0;
+        goto cleanup;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    rec.base.type = TYPE_NETGROUP;
+    rec.name = name;
+    rec.nown = nown;
+    rec.own = own;
+    rec.ngroups = ngroups;
+    rec.groups = groups;
+    rec.ntriples = all.n;
+    rec.triples = all.list;
+
+    if((ret = service_set_rec(service, (KEY *) &key, (REC *) &rec)) == 0)
+        ret = update_including(service, name, depth);
+
+cleanup:
+    triples_free(&all);
+    return ret;
+}
+
+static int
+update_including(SERVICE *service, const char *name, int depth)
+{
+    NETGROUP_KEY key;
+    NETGROUP_REC rec;
+    NAMES including, groups;
+    TRIPLES own;
+    int ret, i, j;
+
+    if(depth >= NETGROUP_DEPTH_MAX) {
+        warnx("netgroup %s nested too deeply", name);
+        return -1;
+    }
+
+    memset(&including, 0, sizeof(including));
+    key.base.type = AUX;
+    key.data.aux = (char *) name;
+    ret = service_get_dups(service, (KEY *) &key, (REC *) &rec,
+                           collect_name, &including);
+    if(ret != 0 && ret != DB_NOTFOUND)
+        goto cleanup;
+
+    key.base.type = PRI;
+    for(i = 0, ret = 0; i < including.n && ret == 0; i++) {
+        key.data.pri = including.list[i];
+        if(service_get_rec(service, (KEY *) &key, (REC *) &rec) != 0)
+            continue;
+
+        memset(&own, 0, sizeof(own));
+        memset(&groups, 0, sizeof(groups));
+        for(j = 0; j < rec.nown; j++)
+            triples_add(&own, &rec.own[j]);
+        for(j = 0; j < rec.ngroups; j++)
+            names_add(&groups, rec.groups[j]);
+
+        ret = store(service, including.list[i], own.list, own.n,
+                    groups.list, groups.n, depth + 1);
+
+        triples_free(&own);
+        names_free(&groups);
+    }
+
+cleanup:
+    names_free(&including);
+    return ret;
+}
+
+static int
+collect_name(SERVICE *service, const REC *rec, void *data)
+{
+    names_add((NAMES *) data, ((const NETGROUP_REC *) rec)->name);
+    return 0;
+}
+
+/*
+ * Split the fields of a triple in place, ending at the closing
+ * parenthesis. Surrounding white space is dropped, and an empty field is
+ * a wildcard. Hosts and domains are matched regardless of case, so are
+ * stored in lower case.
+ */
+static int
+parse_triple(char *raw, NETGROUP_TRIPLE *triple)
+{
+    char *fields[NFIELDS], *end;
+    int i;
+
+    for(i = 0; i < NFIELDS; i++) {
+        raw += strspn(raw, SEPARATORS);
+        end = raw + strcspn(raw, (i < NFIELDS - 1 ? ",)" : ")"));
+        if(*end != (i < NFIELDS - 1 ? ',' : ')'))
+            return -1;
+
+        fields[i] = raw;
+        raw = end + 1;
+        while(end > fields[i] && isspace((unsigned char) end[-1]))
+            end--;
+        *end = '\0';
+
+        if(*fields[i] == '\0')
+            fields[i] = NULL;
+        else if(i != 1)
+            pack_field(fields[i], fields[i], 1);
+    }
+
+    triple->host = fields[0];
+    triple->user = fields[1];
+    triple->domain = fields[2];
+
+    return 0;
+}
+
+static void
+print_field(const char *field)
+{
+    if(field != NULL)
+        printf("%s", field);
+}
+
+static char
+*pack_field(char *buf, const char *field, int fold)
+{
+    if(field != NULL) {
+        while(*field != '\0') {
+            *buf++ = (fold ? tolower((unsigned char) *field) : *field);
+            field++;
+        }
+    }
+    *buf++ = '\0';
+
+    return buf;
+}
+
+static char
+*copy_string(const char *s)
+{
+    char *copy;
+
+    if(s == NULL)
+        return NULL;
+
+    copy = xmalloc(strlen(s) + 1);
+    strcpy(copy, s);
+
+    return copy;
+}
+
+/*
+ * Wildcards order before any value.
+ */
+static int
+compare_field(const char *a, const char *b)
+{
+    if(a == NULL || b == NULL)
+        return (a != NULL) - (b != NULL);
+
+    return strcmp(a, b);
+}
+
+static int
+compare_triple(const void *a, const void *b)
+{
+    const NETGROUP_TRIPLE *ta = a, *tb = b;
+    int ret;
+
+    if((ret = compare_field(ta->host, tb->host)) != 0
+       || (ret = compare_field(ta->user, tb->user)) != 0)
+    {
+        return ret;
+    }
+
+    return compare_field(ta->domain, tb->domain);
+}
+
+static void
+triples_add(TRIPLES *triples, const NETGROUP_TRIPLE *triple)
+{
+    NETGROUP_TRIPLE *copy;
+
+    if(triples->n == triples->size) {
+        triples->size = (triples->size > 0 ? triples->size * 2 : 16);
+        triples->list = xrealloc(triples->list,
+                                 triples->size * sizeof(NETGROUP_TRIPLE));
+    }
+
+    copy = &triples->list[triples->n++];
+    copy->host = copy_string(triple->host);
+    copy->user = copy_string(triple->user);
+    copy->domain = copy_string(triple->domain);
+}
+
+/*
+ * Sort the triples, dropping any duplicates.
+ */
+static void
+triples_sort(TRIPLES *triples)
+{
+    NETGROUP_TRIPLE *list = triples->list;
+    u_int32_t i, n = 0;
+
+    if(triples->n == 0)
+        return;
+
+    qsort(list, triples->n, sizeof(NETGROUP_TRIPLE), compare_triple);
+    for(i = 1; i < triples->n; i++) {
+        if(compare_triple(&list[n], &list[i]) == 0) {
+            free(list[i].host);
+            free(list[i].user);
+            free(list[i].domain);
+        }
+        else {
+            list[++n] = list[i];
+        }
+    }
+
+    triples->n = n + 1;
+}
+
+static int
+triples_equal(const TRIPLES *triples, const NETGROUP_TRIPLE *list,
+              u_int32_t n)
+{
+    u_int32_t i;
+
+    if(triples->n != n)
+        return 0;
+
+    for(i = 0; i < n; i++) {
+        if(compare_triple(&triples->list[i], &list[i]) != 0)
+            return 0;
+    }
+
+    return 1;
+}
+
+static void
+triples_free(TRIPLES *triples)
+{
+    u_int32_t i;
+
+    for(i = 0; i < triples->n; i++) {
+        free(triples->list[i].host);
+        free(triples->list[i].user);
+        free(triples->list[i].domain);
+    }
+
+    free(triples->list);
+    memset(triples, 0, sizeof(*triples));
+}
+
+/*
+ * Add a copy of a name unless already listed. The list is kept NULL
+ * terminated.
+ */
+static void
+names_add(NAMES *names, const char *name)
+{
+    u_int32_t i;
+
+    for(i = 0; i < names->n; i++) {
+        if(!strcmp(names->list[i], name))
+            return;
+    }
+
+    if(names->n + 1 >= names->size) {
+        names->size = (names->size > 0 ? names->size * 2 : 16);
+        names->list = xrealloc(names->list, names->size * sizeof(char *));
+    }
+
+    names->list[names->n++] = copy_string(name);
+    names->list[names->n] = NULL;
+}
+
+static void
+names_free(NAMES *names)
+{
+    u_int32_t i;
+
+    for(i = 0; i < names->n; i++)
+        free(names->list[i]);
+
+    free(names->list);
+    memset(names, 0, sizeof(*names));
+}
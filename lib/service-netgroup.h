@@ -0,0 +1,69 @@
+/**
+ * @file service-netgroup.h
+ * @brief Defines netgroup service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef SERVICE_NETGROUP_H
+#define SERVICE_NETGROUP_H
+
+#include "service.h"
+
+#define NETGROUP_PRI "netgroup.db"
+#define NETGROUP_SEC "netgroup-triple.db"
+#define NETGROUP_AUX "netgroup-member.db"
+
+/* The deepest chain of nested netgroups updated when one changes. */
+#define NETGROUP_DEPTH_MAX 64
+
+/*
+ * A NULL field is a wildcard, matching any value, as an empty field in
+ * the netgroup file.
+ */
+typedef struct NETGROUP_TRIPLE {
+    char *host;
+    char *user;
+    char *domain;
+} NETGROUP_TRIPLE;
+
+/*
+ * Besides the triples and netgroups a netgroup lists itself, each record
+ * holds every triple it contains once the netgroups it includes have been
+ * expanded. The expansion is kept up to date as netgroups are stored, so
+ * that lookups never recurse.
+ */
+typedef struct NETGROUP_REC {
+    REC base;
+    char *name;
+    u_int32_t nown;
+    NETGROUP_TRIPLE *own;
+    u_int32_t ngroups;
+    char **groups;
+    u_int32_t ntriples;     /* Sorted, without duplicates. */
+    NETGROUP_TRIPLE *triples;
+} NETGROUP_REC;
+
+/*
+ * The secondary index holds a key per netgroup and expanded triple, so
+ * that membership of a fully qualified triple is a single lookup. Hosts
+ * and domains are matched regardless of case.
+ */
+typedef struct NETGROUP_KEY {
+    KEY base;
+    union {
+        char *pri;
+        struct {
+            char *name;
+            NETGROUP_TRIPLE triple;
+        } sec;
+        char *aux;      /* An included netgroup. */
+    } data;
+} NETGROUP_KEY;
+
+/**
+ *
+ */
+extern void service_netgroup_init(SERVICE *service);
+
+#endif
@@ -0,0 +1,416 @@
+/**
+ * @file service-numbered.c
+ * @brief Implements the protocols and rpc service abstraction interfaces.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "service-numbered.h"
+#include "utils.h"
+
+#define SEPARATORS " \t"
+
+static void init(SERVICE *);
+static void print(SERVICE *, const KEY *, const REC *);
+static int parse(SERVICE *, const char *, KEY *, REC *);
+static KEY *new_key(SERVICE *);
+static REC *new_rec(SERVICE *);
+static void key_init(SERVICE *, KEY *, enum KEY_TYPE, void *);
+static void pack_key(SERVICE *, const KEY *, DBT *);
+static void pack_rec(SERVICE *, const REC *, DBT *);
+static void unpack_key(SERVICE *, KEY *, const DBT *);
+static void unpack_rec(SERVICE *, REC *, const DBT *);
+static int key_creator(DB *, const DBT *, const DBT *, DBT *);
+static int aux_key_creator(DB *, const DBT *, const DBT *, DBT *);
+static size_t rec_size(SERVICE *, const REC *);
+static size_t key_size(SERVICE *, const KEY *);
+
+extern void
+service_protocols_init(SERVICE *service)
+{
+    init(service);
+    service->type = TYPE_PROTOCOLS;
+    service->pri = PROTOCOLS_PRI;
+    service->sec = PROTOCOLS_SEC;
+    service->aux = PROTOCOLS_AUX;
+}
+
+extern void
+service_rpc_init(SERVICE *service)
+{
+    init(service);
+    service->type = TYPE_RPC;
+    service->pri = RPC_PRI;
+    service->sec = RPC_SEC;
+    service->aux = RPC_AUX;
+}
+
+static void
+init(SERVICE *service)
+{
+    memset(service, 0, sizeof(*service));
+
+    /* Set implemented functions. */
+    service->print = print;
+    service->parse = parse;
+    service->key_creator = key_creator;
+    service->aux_key_creator = aux_key_creator;
+    service->pack_key = pack_key;
+    service->unpack_key = unpack_key;
+    service->pack_rec = pack_rec;
+    service->unpack_rec = unpack_rec;
+    service->rec_size = rec_size;
+    service->key_size = key_size;
+    service->new_key = new_key;
+    service->new_rec = new_rec;
+    service->key_init = key_init;
+    service->cleanup = NULL;
+
+    /* Set inherited functions. */
+    service->validate = service_validate;
+    service->get = service_get_rec;
+    service->get_dups = service_get_dups;
+    service->get_prefix = service_get_prefix;
+    service->set = service_set_rec;
+    service->next = service_next_rec;
+    service->delete = service_delete_rec;
+    service->truncate = service_truncate;
+    service->start_txn = service_start_txn;
+    service->commit = service_commit_txn;
+    service->rollback = service_rollback_txn;
+}
+
+static void
+print(SERVICE *service, const KEY *key, const REC *rec)
+{
+    const NUMBERED_REC *nrec = (const NUMBERED_REC *) rec;
+    int i;
+
+    printf("%s\t%lu", nrec->name, (unsigned long) nrec->number);
+    for(i = 0; i < nrec->count && nrec->aliases[i] != NULL; i++)
+        printf(" %s", nrec->aliases[i]);
+    printf("\n");
+}
+
+/*
+ * Both the protocols and rpc files give the name, then the number, then
+ * any aliases.
+ */
+static int
+parse(SERVICE *service, const char *raw, KEY *key, REC *rec)
+{
+    NUMBERED_KEY *nkey = (NUMBERED_KEY *) key;
+    NUMBERED_REC *nrec = (NUMBERED_REC *) rec;
+    static char buf[SERVICE_REC_MAX];
+    static char *aliases[SERVICE_REC_MAX / 2];
+    char *tok, *comment, *last, *end;
+    unsigned long number;
+
+    memset(nkey, 0, sizeof(*nkey));
+    memset(nrec, 0, sizeof(*nrec));
+    nkey->base.type = PRI;
+    nrec->base.type = service->type;
+
+    if(strlen(raw) >= sizeof(buf)) {
+        warnx("parse: record too large");
+        return 0;
+    }
+    strcpy(buf, raw);
+    if((comment = strchr(buf, '#')) != NULL)
+        *comment = '\0';
+
+    if((nrec->name = strtok_r(buf, SEPARATORS, &last)) == NULL
+       || (tok = strtok_r(NULL, SEPARATORS, &last)) == NULL)
+    {
+        return 0;
+    }
+
+    number = strtoul(tok, &end, 10);
+    if(!isdigit((unsigned char) *tok) || *end != '\0'
+       || number > (u_int32_t) -1)
+    {
+        warnx("parse: invalid number %s", tok);
+        return 0;
+    }
+
+    nrec->number = number;
+    nrec->aliases = aliases;
+    while((tok = strtok_r(NULL, SEPARATORS, &last)) != NULL)
+        aliases[nrec->count++] = tok;
+    aliases[nrec->count] = NULL;
+
+    nkey->data.pri = nrec->name;
+
+    return 1;
+}
+
+static KEY
+*new_key(SERVICE *service)
+{
+    return xmalloc(sizeof(NUMBERED_KEY));
+}
+
+static REC
+*new_rec(SERVICE *service)
+{
+    return xmalloc(sizeof(NUMBERED_REC));
+}
+
+static void
+key_init(SERVICE *service, KEY *key, enum KEY_TYPE type, void *data)
+{
+    NUMBERED_KEY *nkey = (NUMBERED_KEY *) key;
+    nkey->base.type = type;
+    nkey->data.pri = (char *) data;
+}
+
+static int
+key_creator(DB *dbp, const DBT *pkey, const DBT *pdata, DBT *skey)
+{
+    NUMBERED_KEY key;
+    NUMBERED_REC rec;
+    DBT copy;
+
+    /* Create the secondary index on the number. */
+    service_copy_rec(pdata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
+    memset(&key, 0, sizeof(key));
+    key.base.type = SEC;
+    key.data.sec = rec.number;
+    int size = key_size(NULL, (KEY *) &key);
+
+    memset(skey, 0, sizeof(*skey));
+    skey->data = xcalloc(1, size);
+    skey->size = size;
+    skey->flags = DB_DBT_APPMALLOC;
+    pack_key(NULL, (KEY *) &key, skey);
+
+    free(copy.data);
+    return 0;
+}
+
+static int
+aux_key_creator(DB *dbp, const DBT *pkey, const DBT *pdata, DBT *skey)
+{
+    NUMBERED_KEY key;
+    NUMBERED_REC rec;
+    DBT copy;
+    DBT *keys;
+    int i, size;
+
+    /* Index the entry under each of its aliases. */
+    service_copy_rec(pdata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
+    if(rec.count == 0) {
+        free(copy.data);
+        return DB_DONOTINDEX;
+    }
+
+    keys = xcalloc(rec.count, sizeof(DBT));
+    key.base.type = AUX;
+    for(i = 0; i < rec.count; i++) {
+        key.data.aux = rec.aliases[i];
+        size = key_size(NULL, (KEY *) &key);
+
+        keys[i].data = xcalloc(1, size);
+        keys[i].size = size;
+        keys[i].flags = DB_DBT_APPMALLOC;
+        pack_key(NULL, (KEY *) &key, &keys[i]);
+    }
+
+    memset(skey, 0, sizeof(*skey));
+    skey->data = keys;
+    skey->size = rec.count;
+    skey->flags = DB_DBT_MULTIPLE | DB_DBT_APPMALLOC;
+
+    free(copy.data);
+    return 0;
+}
+
+static size_t
+rec_size(SERVICE *service, const REC *rec)
+{
+    NUMBERED_REC *nrec = (NUMBERED_REC *) rec;
+    size_t size;
+    char **alias;
+
+    size = sizeof(nrec->number)
+        + sizeof(nrec->count)
+        + (2 * sizeof(u_int32_t))
+        + ((nrec->count + 1) * sizeof(char *))
+        + (nrec->count * sizeof(u_int32_t))
+        + strlen(nrec->name) + 1;
+
+    for(alias = nrec->aliases;
+        alias != NULL && *alias != NULL;
+        alias++)
+    {
+        size += strlen(*alias) + 1;
+    }
+
+    return size;
+}
+
+static size_t
+key_size(SERVICE *service, const KEY *key)
+{
+    NUMBERED_KEY *nkey = (NUMBERED_KEY *) key;
+
+    return sizeof(nkey->base.type)
+        + (nkey->base.type == SEC
+           ? sizeof(nkey->data.sec)
+           : (strlen(nkey->data.pri) + 1));
+}
+
+/*
+ * Numbers are packed most significant byte first, so that they sort
+ * numerically.
+ */
+static void
+pack_key(SERVICE *service, const KEY *key, DBT *dbkey)
+{
+    NUMBERED_KEY *nkey = (NUMBERED_KEY *) key;
+    unsigned char *buf = (unsigned char *) dbkey->data
+        + sizeof(nkey->base.type);
+
+    switch(nkey->base.type) {
+    case PRI:
+        strcpy((char *) buf, nkey->data.pri);
+        break;
+
+    case SEC:
+        buf[0] = (nkey->data.sec >> 24) & 0xff;
+        buf[1] = (nkey->data.sec >> 16) & 0xff;
+        buf[2] = (nkey->data.sec >> 8) & 0xff;
+        buf[3] = nkey->data.sec & 0xff;
+        break;
+
+    case AUX:
+        strcpy((char *) buf, nkey->data.aux);
+        break;
+    }
+}
+
+static void
+pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
+{
+    NUMBERED_REC *nrec = (NUMBERED_REC *) rec;
+    char *buf = NULL, *s, *block;
+    u_int32_t block_len, offset;
+    int i, end, len, slen = 0;
+
+    buf = dbrec->data;
+    len = dbrec->size;
+
+    s = buf;
+    memcpy(s, &nrec->number, (slen = sizeof(nrec->number)));
+    s += slen;
+
+    memcpy(s, &nrec->count, (slen = sizeof(nrec->count)));
+    s += slen;
+
+    /*
+     * The block_len follows, padded so the space reserved for the alias
+     * pointers set by unpack_rec is aligned, then the alias offsets.
+     */
+    memset(s, 0, 2 * sizeof(block_len));
+    block = s + (2 * sizeof(block_len))
+        + ((nrec->count + 1) * sizeof(char *))
+        + (nrec->count * sizeof(offset));
+
+    memcpy(block, nrec->name, (block_len = strlen(nrec->name) + 1));
+    s += (2 * sizeof(block_len)) + ((nrec->count + 1) * sizeof(char *));
+
+    /* A count past the end of the alias list stores out of range offsets. */
+    for(i = 0, end = (nrec->aliases == NULL); i < nrec->count; i++) {
+        end = end || nrec->aliases[i] == NULL;
+        offset = (end ? (u_int32_t) -1 : block_len);
+        memcpy(s, &offset, sizeof(offset));
+        s += sizeof(offset);
+
+        if(!end) {
+            memcpy(block + block_len, nrec->aliases[i],
+                   (slen = strlen(nrec->aliases[i]) + 1));
+            block_len += slen;
+        }
+    }
+
+    memcpy(buf + sizeof(nrec->number) + sizeof(nrec->count), &block_len,
+           sizeof(block_len));
+
+    memset(dbrec, 0, sizeof(*dbrec));
+    dbrec->data = buf;
+    dbrec->size = len;
+}
+
+static void
+unpack_key(SERVICE *service, KEY *key, const DBT *dbkey)
+{
+    NUMBERED_KEY *nkey = (NUMBERED_KEY *) key;
+    unsigned char *buf = (unsigned char *) dbkey->data;
+
+    memset(nkey, 0, sizeof(*nkey));
+    nkey->base.type = *((enum KEY_TYPE *) buf);
+    buf += sizeof(nkey->base.type);
+
+    switch(nkey->base.type) {
+    case PRI:
+        nkey->data.pri = (char *) buf;
+        break;
+
+    case SEC:
+        nkey->data.sec = ((u_int32_t) buf[0] << 24) | (buf[1] << 16)
+            | (buf[2] << 8) | buf[3];
+        break;
+
+    case AUX:
+        nkey->data.aux = (char *) buf;
+        break;
+    }
+}
+
+static void
+unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
+{
+    NUMBERED_REC *nrec = (NUMBERED_REC *) rec;
+    char *buf = (char *) dbrec->data, *offsets;
+    u_int32_t block_len, offset;
+    int i;
+
+    memset(nrec, 0, sizeof(*nrec));
+    if(service != NULL)
+        nrec->base.type = service->type;
+
+    memcpy(&nrec->number, buf, sizeof(nrec->number));
+    buf += sizeof(nrec->number);
+
+    memcpy(&nrec->count, buf, sizeof(nrec->count));
+    buf += sizeof(nrec->count);
+
+    memcpy(&block_len, buf, sizeof(block_len));
+    buf += 2 * sizeof(block_len);
+
+    nrec->aliases = (char **) buf;
+    buf += (nrec->count + 1) * sizeof(char *);
+
+    offsets = buf;
+    buf += nrec->count * sizeof(offset);
+
+    nrec->base.block = buf;
+    nrec->base.block_len = block_len;
+    nrec->name = buf;
+
+    for(i = 0; i < nrec->count; i++) {
+        memcpy(&offset, offsets + (i * sizeof(offset)), sizeof(offset));
+        if(offset >= block_len)
+            break;
+        nrec->aliases[i] = buf + offset;
+    }
+
+    nrec->aliases[i] = NULL;
+}
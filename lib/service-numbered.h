@@ -0,0 +1,52 @@
+/**
+ * @file service-numbered.h
+ * @brief Defines the protocols and rpc service abstraction interfaces.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef SERVICE_NUMBERED_H
+#define SERVICE_NUMBERED_H
+
+#include "service.h"
+
+#define PROTOCOLS_PRI "protocols.db"
+#define PROTOCOLS_SEC "protocols-number.db"
+#define PROTOCOLS_AUX "protocols-alias.db"
+
+#define RPC_PRI "rpc.db"
+#define RPC_SEC "rpc-number.db"
+#define RPC_AUX "rpc-alias.db"
+
+/*
+ * The protocols and rpc maps both name a number, with any number of
+ * aliases, so share a record layout and implementation.
+ */
+typedef struct NUMBERED_REC {
+    REC base;
+    char *name;
+    u_int32_t number;
+    u_int32_t count;
+    char **aliases;
+} NUMBERED_REC;
+
+typedef struct NUMBERED_KEY {
+    KEY base;
+    union {
+        char *pri;
+        u_int32_t sec;
+        char *aux;      /* Alias. */
+    } data;
+} NUMBERED_KEY;
+
+/**
+ *
+ */
+extern void service_protocols_init(SERVICE *service);
+
+/**
+ *
+ */
+extern void service_rpc_init(SERVICE *service);
+
+#endif
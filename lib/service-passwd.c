@@ -55,6 +55,8 @@ service_passwd_init(SERVICE *service)
 
     /* Set inherited functions. */
     service->get = service_get_rec;
+    service->get_dups = service_get_dups;
+    service->get_prefix = service_get_prefix;
     service->set = service_set_rec;
     service->next = service_next_rec;
     service->delete = service_delete_rec;
@@ -198,9 +200,11 @@ key_creator(DB *dbp, const DBT *pkey, const DBT *pdata, DBT *skey)
 {
     PASSWD_KEY key;
     PASSWD_REC rec;
+    DBT copy;
 
     /* Create the secondary index on the uid. */
-    unpack_rec(NULL, (REC *) &rec, pdata);
+    service_copy_rec(pdata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
     memset(&key, 0, sizeof(key));
     key.base.type = SEC;
     key.data.sec = rec.uid;
@@ -212,6 +216,7 @@ key_creator(DB *dbp, const DBT *pkey, const DBT *pdata, DBT *skey)
     skey->flags = DB_DBT_APPMALLOC;
     pack_key(NULL, (KEY *) &key, skey);
 
+    free(copy.data);
     return 0;
 }
 
@@ -222,6 +227,7 @@ rec_size(SERVICE *service, const REC *rec)
 
     return sizeof(prec->uid)
         + sizeof(prec->gid)
+        + sizeof(u_int32_t) * (PASSWD_NOFFSETS + 1)
         + strlen(prec->name) + 1
         + strlen(prec->passwd) + 1
         + strlen(prec->gecos) + 1
@@ -240,6 +246,10 @@ key_size(SERVICE *service, const KEY *key)
            : sizeof(pkey->data.sec));
 }
 
+/*
+ * Uids are packed most significant byte first, so that they sort
+ * numerically.
+ */
 static void
 pack_key(SERVICE *service, const KEY *key, DBT *dbkey)
 {
@@ -253,8 +263,14 @@ pack_key(SERVICE *service, const KEY *key, DBT *dbkey)
         break;
 
     case SEC:
-        memcpy(buf + sizeof(pkey->base.type), &pkey->data.sec,
-               sizeof(pkey->data.sec));
+        s = buf + sizeof(pkey->base.type);
+        s[0] = (pkey->data.sec >> 24) & 0xff;
+        s[1] = (pkey->data.sec >> 16) & 0xff;
+        s[2] = (pkey->data.sec >> 8) & 0xff;
+        s[3] = pkey->data.sec & 0xff;
+        break;
+
+    default:
         break;
     }
 }
@@ -263,8 +279,12 @@ static void
 pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
 {
     PASSWD_REC *prec = (PASSWD_REC *) rec;
-    char *buf = NULL, *s;
-    int len, slen = 0;
+    const char *strings[] = {
+        prec->name, prec->passwd, prec->gecos, prec->shell, prec->homedir
+    };
+    u_int32_t offsets[PASSWD_NOFFSETS], block_len = 0;
+    char *buf = NULL, *s, *block;
+    int i, len, slen = 0;
 
     buf = dbrec->data;
     len = dbrec->size;
@@ -276,20 +296,21 @@ pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
     memcpy(s, &prec->gid, (slen = sizeof(prec->gid)));
     s += slen;
 
-    memcpy(s, prec->name, (slen = (strlen(prec->name) + 1)));
-    s += slen;
-
-    memcpy(s, prec->passwd, (slen = (strlen(prec->passwd) + 1)));
-    s += slen;
-
-    memcpy(s, prec->gecos, (slen = (strlen(prec->gecos) + 1)));
-    s += slen;
-
-    memcpy(s, prec->shell, (slen = (strlen(prec->shell) + 1)));
-    s += slen;
+    /*
+     * The name always starts the string block, so only the offsets of
+     * the remaining strings are stored.
+     */
+    block = s + sizeof(block_len) + sizeof(offsets);
+    for(i = 0; i <= PASSWD_NOFFSETS; i++) {
+        if(i > 0)
+            offsets[i - 1] = block_len;
+        memcpy(block + block_len, strings[i], (slen = strlen(strings[i]) + 1));
+        block_len += slen;
+    }
 
-    memcpy(s, prec->homedir, (slen = (strlen(prec->homedir) + 1)));
-    s += slen;
+    memcpy(s, &block_len, sizeof(block_len));
+    s += sizeof(block_len);
+    memcpy(s, offsets, sizeof(offsets));
 
     memset(dbrec, 0, sizeof(*dbrec));
     dbrec->data = buf;
@@ -300,7 +321,7 @@ static void
 unpack_key(SERVICE *service, KEY *key, const DBT *dbkey)
 {
     PASSWD_KEY *pkey = (PASSWD_KEY *) key;
-    char *buf = (char *) dbkey->data;
+    unsigned char *buf = (unsigned char *) dbkey->data;
 
     memset(pkey, 0, sizeof(*pkey));
     pkey->base.type = *((enum KEY_TYPE *) buf);
@@ -308,11 +329,15 @@ unpack_key(SERVICE *service, KEY *key, const DBT *dbkey)
 
    switch(pkey->base.type) {
     case PRI:
-        pkey->data.pri = buf;
+        pkey->data.pri = (char *) buf;
         break;
 
     case SEC:
-        memcpy(&pkey->data.sec, buf, sizeof(pkey->data.sec));
+        pkey->data.sec = ((uid_t) buf[0] << 24) | (buf[1] << 16)
+            | (buf[2] << 8) | buf[3];
+        break;
+
+    default:
         break;
     }
 }
@@ -322,6 +347,7 @@ unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
 {
     PASSWD_REC *prec = (PASSWD_REC *) rec;
     char *buf = (char *) dbrec->data;
+    u_int32_t offsets[PASSWD_NOFFSETS], block_len;
 
     memset(prec, 0, sizeof(*prec));
     prec->base.type = TYPE_PASSWD;
@@ -332,20 +358,19 @@ unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
     memcpy(&prec->gid, buf, sizeof(prec->gid));
     buf += sizeof(prec->gid);
 
-    prec->name = buf;
-    buf += strlen(prec->name) + 1;
-
-    prec->passwd = buf;
-    buf += strlen(prec->passwd) + 1;
+    memcpy(&block_len, buf, sizeof(block_len));
+    buf += sizeof(block_len);
 
-    prec->gecos = buf;
-    buf += strlen(prec->gecos) + 1;
+    memcpy(offsets, buf, sizeof(offsets));
+    buf += sizeof(offsets);
 
-    prec->shell = buf;
-    buf += strlen(prec->shell) + 1;
-
-    prec->homedir = buf;
-    buf += strlen(prec->homedir) + 1;
+    prec->base.block = buf;
+    prec->base.block_len = block_len;
+    prec->name = buf;
+    prec->passwd = buf + offsets[0];
+    prec->gecos = buf + offsets[1];
+    prec->shell = buf + offsets[2];
+    prec->homedir = buf + offsets[3];
 }
 
 static int
@@ -10,8 +10,16 @@
 
 #include "service.h"
 
+/*
+ * The uid index is named for its key format, so that an index with keys
+ * in the host byte order, as written before, is never opened. Writers
+ * build the index afresh from the primary.
+ */
 #define PASSWD_PRI "passwd.db"
-#define PASSWD_SEC "passwd-uid.db"
+#define PASSWD_SEC "passwd-uid2.db"
+
+/* Stored string offsets; the name is always at the start of the block. */
+#define PASSWD_NOFFSETS 4
 
 typedef struct PASSWD_REC {
     REC base;
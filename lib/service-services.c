@@ -0,0 +1,430 @@
+/**
+ * @file service-services.c
+ * @brief Implements services service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "service-services.h"
+#include "utils.h"
+
+#define SEPARATORS " \t"
+#define PORT_MAX   65535
+
+static void print(SERVICE *, const KEY *, const REC *);
+static int parse(SERVICE *, const char *, KEY *, REC *);
+static KEY *new_key(SERVICE *);
+static REC *new_rec(SERVICE *);
+static void key_init(SERVICE *, KEY *, enum KEY_TYPE, void *);
+static void pack_key(SERVICE *, const KEY *, DBT *);
+static void pack_rec(SERVICE *, const REC *, DBT *);
+static void unpack_key(SERVICE *, KEY *, const DBT *);
+static void unpack_rec(SERVICE *, REC *, const DBT *);
+static int key_creator(DB *, const DBT *, const DBT *, DBT *);
+static int aux_key_creator(DB *, const DBT *, const DBT *, DBT *);
+static size_t rec_size(SERVICE *, const REC *);
+static size_t key_size(SERVICE *, const KEY *);
+
+extern void
+service_services_init(SERVICE *service)
+{
+    memset(service, 0, sizeof(*service));
+    service->type = TYPE_SERVICES;
+    service->pri = SERVICES_PRI;
+    service->sec = SERVICES_SEC;
+    service->aux = SERVICES_AUX;
+
+    /* Set implemented functions. */
+    service->print = print;
+    service->parse = parse;
+    service->key_creator = key_creator;
+    service->aux_key_creator = aux_key_creator;
+    service->pack_key = pack_key;
+    service->unpack_key = unpack_key;
+    service->pack_rec = pack_rec;
+    service->unpack_rec = unpack_rec;
+    service->rec_size = rec_size;
+    service->key_size = key_size;
+    service->new_key = new_key;
+    service->new_rec = new_rec;
+    service->key_init = key_init;
+    service->cleanup = NULL;
+
+    /* Set inherited functions. */
+    service->validate = service_validate;
+    service->get = service_get_rec;
+    service->get_dups = service_get_dups;
+    service->get_prefix = service_get_prefix;
+    service->set = service_set_rec;
+    service->next = service_next_rec;
+    service->delete = service_delete_rec;
+    service->truncate = service_truncate;
+    service->start_txn = service_start_txn;
+    service->commit = service_commit_txn;
+    service->rollback = service_rollback_txn;
+}
+
+static void
+print(SERVICE *service, const KEY *key, const REC *rec)
+{
+    const SERVICES_REC *srec = (const SERVICES_REC *) rec;
+    int i;
+
+    printf("%s\t%lu/%s", srec->name, (unsigned long) srec->port,
+           srec->proto);
+    for(i = 0; i < srec->count && srec->aliases[i] != NULL; i++)
+        printf(" %s", srec->aliases[i]);
+    printf("\n");
+}
+
+static int
+parse(SERVICE *service, const char *raw, KEY *key, REC *rec)
+{
+    SERVICES_KEY *skey = (SERVICES_KEY *) key;
+    SERVICES_REC *srec = (SERVICES_REC *) rec;
+    static char buf[SERVICE_REC_MAX];
+    static char *aliases[SERVICE_REC_MAX / 2];
+    char *tok, *comment, *last, *proto, *end;
+    unsigned long port;
+
+    memset(skey, 0, sizeof(*skey));
+    memset(srec, 0, sizeof(*srec));
+    skey->base.type = PRI;
+    srec->base.type = TYPE_SERVICES;
+
+    if(strlen(raw) >= sizeof(buf)) {
+        warnx("parse: record too large");
+        return 0;
+    }
+    strcpy(buf, raw);
+    if((comment = strchr(buf, '#')) != NULL)
+        *comment = '\0';
+
+    /* The name comes first, followed by the port and protocol. */
+    if((srec->name = strtok_r(buf, SEPARATORS, &last)) == NULL
+       || (tok = strtok_r(NULL, SEPARATORS, &last)) == NULL
+       || (proto = strchr(tok, '/')) == NULL)
+    {
+        return 0;
+    }
+
+    *proto++ = '\0';
+    port = strtoul(tok, &end, 10);
+    if(*tok == '\0' || *end != '\0' || port > PORT_MAX || *proto == '\0') {
+        warnx("parse: invalid port %s/%s", tok, proto);
+        return 0;
+    }
+
+    srec->port = port;
+    srec->proto = proto;
+    srec->aliases = aliases;
+    while((tok = strtok_r(NULL, SEPARATORS, &last)) != NULL)
+        aliases[srec->count++] = tok;
+    aliases[srec->count] = NULL;
+
+    skey->data.pri.name = srec->name;
+    skey->data.pri.proto = srec->proto;
+
+    return 1;
+}
+
+static KEY
+*new_key(SERVICE *service)
+{
+    return xmalloc(sizeof(SERVICES_KEY));
+}
+
+static REC
+*new_rec(SERVICE *service)
+{
+    return xmalloc(sizeof(SERVICES_REC));
+}
+
+/*
+ * Primary keys are given as name/protocol, as by dbngctl -d.
+ */
+static void
+key_init(SERVICE *service, KEY *key, enum KEY_TYPE type, void *data)
+{
+    SERVICES_KEY *skey = (SERVICES_KEY *) key;
+    static char buf[SERVICE_REC_MAX];
+    char *proto;
+
+    memset(skey, 0, sizeof(*skey));
+    skey->base.type = type;
+    strncpy(buf, (char *) data, sizeof(buf) - 1);
+    if((proto = strrchr(buf, '/')) != NULL)
+        *proto++ = '\0';
+
+    skey->data.pri.name = buf;
+    skey->data.pri.proto = proto;
+}
+
+static int
+key_creator(DB *dbp, const DBT *pkey, const DBT *pdata, DBT *skey)
+{
+    SERVICES_KEY key;
+    SERVICES_REC rec;
+    DBT copy;
+
+    /* Create the secondary index on the port and protocol. */
+    service_copy_rec(pdata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
+    memset(&key, 0, sizeof(key));
+    key.base.type = SEC;
+    key.data.sec.port = rec.port;
+    key.data.sec.proto = rec.proto;
+    int size = key_size(NULL, (KEY *) &key);
+
+    memset(skey, 0, sizeof(*skey));
+    skey->data = xcalloc(1, size);
+    skey->size = size;
+    skey->flags = DB_DBT_APPMALLOC;
+    pack_key(NULL, (KEY *) &key, skey);
+
+    free(copy.data);
+    return 0;
+}
+
+static int
+aux_key_creator(DB *dbp, const DBT *pkey, const DBT *pdata, DBT *skey)
+{
+    SERVICES_KEY key;
+    SERVICES_REC rec;
+    DBT copy;
+    DBT *keys;
+    int i, size;
+
+    /* Index the service under each of its aliases. */
+    service_copy_rec(pdata, &copy);
+    unpack_rec(NULL, (REC *) &rec, &copy);
+    if(rec.count == 0) {
+        free(copy.data);
+        return DB_DONOTINDEX;
+    }
+
+    keys = xcalloc(rec.count, sizeof(DBT));
+    key.base.type = AUX;
+    key.data.aux.proto = rec.proto;
+    for(i = 0; i < rec.count; i++) {
+        key.data.aux.name = rec.aliases[i];
+        size = key_size(NULL, (KEY *) &key);
+
+        keys[i].data = xcalloc(1, size);
+        keys[i].size = size;
+        keys[i].flags = DB_DBT_APPMALLOC;
+        pack_key(NULL, (KEY *) &key, &keys[i]);
+    }
+
+    memset(skey, 0, sizeof(*skey));
+    skey->data = keys;
+    skey->size = rec.count;
+    skey->flags = DB_DBT_MULTIPLE | DB_DBT_APPMALLOC;
+
+    free(copy.data);
+    return 0;
+}
+
+static size_t
+rec_size(SERVICE *service, const REC *rec)
+{
+    SERVICES_REC *srec = (SERVICES_REC *) rec;
+    size_t size;
+    char **alias;
+
+    size = sizeof(srec->port)
+        + sizeof(srec->count)
+        + sizeof(u_int32_t) * 2
+        + ((srec->count + 1) * sizeof(char *))
+        + (srec->count * sizeof(u_int32_t))
+        + strlen(srec->name) + 1
+        + strlen(srec->proto) + 1;
+
+    for(alias = srec->aliases;
+        alias != NULL && *alias != NULL;
+        alias++)
+    {
+        size += strlen(*alias) + 1;
+    }
+
+    return size;
+}
+
+static size_t
+key_size(SERVICE *service, const KEY *key)
+{
+    SERVICES_KEY *skey = (SERVICES_KEY *) key;
+    const char *proto = (skey->base.type == SEC
+                         ? skey->data.sec.proto
+                         : skey->data.pri.proto);
+
+    return sizeof(skey->base.type)
+        + (skey->base.type == SEC
+           ? sizeof(u_int16_t)
+           : (strlen(skey->data.pri.name) + 1))
+        + (proto != NULL ? strlen(proto) + 1 : 0);
+}
+
+/*
+ * Ports are packed in network byte order, so that they sort numerically.
+ */
+static void
+pack_key(SERVICE *service, const KEY *key, DBT *dbkey)
+{
+    SERVICES_KEY *skey = (SERVICES_KEY *) key;
+    unsigned char *buf = (unsigned char *) dbkey->data
+        + sizeof(skey->base.type);
+    const char *proto;
+    size_t len;
+
+    switch(skey->base.type) {
+    case PRI:
+    case AUX:
+        len = strlen(skey->data.pri.name) + 1;
+        memcpy(buf, skey->data.pri.name, len);
+        proto = skey->data.pri.proto;
+        break;
+
+    case SEC:
+        buf[0] = (skey->data.sec.port >> 8) & 0xff;
+        buf[1] = skey->data.sec.port & 0xff;
+        len = sizeof(u_int16_t);
+        proto = skey->data.sec.proto;
+        break;
+
+    default:
+        return;
+    }
+
+    if(proto != NULL)
+        memcpy(buf + len, proto, strlen(proto) + 1);
+}
+
+static void
+pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
+{
+    SERVICES_REC *srec = (SERVICES_REC *) rec;
+    char *buf = NULL, *s, *block;
+    u_int32_t block_len, offset;
+    int i, end, len, slen = 0;
+
+    buf = dbrec->data;
+    len = dbrec->size;
+
+    s = buf;
+    memcpy(s, &srec->port, (slen = sizeof(srec->port)));
+    s += slen;
+
+    memcpy(s, &srec->count, (slen = sizeof(srec->count)));
+    s += slen;
+
+    /*
+     * The block_len and protocol offset follow, then space reserved for
+     * the alias pointers set by unpack_rec, then the alias offsets.
+     */
+    block = s + sizeof(block_len) + sizeof(offset)
+        + ((srec->count + 1) * sizeof(char *))
+        + (srec->count * sizeof(offset));
+
+    memcpy(block, srec->name, (block_len = strlen(srec->name) + 1));
+    offset = block_len;
+    memcpy(block + block_len, srec->proto, (slen = strlen(srec->proto) + 1));
+    block_len += slen;
+
+    memcpy(s + sizeof(block_len), &offset, sizeof(offset));
+    s += sizeof(block_len) + sizeof(offset)
+        + ((srec->count + 1) * sizeof(char *));
+
+    /* A count past the end of the alias list stores out of range offsets. */
+    for(i = 0, end = (srec->aliases == NULL); i < srec->count; i++) {
+        end = end || srec->aliases[i] == NULL;
+        offset = (end ? (u_int32_t) -1 : block_len);
+        memcpy(s, &offset, sizeof(offset));
+        s += sizeof(offset);
+
+        if(!end) {
+            memcpy(block + block_len, srec->aliases[i],
+                   (slen = strlen(srec->aliases[i]) + 1));
+            block_len += slen;
+        }
+    }
+
+    memcpy(buf + sizeof(srec->port) + sizeof(srec->count), &block_len,
+           sizeof(block_len));
+
+    memset(dbrec, 0, sizeof(*dbrec));
+    dbrec->data = buf;
+    dbrec->size = len;
+}
+
+static void
+unpack_key(SERVICE *service, KEY *key, const DBT *dbkey)
+{
+    SERVICES_KEY *skey = (SERVICES_KEY *) key;
+    unsigned char *buf = (unsigned char *) dbkey->data;
+
+    memset(skey, 0, sizeof(*skey));
+    skey->base.type = *((enum KEY_TYPE *) buf);
+    buf += sizeof(skey->base.type);
+
+    switch(skey->base.type) {
+    case PRI:
+    case AUX:
+        skey->data.pri.name = (char *) buf;
+        skey->data.pri.proto = (char *) buf + strlen((char *) buf) + 1;
+        break;
+
+    case SEC:
+        skey->data.sec.port = (buf[0] << 8) | buf[1];
+        skey->data.sec.proto = (char *) buf + sizeof(u_int16_t);
+        break;
+    }
+}
+
+static void
+unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
+{
+    SERVICES_REC *srec = (SERVICES_REC *) rec;
+    char *buf = (char *) dbrec->data, *offsets;
+    u_int32_t block_len, offset;
+    int i;
+
+    memset(srec, 0, sizeof(*srec));
+    srec->base.type = TYPE_SERVICES;
+
+    memcpy(&srec->port, buf, sizeof(srec->port));
+    buf += sizeof(srec->port);
+
+    memcpy(&srec->count, buf, sizeof(srec->count));
+    buf += sizeof(srec->count);
+
+    memcpy(&block_len, buf, sizeof(block_len));
+    buf += sizeof(block_len);
+
+    memcpy(&offset, buf, sizeof(offset));
+    buf += sizeof(offset);
+
+    srec->aliases = (char **) buf;
+    buf += (srec->count + 1) * sizeof(char *);
+
+    offsets = buf;
+    buf += srec->count * sizeof(offset);
+
+    srec->base.block = buf;
+    srec->base.block_len = block_len;
+    srec->name = buf;
+    srec->proto = buf + offset;
+
+    for(i = 0; i < srec->count; i++) {
+        memcpy(&offset, offsets + (i * sizeof(offset)), sizeof(offset));
+        if(offset >= block_len)
+            break;
+        srec->aliases[i] = buf + offset;
+    }
+
+    srec->aliases[i] = NULL;
+}
@@ -0,0 +1,54 @@
+/**
+ * @file service-services.h
+ * @brief Defines services service abstraction interface.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef SERVICE_SERVICES_H
+#define SERVICE_SERVICES_H
+
+#include "service.h"
+
+#define SERVICES_PRI "services.db"
+#define SERVICES_SEC "services-port.db"
+#define SERVICES_AUX "services-alias.db"
+
+typedef struct SERVICES_REC {
+    REC base;
+    char *name;
+    char *proto;
+    u_int32_t port;     /* In host byte order. */
+    u_int32_t count;
+    char **aliases;
+} SERVICES_REC;
+
+/*
+ * Every key is qualified by the protocol. A key with a NULL protocol packs
+ * to the prefix shared by the keys for every protocol, for use with
+ * get_prefix.
+ */
+typedef struct SERVICES_KEY {
+    KEY base;
+    union {
+        struct {
+            char *name;
+            char *proto;
+        } pri;
+        struct {
+            u_int32_t port;
+            char *proto;
+        } sec;
+        struct {
+            char *name;     /* Alias. */
+            char *proto;
+        } aux;
+    } data;
+} SERVICES_KEY;
+
+/**
+ *
+ */
+extern void service_services_init(SERVICE *service);
+
+#endif
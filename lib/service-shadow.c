@@ -54,6 +54,8 @@ service_shadow_init(SERVICE *service)
 
     /* Set inherited functions. */
     service->get = service_get_rec;
+    service->get_dups = service_get_dups;
+    service->get_prefix = service_get_prefix;
     service->set = service_set_rec;
     service->next = service_next_rec;
     service->delete = service_delete_rec;
@@ -204,14 +206,15 @@ rec_size(SERVICE *service, const REC *rec)
 {
     SHADOW_REC *srec = (SHADOW_REC *) rec;
 
-    return strlen(srec->name) + 1
-        + strlen(srec->passwd) + 1
-        + sizeof(srec->lstchg)
+    return sizeof(srec->lstchg)
         + sizeof(srec->min)
         + sizeof(srec->max)
         + sizeof(srec->warn)
         + sizeof(srec->inact)
-        + sizeof(srec->expire);
+        + sizeof(srec->expire)
+        + sizeof(u_int32_t) * 2
+        + strlen(srec->name) + 1
+        + strlen(srec->passwd) + 1;
 }
 
 static size_t
@@ -239,18 +242,13 @@ pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
 {
     SHADOW_REC *srec = (SHADOW_REC *) rec;
     char *buf = NULL, *s;
+    u_int32_t block_len, offset;
     int len, slen = 0;
 
     buf = dbrec->data;
     len = dbrec->size;
 
     s = buf;
-    memcpy(s, srec->name, (slen = (strlen(srec->name) + 1)));
-    s += slen;
-
-    memcpy(s, srec->passwd, (slen = (strlen(srec->passwd) + 1)));
-    s += slen;
-
     memcpy(s, &srec->lstchg, (slen = sizeof(srec->lstchg)));
     s += slen;
 
@@ -269,6 +267,19 @@ pack_rec(SERVICE *service, const REC *rec, DBT *dbrec)
     memcpy(s, &srec->expire, (slen = sizeof(srec->expire)));
     s += slen;
 
+    /* The string block holds the name followed by the password. */
+    offset = strlen(srec->name) + 1;
+    block_len = offset + strlen(srec->passwd) + 1;
+
+    memcpy(s, &block_len, (slen = sizeof(block_len)));
+    s += slen;
+
+    memcpy(s, &offset, (slen = sizeof(offset)));
+    s += slen;
+
+    memcpy(s, srec->name, offset);
+    memcpy(s + offset, srec->passwd, block_len - offset);
+
     memset(dbrec, 0, sizeof(*dbrec));
     dbrec->data = buf;
     dbrec->size = len;
@@ -291,16 +302,11 @@ unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
 {
     SHADOW_REC *srec = (SHADOW_REC *) rec;
     char *buf = (char *) dbrec->data;
+    u_int32_t block_len, offset;
 
     memset(srec, 0, sizeof(*srec));
     srec->base.type = TYPE_SHADOW;
 
-    srec->name = buf;
-    buf += strlen(srec->name) + 1;
-
-    srec->passwd = buf;
-    buf += strlen(srec->passwd) + 1;
-
     memcpy(&srec->lstchg, buf, sizeof(srec->lstchg));
     buf += sizeof(srec->lstchg);
 
@@ -318,4 +324,15 @@ unpack_rec(SERVICE *service, REC *rec, const DBT *dbrec)
 
     memcpy(&srec->expire, buf, sizeof(srec->expire));
     buf += sizeof(srec->expire);
+
+    memcpy(&block_len, buf, sizeof(block_len));
+    buf += sizeof(block_len);
+
+    memcpy(&offset, buf, sizeof(offset));
+    buf += sizeof(offset);
+
+    srec->base.block = buf;
+    srec->base.block_len = block_len;
+    srec->name = buf;
+    srec->passwd = buf + offset;
 }
@@ -5,42 +5,130 @@
  * @date 2015
  */
 
+#include <errno.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "service.h"
 #include "utils.h"
 #include "service-passwd.h"
 #include "service-shadow.h"
 #include "service-group.h"
+#include "service-hosts.h"
+#include "service-services.h"
+#include "service-netgroup.h"
+#include "service-gshadow.h"
+#include "service-numbered.h"
+#include "service-ethers.h"
+#include "service-aliases.h"
+
+/*
+ * Free-threaded handles may not return records in memory owned by the
+ * handle, so each thread reads into its own reallocated buffers.
+ */
+typedef struct SCRATCH {
+    DBT key;
+    DBT val;
+} SCRATCH;
+
+static pthread_key_t Scratch_key;
+static pthread_once_t Scratch_once = PTHREAD_ONCE_INIT;
+
+static int next_rec(SERVICE *, DBC **, DBT *, DBT *, KEY *, REC *);
+static int fetch(SERVICE *, SERVICE_CURSOR *);
+static DB *service_key_db(SERVICE *, enum KEY_TYPE);
+static int scan_sec(SERVICE *, const DBT *, DBT *);
+static SCRATCH *scratch_get(void);
+static void scratch_init(void);
+static void scratch_free(void *);
 
 extern int
 service_init(SERVICE *service, enum TYPE type, int flags, const char *base)
 {
     int perms = 0644;
 
+    /*
+     * An enumeration resumed after the service is reopened repositions on
+     * the last key returned, which only a btree can do once that key has
+     * been deleted. The indexes of enumerated maps may still be hashed.
+     */
     switch(type)
     {
     case TYPE_PASSWD:
+        flags |= DBNG_SCANNED;
         service_passwd_init(service);
         break;
 
     case TYPE_SHADOW:
         perms = 0600;
+        flags |= DBNG_SCANNED;
         service_shadow_init(service);
         break;
 
     case TYPE_GROUP:
+        flags |= DBNG_SCANNED;
         service_group_init(service);
         break;
 
+    case TYPE_HOSTS:
+        service_hosts_init(service);
+        break;
+
+    case TYPE_SERVICES:
+        /* Lookups by name alone scan a range of keys. */
+        flags |= DBNG_ORDERED;
+        service_services_init(service);
+        break;
+
+    case TYPE_NETGROUP:
+        service_netgroup_init(service);
+        break;
+
+    case TYPE_GSHADOW:
+        perms = 0600;
+        flags |= DBNG_SCANNED;
+        service_gshadow_init(service);
+        break;
+
+    case TYPE_PROTOCOLS:
+        service_protocols_init(service);
+        break;
+
+    case TYPE_RPC:
+        service_rpc_init(service);
+        break;
+
+    case TYPE_ETHERS:
+        service_ethers_init(service);
+        break;
+
+    case TYPE_ALIASES:
+        flags |= DBNG_SCANNED;
+        service_aliases_init(service);
+        break;
+
     default:
         warnx("unknown service type");
         goto err;
     }
 
     /* Initialize the database for this service. */
-    return dbng_init(&service->db, base, service->pri, service->sec,
-                     service->key_creator, flags, perms);
+    if(dbng_init(&service->db, base, service->pri, service->sec,
+                 service->key_creator, flags, perms) < 0)
+    {
+        goto err;
+    }
+
+    if(service->aux != NULL
+       && dbng_init_aux(&service->db, base, service->aux,
+                        service->aux_key_creator, flags, perms) < 0)
+    {
+        dbng_cleanup(&service->db);
+        goto err;
+    }
+
+    return 0;
 
 err:
     return -1;
@@ -52,13 +140,26 @@ service_cleanup(SERVICE *service)
     dbng_cleanup(&service->db);
 }
 
+extern void
+service_forget(SERVICE *service)
+{
+    dbng_forget(&service->db);
+}
+
+extern void
+service_copy_rec(const DBT *dbrec, DBT *copy)
+{
+    memset(copy, 0, sizeof(*copy));
+    copy->data = xmalloc(dbrec->size > 0 ? dbrec->size : 1);
+    copy->size = dbrec->size;
+    memcpy(copy->data, dbrec->data, dbrec->size);
+}
+
 extern int
 service_get_rec(SERVICE *service, KEY *key, REC *rec)
 {
     int ret;
     DBT dbkey, dbval;
-    DB *db = (key->type == PRI
-              ? service->db.pri : service->db.sec);
     int ksize = service->key_size(service, key);
     unsigned char kbuf[ksize];
 
@@ -69,13 +170,236 @@ service_get_rec(SERVICE *service, KEY *key, REC *rec)
     service->pack_key(service, key, &dbkey);
     memset(&dbval, 0, sizeof(dbval));
 
-    ret = db->get(db, service->db.txn, &dbkey, &dbval, 0);
-    if(ret == 0)
+    if((ret = service_get_packed(service, key->type, &dbkey, &dbval)) == 0) {
         service->unpack_rec(service, rec, &dbval);
+        if(!service->validate(service, key, rec))
+            return DB_NOTFOUND;
+    }
 
-    if(!service->validate(service, key, rec))
+    return ret;
+}
+
+extern int
+service_get_packed(SERVICE *service, enum KEY_TYPE type, DBT *dbkey,
+                   DBT *dbval)
+{
+    int ret;
+    DBT *val;
+    SCRATCH *scratch;
+    DB *db = service_key_db(service, type);
+    const void *data;
+    void *copy;
+    size_t size;
+
+    /* A secondary index not yet built is scanned for, see scan_sec. */
+    if(db == NULL && (type != SEC || service->sec == NULL))
+        return DB_NOTFOUND;
+
+    /* A definite miss in the key filter needs no database access. */
+    if(!bloom_check(&service->db.filter, type, dbkey->data, dbkey->size))
         return DB_NOTFOUND;
 
+    /*
+     * A trusted snapshot answers hits and misses alike. The record is
+     * copied out of the shared mapping, as unpacking may write to it.
+     */
+    ret = snapshot_get(&service->db.snap, type, dbkey->data, dbkey->size,
+                       &data, &size);
+    if(ret > 0)
+        return DB_NOTFOUND;
+
+    /*
+     * Lookups run within other programs, so running out of memory fails
+     * the lookup rather than exiting.
+     */
+    if(ret == 0) {
+        if((scratch = scratch_get()) == NULL
+           || (copy = realloc(scratch->val.data, size)) == NULL)
+        {
+            return ENOMEM;
+        }
+
+        val = &scratch->val;
+        val->data = copy;
+        val->size = size;
+        memcpy(val->data, data, size);
+    }
+    else if(db == NULL) {
+        if((scratch = scratch_get()) == NULL)
+            return ENOMEM;
+
+        val = &scratch->val;
+        ret = scan_sec(service, dbkey, val);
+    }
+    else if(service->db.flags & DBNG_THREAD) {
+        if((scratch = scratch_get()) == NULL)
+            return ENOMEM;
+
+        val = &scratch->val;
+        ret = dbng_get(&service->db, db, dbkey, val);
+    }
+    else {
+        return dbng_get(&service->db, db, dbkey, dbval);
+    }
+
+    if(ret == 0) {
+        dbval->data = val->data;
+        dbval->size = val->size;
+    }
+
+    return ret;
+}
+
+extern int
+service_exists(SERVICE *service, KEY *key)
+{
+    DBT dbkey, dbval;
+    DB *db = service_key_db(service, key->type);
+    int ksize = service->key_size(service, key);
+    unsigned char kbuf[ksize];
+    const void *data;
+    size_t size;
+    int ret;
+
+    if(db == NULL)
+        return DB_NOTFOUND;
+
+    memset(kbuf, 0, ksize);
+    memset(&dbkey, 0, sizeof(dbkey));
+    dbkey.data = kbuf;
+    dbkey.size = ksize;
+    service->pack_key(service, key, &dbkey);
+
+    if(!bloom_check(&service->db.filter, key->type, kbuf, ksize))
+        return DB_NOTFOUND;
+
+    ret = snapshot_get(&service->db.snap, key->type, kbuf, ksize, &data,
+                       &size);
+    if(ret >= 0)
+        return (ret == 0 ? 0 : DB_NOTFOUND);
+
+    /* An empty partial read finds the key without copying its record. */
+    memset(&dbval, 0, sizeof(dbval));
+    dbval.flags = DB_DBT_USERMEM | DB_DBT_PARTIAL;
+
+    return dbng_get(&service->db, db, &dbkey, &dbval);
+}
+
+extern int
+service_get_dups(SERVICE *service, KEY *key, REC *rec,
+                 int (*walk)(SERVICE *, const REC *, void *), void *data)
+{
+    int ret, found = 0;
+    DBT dbkey, dbval;
+    DB *db = service_key_db(service, key->type);
+    DBC *cursor;
+    int ksize = service->key_size(service, key);
+    unsigned char kbuf[ksize];
+    u_int32_t op = DB_SET;
+
+    if(db == NULL)
+        return DB_NOTFOUND;
+
+    memset(kbuf, 0, ksize);
+    memset(&dbkey, 0, sizeof(dbkey));
+    dbkey.data = kbuf;
+    dbkey.size = ksize;
+    service->pack_key(service, key, &dbkey);
+
+    if(!bloom_check(&service->db.filter, key->type, kbuf, ksize))
+        return DB_NOTFOUND;
+
+    /* Duplicates share the key, so it always fits the packed buffer. */
+    dbkey.ulen = ksize;
+    dbkey.flags = DB_DBT_USERMEM;
+    memset(&dbval, 0, sizeof(dbval));
+    dbval.flags = DB_DBT_REALLOC;
+
+    if((ret = db->cursor(db, service->db.txn, &cursor,
+                         dbng_cursor_flags(&service->db))) != 0)
+    {
+        return ret;
+    }
+
+    /* Position on the first duplicate, then step through the rest. */
+    while((ret = cursor->get(cursor, &dbkey, &dbval, op)) == 0) {
+        op = DB_NEXT_DUP;
+        service->unpack_rec(service, rec, &dbval);
+        if(!service->validate(service, key, rec))
+            continue;
+
+        found = 1;
+        if(walk(service, rec, data) != 0)
+            break;
+    }
+
+    cursor->close(cursor);
+    free(dbval.data);
+
+    if(ret == DB_NOTFOUND || ret == 0)
+        ret = (found ? 0 : DB_NOTFOUND);
+
+    return ret;
+}
+
+extern int
+service_get_prefix(SERVICE *service, KEY *key, REC *rec,
+                   int (*walk)(SERVICE *, const REC *, void *), void *data)
+{
+    int ret, found = 0;
+    DBT dbkey, dbval;
+    DB *db = service_key_db(service, key->type);
+    DBC *cursor;
+    int ksize = service->key_size(service, key);
+    unsigned char kbuf[ksize];
+    u_int32_t op = DB_SET_RANGE;
+
+    if(db == NULL)
+        return DB_NOTFOUND;
+
+    memset(kbuf, 0, ksize);
+    memset(&dbkey, 0, sizeof(dbkey));
+    dbkey.data = kbuf;
+    dbkey.size = ksize;
+    service->pack_key(service, key, &dbkey);
+
+    /* Each key found replaces the prefix, so it is read into its own copy. */
+    if((dbkey.data = malloc(ksize)) == NULL)
+        return ENOMEM;
+    memcpy(dbkey.data, kbuf, ksize);
+    dbkey.flags = DB_DBT_REALLOC;
+    memset(&dbval, 0, sizeof(dbval));
+    dbval.flags = DB_DBT_REALLOC;
+
+    if((ret = db->cursor(db, service->db.txn, &cursor,
+                         dbng_cursor_flags(&service->db))) != 0)
+    {
+        goto cleanup;
+    }
+
+    /* Position on the first key not before the prefix, then step on. */
+    while((ret = cursor->get(cursor, &dbkey, &dbval, op)) == 0) {
+        op = DB_NEXT;
+        if(dbkey.size < ksize || memcmp(dbkey.data, kbuf, ksize) != 0)
+            break;
+
+        service->unpack_rec(service, rec, &dbval);
+        if(!service->validate(service, key, rec))
+            continue;
+
+        found = 1;
+        if(walk(service, rec, data) != 0)
+            break;
+    }
+
+    cursor->close(cursor);
+
+    if(ret == DB_NOTFOUND || ret == 0)
+        ret = (found ? 0 : DB_NOTFOUND);
+
+cleanup:
+    free(dbkey.data);
+    free(dbval.data);
     return ret;
 }
 
@@ -106,6 +430,8 @@ service_set_rec(SERVICE *service, KEY *key, REC *rec)
     service->pack_key(service, key, &dbkey);
     service->pack_rec(service, rec, &dbrec);
     ret = db->put(db, service->db.txn, &dbkey, &dbrec, 0);
+    if(ret == 0)
+        dbng_touch(&service->db);
 
     return ret;
 }
@@ -130,6 +456,8 @@ service_delete_rec(SERVICE *service, KEY *key)
     dbkey.size = ksize;
     service->pack_key(service, key, &dbkey);
     ret = db->del(db, service->db.txn, &dbkey, 0);
+    if(ret == 0)
+        dbng_touch(&service->db);
 
 cleanup:
     xfree((void **) &rec);
@@ -139,42 +467,104 @@ cleanup:
 extern int
 service_next_rec(SERVICE *service, KEY *key, REC *rec)
 {
-    int ret;
     DBT dbkey, dbval;
-    DB *db = service->db.pri;
-    DBC *cursor;
+    SCRATCH *scratch;
 
-    /* If the cursor is not set, create a new one. */
-    if(service->db.cursor == NULL) {
-        ret = db->cursor(db, service->db.txn, &service->db.cursor, 0);
-        if(ret != 0) {
-            service->db.cursor = NULL;
-            return ret;
-        }
+    if(service->db.flags & DBNG_THREAD) {
+        if((scratch = scratch_get()) == NULL)
+            return ENOMEM;
+        return next_rec(service, &service->db.cursor, &scratch->key,
+                        &scratch->val, key, rec);
     }
 
-    cursor = service->db.cursor;
-tryagain:
     memset(&dbkey, 0, sizeof(dbkey));
     memset(&dbval, 0, sizeof(dbval));
 
-    ret = cursor->get(cursor, &dbkey, &dbval, DB_NEXT);
-    switch(ret) {
-    case 0:
-        service->unpack_key(service, key, &dbkey);
-        service->unpack_rec(service, rec, &dbval);
+    return next_rec(service, &service->db.cursor, &dbkey, &dbval, key, rec);
+}
+
+extern int
+service_cursor_next(SERVICE *service, SERVICE_CURSOR *cursor,
+                    KEY *key, REC *rec)
+{
+    void *kdata, *vdata, *prev, *p;
+    u_int32_t klen, vlen;
+    int ret;
+
+    for(;;) {
+        if(cursor->ptr == NULL && (ret = fetch(service, cursor)) != 0)
+            return ret;
+
+        prev = cursor->ptr;
+        DB_MULTIPLE_KEY_NEXT(cursor->ptr, &cursor->bulk,
+                             kdata, klen, vdata, vlen);
+        if(cursor->ptr == NULL)
+            continue;
+
+        /*
+         * Items in the bulk buffer are not aligned, and unpacking stores
+         * pointers within the record, so both are copied out first. The
+         * key is also where to carry on from should the cursor be detached.
+         * Should either copy fail, the record is left to be fetched again.
+         */
+        if((p = realloc(cursor->rec.data, vlen)) == NULL) {
+            cursor->ptr = prev;
+            return ENOMEM;
+        }
+        cursor->rec.data = p;
+        if((p = realloc(cursor->key.data, klen)) == NULL) {
+            cursor->ptr = prev;
+            return ENOMEM;
+        }
+        cursor->key.data = p;
+        cursor->key.size = klen;
+        memcpy(cursor->key.data, kdata, klen);
+        cursor->rec.size = vlen;
+        memcpy(cursor->rec.data, vdata, vlen);
+
+        service->unpack_key(service, key, &cursor->key);
+        service->unpack_rec(service, rec, &cursor->rec);
         if(!service->validate(service, key, rec))
-            goto tryagain;
-        break;
+            continue;
 
-    case DB_NOTFOUND:
-        /* We have reached the end of the iterator. */
-        cursor->close(cursor);
-        service->db.cursor = NULL;
-        break;
+        cursor->last = prev;
+        cursor->pending = 0;
+
+        return 0;
     }
+}
 
-    return ret;
+extern void
+service_cursor_unget(SERVICE_CURSOR *cursor)
+{
+    if(cursor->last != NULL) {
+        cursor->ptr = cursor->last;
+        cursor->last = NULL;
+    }
+    cursor->pending = 1;
+}
+
+extern void
+service_cursor_close(SERVICE_CURSOR *cursor)
+{
+    if(cursor->dbc != NULL)
+        cursor->dbc->close(cursor->dbc);
+    free(cursor->key.data);
+    free(cursor->rec.data);
+    free(cursor->bulk.data);
+    memset(cursor, 0, sizeof(*cursor));
+}
+
+extern void
+service_cursor_detach(SERVICE_CURSOR *cursor)
+{
+    /* Records still buffered were read before the service was reopened. */
+    if(cursor->dbc != NULL || cursor->ptr != NULL) {
+        cursor->dbc = NULL;
+        cursor->ptr = NULL;
+        cursor->last = NULL;
+        cursor->resume = 1;
+    }
 }
 
 extern int
@@ -184,10 +574,24 @@ service_truncate(SERVICE *service)
     DB *db = service->db.pri; /* Secondary database updated automatically. */
 
     ret = db->truncate(db, service->db.txn, &truncated, 0);
+    if(ret == 0)
+        dbng_touch(&service->db);
 
     return ret;
 }
 
+extern int
+service_build_filter(SERVICE *service)
+{
+    return dbng_build_filter(&service->db);
+}
+
+extern int
+service_build_snapshot(SERVICE *service)
+{
+    return dbng_build_snapshot(&service->db);
+}
+
 extern int
 service_validate(SERVICE *service, const KEY *key, const REC *rec)
 {
@@ -197,17 +601,253 @@ service_validate(SERVICE *service, const KEY *key, const REC *rec)
 extern int
 service_start_txn(SERVICE *service)
 {
-    return 0;
+    return dbng_txn_begin(&service->db);
 }
 
 extern int
 service_commit_txn(SERVICE *service)
 {
-    return 0;
+    return dbng_txn_commit(&service->db);
 }
 
 extern int
 service_rollback_txn(SERVICE *service)
 {
+    return dbng_txn_abort(&service->db);
+}
+
+/*
+ * Step a cursor over the primary database, opening it if necessary and
+ * closing it once the end is reached.
+ */
+static int
+next_rec(SERVICE *service, DBC **cursor, DBT *dbkey, DBT *dbval,
+         KEY *key, REC *rec)
+{
+    int ret;
+    DB *db = service->db.pri;
+
+    /* If the cursor is not set, create a new one. */
+    if(*cursor == NULL) {
+        ret = db->cursor(db, service->db.txn, cursor,
+                         dbng_cursor_flags(&service->db));
+        if(ret != 0) {
+            *cursor = NULL;
+            return ret;
+        }
+    }
+
+tryagain:
+    ret = (*cursor)->get(*cursor, dbkey, dbval, DB_NEXT);
+    switch(ret) {
+    case 0:
+        service->unpack_key(service, key, dbkey);
+        service->unpack_rec(service, rec, dbval);
+        if(!service->validate(service, key, rec))
+            goto tryagain;
+        break;
+
+    case DB_NOTFOUND:
+        /* We have reached the end of the iterator. */
+        (*cursor)->close(*cursor);
+        *cursor = NULL;
+        break;
+    }
+
+    return ret;
+}
+
+/*
+ * Fill a cursor's buffer with the next chunk of records, opening the
+ * cursor if needed. A detached cursor is reopened at the first key not
+ * before the last one it returned, skipping that key if it is still
+ * there and was not put back. The cursor is closed once the end is
+ * reached.
+ */
+static int
+fetch(SERVICE *service, SERVICE_CURSOR *cursor)
+{
+    DB *db = service->db.pri;
+    u_int32_t op = DB_NEXT, size = cursor->key.size;
+    void *ptr, *kdata, *vdata, *p;
+    u_int32_t klen, vlen, ulen;
+    int ret;
+
+    unsigned char last[size > 0 ? size : 1];
+
+    if(cursor->bulk.data == NULL) {
+        if((cursor->bulk.data = malloc(SERVICE_BULK_SIZE)) == NULL)
+            return ENOMEM;
+        cursor->bulk.ulen = SERVICE_BULK_SIZE;
+        cursor->bulk.flags = DB_DBT_USERMEM;
+        cursor->key.flags = DB_DBT_REALLOC;
+    }
+
+    if(cursor->dbc == NULL) {
+        if((ret = db->cursor(db, service->db.txn, &cursor->dbc,
+                             dbng_cursor_flags(&service->db))) != 0)
+        {
+            cursor->dbc = NULL;
+            return ret;
+        }
+
+        if(cursor->resume && size > 0) {
+            memcpy(last, cursor->key.data, size);
+            op = DB_SET_RANGE;
+        }
+        cursor->resume = 0;
+    }
+
+    /* A record larger than the whole buffer needs a bigger one. */
+    while((ret = cursor->dbc->get(cursor->dbc, &cursor->key, &cursor->bulk,
+                                  op | DB_MULTIPLE_KEY)) == DB_BUFFER_SMALL)
+    {
+        ulen = (cursor->bulk.size + 2 * cursor->bulk.ulen)
+            & ~((u_int32_t) 1023);
+        if((p = realloc(cursor->bulk.data, ulen)) == NULL) {
+            /* Carry on from the last key returned when next called. */
+            cursor->dbc->close(cursor->dbc);
+            cursor->dbc = NULL;
+            cursor->resume = (cursor->key.size > 0);
+            return ENOMEM;
+        }
+        cursor->bulk.data = p;
+        cursor->bulk.ulen = ulen;
+    }
+
+    if(ret != 0) {
+        cursor->dbc->close(cursor->dbc);
+        cursor->dbc = NULL;
+        return ret;
+    }
+
+    DB_MULTIPLE_INIT(cursor->ptr, &cursor->bulk);
+    cursor->last = NULL;
+
+    if(op == DB_SET_RANGE && !cursor->pending) {
+        ptr = cursor->ptr;
+        DB_MULTIPLE_KEY_NEXT(ptr, &cursor->bulk, kdata, klen, vdata, vlen);
+        if(ptr != NULL && klen == size && memcmp(kdata, last, size) == 0)
+            cursor->ptr = ptr;
+    }
+
     return 0;
 }
+
+static DB
+*service_key_db(SERVICE *service, enum KEY_TYPE type)
+{
+    switch(type) {
+    case PRI:
+        return service->db.pri;
+
+    case SEC:
+        return service->db.sec;
+
+    case AUX:
+        return service->db.aux;
+    }
+
+    return NULL;
+}
+
+/*
+ * Find the record with a secondary key by walking the primary database,
+ * for a reader opening a map before a writer has built its secondary
+ * index. The record is copied into val, which is reallocated to fit.
+ */
+static int
+scan_sec(SERVICE *service, const DBT *dbkey, DBT *val)
+{
+    DB *pri = service->db.pri;
+    DBC *cursor;
+    DBT dbpkey, dbrec, skey, *keys;
+    void *copy;
+    u_int32_t i, nkeys;
+    int ret, found = 0;
+
+    if((ret = pri->cursor(pri, service->db.txn, &cursor,
+                          dbng_cursor_flags(&service->db))) != 0)
+    {
+        return ret;
+    }
+
+    memset(&dbpkey, 0, sizeof(dbpkey));
+    memset(&dbrec, 0, sizeof(dbrec));
+    dbpkey.flags = DB_DBT_REALLOC;
+    dbrec.flags = DB_DBT_REALLOC;
+
+    while(!found
+          && (ret = cursor->get(cursor, &dbpkey, &dbrec, DB_NEXT)) == 0)
+    {
+        /* Derive the record's keys as the index would have them. */
+        memset(&skey, 0, sizeof(skey));
+        if(service->key_creator(pri, &dbpkey, &dbrec, &skey) != 0)
+            continue;
+
+        keys = (skey.flags & DB_DBT_MULTIPLE ? skey.data : &skey);
+        nkeys = (skey.flags & DB_DBT_MULTIPLE ? skey.size : 1);
+        for(i = 0; i < nkeys; i++) {
+            if(keys[i].size == dbkey->size
+               && !memcmp(keys[i].data, dbkey->data, dbkey->size))
+            {
+                found = 1;
+            }
+            if(keys[i].flags & DB_DBT_APPMALLOC)
+                free(keys[i].data);
+        }
+
+        if((skey.flags & DB_DBT_MULTIPLE) && (skey.flags & DB_DBT_APPMALLOC))
+            free(skey.data);
+    }
+
+    if(found) {
+        if((copy = realloc(val->data, dbrec.size)) == NULL) {
+            ret = ENOMEM;
+        }
+        else {
+            val->data = copy;
+            val->size = dbrec.size;
+            memcpy(val->data, dbrec.data, dbrec.size);
+        }
+    }
+
+    cursor->close(cursor);
+    free(dbpkey.data);
+    free(dbrec.data);
+
+    return ret;
+}
+
+static SCRATCH
+*scratch_get(void)
+{
+    SCRATCH *scratch;
+
+    pthread_once(&Scratch_once, scratch_init);
+    if((scratch = pthread_getspecific(Scratch_key)) == NULL) {
+        if((scratch = calloc(1, sizeof(*scratch))) == NULL)
+            return NULL;
+        scratch->key.flags = DB_DBT_REALLOC;
+        scratch->val.flags = DB_DBT_REALLOC;
+        pthread_setspecific(Scratch_key, scratch);
+    }
+
+    return scratch;
+}
+
+static void
+scratch_init(void)
+{
+    pthread_key_create(&Scratch_key, scratch_free);
+}
+
+static void
+scratch_free(void *data)
+{
+    SCRATCH *scratch = data;
+
+    free(scratch->key.data);
+    free(scratch->val.data);
+    free(scratch);
+}
@@ -11,36 +11,78 @@
 #include "dbng.h"
 
 #define SERVICE_REC_MAX 1024
+#define SERVICE_BULK_SIZE (256 * 1024)  /* Multiple of 1024 bytes. */
 
 enum TYPE {
     TYPE_PASSWD,
     TYPE_SHADOW,
-    TYPE_GROUP
+    TYPE_GROUP,
+    TYPE_HOSTS,
+    TYPE_SERVICES,
+    TYPE_NETGROUP,
+    TYPE_GSHADOW,
+    TYPE_PROTOCOLS,
+    TYPE_RPC,
+    TYPE_ETHERS,
+    TYPE_ALIASES
 };
 
 enum KEY_TYPE {
     PRI,
-    SEC
+    SEC,
+    AUX
 };
 
+/*
+ * Records are stored as their fixed-size fields and a table of string
+ * offsets, followed by a block holding every string in the order glibc
+ * expects them in the caller's buffer. Unpacking points block at that
+ * block, so a result can be filled with a single copy and each string
+ * pointer relocated by its distance from block.
+ */
 typedef struct REC {
     enum TYPE type;
+    const char *block;
+    size_t block_len;
 } REC;
 
 typedef struct KEY {
     enum KEY_TYPE type;
 } KEY;
 
+/*
+ * An independent iteration over a service's primary database. Cursors
+ * are not shared, so each thread enumerating a free-threaded service
+ * should use its own. Records are fetched in bulk into the cursor's own
+ * buffer and handed out from there. A zeroed cursor is ready for use.
+ */
+typedef struct SERVICE_CURSOR {
+    DBC *dbc;
+    DBT key;        /* The last key returned. */
+    DBT rec;        /* Aligned copy of the last record returned. */
+    DBT bulk;
+    void *ptr;      /* Next record within bulk, or NULL to fetch more. */
+    void *last;     /* The last record returned within bulk. */
+    int resume;     /* Reposition after key before the next record. */
+    int pending;    /* The last record is to be returned again. */
+} SERVICE_CURSOR;
+
 typedef struct SERVICE SERVICE;
 struct SERVICE {
     char *pri;
     char *sec;
+    char *aux;
     DBNG db;
 
-    /* Callback to update secondary database. */
+    /* Callbacks to update secondary databases. */
     int (*key_creator)(DB *, const DBT *, const DBT *, DBT *);
+    int (*aux_key_creator)(DB *, const DBT *, const DBT *, DBT *);
     void (*cleanup)(SERVICE *);
     int (*get)(SERVICE *, KEY *, REC *);
+    int (*get_dups)(SERVICE *, KEY *, REC *,
+                    int (*)(SERVICE *, const REC *, void *), void *);
+    int (*get_prefix)(SERVICE *, KEY *, REC *,
+                      int (*)(SERVICE *, const REC *, void *), void *);
     int (*next)(SERVICE *, KEY *, REC *);
     int (*set)(SERVICE *, KEY *, REC *);
     void (*print)(SERVICE *, const KEY *, const REC *);
@@ -75,10 +117,62 @@ extern int service_init(SERVICE *service, enum TYPE type, int flags, const char
 extern void service_cleanup(SERVICE *service);
 
 /**
- *
+ * Copy a packed record handed to a key creator into an aligned buffer,
+ * which unpack_rec may then write its pointer arrays to. Berkeley DB's
+ * own copy is neither guaranteed to be aligned nor ours to modify. The
+ * caller frees the copy's data.
+ */
+extern void service_copy_rec(const DBT *dbrec, DBT *copy);
+
+/**
+ * Drop a service inherited across fork(), as dbng_forget does, so that it
+ * may be initialized afresh.
+ */
+extern void service_forget(SERVICE *service);
+
+/**
+ * Fetch a record by key. For DBNG_THREAD services, and for any record served
+ * from the snapshot, the record points into a per-thread buffer valid until
+ * the calling thread's next read. Returns ENOMEM, rather than exiting, if
+ * that buffer cannot be grown.
  */
 extern int service_get_rec(SERVICE *service, KEY *key, REC *rec);
 
+/**
+ * Fetch the packed record stored under a packed key of the given type,
+ * without unpacking it or validating it for the calling user. The data is
+ * owned by the service, and for DBNG_THREAD services or records served
+ * from the snapshot is in a per-thread buffer valid until the calling
+ * thread's next read. So are records found by scanning the primary, when
+ * a read-only service's secondary index has not been built yet.
+ */
+extern int service_get_packed(SERVICE *service, enum KEY_TYPE type,
+                              DBT *dbkey, DBT *dbval);
+
+/**
+ * Returns 0 if a record is stored under the key, without reading it or
+ * validating it for the calling user, or DB_NOTFOUND if not.
+ */
+extern int service_exists(SERVICE *service, KEY *key);
+
+/**
+ * Call walk for every valid record stored under a (possibly duplicated)
+ * secondary key. The walk stops early if the callback returns non-zero.
+ */
+extern int service_get_dups(SERVICE *service, KEY *key, REC *rec,
+                            int (*walk)(SERVICE *, const REC *, void *),
+                            void *data);
+
+/**
+ * Call walk for every valid record stored under a key beginning with the
+ * packed form of the given key, in key order, as for a key packed without
+ * its trailing fields. The walk stops early if the callback returns
+ * non-zero.
+ */
+extern int service_get_prefix(SERVICE *service, KEY *key, REC *rec,
+                              int (*walk)(SERVICE *, const REC *, void *),
+                              void *data);
+
 /**
  *
  */
@@ -89,6 +183,49 @@ extern int service_set_rec(SERVICE *service, KEY *key, REC *rec);
  */
 extern int service_next_rec(SERVICE *service, KEY *key, REC *rec);
 
+/**
+ * Fetch the next record through a caller-owned cursor. The record points
+ * into the cursor's buffers until the next call or service_cursor_close.
+ * Should the buffers not grow, ENOMEM is returned and the same record is
+ * fetched by the next call.
+ */
+extern int service_cursor_next(SERVICE *service, SERVICE_CURSOR *cursor,
+                               KEY *key, REC *rec);
+
+/**
+ * Return the last record fetched through a cursor again on the next call,
+ * as when the caller's buffer was too small to hold it. The record is
+ * served from the cursor's buffer, or read again if the cursor has since
+ * been detached.
+ */
+extern void service_cursor_unget(SERVICE_CURSOR *cursor);
+
+/**
+ * Release a cursor and its buffers, leaving it ready for a new iteration.
+ */
+extern void service_cursor_close(SERVICE_CURSOR *cursor);
+
+/**
+ * Forget a cursor's database cursor without closing it, as when the
+ * service it was opened on has since been closed. The next call to
+ * service_cursor_next, on the reopened service, carries on after the last
+ * record returned.
+ */
+extern void service_cursor_detach(SERVICE_CURSOR *cursor);
+
+/**
+ * Rebuild the service's key filter after modifying it. Read-only handles
+ * opened afterwards answer definite misses without a database lookup.
+ */
+extern int service_build_filter(SERVICE *service);
+
+/**
+ * Rebuild the service's snapshot after modifying it. Read-only handles
+ * opened afterwards serve lookups by primary and secondary key from the
+ * shared mapping instead of the database.
+ */
+extern int service_build_snapshot(SERVICE *service);
+
 /**
  *
  */
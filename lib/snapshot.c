@@ -0,0 +1,532 @@
+/**
+ * @file snapshot.c
+ * @brief Implements the immutable memory-mapped snapshot.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "snapshot.h"
+#include "utils.h"
+
+#define ALIGN(n)    (((n) + 7) & ~((size_t) 7))
+#define BUCKET_SIZE 4           /* Average keys per displacement bucket. */
+#define MAX_SEED    (1 << 24)   /* Displacements to try before growing. */
+
+/*
+ * A table slot holds the lower half of the key's hash and the item's
+ * offset. Items start after a word of padding, so an offset of zero marks
+ * an empty slot.
+ */
+typedef struct SLOT {
+    u_int32_t hash;
+    u_int32_t item;
+} SLOT;
+
+/* An item header, followed by the key and then the value. */
+typedef struct ITEM {
+    u_int32_t klen;
+    u_int32_t vlen;
+    u_int64_t ref;
+} ITEM;
+
+/*
+ * Keys are hashed into buckets, and each bucket stores the displacement
+ * that places all of its keys in distinct free slots. A lookup therefore
+ * costs one hash, one displacement and one slot.
+ */
+typedef struct TABLE {
+    u_int32_t nslots;
+    u_int32_t nbuckets;
+    SLOT *slots;
+    u_int32_t *disps;
+} TABLE;
+
+/* A key being placed while building a table. */
+typedef struct ENTRY {
+    u_int64_t hash;
+    u_int32_t item;
+    u_int32_t bucket;
+} ENTRY;
+
+typedef struct BUCKET {
+    u_int32_t bucket;
+    u_int32_t start;
+    u_int32_t size;
+} BUCKET;
+
+static u_int32_t position(u_int64_t, u_int32_t, u_int32_t);
+static SLOT *find(const TABLE *, const unsigned char *, const void *, size_t,
+                  u_int64_t);
+static int build_table(TABLE *, const unsigned char *, ENTRY *, size_t);
+static int place(TABLE *, ENTRY *, BUCKET *, size_t, size_t);
+static int entry_cmp(const void *, const void *);
+static int bucket_cmp(const void *, const void *);
+static size_t append(SNAPSHOT_BUILD *, int, const void *, size_t,
+                     const void *, size_t);
+
+extern int
+snapshot_open(SNAPSHOT *snap, const char *path)
+{
+    int fd, i;
+    struct stat st;
+    void *map;
+    SNAPSHOT_HDR *hdr;
+    SNAPSHOT_INDEX *index;
+
+    memset(snap, 0, sizeof(*snap));
+
+    if((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    if(fstat(fd, &st) < 0 || st.st_size < sizeof(SNAPSHOT_HDR)) {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+
+    hdr = map;
+    if(hdr->magic != SNAPSHOT_MAGIC
+       || hdr->version != SNAPSHOT_VERSION
+       || hdr->len != st.st_size
+       || hdr->items > hdr->len)
+    {
+        goto err;
+    }
+
+    for(i = 0; i < SNAPSHOT_NINDEX; i++) {
+        index = &hdr->index[i];
+        if(index->nslots == 0
+           || index->nbuckets == 0
+           || index->slots + (u_int64_t) index->nslots * sizeof(SLOT)
+               > hdr->items
+           || index->disps + (u_int64_t) index->nbuckets * sizeof(u_int32_t)
+               > hdr->items)
+        {
+            goto err;
+        }
+    }
+
+    snap->hdr = hdr;
+    snap->len = st.st_size;
+
+    return 0;
+
+err:
+    munmap(map, st.st_size);
+    return -1;
+}
+
+extern int
+snapshot_valid(const SNAPSHOT *snap)
+{
+    return (snap->hdr != NULL && snap->hdr->valid);
+}
+
+extern int
+snapshot_get(const SNAPSHOT *snap, int index, const void *key, size_t klen,
+             const void **val, size_t *vlen)
+{
+    TABLE table;
+    SLOT *slot;
+    ITEM *item;
+    unsigned char *base = (unsigned char *) snap->hdr, *items;
+
+    if(!snapshot_valid(snap) || index < 0 || index >= SNAPSHOT_NINDEX)
+        return -1;
+
+    table.nslots = snap->hdr->index[index].nslots;
+    table.nbuckets = snap->hdr->index[index].nbuckets;
+    table.slots = (SLOT *) (base + snap->hdr->index[index].slots);
+    table.disps = (u_int32_t *) (base + snap->hdr->index[index].disps);
+    items = base + snap->hdr->items;
+
+    slot = find(&table, items, key, klen, hash64(index, key, klen));
+    if(slot == NULL)
+        return 1;
+
+    /* Secondary items refer to the primary item holding the record. */
+    item = (ITEM *) (items + ((ITEM *) (items + slot->item))->ref);
+    *val = (unsigned char *) (item + 1) + item->klen;
+    *vlen = item->vlen;
+
+    return 0;
+}
+
+extern void
+snapshot_close(SNAPSHOT *snap)
+{
+    if(snap->hdr != NULL)
+        munmap(snap->hdr, snap->len);
+    memset(snap, 0, sizeof(*snap));
+}
+
+extern void
+snapshot_build_init(SNAPSHOT_BUILD *build)
+{
+    memset(build, 0, sizeof(*build));
+
+    /* Reserve the leading word so that no item is at offset zero. */
+    build->size = 4096;
+    build->items = xcalloc(1, build->size);
+    build->len = ALIGN(1);
+}
+
+extern void
+snapshot_build_add(SNAPSHOT_BUILD *build, const void *key, size_t klen,
+                   const void *val, size_t vlen)
+{
+    size_t off = append(build, 0, key, klen, val, vlen);
+
+    ((ITEM *) (build->items + off))->ref = off;
+}
+
+extern void
+snapshot_build_ref(SNAPSHOT_BUILD *build, int index, const void *key,
+                   size_t klen, const void *pkey, size_t pklen)
+{
+    /* The primary key is kept as the value until the tables are laid out. */
+    append(build, index, key, klen, pkey, pklen);
+}
+
+extern int
+snapshot_build_write(SNAPSHOT_BUILD *build, const char *path, int perms)
+{
+    SNAPSHOT_HDR *hdr = NULL;
+    TABLE tables[SNAPSHOT_NINDEX];
+    ENTRY *entries;
+    SLOT *slot;
+    ITEM *item;
+    u_int64_t len, off;
+    size_t i, n;
+    int index, ret = -1;
+
+    memset(tables, 0, sizeof(tables));
+    if(build->len > (u_int32_t) -1) {
+        warnx("snapshot %s too large", path);
+        return -1;
+    }
+
+    /*
+     * The primary table must be complete before the other indexes can
+     * resolve their primary keys against it. Keys without a primary
+     * record are dropped.
+     */
+    for(index = 0; index < SNAPSHOT_NINDEX; index++) {
+        entries = xcalloc(build->count[index] + 1, sizeof(*entries));
+        for(i = 0, n = 0; i < build->count[index]; i++) {
+            item = (ITEM *) (build->items + build->offsets[index][i]);
+
+            if(index > 0) {
+                slot = find(&tables[0], build->items,
+                            (unsigned char *) (item + 1) + item->klen,
+                            item->vlen,
+                            hash64(0, (unsigned char *) (item + 1)
+                                   + item->klen, item->vlen));
+                if(slot == NULL)
+                    continue;
+                item->ref = ((ITEM *) (build->items + slot->item))->ref;
+            }
+
+            entries[n].hash = hash64(index, item + 1, item->klen);
+            entries[n++].item = build->offsets[index][i];
+        }
+
+        ret = build_table(&tables[index], build->items, entries, n);
+        free(entries);
+        if(ret != 0) {
+            warnx("could not build snapshot index for %s", path);
+            goto cleanup;
+        }
+    }
+
+    len = sizeof(*hdr);
+    for(index = 0; index < SNAPSHOT_NINDEX; index++) {
+        len += ALIGN(tables[index].nslots * sizeof(SLOT));
+        len += ALIGN(tables[index].nbuckets * sizeof(u_int32_t));
+    }
+    len += build->len;
+
+    hdr = xcalloc(1, len);
+    hdr->magic = SNAPSHOT_MAGIC;
+    hdr->version = SNAPSHOT_VERSION;
+    hdr->valid = 0;
+    hdr->len = len;
+
+    off = sizeof(*hdr);
+    for(index = 0; index < SNAPSHOT_NINDEX; index++) {
+        hdr->index[index].nslots = tables[index].nslots;
+        hdr->index[index].nbuckets = tables[index].nbuckets;
+
+        hdr->index[index].slots = off;
+        memcpy((unsigned char *) hdr + off, tables[index].slots,
+               tables[index].nslots * sizeof(SLOT));
+        off += ALIGN(tables[index].nslots * sizeof(SLOT));
+
+        hdr->index[index].disps = off;
+        memcpy((unsigned char *) hdr + off, tables[index].disps,
+               tables[index].nbuckets * sizeof(u_int32_t));
+        off += ALIGN(tables[index].nbuckets * sizeof(u_int32_t));
+    }
+
+    hdr->items = off;
+    memcpy((unsigned char *) hdr + off, build->items, build->len);
+
+    hdr->valid = 1;
+    ret = replace_file(path, hdr, len, perms);
+
+cleanup:
+    for(index = 0; index < SNAPSHOT_NINDEX; index++) {
+        free(tables[index].slots);
+        free(tables[index].disps);
+    }
+    free(hdr);
+
+    return ret;
+}
+
+extern void
+snapshot_build_free(SNAPSHOT_BUILD *build)
+{
+    int index;
+
+    free(build->items);
+    for(index = 0; index < SNAPSHOT_NINDEX; index++)
+        free(build->offsets[index]);
+    memset(build, 0, sizeof(*build));
+}
+
+extern int
+snapshot_invalidate(const char *path)
+{
+    return clear_flag(path, offsetof(SNAPSHOT_HDR, valid));
+}
+
+/*
+ * Mix a key's hash with a bucket's displacement to give its slot.
+ */
+static u_int32_t
+position(u_int64_t hash, u_int32_t seed, u_int32_t nslots)
+{
+    u_int64_t h = hash + (u_int64_t) seed * 0x9e3779b97f4a7c15ULL;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return (u_int32_t) (h % nslots);
+}
+
+/*
+ * Returns the slot holding a key, or NULL if the key is absent. A perfect
+ * hash maps absent keys to arbitrary slots, so the key is always checked.
+ */
+static SLOT
+*find(const TABLE *table, const unsigned char *items, const void *key,
+      size_t klen, u_int64_t h)
+{
+    SLOT *slot;
+    ITEM *item;
+    u_int32_t bucket = (u_int32_t) (h >> 32) % table->nbuckets;
+
+    slot = &table->slots[position(h, table->disps[bucket], table->nslots)];
+    if(slot->item == 0 || slot->hash != (u_int32_t) h)
+        return NULL;
+
+    item = (ITEM *) (items + slot->item);
+    if(item->klen != klen || memcmp(item + 1, key, klen) != 0)
+        return NULL;
+
+    return slot;
+}
+
+/*
+ * Build a minimal perfect hash over the entries, in the manner of CHD.
+ * Where keys repeat, the first one added is kept.
+ */
+static int
+build_table(TABLE *table, const unsigned char *items, ENTRY *entries,
+            size_t n)
+{
+    BUCKET *buckets;
+    ITEM *a, *b;
+    size_t i, j, w, start, nbuckets = 0, max = 1;
+    int ret = -1;
+
+    table->nbuckets = n / BUCKET_SIZE + 1;
+    for(i = 0; i < n; i++)
+        entries[i].bucket = (u_int32_t) (entries[i].hash >> 32)
+            % table->nbuckets;
+
+    /* Group the keys by bucket, dropping repeats within each bucket. */
+    qsort(entries, n, sizeof(*entries), entry_cmp);
+    buckets = xcalloc(n + 1, sizeof(*buckets));
+    for(i = 0, w = 0, start = 0; i < n; i++) {
+        if(w > 0 && entries[i].bucket != entries[w - 1].bucket)
+            start = w;
+
+        a = (ITEM *) (items + entries[i].item);
+        for(j = start; j < w; j++) {
+            b = (ITEM *) (items + entries[j].item);
+            if(entries[j].hash == entries[i].hash
+               && a->klen == b->klen
+               && memcmp(a + 1, b + 1, a->klen) == 0)
+            {
+                break;
+            }
+        }
+
+        if(j < w)
+            continue;
+
+        if(w == start) {
+            buckets[nbuckets].bucket = entries[i].bucket;
+            buckets[nbuckets++].start = w;
+        }
+
+        buckets[nbuckets - 1].size++;
+        if(buckets[nbuckets - 1].size > max)
+            max = buckets[nbuckets - 1].size;
+        entries[w++] = entries[i];
+    }
+
+    /* Place the largest buckets while the most slots are free. */
+    qsort(buckets, nbuckets, sizeof(*buckets), bucket_cmp);
+
+    table->nslots = (w > 0 ? w : 1);
+    table->disps = xcalloc(table->nbuckets, sizeof(u_int32_t));
+    table->slots = NULL;
+
+    /* Should some bucket not fit, retry with a little slack. */
+    while(table->nslots < (u_int32_t) -1) {
+        table->slots = xrealloc(table->slots, table->nslots * sizeof(SLOT));
+        memset(table->slots, 0, table->nslots * sizeof(SLOT));
+        if(place(table, entries, buckets, nbuckets, max) == 0) {
+            ret = 0;
+            break;
+        }
+        table->nslots += table->nslots / 8 + 1;
+    }
+
+    free(buckets);
+    return ret;
+}
+
+/*
+ * Find a displacement for each bucket that puts its keys in distinct free
+ * slots.
+ */
+static int
+place(TABLE *table, ENTRY *entries, BUCKET *buckets, size_t nbuckets,
+      size_t max)
+{
+    u_int32_t *pos, seed;
+    size_t i, j, k;
+    int ret = 0;
+
+    pos = xcalloc(max, sizeof(*pos));
+
+    for(i = 0; i < nbuckets; i++) {
+        for(seed = 0; seed < MAX_SEED; seed++) {
+            for(j = 0; j < buckets[i].size; j++) {
+                pos[j] = position(entries[buckets[i].start + j].hash, seed,
+                                  table->nslots);
+                if(table->slots[pos[j]].item != 0)
+                    break;
+                for(k = 0; k < j && pos[k] != pos[j]; k++)
+                    ;
+                if(k < j)
+                    break;
+            }
+
+            if(j == buckets[i].size)
+                break;
+        }
+
+        if(seed == MAX_SEED) {
+            ret = -1;
+            break;
+        }
+
+        table->disps[buckets[i].bucket] = seed;
+        for(j = 0; j < buckets[i].size; j++) {
+            table->slots[pos[j]].hash =
+                (u_int32_t) entries[buckets[i].start + j].hash;
+            table->slots[pos[j]].item = entries[buckets[i].start + j].item;
+        }
+    }
+
+    free(pos);
+    return ret;
+}
+
+/*
+ * Order entries by bucket, then by the order they were added in.
+ */
+static int
+entry_cmp(const void *a, const void *b)
+{
+    const ENTRY *x = a, *y = b;
+
+    if(x->bucket != y->bucket)
+        return (x->bucket < y->bucket ? -1 : 1);
+    return (x->item < y->item ? -1 : (x->item > y->item));
+}
+
+/*
+ * Order buckets from largest to smallest.
+ */
+static int
+bucket_cmp(const void *a, const void *b)
+{
+    const BUCKET *x = a, *y = b;
+
+    if(x->size != y->size)
+        return (x->size > y->size ? -1 : 1);
+    return (x->bucket < y->bucket ? -1 : (x->bucket > y->bucket));
+}
+
+/*
+ * Append an item to the build, returning its offset.
+ */
+static size_t
+append(SNAPSHOT_BUILD *build, int index, const void *key, size_t klen,
+       const void *val, size_t vlen)
+{
+    ITEM *item;
+    size_t off = build->len, need = ALIGN(sizeof(*item) + klen + vlen);
+
+    while(build->len + need > build->size) {
+        build->items = xrealloc(build->items, build->size * 2);
+        memset(build->items + build->size, 0, build->size);
+        build->size *= 2;
+    }
+
+    if(build->count[index] == build->max[index]) {
+        build->max[index] = (build->max[index] ? build->max[index] * 2 : 64);
+        build->offsets[index] = xrealloc(
+            build->offsets[index], build->max[index] * sizeof(u_int64_t));
+    }
+
+    item = (ITEM *) (build->items + off);
+    item->klen = klen;
+    item->vlen = vlen;
+    item->ref = 0;
+    memcpy(item + 1, key, klen);
+    memcpy((unsigned char *) (item + 1) + klen, val, vlen);
+
+    build->offsets[index][build->count[index]++] = off;
+    build->len += need;
+
+    return off;
+}
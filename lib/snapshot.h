@@ -0,0 +1,119 @@
+/**
+ * @file snapshot.h
+ * @brief Immutable memory-mapped snapshot of a database.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SNAPSHOT_SUFFIX  ".snap"
+#define SNAPSHOT_MAGIC   0x504e4244  /* "DBNP" */
+#define SNAPSHOT_VERSION 3
+#define SNAPSHOT_NINDEX  2           /* Primary and secondary keys. */
+
+/*
+ * The snapshot file is a header, a minimal perfect hash table per index and
+ * the items the tables refer to. Each item is a key and value, plus the
+ * offset of the item holding the record, so a secondary key item refers to
+ * its primary item. As with the key filter, writers clear the valid flag in
+ * place so that readers still mapping an old snapshot stop trusting it.
+ */
+typedef struct SNAPSHOT_INDEX {
+    u_int32_t nslots;
+    u_int32_t nbuckets;
+    u_int64_t slots;        /* Offset of the slot array. */
+    u_int64_t disps;        /* Offset of the per-bucket displacements. */
+} SNAPSHOT_INDEX;
+
+typedef struct SNAPSHOT_HDR {
+    u_int32_t magic;
+    u_int32_t version;
+    volatile u_int32_t valid;
+    u_int32_t unused;
+    u_int64_t items;        /* Offset of the items. */
+    u_int64_t len;          /* Total length of the file. */
+    SNAPSHOT_INDEX index[SNAPSHOT_NINDEX];
+} SNAPSHOT_HDR;
+
+typedef struct SNAPSHOT {
+    SNAPSHOT_HDR *hdr;
+    size_t len;
+} SNAPSHOT;
+
+/*
+ * Items are accumulated in memory by the writer, which lays out the
+ * tables once every item is known.
+ */
+typedef struct SNAPSHOT_BUILD {
+    unsigned char *items;
+    size_t len;
+    size_t size;
+    u_int64_t *offsets[SNAPSHOT_NINDEX];
+    size_t count[SNAPSHOT_NINDEX];
+    size_t max[SNAPSHOT_NINDEX];
+} SNAPSHOT_BUILD;
+
+/**
+ * Map an existing snapshot read-only. Returns -1 if there is no usable
+ * snapshot, in which case every lookup must go to the database.
+ */
+extern int snapshot_open(SNAPSHOT *snap, const char *path);
+
+/**
+ * Returns 1 if the snapshot can currently answer lookups.
+ */
+extern int snapshot_valid(const SNAPSHOT *snap);
+
+/**
+ * Look up a packed key in the given index. On success, val and vlen point
+ * at the packed record within the mapping. Returns 0 if found, 1 if the
+ * key is definitely absent and -1 if the snapshot cannot be trusted.
+ */
+extern int snapshot_get(const SNAPSHOT *snap, int index, const void *key,
+                        size_t klen, const void **val, size_t *vlen);
+
+/**
+ *
+ */
+extern void snapshot_close(SNAPSHOT *snap);
+
+/**
+ *
+ */
+extern void snapshot_build_init(SNAPSHOT_BUILD *build);
+
+/**
+ * Add a primary key and its record.
+ */
+extern void snapshot_build_add(SNAPSHOT_BUILD *build, const void *key,
+                               size_t klen, const void *val, size_t vlen);
+
+/**
+ * Add a key in another index, referring to the record of a primary key.
+ */
+extern void snapshot_build_ref(SNAPSHOT_BUILD *build, int index,
+                               const void *key, size_t klen,
+                               const void *pkey, size_t pklen);
+
+/**
+ * Lay out the tables and atomically replace the snapshot at path.
+ */
+extern int snapshot_build_write(SNAPSHOT_BUILD *build, const char *path,
+                                int perms);
+
+/**
+ *
+ */
+extern void snapshot_build_free(SNAPSHOT_BUILD *build);
+
+/**
+ * Mark the snapshot at path as stale, if it exists.
+ */
+extern int snapshot_invalidate(const char *path);
+
+#endif
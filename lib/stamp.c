@@ -0,0 +1,132 @@
+/**
+ * @file stamp.c
+ * @brief Implements the database generation counter.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "stamp.h"
+#include "utils.h"
+
+static void stamp_path(char *, size_t, const char *);
+
+extern int
+stamp_open(STAMP *stamp, const char *base)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    void *map;
+    int fd;
+
+    memset(stamp, 0, sizeof(*stamp));
+    stamp_path(path, sizeof(path), base);
+
+    if((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    if(fstat(fd, &st) < 0 || st.st_size < sizeof(STAMP_HDR)) {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, sizeof(STAMP_HDR), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+
+    stamp->hdr = map;
+    if(stamp->hdr->magic != STAMP_MAGIC
+       || stamp->hdr->version != STAMP_VERSION)
+    {
+        stamp_close(stamp);
+        return -1;
+    }
+
+    return 0;
+}
+
+extern u_int64_t
+stamp_read(const STAMP *stamp)
+{
+    if(stamp->hdr == NULL)
+        return 0;
+
+    return __atomic_load_n(&stamp->hdr->generation, __ATOMIC_ACQUIRE);
+}
+
+extern int
+stamp_create(STAMP *stamp, const char *base)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    void *map;
+    int fd, ret = -1;
+
+    memset(stamp, 0, sizeof(*stamp));
+    stamp_path(path, sizeof(path), base);
+    if((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+        warn("open %s", path);
+        return -1;
+    }
+
+    if(fstat(fd, &st) < 0) {
+        warn("fstat %s", path);
+        goto cleanup;
+    }
+
+    if(st.st_size < sizeof(STAMP_HDR)
+       && ftruncate(fd, sizeof(STAMP_HDR)) < 0)
+    {
+        warn("ftruncate %s", path);
+        goto cleanup;
+    }
+
+    map = mmap(NULL, sizeof(STAMP_HDR), PROT_READ | PROT_WRITE, MAP_SHARED,
+               fd, 0);
+    if(map == MAP_FAILED) {
+        warn("mmap %s", path);
+        goto cleanup;
+    }
+
+    /* A freshly created stamp is all zeroes. */
+    stamp->hdr = map;
+    stamp->hdr->magic = STAMP_MAGIC;
+    stamp->hdr->version = STAMP_VERSION;
+    ret = 0;
+
+cleanup:
+    close(fd);
+    return ret;
+}
+
+extern void
+stamp_incr(STAMP *stamp)
+{
+    if(stamp->hdr != NULL)
+        __atomic_add_fetch(&stamp->hdr->generation, 1, __ATOMIC_RELEASE);
+}
+
+extern void
+stamp_close(STAMP *stamp)
+{
+    if(stamp->hdr != NULL)
+        munmap(stamp->hdr, sizeof(STAMP_HDR));
+    stamp->hdr = NULL;
+}
+
+static void
+stamp_path(char *path, size_t len, const char *base)
+{
+    size_t blen = strlen(base);
+
+    snprintf(path, len, "%s%s%s", base,
+             (blen > 0 && base[blen - 1] == '/' ? "" : "/"), STAMP_FILE);
+}
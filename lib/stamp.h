@@ -0,0 +1,56 @@
+/**
+ * @file stamp.h
+ * @brief Memory-mapped database generation counter.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef STAMP_H
+#define STAMP_H
+
+#include <sys/types.h>
+
+#define STAMP_FILE    "dbng.stamp"
+#define STAMP_MAGIC   0x534e4244  /* "DBNS" */
+#define STAMP_VERSION 1
+
+/*
+ * The stamp lives in the base directory and is only ever updated in place,
+ * so a reader's mapping never goes stale.
+ */
+typedef struct STAMP_HDR {
+    u_int32_t magic;
+    u_int32_t version;
+    u_int64_t generation;
+} STAMP_HDR;
+
+typedef struct STAMP {
+    STAMP_HDR *hdr;
+} STAMP;
+
+/**
+ * Map the stamp in base read-only. Returns -1 if it does not exist yet.
+ */
+extern int stamp_open(STAMP *stamp, const char *base);
+
+/**
+ * Return the current generation, or 0 if the stamp is not mapped.
+ */
+extern u_int64_t stamp_read(const STAMP *stamp);
+
+/**
+ * Map the stamp in base for writing, creating it if needed.
+ */
+extern int stamp_create(STAMP *stamp, const char *base);
+
+/**
+ * Increment the generation of a stamp mapped with stamp_create.
+ */
+extern void stamp_incr(STAMP *stamp);
+
+/**
+ *
+ */
+extern void stamp_close(STAMP *stamp);
+
+#endif
@@ -0,0 +1,211 @@
+/**
+ * @file table.c
+ * @brief Implements the daemon's shared-memory answer table.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "table.h"
+#include "utils.h"
+
+static TABLE_SLOT *slot_for(const TABLE *, const void *, size_t);
+
+extern int
+table_create(TABLE *table, const char *path, u_int32_t nslots, int perms)
+{
+    char tmp[PATH_MAX];
+    size_t len;
+    void *map;
+    int fd;
+
+    memset(table, 0, sizeof(*table));
+    len = sizeof(TABLE_HDR) + (size_t) nslots * sizeof(TABLE_SLOT);
+
+    snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long) getpid());
+    if((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, perms)) < 0) {
+        warn("open %s", tmp);
+        return -1;
+    }
+
+    /* The file is sparse, and only slots which are written take memory. */
+    if(ftruncate(fd, len) < 0) {
+        warn("ftruncate %s", tmp);
+        goto err;
+    }
+
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED) {
+        warn("mmap %s", tmp);
+        goto err;
+    }
+    close(fd);
+
+    table->hdr = map;
+    table->slots = (TABLE_SLOT *) (table->hdr + 1);
+    table->len = len;
+    table->hdr->magic = TABLE_MAGIC;
+    table->hdr->version = TABLE_VERSION;
+    table->hdr->nslots = nslots;
+    __atomic_store_n(&table->hdr->valid, 1, __ATOMIC_RELEASE);
+
+    if(rename(tmp, path) < 0) {
+        warn("rename %s", tmp);
+        table_close(table);
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+
+err:
+    close(fd);
+    unlink(tmp);
+    return -1;
+}
+
+extern int
+table_open(TABLE *table, const char *path)
+{
+    struct stat st;
+    void *map;
+    TABLE_HDR *hdr;
+    int fd;
+
+    memset(table, 0, sizeof(*table));
+
+    if((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    if(fstat(fd, &st) < 0 || st.st_size < sizeof(TABLE_HDR)) {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+
+    hdr = map;
+    if(hdr->magic != TABLE_MAGIC
+       || hdr->version != TABLE_VERSION
+       || hdr->nslots == 0
+       || sizeof(TABLE_HDR) + (u_int64_t) hdr->nslots * sizeof(TABLE_SLOT)
+           != st.st_size)
+    {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    table->hdr = hdr;
+    table->slots = (TABLE_SLOT *) (hdr + 1);
+    table->len = st.st_size;
+
+    return 0;
+}
+
+extern int
+table_valid(const TABLE *table)
+{
+    return (table->hdr != NULL
+            && __atomic_load_n(&table->hdr->valid, __ATOMIC_ACQUIRE));
+}
+
+extern int
+table_get(const TABLE *table, u_int64_t gen, const void *key, size_t klen,
+          void *val, size_t *vlen)
+{
+    TABLE_SLOT *slot;
+    u_int32_t seq;
+    u_int16_t sklen, svlen;
+    unsigned char data[TABLE_DATA_MAX];
+
+    if(!table_valid(table) || gen == 0 || klen > TABLE_DATA_MAX)
+        return 1;
+
+    slot = slot_for(table, key, klen);
+
+    seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    if(seq & 1)
+        return 1;
+
+    /*
+     * The lengths may be torn by a concurrent write, so are checked before
+     * use and the whole copy discarded if the slot changed meanwhile.
+     */
+    sklen = slot->klen;
+    svlen = slot->vlen;
+    if(slot->gen != gen
+       || sklen != klen
+       || (size_t) sklen + svlen > TABLE_DATA_MAX)
+    {
+        return 1;
+    }
+    memcpy(data, slot->data, sklen + svlen);
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+        return 1;
+
+    if(memcmp(data, key, klen) != 0)
+        return 1;
+
+    memcpy(val, data + klen, svlen);
+    *vlen = svlen;
+
+    return 0;
+}
+
+extern void
+table_put(TABLE *table, u_int64_t gen, const void *key, size_t klen,
+          const void *val, size_t vlen)
+{
+    TABLE_SLOT *slot;
+    u_int32_t seq;
+
+    if(table->hdr == NULL || klen + vlen > TABLE_DATA_MAX)
+        return;
+
+    slot = slot_for(table, key, klen);
+    seq = slot->seq;
+
+    __atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->gen = gen;
+    slot->klen = klen;
+    slot->vlen = vlen;
+    memcpy(slot->data, key, klen);
+    memcpy(slot->data + klen, val, vlen);
+
+    __atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+extern void
+table_invalidate(TABLE *table)
+{
+    if(table->hdr != NULL)
+        __atomic_store_n(&table->hdr->valid, 0, __ATOMIC_RELEASE);
+}
+
+extern void
+table_close(TABLE *table)
+{
+    if(table->hdr != NULL)
+        munmap(table->hdr, table->len);
+    memset(table, 0, sizeof(*table));
+}
+
+static TABLE_SLOT
+*slot_for(const TABLE *table, const void *key, size_t klen)
+{
+    return &table->slots[hash64(0, key, klen) % table->hdr->nslots];
+}
@@ -0,0 +1,91 @@
+/**
+ * @file table.h
+ * @brief Shared-memory table of answers published by the lookup daemon.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define TABLE_FILE      "dbngd.table"
+#define TABLE_MAGIC     0x54474e44  /* "DNGT" */
+#define TABLE_VERSION   1
+#define TABLE_SLOT_SIZE 512
+
+/*
+ * The table is a direct-mapped cache of recent answers, written only by
+ * the daemon and read without locks. Each slot is guarded by a sequence
+ * number which is odd while the slot is being written, so a reader
+ * copies the slot out and only trusts the copy if the sequence number
+ * was even and unchanged throughout. Answers are tagged with the database
+ * generation they were read at, and only used at that generation.
+ */
+typedef struct TABLE_SLOT {
+    volatile u_int32_t seq;
+    u_int16_t klen;
+    u_int16_t vlen;
+    u_int64_t gen;
+    unsigned char data[TABLE_SLOT_SIZE - 16];   /* Key then record. */
+} TABLE_SLOT;
+
+#define TABLE_DATA_MAX (sizeof(((TABLE_SLOT *) 0)->data))
+
+typedef struct TABLE_HDR {
+    u_int32_t magic;
+    u_int32_t version;
+    volatile u_int32_t valid;
+    u_int32_t nslots;
+} TABLE_HDR;
+
+typedef struct TABLE {
+    TABLE_HDR *hdr;
+    TABLE_SLOT *slots;
+    size_t len;
+} TABLE;
+
+/**
+ * Create an empty table of nslots at path, mapped for writing, replacing
+ * any table left by a previous daemon.
+ */
+extern int table_create(TABLE *table, const char *path, u_int32_t nslots,
+                        int perms);
+
+/**
+ * Map the table at path read-only. Returns -1 if there is no usable table.
+ */
+extern int table_open(TABLE *table, const char *path);
+
+/**
+ * Returns 1 while the daemon which created the table is publishing to it.
+ */
+extern int table_valid(const TABLE *table);
+
+/**
+ * Copy the record stored under key at generation gen into val, which must
+ * hold TABLE_DATA_MAX bytes. Returns 0 if found and 1 otherwise.
+ */
+extern int table_get(const TABLE *table, u_int64_t gen, const void *key,
+                     size_t klen, void *val, size_t *vlen);
+
+/**
+ * Publish a record under key, replacing whatever shared its slot. Records
+ * too large for a slot are not published.
+ */
+extern void table_put(TABLE *table, u_int64_t gen, const void *key,
+                      size_t klen, const void *val, size_t vlen);
+
+/**
+ * Stop readers trusting a table created with table_create.
+ */
+extern void table_invalidate(TABLE *table);
+
+/**
+ *
+ */
+extern void table_close(TABLE *table);
+
+#endif
@@ -3,6 +3,12 @@
  *
  */
 
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
 #include "utils.h"
 
 extern void
@@ -29,6 +35,18 @@ extern void
     return res;
 }
 
+extern void
+*xrealloc(void *p, size_t size)
+{
+    void *res = NULL;
+
+    res = realloc(p, size);
+    if(res == NULL)
+        err(1, "realloc");
+
+    return res;
+}
+
 extern void
 xfree(void **p)
 {
@@ -36,3 +54,92 @@ xfree(void **p)
         free(*p);
     *p = NULL;
 }
+
+/*
+ * 64-bit FNV-1a seeded by the given value, with a final avalanche so that
+ * both halves can be used independently.
+ */
+extern u_int64_t
+hash64(int seed, const void *key, size_t len)
+{
+    const unsigned char *k = key;
+    u_int64_t h = 0xcbf29ce484222325ULL ^ (u_int64_t) (seed + 1);
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        h ^= k[i];
+        h *= 0x100000001b3ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+extern int
+replace_file(const char *path, const void *data, size_t len, int perms)
+{
+    char tmp[PATH_MAX];
+    const char *p;
+    size_t remaining;
+    ssize_t n;
+    int fd;
+
+    snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long) getpid());
+    if((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, perms)) < 0) {
+        warn("open %s", tmp);
+        return -1;
+    }
+
+    for(p = data, remaining = len; remaining > 0; p += n, remaining -= n) {
+        if((n = write(fd, p, remaining)) < 0) {
+            if(errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            warn("write %s", tmp);
+            goto err;
+        }
+    }
+
+    if(fsync(fd) < 0 || close(fd) < 0) {
+        warn("close %s", tmp);
+        fd = -1;
+        goto err;
+    }
+
+    /* Readers opening the path from now on see the complete new file. */
+    if(rename(tmp, path) < 0) {
+        warn("rename %s", tmp);
+        fd = -1;
+        goto err;
+    }
+
+    return 0;
+
+err:
+    if(fd >= 0)
+        close(fd);
+    unlink(tmp);
+    return -1;
+}
+
+extern int
+clear_flag(const char *path, off_t offset)
+{
+    int fd, ret = 0;
+    u_int32_t flag = 0;
+
+    if((fd = open(path, O_WRONLY)) < 0)
+        return (errno == ENOENT ? 0 : -1);
+
+    if(pwrite(fd, &flag, sizeof(flag), offset) != sizeof(flag))
+        ret = -1;
+
+    close(fd);
+    return ret;
+}
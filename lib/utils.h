@@ -10,9 +10,29 @@
 
 #include <stdlib.h>
 #include <err.h>
+#include <sys/types.h>
 
 extern void *xmalloc(size_t size);
 extern void *xcalloc(size_t nmemb, size_t size);
+extern void *xrealloc(void *p, size_t size);
 extern void xfree(void **p);
 
+/**
+ * Hash a key, with each seed giving an independent function.
+ */
+extern u_int64_t hash64(int seed, const void *key, size_t len);
+
+/**
+ * Atomically replace the file at path with the given contents, so that
+ * readers opening it see either the old or the new file in full.
+ */
+extern int replace_file(const char *path, const void *data, size_t len,
+                        int perms);
+
+/**
+ * Clear the 32-bit flag at offset within the file at path in place, if
+ * the file exists.
+ */
+extern int clear_flag(const char *path, off_t offset);
+
 #endif
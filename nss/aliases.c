@@ -0,0 +1,202 @@
+/**
+ * @file aliases.c
+ * @brief Implements the functions to retrieve mail aliases.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include "nss-dbng.h"
+
+#include <aliases.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "../lib/service-aliases.h"
+#include "handle.h"
+
+/*
+ * Free-threaded, read-only handle shared by all lookups and enumerations
+ * in this process, reopened once dbngctl modifies the databases.
+ */
+static HANDLE Alias_handle = HANDLE_INITIALIZER(TYPE_ALIASES);
+
+/*
+ * Each enumerating thread has its own cursor over the lookup handle, so
+ * concurrent getaliasent scans neither block nor disturb each other.
+ */
+static __thread HANDLE_CURSOR Alias_cursor;
+static __thread int ent_init;
+
+/* Buffer size needed by the last record which did not fit, or 0. */
+static __thread size_t ent_size;
+
+static enum nss_status fill_aliasent(struct aliasent *, char *, size_t,
+                                     ALIASES_REC *, int *);
+static size_t aliasent_size(const ALIASES_REC *);
+
+enum nss_status
+_nss_dbng_setaliasent(void)
+{
+    /* Restart any enumeration already in progress on this thread. */
+    handle_cursor_close(&Alias_handle, &Alias_cursor);
+    if(handle_acquire(&Alias_handle) == NULL)
+        return NSS_STATUS_UNAVAIL;
+    handle_release(&Alias_handle);
+    ent_init = 1;
+
+    return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status
+_nss_dbng_endaliasent(void)
+{
+    if(ent_init) {
+        handle_cursor_close(&Alias_handle, &Alias_cursor);
+        ent_init = 0;
+    }
+
+    return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status
+_nss_dbng_getaliasent_r(struct aliasent *result, char *buf, size_t buflen,
+                        int *errnop)
+{
+    ALIASES_KEY key;
+    ALIASES_REC rec;
+    int res;
+    enum nss_status status;
+
+    if(!ent_init || handle_acquire(&Alias_handle) == NULL) {
+        *errnop = ENOENT;
+        return NSS_STATUS_NOTFOUND;
+    }
+
+    res = handle_cursor_next(&Alias_handle, &Alias_cursor,
+                             (KEY *) &key, (REC *) &rec);
+    switch(res) {
+    case 0:
+        status = fill_aliasent(result, buf, buflen, &rec, errnop);
+        if(status == NSS_STATUS_TRYAGAIN) {
+            /* Hand the same record out again once the caller has room. */
+            handle_cursor_unget(&Alias_handle, &Alias_cursor);
+            ent_size = aliasent_size(&rec);
+        }
+        else {
+            ent_size = 0;
+        }
+        break;
+
+    case DB_NOTFOUND:
+        *errnop = ENOENT;
+        status = NSS_STATUS_NOTFOUND;
+        goto cleanup;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        goto cleanup;
+
+    default:
+        NSS_DEBUG("unknown status from next: %d", res);
+        *errnop = ENOENT;
+        status = NSS_STATUS_NOTFOUND;
+        goto cleanup;
+    }
+
+cleanup:
+    handle_release(&Alias_handle);
+    return status;
+}
+
+/**
+ * Return the buffer size needed by the entry for which getaliasent_r last
+ * failed with ERANGE on this thread, or 0 if the last call succeeded.
+ */
+size_t
+_nss_dbng_getaliasent_size(void)
+{
+    return ent_size;
+}
+
+enum nss_status
+_nss_dbng_getaliasbyname_r(const char *name, struct aliasent *result,
+                           char *buf, size_t buflen, int *errnop)
+{
+    ALIASES_KEY key;
+    ALIASES_REC rec;
+    int res;
+
+    key.base.type = PRI;
+    key.data.pri = (char *) name;
+
+    res = handle_lookup(&Alias_handle, (KEY *) &key, (REC *) &rec);
+    switch(res) {
+    case 0:
+        NSS_DEBUG("found alias by name %s", name);
+        return fill_aliasent(result, buf, buflen, &rec, errnop);
+
+    case DB_NOTFOUND:
+        *errnop = ENOENT;
+        return NSS_STATUS_NOTFOUND;
+
+    case -1:
+        *errnop = ENOENT;
+        return NSS_STATUS_UNAVAIL;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        return NSS_STATUS_TRYAGAIN;
+
+    default:
+        NSS_DEBUG("unknown status from get: %d", res);
+        *errnop = ENOENT;
+        return NSS_STATUS_NOTFOUND;
+    }
+}
+
+static enum nss_status
+fill_aliasent(struct aliasent *result, char *buf, size_t buflen,
+              ALIASES_REC *rec, int *errnop)
+{
+    size_t align;
+    char *strings;
+    int i;
+
+    /* The member pointers lead the buffer, so must be suitably aligned. */
+    align = (sizeof(char *) - ((uintptr_t) buf % sizeof(char *)))
+        % sizeof(char *);
+
+    if(buflen < align + aliasent_size(rec)) {
+        *errnop = ERANGE;
+        return NSS_STATUS_TRYAGAIN;
+    }
+
+    result->alias_members = (char **) (buf + align);
+    strings = (char *) (result->alias_members + rec->count + 1);
+
+    /* The stored string block is already laid out as glibc expects. */
+    memcpy(strings, rec->base.block, rec->base.block_len);
+    result->alias_name = NSS_DBNG_RELOC(strings, rec, rec->name);
+
+    for(i = 0; i < rec->count && rec->members[i] != NULL; i++) {
+        result->alias_members[i] =
+            NSS_DBNG_RELOC(strings, rec, rec->members[i]);
+    }
+    result->alias_members[i] = NULL;
+    result->alias_members_len = i;
+    result->alias_local = 1;
+
+    return NSS_STATUS_SUCCESS;
+}
+
+/*
+ * The space taken by an entry in an aligned buffer: the null-terminated
+ * member pointers followed by the string block.
+ */
+static size_t
+aliasent_size(const ALIASES_REC *rec)
+{
+    return (rec->count + 1) * sizeof(char *) + rec->base.block_len;
+}
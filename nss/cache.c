@@ -0,0 +1,314 @@
+/**
+ * @file cache.c
+ * @brief Implements the in-process record cache.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include "nss-dbng.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "cache.h"
+
+#define NSHARDS 16
+
+/*
+ * Entries hold the packed key (prefixed by its key type) followed by the
+ * packed record, exactly as they would be read from the database.
+ */
+typedef struct ENTRY ENTRY;
+struct ENTRY {
+    ENTRY *hnext;
+    ENTRY *prev;
+    ENTRY *next;
+    u_int64_t gen;
+    u_int32_t hash;
+    size_t klen;
+    size_t vlen;
+    unsigned char data[];
+};
+
+/* Each shard is an independent LRU, so lookups rarely contend. */
+typedef struct SHARD {
+    pthread_mutex_t lock;
+    ENTRY **buckets;
+    size_t nbuckets;
+    size_t count;
+    size_t max;
+    ENTRY *head;
+    ENTRY *tail;
+} SHARD;
+
+struct CACHE {
+    SHARD shards[NSHARDS];
+};
+
+/* Per-thread copy of the last record served from a cache. */
+typedef struct HIT {
+    unsigned char *data;
+    size_t len;
+} HIT;
+
+static pthread_key_t Hit_key;
+static pthread_once_t Hit_once = PTHREAD_ONCE_INIT;
+
+static unsigned char *hit_buf(size_t);
+static void hit_init(void);
+static void hit_free(void *);
+static u_int32_t hash(const unsigned char *, size_t);
+static ENTRY *find(SHARD *, u_int32_t, const unsigned char *, size_t);
+static void unlink_entry(SHARD *, ENTRY *);
+static void push_front(SHARD *, ENTRY *);
+static void insert(SHARD *, ENTRY *);
+
+extern CACHE
+*cache_new(size_t size)
+{
+    CACHE *cache;
+    SHARD *shard;
+    int i;
+
+    if(size == 0 || (cache = calloc(1, sizeof(*cache))) == NULL)
+        return NULL;
+
+    for(i = 0; i < NSHARDS; i++) {
+        shard = &cache->shards[i];
+        pthread_mutex_init(&shard->lock, NULL);
+        shard->max = (size + NSHARDS - 1) / NSHARDS;
+        for(shard->nbuckets = 1;
+            shard->nbuckets < shard->max;
+            shard->nbuckets <<= 1)
+            ;
+        shard->buckets = calloc(shard->nbuckets, sizeof(ENTRY *));
+        if(shard->buckets == NULL) {
+            while(i-- > 0)
+                free(cache->shards[i].buckets);
+            free(cache);
+            return NULL;
+        }
+    }
+
+    return cache;
+}
+
+extern int
+cache_get_rec(CACHE *cache, u_int64_t gen, SERVICE *service, KEY *key,
+              REC *rec)
+{
+    u_int32_t h;
+    int ret;
+    size_t klen, vlen;
+    DBT dbkey, dbval;
+    SHARD *shard;
+    ENTRY *e;
+    unsigned char *buf;
+
+    /* Without a generation, changes to the databases cannot be noticed. */
+    if(cache == NULL || gen == 0)
+        return service->get(service, key, rec);
+
+    /* Build the cache key from the key type and the packed key. */
+    klen = service->key_size(service, key) + 1;
+    unsigned char kbuf[klen];
+    memset(kbuf, 0, klen);
+    kbuf[0] = (unsigned char) key->type;
+    memset(&dbkey, 0, sizeof(dbkey));
+    dbkey.data = kbuf + 1;
+    dbkey.size = klen - 1;
+    service->pack_key(service, key, &dbkey);
+
+    h = hash(kbuf, klen);
+    shard = &cache->shards[h % NSHARDS];
+
+    pthread_mutex_lock(&shard->lock);
+    if((e = find(shard, h, kbuf, klen)) != NULL) {
+        if(e->gen == gen && (buf = hit_buf(e->vlen)) != NULL) {
+            unlink_entry(shard, e);
+            push_front(shard, e);
+            memcpy(buf, e->data + e->klen, (vlen = e->vlen));
+            pthread_mutex_unlock(&shard->lock);
+
+            memset(&dbval, 0, sizeof(dbval));
+            dbval.data = buf;
+            dbval.size = vlen;
+            service->unpack_rec(service, rec, &dbval);
+
+            return (service->validate(service, key, rec) ? 0 : DB_NOTFOUND);
+        }
+        else if(e->gen != gen) {
+            /* The databases have changed since this entry was cached. */
+            unlink_entry(shard, e);
+            free(e);
+        }
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if((ret = service->get(service, key, rec)) != 0)
+        return ret;
+
+    vlen = service->rec_size(service, rec);
+    if((e = malloc(sizeof(*e) + klen + vlen)) == NULL)
+        return ret;
+
+    e->gen = gen;
+    e->hash = h;
+    e->klen = klen;
+    e->vlen = vlen;
+    memcpy(e->data, kbuf, klen);
+    memset(e->data + klen, 0, vlen);
+    memset(&dbval, 0, sizeof(dbval));
+    dbval.data = e->data + klen;
+    dbval.size = vlen;
+    service->pack_rec(service, rec, &dbval);
+
+    pthread_mutex_lock(&shard->lock);
+    insert(shard, e);
+    pthread_mutex_unlock(&shard->lock);
+
+    return ret;
+}
+
+static unsigned char
+*hit_buf(size_t len)
+{
+    HIT *hit;
+    unsigned char *data;
+
+    pthread_once(&Hit_once, hit_init);
+    if((hit = pthread_getspecific(Hit_key)) == NULL) {
+        if((hit = calloc(1, sizeof(*hit))) == NULL)
+            return NULL;
+        pthread_setspecific(Hit_key, hit);
+    }
+
+    if(hit->len < len) {
+        if((data = realloc(hit->data, len)) == NULL)
+            return NULL;
+        hit->data = data;
+        hit->len = len;
+    }
+
+    return hit->data;
+}
+
+static void
+hit_init(void)
+{
+    pthread_key_create(&Hit_key, hit_free);
+}
+
+static void
+hit_free(void *data)
+{
+    HIT *hit = data;
+
+    free(hit->data);
+    free(hit);
+}
+
+static u_int32_t
+hash(const unsigned char *data, size_t len)
+{
+    u_int32_t h = 2166136261U;
+    size_t i;
+
+    for(i = 0; i < len; i++) {
+        h ^= data[i];
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+static ENTRY
+*find(SHARD *shard, u_int32_t h, const unsigned char *key, size_t klen)
+{
+    ENTRY *e;
+
+    for(e = shard->buckets[(h / NSHARDS) & (shard->nbuckets - 1)];
+        e != NULL;
+        e = e->hnext)
+    {
+        if(e->hash == h && e->klen == klen && !memcmp(e->data, key, klen))
+            return e;
+    }
+
+    return NULL;
+}
+
+/*
+ * Remove an entry from both its hash chain and the LRU list.
+ */
+static void
+unlink_entry(SHARD *shard, ENTRY *e)
+{
+    ENTRY **p;
+
+    for(p = &shard->buckets[(e->hash / NSHARDS) & (shard->nbuckets - 1)];
+        *p != NULL;
+        p = &(*p)->hnext)
+    {
+        if(*p == e) {
+            *p = e->hnext;
+            break;
+        }
+    }
+
+    if(e->prev != NULL)
+        e->prev->next = e->next;
+    else
+        shard->head = e->next;
+
+    if(e->next != NULL)
+        e->next->prev = e->prev;
+    else
+        shard->tail = e->prev;
+
+    shard->count--;
+}
+
+/*
+ * Link an entry at the head of the LRU list and into its hash chain.
+ */
+static void
+push_front(SHARD *shard, ENTRY *e)
+{
+    ENTRY **bucket;
+
+    bucket = &shard->buckets[(e->hash / NSHARDS) & (shard->nbuckets - 1)];
+    e->hnext = *bucket;
+    *bucket = e;
+
+    e->prev = NULL;
+    e->next = shard->head;
+    if(shard->head != NULL)
+        shard->head->prev = e;
+    shard->head = e;
+    if(shard->tail == NULL)
+        shard->tail = e;
+
+    shard->count++;
+}
+
+static void
+insert(SHARD *shard, ENTRY *e)
+{
+    ENTRY *old;
+
+    /* Another thread may have cached the same key in the meantime. */
+    if((old = find(shard, e->hash, e->data, e->klen)) != NULL) {
+        unlink_entry(shard, old);
+        free(old);
+    }
+
+    push_front(shard, e);
+
+    while(shard->count > shard->max && shard->tail != NULL) {
+        old = shard->tail;
+        unlink_entry(shard, old);
+        free(old);
+    }
+}
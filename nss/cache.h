@@ -0,0 +1,34 @@
+/**
+ * @file cache.h
+ * @brief In-process cache of recently resolved records.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "../lib/service.h"
+
+#ifndef CACHE_SIZE
+#  define CACHE_SIZE 0
+#endif
+
+typedef struct CACHE CACHE;
+
+/**
+ * Create a cache holding at most size records, or return NULL (a disabled
+ * cache) if size is zero.
+ */
+extern CACHE *cache_new(size_t size);
+
+/**
+ * Fetch a record like service_get_rec, answering from the cache when it
+ * holds an entry for the key from the given database generation. The
+ * cache is bypassed for generation 0, when there is no stamp. The record
+ * points into a per-thread buffer until the thread's next lookup.
+ */
+extern int cache_get_rec(CACHE *cache, u_int64_t gen, SERVICE *service,
+                         KEY *key, REC *rec);
+
+#endif
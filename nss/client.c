@@ -0,0 +1,404 @@
+/**
+ * @file client.c
+ * @brief Implements lookups through the dbngd lookup daemon.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include "nss-dbng.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "client.h"
+#include "../lib/daemon.h"
+#include "../lib/table.h"
+#include "../lib/service-passwd.h"
+#include "../lib/service-group.h"
+
+#define CLIENT_SOCKET  DEFAULT_BASE "/" DAEMON_SOCKET
+#define CLIENT_TABLE   DEFAULT_BASE "/" TABLE_FILE
+#define CLIENT_TIMEOUT 2    /* Seconds to wait for the daemon to answer. */
+
+/* Per-thread buffer holding the last record answered by the daemon. */
+typedef struct BUF {
+    unsigned char *data;
+    size_t len;
+} BUF;
+
+/* A lookup waiting to be sent to the daemon as part of a batch. */
+typedef struct QUERY {
+    const unsigned char *key;
+    size_t klen;
+    BUF *buf;
+    DAEMON_ANSWER answer;
+    int failed;
+    int done;
+} QUERY;
+
+/*
+ * Services used only for their key and record packing and validation;
+ * their databases are never opened.
+ */
+static SERVICE Passwd, Group;
+static pthread_once_t Client_once = PTHREAD_ONCE_INIT;
+static pthread_key_t Buf_key;
+
+/* The table mapping, replaced once the daemon that created it exits. */
+static pthread_rwlock_t tlock = PTHREAD_RWLOCK_INITIALIZER;
+static TABLE Table;
+static time_t table_retry;
+
+/*
+ * The connection is shared by every thread. Whichever thread finds it idle
+ * sends all the queries pending at that moment in one request, while the
+ * others wait for their answers.
+ */
+static pthread_mutex_t cmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ccond = PTHREAD_COND_INITIALIZER;
+static QUERY *Pending[DAEMON_BATCH_MAX];
+static int Npending;
+static int Busy;
+static int Sock = -1;
+static time_t sock_retry;
+
+static void client_init(void);
+static SERVICE *client_service(enum TYPE);
+static BUF *buf_get(size_t);
+static void buf_free(void *);
+static int table_lookup(u_int64_t, const unsigned char *, size_t, BUF *,
+                        size_t *);
+static int ask(QUERY *);
+static void exchange(QUERY **, int);
+static int connect_daemon(void);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+
+extern int
+client_get(enum TYPE type, u_int64_t gen, KEY *key, REC *rec)
+{
+    SERVICE *service;
+    QUERY query;
+    DBT dbval;
+    BUF *buf;
+    size_t klen, vlen;
+
+    pthread_once(&Client_once, client_init);
+    if((service = client_service(type)) == NULL)
+        return -1;
+
+    if((klen = daemon_key_size(service, key)) > DAEMON_KEY_MAX
+       || (buf = buf_get(TABLE_DATA_MAX)) == NULL)
+    {
+        return -1;
+    }
+
+    unsigned char kbuf[klen];
+    daemon_key(service, key, kbuf);
+
+    if(table_lookup(gen, kbuf, klen, buf, &vlen) != 0) {
+        memset(&query, 0, sizeof(query));
+        query.key = kbuf;
+        query.klen = klen;
+        query.buf = buf;
+
+        /*
+         * An answer read before the caller's generation may predate a
+         * change the caller has already seen, so the databases are read
+         * directly instead, as they are for a stale table entry.
+         */
+        if(ask(&query) != 0 || query.answer.status == -1
+           || query.answer.gen < gen)
+        {
+            return -1;
+        }
+        else if(query.answer.status != 0)
+            return query.answer.status;
+        vlen = query.answer.vlen;
+    }
+
+    memset(&dbval, 0, sizeof(dbval));
+    dbval.data = buf->data;
+    dbval.size = vlen;
+    service->unpack_rec(service, rec, &dbval);
+
+    return (service->validate(service, key, rec) ? 0 : DB_NOTFOUND);
+}
+
+static void
+client_init(void)
+{
+    service_passwd_init(&Passwd);
+    service_group_init(&Group);
+    pthread_key_create(&Buf_key, buf_free);
+
+    if(pthread_atfork(fork_prepare, fork_parent, fork_child) != 0)
+        NSS_ERROR("could not register fork handlers");
+}
+
+static SERVICE
+*client_service(enum TYPE type)
+{
+    switch(type) {
+    case TYPE_PASSWD:
+        return &Passwd;
+
+    case TYPE_GROUP:
+        return &Group;
+
+    default:
+        return NULL;
+    }
+}
+
+static BUF
+*buf_get(size_t len)
+{
+    BUF *buf;
+    unsigned char *data;
+
+    if((buf = pthread_getspecific(Buf_key)) == NULL) {
+        if((buf = calloc(1, sizeof(*buf))) == NULL)
+            return NULL;
+        pthread_setspecific(Buf_key, buf);
+    }
+
+    if(buf->len < len) {
+        if((data = realloc(buf->data, len)) == NULL)
+            return NULL;
+        buf->data = data;
+        buf->len = len;
+    }
+
+    return buf;
+}
+
+static void
+buf_free(void *data)
+{
+    BUF *buf = data;
+
+    free(buf->data);
+    free(buf);
+}
+
+/*
+ * Look a key up in the shared table, mapping it again at most once a
+ * second while the daemon is not publishing to it.
+ */
+static int
+table_lookup(u_int64_t gen, const unsigned char *key, size_t klen, BUF *buf,
+             size_t *vlen)
+{
+    int ret = 1, valid;
+    time_t now;
+
+    pthread_rwlock_rdlock(&tlock);
+    if((valid = table_valid(&Table)))
+        ret = table_get(&Table, gen, key, klen, buf->data, vlen);
+    pthread_rwlock_unlock(&tlock);
+
+    if(!valid) {
+        now = time(NULL);
+        if(now < __atomic_load_n(&table_retry, __ATOMIC_RELAXED))
+            return 1;
+
+        pthread_rwlock_wrlock(&tlock);
+        if(!table_valid(&Table)) {
+            table_close(&Table);
+            if(table_open(&Table, CLIENT_TABLE) < 0)
+                __atomic_store_n(&table_retry, now + 1, __ATOMIC_RELAXED);
+        }
+        pthread_rwlock_unlock(&tlock);
+    }
+
+    return ret;
+}
+
+/*
+ * Queue a query and wait for its answer, sending the pending batch
+ * whenever the connection is idle. Returns -1 if the daemon could not be
+ * asked.
+ */
+static int
+ask(QUERY *query)
+{
+    QUERY *batch[DAEMON_BATCH_MAX];
+    int n;
+
+    if(time(NULL) < __atomic_load_n(&sock_retry, __ATOMIC_RELAXED))
+        return -1;
+
+    pthread_mutex_lock(&cmutex);
+    while(Npending == DAEMON_BATCH_MAX)
+        pthread_cond_wait(&ccond, &cmutex);
+    Pending[Npending++] = query;
+
+    while(!query->done) {
+        if(Busy) {
+            pthread_cond_wait(&ccond, &cmutex);
+            continue;
+        }
+
+        Busy = 1;
+        n = Npending;
+        memcpy(batch, Pending, n * sizeof(QUERY *));
+        Npending = 0;
+        pthread_mutex_unlock(&cmutex);
+
+        exchange(batch, n);
+
+        pthread_mutex_lock(&cmutex);
+        while(n-- > 0)
+            batch[n]->done = 1;
+        Busy = 0;
+        pthread_cond_broadcast(&ccond);
+    }
+    pthread_mutex_unlock(&cmutex);
+
+    return (query->failed ? -1 : 0);
+}
+
+/*
+ * Send a batch of queries in one request and read back their answers. On
+ * any failure the connection is dropped and the whole batch fails.
+ */
+static void
+exchange(QUERY **batch, int n)
+{
+    DAEMON_REQUEST req;
+    DAEMON_QUERY hdr;
+    QUERY *query;
+    BUF *buf;
+    size_t len = sizeof(req);
+    int i;
+
+    for(i = 0; i < n; i++)
+        len += sizeof(hdr) + batch[i]->klen;
+
+    unsigned char out[len], *p = out;
+
+    req.count = n;
+    memcpy(p, &req, sizeof(req));
+    p += sizeof(req);
+    for(i = 0; i < n; i++) {
+        hdr.klen = batch[i]->klen;
+        memcpy(p, &hdr, sizeof(hdr));
+        memcpy(p + sizeof(hdr), batch[i]->key, hdr.klen);
+        p += sizeof(hdr) + hdr.klen;
+    }
+
+    if(Sock < 0 && connect_daemon() < 0)
+        goto err;
+
+    if(daemon_write(Sock, out, len) < 0)
+        goto err;
+
+    for(i = 0; i < n; i++) {
+        query = batch[i];
+        if(daemon_read(Sock, &query->answer, sizeof(query->answer)) < 0
+           || query->answer.vlen > DAEMON_REC_MAX)
+        {
+            goto err;
+        }
+
+        /* Each query's owner is waiting, so its buffer may be grown here. */
+        buf = query->buf;
+        if(buf->len < query->answer.vlen) {
+            if((p = realloc(buf->data, query->answer.vlen)) == NULL)
+                goto err;
+            buf->data = p;
+            buf->len = query->answer.vlen;
+        }
+
+        if(daemon_read(Sock, buf->data, query->answer.vlen) < 0)
+            goto err;
+    }
+
+    return;
+
+err:
+    if(Sock >= 0) {
+        close(Sock);
+        Sock = -1;
+    }
+
+    for(i = 0; i < n; i++)
+        batch[i]->failed = 1;
+}
+
+/*
+ * Connect to the daemon, trying again at most once a second if it is not
+ * running.
+ */
+static int
+connect_daemon(void)
+{
+    struct sockaddr_un addr;
+    struct timeval timeout = { CLIENT_TIMEOUT, 0 };
+    int fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, CLIENT_SOCKET, sizeof(addr.sun_path) - 1);
+
+    if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+        goto err;
+
+    if(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        goto err;
+    }
+
+    /* A wedged daemon must not hang lookups indefinitely. */
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    Sock = fd;
+
+    return 0;
+
+err:
+    __atomic_store_n(&sock_retry, time(NULL) + 1, __ATOMIC_RELAXED);
+    return -1;
+}
+
+/*
+ * A child must neither inherit a lock held by another thread nor share
+ * the parent's connection, where their requests would interleave.
+ */
+static void
+fork_prepare(void)
+{
+    pthread_rwlock_wrlock(&tlock);
+    pthread_mutex_lock(&cmutex);
+}
+
+static void
+fork_parent(void)
+{
+    pthread_mutex_unlock(&cmutex);
+    pthread_rwlock_unlock(&tlock);
+}
+
+static void
+fork_child(void)
+{
+    /* Any batch in flight belongs to threads which did not survive. */
+    pthread_cond_init(&ccond, NULL);
+    Npending = 0;
+    Busy = 0;
+    if(Sock >= 0) {
+        close(Sock);
+        Sock = -1;
+    }
+
+    fork_parent();
+}
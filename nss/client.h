@@ -0,0 +1,25 @@
+/**
+ * @file client.h
+ * @brief Lookups through the dbngd lookup daemon.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include "../lib/service.h"
+
+/**
+ * Look up a record through dbngd, first in the table it shares and then
+ * over its socket, where lookups from concurrent threads are batched into
+ * a single round trip. Table answers are only used at the given database
+ * generation, and socket answers only if read at it or later. The record
+ * is unpacked into a per-thread buffer and validated for the calling user.
+ *
+ * Returns 0 or DB_NOTFOUND as service_get_rec does, or -1 if the daemon
+ * could not answer and the databases should be read directly.
+ */
+extern int client_get(enum TYPE type, u_int64_t gen, KEY *key, REC *rec);
+
+#endif
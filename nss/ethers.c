@@ -0,0 +1,111 @@
+/**
+ * @file ethers.c
+ * @brief Implements the functions to map ethernet addresses to host names.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include "nss-dbng.h"
+
+#include <errno.h>
+#include <string.h>
+#include <netinet/ether.h>
+
+#include "../lib/service.h"
+#include "handle.h"
+#include "../lib/service-ethers.h"
+
+/*
+ * The entry glibc's ether_hostton and ether_ntohost pass to the service
+ * functions, which it does not export in a public header.
+ */
+struct etherent {
+    const char *e_name;
+    struct ether_addr e_addr;
+};
+
+/*
+ * Free-threaded, read-only handle shared by all lookups in this process,
+ * reopened once dbngctl modifies the databases.
+ */
+static HANDLE Ethers_handle = HANDLE_INITIALIZER(TYPE_ETHERS);
+
+static enum nss_status lookup(ETHERS_KEY *, struct etherent *, char *,
+                              size_t, int *);
+
+enum nss_status
+_nss_dbng_gethostton_r(const char *name, struct etherent *result,
+                       char *buf, size_t buflen, int *errnop)
+{
+    ETHERS_KEY key;
+
+    key.base.type = PRI;
+    key.data.pri = (char *) name;
+
+    return lookup(&key, result, buf, buflen, errnop);
+}
+
+enum nss_status
+_nss_dbng_getntohost_r(const struct ether_addr *addr,
+                       struct etherent *result, char *buf, size_t buflen,
+                       int *errnop)
+{
+    ETHERS_KEY key;
+
+    /* Query on the secondary index. */
+    key.base.type = SEC;
+    memcpy(&key.data.sec, addr, sizeof(key.data.sec));
+
+    return lookup(&key, result, buf, buflen, errnop);
+}
+
+/*
+ * Fill the entry with the host name and, by name, the first address of the
+ * host, or by address, the address asked for.
+ */
+static enum nss_status
+lookup(ETHERS_KEY *key, struct etherent *result, char *buf, size_t buflen,
+       int *errnop)
+{
+    ETHERS_REC rec;
+    int res;
+
+    res = handle_lookup(&Ethers_handle, (KEY *) key, (REC *) &rec);
+    switch(res) {
+    case 0:
+        break;
+
+    case DB_NOTFOUND:
+        *errnop = ENOENT;
+        return NSS_STATUS_NOTFOUND;
+
+    case -1:
+        *errnop = ENOENT;
+        return NSS_STATUS_UNAVAIL;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        return NSS_STATUS_TRYAGAIN;
+
+    default:
+        NSS_DEBUG("unknown status from get: %d", res);
+        *errnop = ENOENT;
+        return NSS_STATUS_NOTFOUND;
+    }
+
+    if(buflen < rec.base.block_len) {
+        *errnop = ERANGE;
+        return NSS_STATUS_TRYAGAIN;
+    }
+
+    /* The string block holds just the name. */
+    memcpy(buf, rec.base.block, rec.base.block_len);
+    result->e_name = buf;
+
+    if(key->base.type == SEC)
+        memcpy(&result->e_addr, &key->data.sec, sizeof(result->e_addr));
+    else
+        memcpy(&result->e_addr, &rec.addrs[0], sizeof(result->e_addr));
+
+    return NSS_STATUS_SUCCESS;
+}
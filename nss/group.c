@@ -10,53 +10,67 @@
 #include <grp.h>
 #include <errno.h>
 #include <string.h>
-#include <pthread.h>
+#include <stdlib.h>
+#include <stdint.h>
 
 #include "../lib/service.h"
+#include "handle.h"
 #include "../lib/service-group.h"
 
-#define NSS_DBNG_LOCK()                \
-    do {                               \
-        pthread_mutex_lock(&gmutex);   \
-    } while (0)
-#define NSS_DBNG_UNLOCK()              \
-    do {                               \
-        pthread_mutex_unlock(&gmutex); \
-    } while (0)
+/*
+ * Free-threaded, read-only handle shared by all lookups and enumerations
+ * in this process, reopened once dbngctl modifies the databases.
+ */
+static HANDLE Gr_handle = HANDLE_INITIALIZER(TYPE_GROUP);
 
-static pthread_mutex_t gmutex = PTHREAD_MUTEX_INITIALIZER;
-static SERVICE Gr_service;
-static volatile int init;
+/*
+ * Each enumerating thread has its own cursor over the lookup handle, so
+ * concurrent getgrent scans neither block nor disturb each other.
+ */
+static __thread HANDLE_CURSOR Gr_cursor;
+static __thread int ent_init;
+
+/* Buffer size needed by the last record which did not fit, or 0. */
+static __thread size_t ent_size;
+
+/* Accumulates supplementary groups for initgroups_dyn. */
+struct initgroups_state {
+    gid_t skip;
+    long int *start;
+    long int *size;
+    gid_t **groupsp;
+    long int limit;
+    int *errnop;
+    int found;
+    int done;
+    enum nss_status status;
+};
 
+static int add_group(SERVICE *, const REC *, void *);
 static enum nss_status fill_group(struct group *, char *, size_t,
-                                  SERVICE *, GROUP_REC *, int *);
+                                  GROUP_REC *, int *);
+static size_t group_size(const GROUP_REC *);
 
 enum nss_status
 _nss_dbng_setgrent(void)
 {
-    enum nss_status status = NSS_STATUS_SUCCESS;
-
-    NSS_DBNG_LOCK();
-    if(service_init(&Gr_service, TYPE_GROUP, DBNG_RO, DEFAULT_BASE) < 0) {
-        status = NSS_STATUS_UNAVAIL;
-        goto cleanup;
-    }
-    init = 1;
+    /* Restart any enumeration already in progress on this thread. */
+    handle_cursor_close(&Gr_handle, &Gr_cursor);
+    if(handle_acquire(&Gr_handle) == NULL)
+        return NSS_STATUS_UNAVAIL;
+    handle_release(&Gr_handle);
+    ent_init = 1;
 
-cleanup:
-    NSS_DBNG_UNLOCK();
-    return status;
+    return NSS_STATUS_SUCCESS;
 }
 
 enum nss_status
 _nss_dbng_endgrent(void)
 {
-    NSS_DBNG_LOCK();
-    if(init == 1) {
-        service_cleanup(&Gr_service);
-        init = 0;
+    if(ent_init) {
+        handle_cursor_close(&Gr_handle, &Gr_cursor);
+        ent_init = 0;
     }
-    NSS_DBNG_UNLOCK();
 
     return NSS_STATUS_SUCCESS;
 }
@@ -70,18 +84,24 @@ _nss_dbng_getgrent_r(struct group *gbuf, char *buf, size_t buflen,
     int res;
     enum nss_status status;
 
-    NSS_DBNG_LOCK();
-
-    if(init != 1) {
+    if(!ent_init || handle_acquire(&Gr_handle) == NULL) {
         *errnop = ENOENT;
-        status = NSS_STATUS_NOTFOUND;
-        goto cleanup;
+        return NSS_STATUS_NOTFOUND;
     }
 
-    res = Gr_service.next(&Gr_service, (KEY *) &key, (REC *) &rec);
+    res = handle_cursor_next(&Gr_handle, &Gr_cursor,
+                             (KEY *) &key, (REC *) &rec);
     switch(res) {
     case 0:
-        status = fill_group(gbuf, buf, buflen, &Gr_service, &rec, errnop);
+        status = fill_group(gbuf, buf, buflen, &rec, errnop);
+        if(status == NSS_STATUS_TRYAGAIN) {
+            /* Hand the same record out again once the caller has room. */
+            handle_cursor_unget(&Gr_handle, &Gr_cursor);
+            ent_size = group_size(&rec);
+        }
+        else {
+            ent_size = 0;
+        }
         break;
 
     case DB_NOTFOUND:
@@ -89,6 +109,11 @@ _nss_dbng_getgrent_r(struct group *gbuf, char *buf, size_t buflen,
         status = NSS_STATUS_NOTFOUND;
         goto cleanup;
 
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        goto cleanup;
+
     default:
         NSS_DEBUG("unknown status from next: %d", res);
         *errnop = ENOENT;
@@ -97,51 +122,62 @@ _nss_dbng_getgrent_r(struct group *gbuf, char *buf, size_t buflen,
     }
 
 cleanup:
-    NSS_DBNG_UNLOCK();
+    handle_release(&Gr_handle);
     return status;
 }
 
+/**
+ * Return the buffer size needed by the entry for which getgrent_r last
+ * failed with ERANGE on this thread, or 0 if the last call succeeded.
+ * The size assumes a buffer aligned for a pointer, as malloc returns.
+ */
+size_t
+_nss_dbng_getgrent_size(void)
+{
+    return ent_size;
+}
+
 enum nss_status
 _nss_dbng_getgrnam_r(const char* name, struct group *gbuf,
                        char *buf, size_t buflen, int *errnop)
 {
-    SERVICE group;
     GROUP_KEY key;
     GROUP_REC rec;
     int res;
     enum nss_status status;
 
-    if(service_init(&group, TYPE_GROUP, DBNG_RO, DEFAULT_BASE) < 0) {
-        *errnop = ENOENT;
-        return NSS_STATUS_UNAVAIL;
-    }
-
-    char uname[strlen(name) + 1];
-    strcpy(uname, name);
-    key.data.pri = uname;
+    key.data.pri = (char *) name;
     key.base.type = PRI;
 
-    res = group.get(&group, (KEY *) &key, (REC *) &rec);
+    res = handle_lookup(&Gr_handle, (KEY *) &key, (REC *) &rec);
     switch(res) {
     case 0:
         NSS_DEBUG("found group by name %s", name);
-        status = fill_group(gbuf, buf, buflen, &group, &rec, errnop);
+        status = fill_group(gbuf, buf, buflen, &rec, errnop);
         break;
 
     case DB_NOTFOUND:
         *errnop = ENOENT;
         status = NSS_STATUS_NOTFOUND;
-        goto cleanup;
+        break;
+
+    case -1:
+        *errnop = ENOENT;
+        status = NSS_STATUS_UNAVAIL;
+        break;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        break;
 
     default:
         NSS_DEBUG("unknown status from get: %d", res);
         *errnop = ENOENT;
         status = NSS_STATUS_NOTFOUND;
-        goto cleanup;
+        break;
     }
 
-cleanup:
-    service_cleanup(&group);
     return status;
 }
 
@@ -150,80 +186,227 @@ enum nss_status
 _nss_dbng_getgrgid_r(gid_t gid, struct group *gbuf,
                        char *buf, size_t buflen, int *errnop)
 {
-    SERVICE group;
     GROUP_KEY key;
     GROUP_REC rec;
     int res;
     enum nss_status status;
 
-    if(service_init(&group, TYPE_GROUP, DBNG_RO, DEFAULT_BASE) < 0) {
-        *errnop = ENOENT;
-        return NSS_STATUS_UNAVAIL;
-    }
-
     /* Query on the secondary index. */
     key.base.type = SEC;
     key.data.sec = gid;
-    res = group.get(&group, (KEY *) &key, (REC *) &rec);
+    res = handle_lookup(&Gr_handle, (KEY *) &key, (REC *) &rec);
     switch(res) {
     case 0:
         NSS_DEBUG("found group by gid %d", gid);
-        status = fill_group(gbuf, buf, buflen, &group, &rec, errnop);
+        status = fill_group(gbuf, buf, buflen, &rec, errnop);
         break;
 
     case DB_NOTFOUND:
         *errnop = ENOENT;
         status = NSS_STATUS_NOTFOUND;
-        goto cleanup;
+        break;
+
+    case -1:
+        *errnop = ENOENT;
+        status = NSS_STATUS_UNAVAIL;
+        break;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        break;
 
     default:
         NSS_DEBUG("unknown status from get: %d", res);
         *errnop = ENOENT;
         status = NSS_STATUS_UNAVAIL;
-        goto cleanup;
+        break;
     }
 
-cleanup:
-    service_cleanup(&group);
     return status;
 }
 
+enum nss_status
+_nss_dbng_initgroups_dyn(const char *user, gid_t group, long int *start,
+                         long int *size, gid_t **groupsp, long int limit,
+                         int *errnop)
+{
+    SERVICE *gservice;
+    GROUP_KEY key;
+    GROUP_REC rec;
+    struct initgroups_state state;
+    SERVICE_CURSOR cursor;
+    char **member;
+    int res;
+    enum nss_status status;
+
+    memset(&state, 0, sizeof(state));
+    state.skip = group;
+    state.start = start;
+    state.size = size;
+    state.groupsp = groupsp;
+    state.limit = limit;
+    state.errnop = errnop;
+    state.status = NSS_STATUS_SUCCESS;
+
+    if((gservice = handle_acquire(&Gr_handle)) == NULL) {
+        *errnop = ENOENT;
+        return NSS_STATUS_UNAVAIL;
+    }
+
+    if(gservice->db.aux != NULL) {
+        /* Walk the groups indexed under this member. */
+        key.base.type = AUX;
+        key.data.aux = (char *) user;
+        res = gservice->get_dups(gservice, (KEY *) &key, (REC *) &rec,
+                                 add_group, &state);
+    }
+    else {
+        /* The member index has not been built yet, so scan every group. */
+        NSS_DEBUG("no member index, scanning groups for %s", user);
+        memset(&cursor, 0, sizeof(cursor));
+        while(!state.done
+              && (res = service_cursor_next(gservice, &cursor, (KEY *) &key,
+                                            (REC *) &rec)) == 0)
+        {
+            for(member = rec.members;
+                member != NULL && *member != NULL;
+                member++)
+            {
+                if(!strcmp(*member, user)) {
+                    add_group(gservice, (REC *) &rec, &state);
+                    break;
+                }
+            }
+        }
+        service_cursor_close(&cursor);
+    }
+
+    switch(res) {
+    case 0:
+    case DB_NOTFOUND:
+        if(state.status != NSS_STATUS_SUCCESS) {
+            status = state.status;
+        }
+        else if(!state.found) {
+            *errnop = ENOENT;
+            status = NSS_STATUS_NOTFOUND;
+        }
+        else {
+            NSS_DEBUG("found groups for member %s", user);
+            status = NSS_STATUS_SUCCESS;
+        }
+        break;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        break;
+
+    default:
+        NSS_DEBUG("unknown status from get_dups: %d", res);
+        *errnop = ENOENT;
+        status = NSS_STATUS_UNAVAIL;
+        break;
+    }
+
+    handle_release(&Gr_handle);
+    return status;
+}
+
+/*
+ * Append a group to the caller's gid array, growing it as glibc expects
+ * and skipping the primary group and duplicates. Returns non-zero to stop
+ * the walk.
+ */
+static int
+add_group(SERVICE *service, const REC *rec, void *data)
+{
+    struct initgroups_state *state = data;
+    const GROUP_REC *grec = (const GROUP_REC *) rec;
+    gid_t *groups;
+    long int i, newsize;
+
+    if(state->done)
+        return 1;
+
+    state->found = 1;
+    if(grec->gid == state->skip)
+        return 0;
+
+    for(i = 0; i < *state->start; i++) {
+        if((*state->groupsp)[i] == grec->gid)
+            return 0;
+    }
+
+    if(*state->start == *state->size) {
+        if(state->limit > 0 && *state->size >= state->limit) {
+            /* The caller does not want any more groups. */
+            state->done = 1;
+            return 1;
+        }
+
+        newsize = (*state->size > 0 ? 2 * *state->size : 16);
+        if(state->limit > 0 && newsize > state->limit)
+            newsize = state->limit;
+
+        groups = realloc(*state->groupsp, newsize * sizeof(gid_t));
+        if(groups == NULL) {
+            *state->errnop = ENOMEM;
+            state->status = NSS_STATUS_TRYAGAIN;
+            state->done = 1;
+            return 1;
+        }
+
+        *state->groupsp = groups;
+        *state->size = newsize;
+    }
+
+    (*state->groupsp)[(*state->start)++] = grec->gid;
+
+    return 0;
+}
+
 static enum nss_status
 fill_group(struct group *gbuf, char *buf, size_t buflen,
-           SERVICE *service, GROUP_REC *rec, int *errnop)
+           GROUP_REC *rec, int *errnop)
 {
+    size_t align, ptrs;
+    char *strings;
     int i;
-    char **member;
 
-    if(buflen < service->rec_size(service, (REC *) rec)) {
+    /* The member pointers lead the buffer, so must be suitably aligned. */
+    align = (sizeof(char *) - ((uintptr_t) buf % sizeof(char *)))
+        % sizeof(char *);
+    ptrs = (rec->count + 1) * sizeof(char *);
+
+    if(buflen < align + group_size(rec)) {
         *errnop = ERANGE;
         return NSS_STATUS_TRYAGAIN;
     }
 
     gbuf->gr_gid = rec->gid;
+    gbuf->gr_mem = (char **) (buf + align);
+    strings = buf + align + ptrs;
 
-    strcpy(buf, rec->name);
-    gbuf->gr_name = buf;
-    buf += strlen(rec->name) + 1;
-
-    strcpy(buf, rec->passwd);
-    gbuf->gr_passwd = buf;
-    buf += strlen(rec->passwd) + 1;
-
-    /* Reserve space for the pointers to the group members. */
-    gbuf->gr_mem = (char **) buf;
-    gbuf->gr_mem[rec->count] = NULL;
-    buf += ((rec->count + 1) * sizeof(char *));
-
-    /* Now store the actual member names. */
-    for(member = rec->members, i = 0;
-        member != NULL && *member != NULL && i < rec->count;
-        member++, i++)
-    {
-        strcpy(buf, *member);
-        gbuf->gr_mem[i] = buf;
-        buf += strlen(*member) + 1;
-    }
+    /* The stored string block is already laid out as glibc expects. */
+    memcpy(strings, rec->base.block, rec->base.block_len);
+    gbuf->gr_name = NSS_DBNG_RELOC(strings, rec, rec->name);
+    gbuf->gr_passwd = NSS_DBNG_RELOC(strings, rec, rec->passwd);
+
+    for(i = 0; i < rec->count && rec->members[i] != NULL; i++)
+        gbuf->gr_mem[i] = NSS_DBNG_RELOC(strings, rec, rec->members[i]);
+    gbuf->gr_mem[i] = NULL;
 
     return NSS_STATUS_SUCCESS;
 }
+
+/*
+ * The space taken by a group in an aligned buffer: the null-terminated
+ * member pointers followed by the string block.
+ */
+static size_t
+group_size(const GROUP_REC *rec)
+{
+    return (rec->count + 1) * sizeof(char *) + rec->base.block_len;
+}
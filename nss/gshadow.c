@@ -0,0 +1,215 @@
+/**
+ * @file gshadow.c
+ * @brief Implements the functions to retrieve gshadow entries.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include "nss-dbng.h"
+
+#include <gshadow.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include "../lib/service-gshadow.h"
+#include "handle.h"
+
+/*
+ * Free-threaded, read-only handle shared by all lookups and enumerations
+ * in this process, reopened once dbngctl modifies the databases.
+ */
+static HANDLE Sg_handle = HANDLE_INITIALIZER(TYPE_GSHADOW);
+
+/*
+ * Each enumerating thread has its own cursor over the lookup handle, so
+ * concurrent getsgent scans neither block nor disturb each other.
+ */
+static __thread HANDLE_CURSOR Sg_cursor;
+static __thread int ent_init;
+
+/* Buffer size needed by the last record which did not fit, or 0. */
+static __thread size_t ent_size;
+
+static enum nss_status fill_gshadow(struct sgrp *, char *, size_t,
+                                    GSHADOW_REC *, int *);
+static size_t gshadow_size(const GSHADOW_REC *);
+
+enum nss_status
+_nss_dbng_setsgent(void)
+{
+    /* Restart any enumeration already in progress on this thread. */
+    handle_cursor_close(&Sg_handle, &Sg_cursor);
+    if(handle_acquire(&Sg_handle) == NULL)
+        return NSS_STATUS_UNAVAIL;
+    handle_release(&Sg_handle);
+    ent_init = 1;
+
+    return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status
+_nss_dbng_endsgent(void)
+{
+    if(ent_init) {
+        handle_cursor_close(&Sg_handle, &Sg_cursor);
+        ent_init = 0;
+    }
+
+    return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status
+_nss_dbng_getsgent_r(struct sgrp *sgbuf, char *buf, size_t buflen,
+                     int *errnop)
+{
+    GSHADOW_KEY key;
+    GSHADOW_REC rec;
+    int res;
+    enum nss_status status;
+
+    if(!ent_init || handle_acquire(&Sg_handle) == NULL) {
+        *errnop = ENOENT;
+        return NSS_STATUS_NOTFOUND;
+    }
+
+    res = handle_cursor_next(&Sg_handle, &Sg_cursor,
+                             (KEY *) &key, (REC *) &rec);
+    switch(res) {
+    case 0:
+        status = fill_gshadow(sgbuf, buf, buflen, &rec, errnop);
+        if(status == NSS_STATUS_TRYAGAIN) {
+            /* Hand the same record out again once the caller has room. */
+            handle_cursor_unget(&Sg_handle, &Sg_cursor);
+            ent_size = gshadow_size(&rec);
+        }
+        else {
+            ent_size = 0;
+        }
+        break;
+
+    case DB_NOTFOUND:
+        *errnop = ENOENT;
+        status = NSS_STATUS_NOTFOUND;
+        goto cleanup;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        goto cleanup;
+
+    default:
+        NSS_DEBUG("unknown status from next: %d", res);
+        *errnop = ENOENT;
+        status = NSS_STATUS_NOTFOUND;
+        goto cleanup;
+    }
+
+cleanup:
+    handle_release(&Sg_handle);
+    return status;
+}
+
+/**
+ * Return the buffer size needed by the entry for which getsgent_r last
+ * failed with ERANGE on this thread, or 0 if the last call succeeded.
+ */
+size_t
+_nss_dbng_getsgent_size(void)
+{
+    return ent_size;
+}
+
+enum nss_status
+_nss_dbng_getsgnam_r(const char *name, struct sgrp *sgbuf,
+                     char *buf, size_t buflen, int *errnop)
+{
+    GSHADOW_KEY key;
+    GSHADOW_REC rec;
+    int res;
+    enum nss_status status;
+
+    if(handle_acquire(&Sg_handle) == NULL) {
+        *errnop = ENOENT;
+        return NSS_STATUS_UNAVAIL;
+    }
+
+    key.data.pri = (char *) name;
+    key.base.type = PRI;
+
+    res = handle_get(&Sg_handle, (KEY *) &key, (REC *) &rec);
+    switch(res) {
+    case 0:
+        NSS_DEBUG("found gshadow entry by name %s", name);
+        status = fill_gshadow(sgbuf, buf, buflen, &rec, errnop);
+        break;
+
+    case DB_NOTFOUND:
+        *errnop = ENOENT;
+        status = NSS_STATUS_NOTFOUND;
+        goto cleanup;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        goto cleanup;
+
+    default:
+        NSS_DEBUG("unknown status from get: %d", res);
+        *errnop = ENOENT;
+        status = NSS_STATUS_NOTFOUND;
+        goto cleanup;
+    }
+
+cleanup:
+    handle_release(&Sg_handle);
+    return status;
+}
+
+static enum nss_status
+fill_gshadow(struct sgrp *sgbuf, char *buf, size_t buflen,
+             GSHADOW_REC *rec, int *errnop)
+{
+    size_t align;
+    char *strings;
+    int i;
+
+    /* The list pointers lead the buffer, so must be suitably aligned. */
+    align = (sizeof(char *) - ((uintptr_t) buf % sizeof(char *)))
+        % sizeof(char *);
+
+    if(buflen < align + gshadow_size(rec)) {
+        *errnop = ERANGE;
+        return NSS_STATUS_TRYAGAIN;
+    }
+
+    sgbuf->sg_adm = (char **) (buf + align);
+    sgbuf->sg_mem = sgbuf->sg_adm + rec->nadmins + 1;
+    strings = (char *) (sgbuf->sg_mem + rec->count + 1);
+
+    /* The stored string block is already laid out as glibc expects. */
+    memcpy(strings, rec->base.block, rec->base.block_len);
+    sgbuf->sg_namp = NSS_DBNG_RELOC(strings, rec, rec->name);
+    sgbuf->sg_passwd = NSS_DBNG_RELOC(strings, rec, rec->passwd);
+
+    for(i = 0; i < rec->nadmins && rec->admins[i] != NULL; i++)
+        sgbuf->sg_adm[i] = NSS_DBNG_RELOC(strings, rec, rec->admins[i]);
+    sgbuf->sg_adm[i] = NULL;
+
+    for(i = 0; i < rec->count && rec->members[i] != NULL; i++)
+        sgbuf->sg_mem[i] = NSS_DBNG_RELOC(strings, rec, rec->members[i]);
+    sgbuf->sg_mem[i] = NULL;
+
+    return NSS_STATUS_SUCCESS;
+}
+
+/*
+ * The space taken by an entry in an aligned buffer: the null-terminated
+ * administrator and member pointers followed by the string block.
+ */
+static size_t
+gshadow_size(const GSHADOW_REC *rec)
+{
+    return (rec->nadmins + rec->count + 2) * sizeof(char *)
+        + rec->base.block_len;
+}
@@ -0,0 +1,292 @@
+/**
+ * @file handle.c
+ * @brief Implements the process-wide lookup handles.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include "nss-dbng.h"
+
+#include <string.h>
+#include <time.h>
+
+#include "handle.h"
+#include "client.h"
+#include "../lib/stamp.h"
+
+static pthread_mutex_t smutex = PTHREAD_MUTEX_INITIALIZER;
+static STAMP Stamp;
+static int stamp_init;
+static time_t stamp_retry;
+
+/* Handles which have been acquired at least once, for the fork handlers. */
+static pthread_mutex_t hmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t Fork_once = PTHREAD_ONCE_INIT;
+static HANDLE *Handles;
+
+static u_int64_t current_gen(void);
+static void handle_quiesce(HANDLE *);
+static void handle_register(HANDLE *);
+static void fork_init(void);
+static void fork_prepare(void);
+static void fork_parent(void);
+static void fork_child(void);
+
+extern SERVICE
+*handle_acquire(HANDLE *handle)
+{
+    u_int64_t gen;
+    int open;
+
+again:
+    gen = current_gen();
+
+    /*
+     * Count this lookup before checking that no reopen has begun, as the
+     * reopen marks itself before counting the lookups it must wait for.
+     */
+    __atomic_add_fetch(&handle->readers, 1, __ATOMIC_SEQ_CST);
+    if(!__atomic_load_n(&handle->closing, __ATOMIC_SEQ_CST)
+       && handle->open && handle->gen >= gen)
+    {
+        return &handle->service;
+    }
+    handle_release(handle);
+
+    /* Not under the handle's lock, as the fork handlers nest them. */
+    handle_register(handle);
+
+    /*
+     * Reopen the service, unless another thread has just done so, which it
+     * may also have done while this one waited for the lookups to finish.
+     */
+    pthread_mutex_lock(&handle->lock);
+    if(!handle->open || handle->gen < gen) {
+        handle_quiesce(handle);
+
+        if(handle->open && handle->gen < gen) {
+            service_cleanup(&handle->service);
+            handle->open = 0;
+        }
+
+        if(!handle->open
+           && service_init(&handle->service, handle->type,
+                           DBNG_RO | DBNG_THREAD, DEFAULT_BASE) == 0)
+        {
+            handle->open = 1;
+            handle->gen = gen;
+            handle->epoch++;
+            if(handle->cache == NULL)
+                handle->cache = cache_new(CACHE_SIZE);
+        }
+
+        __atomic_store_n(&handle->closing, 0, __ATOMIC_RELEASE);
+    }
+
+    open = handle->open;
+    pthread_mutex_unlock(&handle->lock);
+
+    if(!open)
+        return NULL;
+
+    goto again;
+}
+
+extern void
+handle_release(HANDLE *handle)
+{
+    /* Only the last lookup out while a reopen waits takes the lock. */
+    if(__atomic_sub_fetch(&handle->readers, 1, __ATOMIC_SEQ_CST) == 0
+       && __atomic_load_n(&handle->closing, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&handle->lock);
+        pthread_cond_broadcast(&handle->drained);
+        pthread_mutex_unlock(&handle->lock);
+    }
+}
+
+extern int
+handle_get(HANDLE *handle, KEY *key, REC *rec)
+{
+    return cache_get_rec(handle->cache, handle->gen, &handle->service,
+                         key, rec);
+}
+
+extern int
+handle_lookup(HANDLE *handle, KEY *key, REC *rec)
+{
+    int ret;
+
+    if((ret = client_get(handle->type, current_gen(), key, rec)) != -1)
+        return ret;
+
+    if(handle_acquire(handle) == NULL)
+        return -1;
+    ret = handle_get(handle, key, rec);
+    handle_release(handle);
+
+    return ret;
+}
+
+extern int
+handle_cursor_next(HANDLE *handle, HANDLE_CURSOR *cursor, KEY *key, REC *rec)
+{
+    /* The cursor's database was closed when the service was reopened. */
+    if(cursor->epoch != handle->epoch) {
+        service_cursor_detach(&cursor->cursor);
+        cursor->epoch = handle->epoch;
+    }
+
+    return service_cursor_next(&handle->service, &cursor->cursor, key, rec);
+}
+
+extern void
+handle_cursor_unget(HANDLE *handle, HANDLE_CURSOR *cursor)
+{
+    service_cursor_unget(&cursor->cursor);
+}
+
+extern void
+handle_cursor_close(HANDLE *handle, HANDLE_CURSOR *cursor)
+{
+    SERVICE *service;
+
+    if(cursor->cursor.dbc != NULL) {
+        service = handle_acquire(handle);
+        if(service == NULL || cursor->epoch != handle->epoch)
+            service_cursor_detach(&cursor->cursor);
+        service_cursor_close(&cursor->cursor);
+        if(service != NULL)
+            handle_release(handle);
+    }
+    else {
+        service_cursor_close(&cursor->cursor);
+    }
+
+    cursor->epoch = 0;
+}
+
+/*
+ * Read the current database generation, or 0 if there is no stamp yet.
+ * Mapping the stamp is retried at most once a second.
+ */
+static u_int64_t
+current_gen(void)
+{
+    time_t now;
+    int ok;
+
+    if(!__atomic_load_n(&stamp_init, __ATOMIC_ACQUIRE)) {
+        now = time(NULL);
+        if(now < __atomic_load_n(&stamp_retry, __ATOMIC_RELAXED))
+            return 0;
+
+        pthread_mutex_lock(&smutex);
+        if(!stamp_init) {
+            if(stamp_open(&Stamp, DEFAULT_BASE) == 0)
+                __atomic_store_n(&stamp_init, 1, __ATOMIC_RELEASE);
+            else
+                __atomic_store_n(&stamp_retry, now + 1, __ATOMIC_RELAXED);
+        }
+        ok = stamp_init;
+        pthread_mutex_unlock(&smutex);
+
+        if(!ok)
+            return 0;
+    }
+
+    return stamp_read(&Stamp);
+}
+
+/*
+ * Hold off new lookups through a handle, and wait for those in progress
+ * to release it. The handle's lock must be held, and is dropped while
+ * waiting, so another reopen finishing meanwhile may have cleared closing.
+ */
+static void
+handle_quiesce(HANDLE *handle)
+{
+    __atomic_store_n(&handle->closing, 1, __ATOMIC_SEQ_CST);
+    while(__atomic_load_n(&handle->readers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_cond_wait(&handle->drained, &handle->lock);
+        __atomic_store_n(&handle->closing, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+static void
+handle_register(HANDLE *handle)
+{
+    pthread_once(&Fork_once, fork_init);
+
+    pthread_mutex_lock(&hmutex);
+    if(!handle->registered) {
+        handle->next = Handles;
+        Handles = handle;
+        handle->registered = 1;
+    }
+    pthread_mutex_unlock(&hmutex);
+}
+
+static void
+fork_init(void)
+{
+    if(pthread_atfork(fork_prepare, fork_parent, fork_child) != 0)
+        NSS_ERROR("could not register fork handlers");
+}
+
+/*
+ * Wait for the lookups in progress to finish, and hold off new ones, so
+ * that no thread is inside Berkeley DB, a cache or the stamp when the
+ * process is copied.
+ */
+static void
+fork_prepare(void)
+{
+    HANDLE *handle;
+
+    pthread_mutex_lock(&hmutex);
+    pthread_mutex_lock(&smutex);
+    for(handle = Handles; handle != NULL; handle = handle->next) {
+        pthread_mutex_lock(&handle->lock);
+        handle_quiesce(handle);
+    }
+}
+
+static void
+fork_parent(void)
+{
+    HANDLE *handle;
+
+    for(handle = Handles; handle != NULL; handle = handle->next) {
+        __atomic_store_n(&handle->closing, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&handle->lock);
+    }
+    pthread_mutex_unlock(&smutex);
+    pthread_mutex_unlock(&hmutex);
+}
+
+/*
+ * Berkeley DB handles may not be used across fork(), so the child drops
+ * each open service without closing it, and reopens it on the next lookup.
+ * The cursors of the threads which did not survive the fork are forgotten
+ * along with it, as are any of their lookups counted after the handles
+ * were quiesced, and their waits on drained.
+ */
+static void
+fork_child(void)
+{
+    HANDLE *handle;
+
+    for(handle = Handles; handle != NULL; handle = handle->next) {
+        if(handle->open) {
+            service_forget(&handle->service);
+            handle->open = 0;
+        }
+        handle->readers = 0;
+        pthread_cond_init(&handle->drained, NULL);
+        __atomic_store_n(&handle->closing, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&handle->lock);
+    }
+    pthread_mutex_unlock(&smutex);
+    pthread_mutex_unlock(&hmutex);
+}
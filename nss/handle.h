@@ -0,0 +1,107 @@
+/**
+ * @file handle.h
+ * @brief Process-wide lookup handles, reopened when the databases change.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef HANDLE_H
+#define HANDLE_H
+
+#include <pthread.h>
+
+#include "../lib/service.h"
+#include "cache.h"
+
+/*
+ * A free-threaded, read-only service shared by every lookup and
+ * enumeration of a map. It reads a snapshot of the last committed state,
+ * so never waits on dbngctl nor sees part of its changes. Lookups take no
+ * lock: they count themselves in readers and check the generation. The
+ * lock is only taken to open the service, or to reopen it once the
+ * generation stamp shows that dbngctl has modified the databases, and the
+ * reopen waits for the lookups in progress to finish while closing holds
+ * off new ones. The last of them to finish signals drained.
+ */
+typedef struct HANDLE {
+    enum TYPE type;
+    pthread_mutex_t lock;
+    pthread_cond_t drained; /* Signalled once no lookup holds the handle. */
+    unsigned int readers;   /* Lookups holding the handle. */
+    int closing;            /* Set while the service may not be used. */
+    int open;
+    u_int64_t gen;          /* Generation the service was opened at. */
+    unsigned long epoch;    /* Incremented each time the service is opened. */
+    SERVICE service;
+    CACHE *cache;
+    int registered;
+    struct HANDLE *next;    /* Next handle quiesced around fork(). */
+} HANDLE;
+
+/*
+ * A reopen holds off new lookups, so a steady stream of them cannot hold
+ * off a reopen. Lookups must then never acquire a handle they already
+ * hold.
+ */
+#define HANDLE_INITIALIZER(type) \
+    { (type), PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, \
+      0, 0, 0, 0, 0 }
+
+/*
+ * A per-thread enumeration over a handle, which carries on across a
+ * reopen of the handle's service.
+ */
+typedef struct HANDLE_CURSOR {
+    SERVICE_CURSOR cursor;
+    unsigned long epoch;
+} HANDLE_CURSOR;
+
+/**
+ * Return the handle's current service, opening or reopening it as needed.
+ * On success the handle is held until handle_release; NULL is returned if
+ * the service could not be opened.
+ *
+ * Every handle is quiesced across fork(), so that no lookup is in progress
+ * when the process is copied. As Berkeley DB handles may not be used in
+ * the child, it drops each open service and reopens it on the next
+ * lookup. A thread must not fork while it holds a handle.
+ */
+extern SERVICE *handle_acquire(HANDLE *handle);
+
+/**
+ *
+ */
+extern void handle_release(HANDLE *handle);
+
+/**
+ * Fetch a record from an acquired handle, through its cache if enabled.
+ */
+extern int handle_get(HANDLE *handle, KEY *key, REC *rec);
+
+/**
+ * Fetch a record by key for a lookup, asking dbngd if it is running and
+ * only otherwise acquiring the handle to read the databases directly.
+ * The handle must not already be acquired by the calling thread, and the
+ * record is in a per-thread buffer. Returns -1 if neither the daemon nor
+ * the databases are available.
+ */
+extern int handle_lookup(HANDLE *handle, KEY *key, REC *rec);
+
+/**
+ * Fetch the next record through a cursor on an acquired handle.
+ */
+extern int handle_cursor_next(HANDLE *handle, HANDLE_CURSOR *cursor,
+                              KEY *key, REC *rec);
+
+/**
+ * Have the next call to handle_cursor_next return the last record again.
+ */
+extern void handle_cursor_unget(HANDLE *handle, HANDLE_CURSOR *cursor);
+
+/**
+ * Release a cursor, leaving it ready for a new enumeration. The handle
+ * must not already be acquired by the calling thread.
+ */
+extern void handle_cursor_close(HANDLE *handle, HANDLE_CURSOR *cursor);
+
+#endif
@@ -0,0 +1,277 @@
+/**
+ * @file hosts.c
+ * @brief Implements the functions to resolve hosts.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include "nss-dbng.h"
+
+#include <netdb.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "../lib/service.h"
+#include "handle.h"
+#include "../lib/service-hosts.h"
+
+/*
+ * Free-threaded, read-only handle shared by all lookups in this process,
+ * reopened once dbngctl modifies the databases.
+ */
+static HANDLE Hosts_handle = HANDLE_INITIALIZER(TYPE_HOSTS);
+
+static int lookup_name(const char *, HOSTS_REC *);
+static enum nss_status lookup_status(int, int *, int *);
+static enum nss_status fill_hostent(struct hostent *, char *, size_t,
+                                    HOSTS_REC *, int, int *, int *);
+
+enum nss_status
+_nss_dbng_gethostbyname2_r(const char *name, int af, struct hostent *result,
+                           char *buf, size_t buflen, int *errnop,
+                           int *h_errnop)
+{
+    HOSTS_REC rec;
+    int res;
+
+    if(hosts_addr_len(af) == 0) {
+        *errnop = EAFNOSUPPORT;
+        *h_errnop = NO_DATA;
+        return NSS_STATUS_UNAVAIL;
+    }
+
+    if((res = lookup_name(name, &rec)) != 0)
+        return lookup_status(res, errnop, h_errnop);
+
+    NSS_DEBUG("found host by name %s", name);
+    return fill_hostent(result, buf, buflen, &rec, af, errnop, h_errnop);
+}
+
+enum nss_status
+_nss_dbng_gethostbyname_r(const char *name, struct hostent *result,
+                          char *buf, size_t buflen, int *errnop,
+                          int *h_errnop)
+{
+    return _nss_dbng_gethostbyname2_r(name, AF_INET, result, buf, buflen,
+                                      errnop, h_errnop);
+}
+
+/**
+ * Resolve every address of a host for getaddrinfo in a single call. The
+ * first tuple may be supplied by the caller; the rest, and the name, are
+ * laid out in the buffer.
+ */
+enum nss_status
+_nss_dbng_gethostbyname4_r(const char *name, struct gaih_addrtuple **pat,
+                           char *buf, size_t buflen, int *errnop,
+                           int *h_errnop, int32_t *ttlp)
+{
+    HOSTS_REC rec;
+    struct gaih_addrtuple *tuples, *tuple;
+    size_t align, ntuples;
+    char *hname;
+    int res, i;
+
+    if((res = lookup_name(name, &rec)) != 0)
+        return lookup_status(res, errnop, h_errnop);
+
+    if(rec.naddrs == 0) {
+        *errnop = ENOENT;
+        *h_errnop = NO_DATA;
+        return NSS_STATUS_NOTFOUND;
+    }
+
+    align = (__alignof__(struct gaih_addrtuple)
+             - ((uintptr_t) buf % __alignof__(struct gaih_addrtuple)))
+        % __alignof__(struct gaih_addrtuple);
+    ntuples = rec.naddrs - (*pat != NULL ? 1 : 0);
+
+    if(buflen < align + ntuples * sizeof(*tuples) + strlen(rec.name) + 1) {
+        *errnop = ERANGE;
+        *h_errnop = NETDB_INTERNAL;
+        return NSS_STATUS_TRYAGAIN;
+    }
+
+    tuples = (struct gaih_addrtuple *) (buf + align);
+    hname = (char *) (tuples + ntuples);
+    strcpy(hname, rec.name);
+
+    for(i = 0; i < rec.naddrs; i++) {
+        if(*pat == NULL)
+            *pat = tuples++;
+
+        tuple = *pat;
+        memset(tuple, 0, sizeof(*tuple));
+        tuple->name = (i == 0 ? hname : NULL);
+        tuple->family = rec.addrs[i].family;
+        memcpy(tuple->addr, rec.addrs[i].addr,
+               hosts_addr_len(rec.addrs[i].family));
+        pat = &tuple->next;
+    }
+
+    if(ttlp != NULL)
+        *ttlp = 0;
+
+    NSS_DEBUG("found host by name %s", name);
+    *h_errnop = NETDB_SUCCESS;
+    return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status
+_nss_dbng_gethostbyaddr2_r(const void *addr, socklen_t len, int af,
+                           struct hostent *result, char *buf, size_t buflen,
+                           int *errnop, int *h_errnop, int32_t *ttlp)
+{
+    HOSTS_KEY key;
+    HOSTS_REC rec;
+    int res;
+
+    if(hosts_addr_len(af) == 0 || len != hosts_addr_len(af)) {
+        *errnop = EAFNOSUPPORT;
+        *h_errnop = NO_RECOVERY;
+        return NSS_STATUS_UNAVAIL;
+    }
+
+    /* Query on the secondary index. */
+    memset(&key, 0, sizeof(key));
+    key.base.type = SEC;
+    key.data.sec.family = af;
+    memcpy(key.data.sec.addr, addr, len);
+
+    res = handle_lookup(&Hosts_handle, (KEY *) &key, (REC *) &rec);
+    if(res != 0)
+        return lookup_status(res, errnop, h_errnop);
+
+    if(ttlp != NULL)
+        *ttlp = 0;
+
+    NSS_DEBUG("found host by address");
+    return fill_hostent(result, buf, buflen, &rec, af, errnop, h_errnop);
+}
+
+enum nss_status
+_nss_dbng_gethostbyaddr_r(const void *addr, socklen_t len, int af,
+                          struct hostent *result, char *buf, size_t buflen,
+                          int *errnop, int *h_errnop)
+{
+    return _nss_dbng_gethostbyaddr2_r(addr, len, af, result, buf, buflen,
+                                      errnop, h_errnop, NULL);
+}
+
+/*
+ * Look a host up by its canonical name, then by its aliases.
+ */
+static int
+lookup_name(const char *name, HOSTS_REC *rec)
+{
+    HOSTS_KEY key;
+    int res;
+
+    key.base.type = PRI;
+    key.data.pri = (char *) name;
+    if((res = handle_lookup(&Hosts_handle, (KEY *) &key, (REC *) rec))
+       != DB_NOTFOUND)
+    {
+        return res;
+    }
+
+    key.base.type = AUX;
+    key.data.aux = (char *) name;
+
+    return handle_lookup(&Hosts_handle, (KEY *) &key, (REC *) rec);
+}
+
+static enum nss_status
+lookup_status(int res, int *errnop, int *h_errnop)
+{
+    switch(res) {
+    case DB_NOTFOUND:
+        *errnop = ENOENT;
+        *h_errnop = HOST_NOT_FOUND;
+        return NSS_STATUS_NOTFOUND;
+
+    case -1:
+        *errnop = ENOENT;
+        *h_errnop = NO_RECOVERY;
+        return NSS_STATUS_UNAVAIL;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        *h_errnop = TRY_AGAIN;
+        return NSS_STATUS_TRYAGAIN;
+
+    default:
+        NSS_DEBUG("unknown status from get: %d", res);
+        *errnop = ENOENT;
+        *h_errnop = HOST_NOT_FOUND;
+        return NSS_STATUS_NOTFOUND;
+    }
+}
+
+/*
+ * Lay the host's addresses of the requested family out in the buffer,
+ * after the address and alias pointers, followed by the string block.
+ */
+static enum nss_status
+fill_hostent(struct hostent *result, char *buf, size_t buflen,
+             HOSTS_REC *rec, int af, int *errnop, int *h_errnop)
+{
+    size_t align, alen = hosts_addr_len(af), naddrs = 0;
+    char *p, *strings;
+    int i, j;
+
+    for(i = 0; i < rec->naddrs; i++) {
+        if(rec->addrs[i].family == af)
+            naddrs++;
+    }
+
+    if(naddrs == 0) {
+        *errnop = ENOENT;
+        *h_errnop = NO_DATA;
+        return NSS_STATUS_NOTFOUND;
+    }
+
+    /* The pointers lead the buffer, so must be suitably aligned. */
+    align = (sizeof(char *) - ((uintptr_t) buf % sizeof(char *)))
+        % sizeof(char *);
+
+    if(buflen < align
+       + (naddrs + 1 + rec->count + 1) * sizeof(char *)
+       + naddrs * alen
+       + rec->base.block_len)
+    {
+        *errnop = ERANGE;
+        *h_errnop = NETDB_INTERNAL;
+        return NSS_STATUS_TRYAGAIN;
+    }
+
+    result->h_addrtype = af;
+    result->h_length = alen;
+    result->h_addr_list = (char **) (buf + align);
+    result->h_aliases = result->h_addr_list + naddrs + 1;
+    p = (char *) (result->h_aliases + rec->count + 1);
+
+    for(i = 0, j = 0; i < rec->naddrs; i++) {
+        if(rec->addrs[i].family != af)
+            continue;
+
+        memcpy(p, rec->addrs[i].addr, alen);
+        result->h_addr_list[j++] = p;
+        p += alen;
+    }
+    result->h_addr_list[j] = NULL;
+
+    /* The stored string block is already laid out as glibc expects. */
+    strings = p;
+    memcpy(strings, rec->base.block, rec->base.block_len);
+    result->h_name = NSS_DBNG_RELOC(strings, rec, rec->name);
+
+    for(i = 0; i < rec->count && rec->aliases[i] != NULL; i++)
+        result->h_aliases[i] = NSS_DBNG_RELOC(strings, rec, rec->aliases[i]);
+    result->h_aliases[i] = NULL;
+
+    *h_errnop = NETDB_SUCCESS;
+    return NSS_STATUS_SUCCESS;
+}
@@ -0,0 +1,41 @@
+/**
+ * @file netgrent.h
+ * @brief Netgroup enumeration state shared with glibc.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#ifndef NETGRENT_H
+#define NETGRENT_H
+
+#include <stddef.h>
+
+/*
+ * The state glibc keeps for a netgroup enumeration, declared only in its
+ * private headers. Only the leading fields are used by the module.
+ */
+struct name_list;
+
+struct __netgrent {
+    enum { triple_val, group_val } type;
+    union {
+        struct {
+            const char *host;
+            const char *user;
+            const char *domain;
+        } triple;
+        const char *group;
+    } val;
+    char *data;
+    size_t data_size;
+    union {
+        char *cursor;
+        unsigned long int position;
+    };
+    int first;
+    struct name_list *known_groups;
+    struct name_list *needed_groups;
+    void *nip;
+};
+
+#endif
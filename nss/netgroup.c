@@ -0,0 +1,229 @@
+/**
+ * @file netgroup.c
+ * @brief Implements the functions to enumerate and match netgroups.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include "nss-dbng.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "../lib/service.h"
+#include "handle.h"
+#include "netgrent.h"
+#include "../lib/service-netgroup.h"
+
+/*
+ * Free-threaded, read-only handle shared by all lookups in this process,
+ * reopened once dbngctl modifies the databases.
+ */
+static HANDLE Netgroup_handle = HANDLE_INITIALIZER(TYPE_NETGROUP);
+
+static enum nss_status lookup_status(int);
+static int match(const NETGROUP_TRIPLE *, const char *, const char *,
+                 const char *);
+
+/**
+ * Start enumerating a netgroup. Its expansion is copied out whole, so the
+ * netgroups it includes are never visited by glibc.
+ */
+enum nss_status
+_nss_dbng_setnetgrent(const char *group, struct __netgrent *result)
+{
+    NETGROUP_KEY key;
+    NETGROUP_REC rec;
+    const char *fields[3];
+    size_t size = 0;
+    char *s;
+    int res, i, j;
+
+    key.base.type = PRI;
+    key.data.pri = (char *) group;
+    res = handle_lookup(&Netgroup_handle, (KEY *) &key, (REC *) &rec);
+    if(res != 0)
+        return lookup_status(res);
+
+    /* Each triple is kept as three strings, with a wildcard left empty. */
+    for(i = 0; i < rec.ntriples; i++) {
+        fields[0] = rec.triples[i].host;
+        fields[1] = rec.triples[i].user;
+        fields[2] = rec.triples[i].domain;
+
+        for(j = 0; j < 3; j++)
+            size += (fields[j] != NULL ? strlen(fields[j]) : 0) + 1;
+    }
+
+    if((result->data = malloc(size + 1)) == NULL)
+        return NSS_STATUS_TRYAGAIN;
+
+    for(i = 0, s = result->data; i < rec.ntriples; i++) {
+        fields[0] = rec.triples[i].host;
+        fields[1] = rec.triples[i].user;
+        fields[2] = rec.triples[i].domain;
+
+        for(j = 0; j < 3; j++) {
+            if(fields[j] != NULL) {
+                strcpy(s, fields[j]);
+                s += strlen(fields[j]);
+            }
+            *s++ = '\0';
+        }
+    }
+
+    result->data_size = size;
+    result->cursor = result->data;
+    result->first = 1;
+
+    NSS_DEBUG("found netgroup %s", group);
+    return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status
+_nss_dbng_getnetgrent_r(struct __netgrent *result, char *buf, size_t buflen,
+                        int *errnop)
+{
+    const char *fields[3], **vals[3];
+    size_t len, need = 0;
+    char *s;
+    int i;
+
+    if(result->data == NULL
+       || result->cursor >= result->data + result->data_size)
+    {
+        return (result->first ? NSS_STATUS_NOTFOUND : NSS_STATUS_RETURN);
+    }
+
+    for(i = 0, s = result->cursor; i < 3; i++) {
+        fields[i] = s;
+        len = strlen(s);
+        need += (len > 0 ? len + 1 : 0);
+        s += len + 1;
+    }
+
+    if(buflen < need) {
+        *errnop = ERANGE;
+        return NSS_STATUS_TRYAGAIN;
+    }
+
+    vals[0] = &result->val.triple.host;
+    vals[1] = &result->val.triple.user;
+    vals[2] = &result->val.triple.domain;
+
+    for(i = 0; i < 3; i++) {
+        if(*fields[i] == '\0') {
+            *vals[i] = NULL;
+        }
+        else {
+            strcpy(buf, fields[i]);
+            *vals[i] = buf;
+            buf += strlen(fields[i]) + 1;
+        }
+    }
+
+    result->type = triple_val;
+    result->cursor = s;
+    result->first = 0;
+
+    return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status
+_nss_dbng_endnetgrent(struct __netgrent *result)
+{
+    free(result->data);
+    result->data = NULL;
+    result->data_size = 0;
+    result->cursor = NULL;
+
+    return NSS_STATUS_SUCCESS;
+}
+
+/**
+ * Check whether a triple is in a netgroup, as innetgr does, without
+ * enumerating it. A NULL host, user or domain matches any. A fully given
+ * triple is answered by at most eight index lookups, for each part as
+ * given or as a wildcard; otherwise the netgroup's expansion is searched.
+ * Returns NSS_STATUS_SUCCESS for a member and NSS_STATUS_NOTFOUND if not.
+ */
+enum nss_status
+_nss_dbng_innetgr(const char *netgroup, const char *host, const char *user,
+                  const char *domain)
+{
+    SERVICE *service;
+    NETGROUP_KEY key;
+    NETGROUP_REC rec;
+    int res = DB_NOTFOUND, mask, i;
+
+    if(host == NULL || user == NULL || domain == NULL) {
+        key.base.type = PRI;
+        key.data.pri = (char *) netgroup;
+        res = handle_lookup(&Netgroup_handle, (KEY *) &key, (REC *) &rec);
+        if(res != 0)
+            return lookup_status(res);
+
+        for(i = 0; i < rec.ntriples; i++) {
+            if(match(&rec.triples[i], host, user, domain))
+                return NSS_STATUS_SUCCESS;
+        }
+
+        return NSS_STATUS_NOTFOUND;
+    }
+
+    if((service = handle_acquire(&Netgroup_handle)) == NULL)
+        return NSS_STATUS_UNAVAIL;
+
+    key.base.type = SEC;
+    key.data.sec.name = (char *) netgroup;
+    for(mask = 0; mask < 8 && res == DB_NOTFOUND; mask++) {
+        key.data.sec.triple.host = (mask & 1 ? NULL : (char *) host);
+        key.data.sec.triple.user = (mask & 2 ? NULL : (char *) user);
+        key.data.sec.triple.domain = (mask & 4 ? NULL : (char *) domain);
+        res = service_exists(service, (KEY *) &key);
+    }
+
+    handle_release(&Netgroup_handle);
+
+    return lookup_status(res);
+}
+
+static enum nss_status
+lookup_status(int res)
+{
+    switch(res) {
+    case 0:
+        return NSS_STATUS_SUCCESS;
+
+    case DB_NOTFOUND:
+        return NSS_STATUS_NOTFOUND;
+
+    case -1:
+        return NSS_STATUS_UNAVAIL;
+
+    case ENOMEM:
+        return NSS_STATUS_TRYAGAIN;
+
+    default:
+        NSS_DEBUG("unknown status from get: %d", res);
+        return NSS_STATUS_NOTFOUND;
+    }
+}
+
+/*
+ * Match a triple as innetgr does, with a wildcard on either side matching
+ * anything, and hosts and domains compared regardless of case.
+ */
+static int
+match(const NETGROUP_TRIPLE *triple, const char *host, const char *user,
+      const char *domain)
+{
+    return (triple->host == NULL || host == NULL
+            || !strcasecmp(triple->host, host))
+        && (triple->user == NULL || user == NULL
+            || !strcmp(triple->user, user))
+        && (triple->domain == NULL || domain == NULL
+            || !strcasecmp(triple->domain, domain));
+}
@@ -27,6 +27,12 @@
 
 #define NSS_ERROR(msg, ...) syslog(LOG_ERR, (msg), ## __VA_ARGS__)
 
+/*
+ * Locate a string of an unpacked record within a copy of the record's
+ * string block at dst.
+ */
+#define NSS_DBNG_RELOC(dst, rec, str) ((dst) + ((str) - (rec)->base.block))
+
 #define DBNG_PASSWD     "passwd.db"
 #define DBNG_PASSWD_UID "passwd_uid.db"
 #define DBNG_SHADOW     "shadow.db"
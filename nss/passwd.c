@@ -10,26 +10,29 @@
 #include <pwd.h>
 #include <errno.h>
 #include <string.h>
-#include <pthread.h>
 
 #include "../lib/service.h"
+#include "handle.h"
 #include "../lib/service-passwd.h"
 
-#define NSS_DBNG_LOCK()                \
-    do {                               \
-        pthread_mutex_lock(&pmutex);   \
-    } while (0)
-#define NSS_DBNG_UNLOCK()              \
-    do {                               \
-        pthread_mutex_unlock(&pmutex); \
-    } while (0)
+/*
+ * Free-threaded, read-only handle shared by all lookups and enumerations
+ * in this process, reopened once dbngctl modifies the databases.
+ */
+static HANDLE Pwd_handle = HANDLE_INITIALIZER(TYPE_PASSWD);
+
+/*
+ * Each enumerating thread has its own cursor over the lookup handle, so
+ * concurrent getpwent scans neither block nor disturb each other.
+ */
+static __thread HANDLE_CURSOR Pwd_cursor;
+static __thread int ent_init;
 
-static pthread_mutex_t pmutex = PTHREAD_MUTEX_INITIALIZER;
-static SERVICE Pwd_service;
-static volatile int init;
+/* Buffer size needed by the last record which did not fit, or 0. */
+static __thread size_t ent_size;
 
 static enum nss_status fill_passwd(struct passwd *, char *, size_t,
-                                   SERVICE *, PASSWD_REC *, int *);
+                                   PASSWD_REC *, int *);
 
 /**
  *
@@ -37,18 +40,14 @@ static enum nss_status fill_passwd(struct passwd *, char *, size_t,
 enum nss_status
 _nss_dbng_setpwent(void)
 {
-    enum nss_status status = NSS_STATUS_SUCCESS;
-
-    NSS_DBNG_LOCK();
-    if(service_init(&Pwd_service, TYPE_PASSWD, DBNG_RO, DEFAULT_BASE) < 0) {
-        status = NSS_STATUS_UNAVAIL;
-        goto cleanup;
-    }
-    init = 1;
+    /* Restart any enumeration already in progress on this thread. */
+    handle_cursor_close(&Pwd_handle, &Pwd_cursor);
+    if(handle_acquire(&Pwd_handle) == NULL)
+        return NSS_STATUS_UNAVAIL;
+    handle_release(&Pwd_handle);
+    ent_init = 1;
 
-cleanup:
-    NSS_DBNG_UNLOCK();
-    return status;
+    return NSS_STATUS_SUCCESS;
 }
 
 /**
@@ -57,12 +56,10 @@ cleanup:
 enum nss_status
 _nss_dbng_endpwent(void)
 {
-    NSS_DBNG_LOCK();
-    if(init) {
-        service_cleanup(&Pwd_service);
-        init = 0;
+    if(ent_init) {
+        handle_cursor_close(&Pwd_handle, &Pwd_cursor);
+        ent_init = 0;
     }
-    NSS_DBNG_UNLOCK();
 
     return NSS_STATUS_SUCCESS;
 }
@@ -79,18 +76,24 @@ _nss_dbng_getpwent_r(struct passwd *pwbuf, char *buf,
     int res;
     enum nss_status status;
 
-    NSS_DBNG_LOCK();
-
-    if(!init) {
+    if(!ent_init || handle_acquire(&Pwd_handle) == NULL) {
         *errnop = ENOENT;
-        status = NSS_STATUS_NOTFOUND;
-        goto cleanup;
+        return NSS_STATUS_NOTFOUND;
     }
 
-    res = Pwd_service.next(&Pwd_service, (KEY *) &key, (REC *) &rec);
+    res = handle_cursor_next(&Pwd_handle, &Pwd_cursor,
+                             (KEY *) &key, (REC *) &rec);
     switch(res) {
     case 0:
-        status = fill_passwd(pwbuf, buf, buflen, &Pwd_service, &rec, errnop);
+        status = fill_passwd(pwbuf, buf, buflen, &rec, errnop);
+        if(status == NSS_STATUS_TRYAGAIN) {
+            /* Hand the same record out again once the caller has room. */
+            handle_cursor_unget(&Pwd_handle, &Pwd_cursor);
+            ent_size = rec.base.block_len;
+        }
+        else {
+            ent_size = 0;
+        }
         break;
 
     case DB_NOTFOUND:
@@ -98,6 +101,11 @@ _nss_dbng_getpwent_r(struct passwd *pwbuf, char *buf,
         status = NSS_STATUS_NOTFOUND;
         goto cleanup;
 
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        goto cleanup;
+
     default:
         NSS_DEBUG("unknown status from next: %d", res);
         *errnop = ENOENT;
@@ -106,10 +114,20 @@ _nss_dbng_getpwent_r(struct passwd *pwbuf, char *buf,
     }
 
 cleanup:
-    NSS_DBNG_UNLOCK();
+    handle_release(&Pwd_handle);
     return status;
 }
 
+/**
+ * Return the buffer size needed by the entry for which getpwent_r last
+ * failed with ERANGE on this thread, or 0 if the last call succeeded.
+ */
+size_t
+_nss_dbng_getpwent_size(void)
+{
+    return ent_size;
+}
+
 /**
  *
  */
@@ -117,43 +135,43 @@ enum nss_status
 _nss_dbng_getpwnam_r(const char* name, struct passwd *pwbuf,
                      char *buf, size_t buflen, int *errnop)
 {
-    SERVICE passwd;
     PASSWD_KEY key;
     PASSWD_REC rec;
     int res;
     enum nss_status status;
 
-    if(service_init(&passwd, TYPE_PASSWD, DBNG_RO, DEFAULT_BASE) < 0) {
-        *errnop = ENOENT;
-        return NSS_STATUS_UNAVAIL;
-    }
-
-    char uname[strlen(name) + 1];
-    strcpy(uname, name);
-    key.data.pri = uname;
+    key.data.pri = (char *) name;
     key.base.type = PRI;
 
-    res = passwd.get(&passwd, (KEY *) &key, (REC *) &rec);
+    res = handle_lookup(&Pwd_handle, (KEY *) &key, (REC *) &rec);
     switch(res) {
     case 0:
         NSS_DEBUG("found user by name %s", name);
-        status = fill_passwd(pwbuf, buf, buflen, &passwd, &rec, errnop);
+        status = fill_passwd(pwbuf, buf, buflen, &rec, errnop);
         break;
 
     case DB_NOTFOUND:
         *errnop = ENOENT;
         status = NSS_STATUS_NOTFOUND;
-        goto cleanup;
+        break;
+
+    case -1:
+        *errnop = ENOENT;
+        status = NSS_STATUS_UNAVAIL;
+        break;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        break;
 
     default:
         NSS_DEBUG("unknown status from get: %d", res);
         *errnop = ENOENT;
         status = NSS_STATUS_NOTFOUND;
-        goto cleanup;
+        break;
     }
 
-cleanup:
-    service_cleanup(&passwd);
     return status;
 }
 
@@ -164,49 +182,51 @@ enum nss_status
 _nss_dbng_getpwuid_r(uid_t uid, struct passwd *pwbuf,
                      char *buf, size_t buflen, int *errnop)
 {
-    SERVICE passwd;
     PASSWD_KEY key;
     PASSWD_REC rec;
     int res;
     enum nss_status status;
 
-    if(service_init(&passwd, TYPE_PASSWD, DBNG_RO, DEFAULT_BASE) < 0) {
-        *errnop = ENOENT;
-        return NSS_STATUS_UNAVAIL;
-    }
-
     /* Query on the secondary index. */
     key.base.type = SEC;
     key.data.sec = uid;
-    res = passwd.get(&passwd, (KEY *) &key, (REC *) &rec);
+    res = handle_lookup(&Pwd_handle, (KEY *) &key, (REC *) &rec);
     switch(res) {
     case 0:
         NSS_DEBUG("found user by uid %d", uid);
-        status = fill_passwd(pwbuf, buf, buflen, &passwd, &rec, errnop);
+        status = fill_passwd(pwbuf, buf, buflen, &rec, errnop);
         break;
 
     case DB_NOTFOUND:
         *errnop = ENOENT;
         status = NSS_STATUS_NOTFOUND;
-        goto cleanup;
+        break;
+
+    case -1:
+        *errnop = ENOENT;
+        status = NSS_STATUS_UNAVAIL;
+        break;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        break;
 
     default:
         NSS_DEBUG("unknown status from get: %d", res);
         *errnop = ENOENT;
         status = NSS_STATUS_UNAVAIL;
-        goto cleanup;
+        break;
     }
 
-cleanup:
-    service_cleanup(&passwd);
     return status;
 }
 
 static enum nss_status
 fill_passwd(struct passwd *pwbuf, char *buf, size_t buflen,
-            SERVICE *service, PASSWD_REC *rec, int *errnop)
+            PASSWD_REC *rec, int *errnop)
 {
-    if(buflen < service->rec_size(service, (REC *) rec)) {
+    if(buflen < rec->base.block_len) {
         *errnop = ERANGE;
         return NSS_STATUS_TRYAGAIN;
     }
@@ -214,24 +234,13 @@ fill_passwd(struct passwd *pwbuf, char *buf, size_t buflen,
     pwbuf->pw_uid = rec->uid;
     pwbuf->pw_gid = rec->gid;
 
-    strcpy(buf, rec->name);
-    pwbuf->pw_name = buf;
-    buf += strlen(rec->name) + 1;
-
-    strcpy(buf, rec->passwd);
-    pwbuf->pw_passwd = buf;
-    buf += strlen(rec->passwd) + 1;
-
-    strcpy(buf, rec->gecos);
-    pwbuf->pw_gecos = buf;
-    buf += strlen(rec->gecos) + 1;
-
-    strcpy(buf, rec->shell);
-    pwbuf->pw_shell = buf;
-    buf += strlen(rec->shell) + 1;
-
-    strcpy(buf, rec->homedir);
-    pwbuf->pw_dir = buf;
+    /* The stored string block is already laid out as glibc expects. */
+    memcpy(buf, rec->base.block, rec->base.block_len);
+    pwbuf->pw_name = NSS_DBNG_RELOC(buf, rec, rec->name);
+    pwbuf->pw_passwd = NSS_DBNG_RELOC(buf, rec, rec->passwd);
+    pwbuf->pw_gecos = NSS_DBNG_RELOC(buf, rec, rec->gecos);
+    pwbuf->pw_shell = NSS_DBNG_RELOC(buf, rec, rec->shell);
+    pwbuf->pw_dir = NSS_DBNG_RELOC(buf, rec, rec->homedir);
 
     return NSS_STATUS_SUCCESS;
 }
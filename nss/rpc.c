@@ -0,0 +1,127 @@
+/**
+ * @file rpc.c
+ * @brief Implements the functions to retrieve RPC program numbers.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include "nss-dbng.h"
+
+#include <netdb.h>
+#include <rpc/netdb.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../lib/service.h"
+#include "handle.h"
+#include "../lib/service-numbered.h"
+
+/*
+ * Free-threaded, read-only handle shared by all lookups in this process,
+ * reopened once dbngctl modifies the databases.
+ */
+static HANDLE Rpc_handle = HANDLE_INITIALIZER(TYPE_RPC);
+
+static enum nss_status lookup(NUMBERED_KEY *, struct rpcent *, char *,
+                              size_t, int *);
+static enum nss_status fill_rpcent(struct rpcent *, char *, size_t,
+                                   const NUMBERED_REC *, int *);
+
+enum nss_status
+_nss_dbng_getrpcbyname_r(const char *name, struct rpcent *result,
+                         char *buf, size_t buflen, int *errnop)
+{
+    NUMBERED_KEY key;
+    enum nss_status status;
+
+    key.base.type = PRI;
+    key.data.pri = (char *) name;
+    if((status = lookup(&key, result, buf, buflen, errnop))
+       != NSS_STATUS_NOTFOUND)
+    {
+        return status;
+    }
+
+    key.base.type = AUX;
+    key.data.aux = (char *) name;
+
+    return lookup(&key, result, buf, buflen, errnop);
+}
+
+enum nss_status
+_nss_dbng_getrpcbynumber_r(int number, struct rpcent *result,
+                           char *buf, size_t buflen, int *errnop)
+{
+    NUMBERED_KEY key;
+
+    /* Query on the secondary index. */
+    key.base.type = SEC;
+    key.data.sec = number;
+
+    return lookup(&key, result, buf, buflen, errnop);
+}
+
+static enum nss_status
+lookup(NUMBERED_KEY *key, struct rpcent *result, char *buf, size_t buflen,
+       int *errnop)
+{
+    NUMBERED_REC rec;
+    int res;
+
+    res = handle_lookup(&Rpc_handle, (KEY *) key, (REC *) &rec);
+    switch(res) {
+    case 0:
+        return fill_rpcent(result, buf, buflen, &rec, errnop);
+
+    case DB_NOTFOUND:
+        *errnop = ENOENT;
+        return NSS_STATUS_NOTFOUND;
+
+    case -1:
+        *errnop = ENOENT;
+        return NSS_STATUS_UNAVAIL;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        return NSS_STATUS_TRYAGAIN;
+
+    default:
+        NSS_DEBUG("unknown status from get: %d", res);
+        *errnop = ENOENT;
+        return NSS_STATUS_NOTFOUND;
+    }
+}
+
+static enum nss_status
+fill_rpcent(struct rpcent *result, char *buf, size_t buflen,
+            const NUMBERED_REC *rec, int *errnop)
+{
+    size_t align, ptrs;
+    char *strings;
+    int i;
+
+    /* The alias pointers lead the buffer, so must be suitably aligned. */
+    align = (sizeof(char *) - ((uintptr_t) buf % sizeof(char *)))
+        % sizeof(char *);
+    ptrs = (rec->count + 1) * sizeof(char *);
+
+    if(buflen < align + ptrs + rec->base.block_len) {
+        *errnop = ERANGE;
+        return NSS_STATUS_TRYAGAIN;
+    }
+
+    result->r_number = rec->number;
+    result->r_aliases = (char **) (buf + align);
+    strings = buf + align + ptrs;
+
+    /* The stored string block is already laid out as glibc expects. */
+    memcpy(strings, rec->base.block, rec->base.block_len);
+    result->r_name = NSS_DBNG_RELOC(strings, rec, rec->name);
+
+    for(i = 0; i < rec->count && rec->aliases[i] != NULL; i++)
+        result->r_aliases[i] = NSS_DBNG_RELOC(strings, rec, rec->aliases[i]);
+    result->r_aliases[i] = NULL;
+
+    return NSS_STATUS_SUCCESS;
+}
@@ -0,0 +1,182 @@
+/**
+ * @file services.c
+ * @brief Implements the functions to retrieve network services.
+ * @author Mikey Austin
+ * @date 2015
+ */
+
+#include "nss-dbng.h"
+
+#include <netdb.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+
+#include "../lib/service.h"
+#include "handle.h"
+#include "../lib/service-services.h"
+
+/*
+ * Free-threaded, read-only handle shared by all lookups in this process,
+ * reopened once dbngctl modifies the databases.
+ */
+static HANDLE Serv_handle = HANDLE_INITIALIZER(TYPE_SERVICES);
+
+/* The caller's result, filled from the first entry of any protocol. */
+struct any_state {
+    struct servent *result;
+    char *buf;
+    size_t buflen;
+    int *errnop;
+    enum nss_status status;
+};
+
+static enum nss_status lookup(SERVICES_KEY *, struct servent *, char *,
+                              size_t, int *);
+static int fill_any(SERVICE *, const REC *, void *);
+static enum nss_status fill_servent(struct servent *, char *, size_t,
+                                    const SERVICES_REC *, int *);
+
+enum nss_status
+_nss_dbng_getservbyname_r(const char *name, const char *proto,
+                          struct servent *result, char *buf, size_t buflen,
+                          int *errnop)
+{
+    SERVICES_KEY key;
+    enum nss_status status;
+
+    key.base.type = PRI;
+    key.data.pri.name = (char *) name;
+    key.data.pri.proto = (char *) proto;
+    if((status = lookup(&key, result, buf, buflen, errnop))
+       != NSS_STATUS_NOTFOUND)
+    {
+        return status;
+    }
+
+    key.base.type = AUX;
+    key.data.aux.name = (char *) name;
+    key.data.aux.proto = (char *) proto;
+
+    return lookup(&key, result, buf, buflen, errnop);
+}
+
+enum nss_status
+_nss_dbng_getservbyport_r(int port, const char *proto,
+                          struct servent *result, char *buf, size_t buflen,
+                          int *errnop)
+{
+    SERVICES_KEY key;
+
+    /* Query on the secondary index. */
+    key.base.type = SEC;
+    key.data.sec.port = ntohs(port);
+    key.data.sec.proto = (char *) proto;
+
+    return lookup(&key, result, buf, buflen, errnop);
+}
+
+/*
+ * Look a service up by a key qualified by its protocol, or when no
+ * protocol is given, take the first entry stored for any protocol.
+ */
+static enum nss_status
+lookup(SERVICES_KEY *key, struct servent *result, char *buf, size_t buflen,
+       int *errnop)
+{
+    SERVICE *service;
+    SERVICES_REC rec;
+    struct any_state state;
+    const char *proto = (key->base.type == SEC
+                         ? key->data.sec.proto
+                         : key->data.pri.proto);
+    int res;
+
+    if(proto != NULL) {
+        res = handle_lookup(&Serv_handle, (KEY *) key, (REC *) &rec);
+        if(res == 0)
+            return fill_servent(result, buf, buflen, &rec, errnop);
+    }
+    else if((service = handle_acquire(&Serv_handle)) != NULL) {
+        memset(&state, 0, sizeof(state));
+        state.result = result;
+        state.buf = buf;
+        state.buflen = buflen;
+        state.errnop = errnop;
+
+        /* The record is only valid during the walk, so it is filled there. */
+        res = service->get_prefix(service, (KEY *) key, (REC *) &rec,
+                                  fill_any, &state);
+        handle_release(&Serv_handle);
+        if(res == 0)
+            return state.status;
+    }
+    else {
+        res = -1;
+    }
+
+    switch(res) {
+    case DB_NOTFOUND:
+        *errnop = ENOENT;
+        return NSS_STATUS_NOTFOUND;
+
+    case -1:
+        *errnop = ENOENT;
+        return NSS_STATUS_UNAVAIL;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        return NSS_STATUS_TRYAGAIN;
+
+    default:
+        NSS_DEBUG("unknown status from get: %d", res);
+        *errnop = ENOENT;
+        return NSS_STATUS_NOTFOUND;
+    }
+}
+
+static int
+fill_any(SERVICE *service, const REC *rec, void *data)
+{
+    struct any_state *state = data;
+
+    state->status = fill_servent(state->result, state->buf, state->buflen,
+                                 (const SERVICES_REC *) rec, state->errnop);
+
+    return 1;
+}
+
+static enum nss_status
+fill_servent(struct servent *result, char *buf, size_t buflen,
+             const SERVICES_REC *rec, int *errnop)
+{
+    size_t align, ptrs;
+    char *strings;
+    int i;
+
+    /* The alias pointers lead the buffer, so must be suitably aligned. */
+    align = (sizeof(char *) - ((uintptr_t) buf % sizeof(char *)))
+        % sizeof(char *);
+    ptrs = (rec->count + 1) * sizeof(char *);
+
+    if(buflen < align + ptrs + rec->base.block_len) {
+        *errnop = ERANGE;
+        return NSS_STATUS_TRYAGAIN;
+    }
+
+    result->s_port = htons(rec->port);
+    result->s_aliases = (char **) (buf + align);
+    strings = buf + align + ptrs;
+
+    /* The stored string block is already laid out as glibc expects. */
+    memcpy(strings, rec->base.block, rec->base.block_len);
+    result->s_name = NSS_DBNG_RELOC(strings, rec, rec->name);
+    result->s_proto = NSS_DBNG_RELOC(strings, rec, rec->proto);
+
+    for(i = 0; i < rec->count && rec->aliases[i] != NULL; i++)
+        result->s_aliases[i] = NSS_DBNG_RELOC(strings, rec, rec->aliases[i]);
+    result->s_aliases[i] = NULL;
+
+    return NSS_STATUS_SUCCESS;
+}
@@ -12,35 +12,136 @@
 #include <errno.h>
 
 #include "../lib/service-shadow.h"
+#include "handle.h"
+
+/*
+ * Free-threaded, read-only handle shared by all lookups and enumerations
+ * in this process, reopened once dbngctl modifies the databases.
+ */
+static HANDLE Sp_handle = HANDLE_INITIALIZER(TYPE_SHADOW);
+
+/*
+ * Each enumerating thread has its own cursor over the lookup handle, so
+ * concurrent getspent scans neither block nor disturb each other.
+ */
+static __thread HANDLE_CURSOR Sp_cursor;
+static __thread int ent_init;
+
+/* Buffer size needed by the last record which did not fit, or 0. */
+static __thread size_t ent_size;
 
 static enum nss_status fill_shadow(struct spwd *, char *, size_t,
                                    SERVICE *, SHADOW_REC *, int *);
 
+enum nss_status
+_nss_dbng_setspent(void)
+{
+    /* Restart any enumeration already in progress on this thread. */
+    handle_cursor_close(&Sp_handle, &Sp_cursor);
+    if(handle_acquire(&Sp_handle) == NULL)
+        return NSS_STATUS_UNAVAIL;
+    handle_release(&Sp_handle);
+    ent_init = 1;
+
+    return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status
+_nss_dbng_endspent(void)
+{
+    if(ent_init) {
+        handle_cursor_close(&Sp_handle, &Sp_cursor);
+        ent_init = 0;
+    }
+
+    return NSS_STATUS_SUCCESS;
+}
+
+enum nss_status
+_nss_dbng_getspent_r(struct spwd *spbuf, char *buf, size_t buflen,
+                     int *errnop)
+{
+    SHADOW_KEY key;
+    SHADOW_REC rec;
+    SERVICE *shadow;
+    int res;
+    enum nss_status status;
+
+    if(!ent_init || (shadow = handle_acquire(&Sp_handle)) == NULL) {
+        *errnop = ENOENT;
+        return NSS_STATUS_NOTFOUND;
+    }
+
+    res = handle_cursor_next(&Sp_handle, &Sp_cursor,
+                             (KEY *) &key, (REC *) &rec);
+    switch(res) {
+    case 0:
+        status = fill_shadow(spbuf, buf, buflen, shadow, &rec, errnop);
+        if(status == NSS_STATUS_TRYAGAIN) {
+            /* Hand the same record out again once the caller has room. */
+            handle_cursor_unget(&Sp_handle, &Sp_cursor);
+            ent_size = rec.base.block_len;
+        }
+        else {
+            ent_size = 0;
+        }
+        break;
+
+    case DB_NOTFOUND:
+        *errnop = ENOENT;
+        status = NSS_STATUS_NOTFOUND;
+        goto cleanup;
+
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        goto cleanup;
+
+    default:
+        NSS_DEBUG("unknown status from next: %d", res);
+        *errnop = ENOENT;
+        status = NSS_STATUS_NOTFOUND;
+        goto cleanup;
+    }
+
+cleanup:
+    handle_release(&Sp_handle);
+    return status;
+}
+
+/**
+ * Return the buffer size needed by the entry for which getspent_r last
+ * failed with ERANGE on this thread, or 0 if the last call succeeded.
+ */
+size_t
+_nss_dbng_getspent_size(void)
+{
+    return ent_size;
+}
+
 enum nss_status
 _nss_dbng_getspnam_r(const char* name, struct spwd *spbuf,
                      char *buf, size_t buflen, int *errnop)
 {
-    SERVICE shadow;
+    SERVICE *shadow;
     SHADOW_KEY key;
     SHADOW_REC rec;
     int res;
     enum nss_status status;
 
-    if(service_init(&shadow, TYPE_SHADOW, DBNG_RO, DEFAULT_BASE) < 0) {
+    if((shadow = handle_acquire(&Sp_handle)) == NULL) {
         *errnop = ENOENT;
         return NSS_STATUS_UNAVAIL;
     }
 
-    char uname[strlen(name) + 1];
-    strcpy(uname, name);
-    key.data.pri = uname;
+    key.data.pri = (char *) name;
     key.base.type = PRI;
 
-    res = shadow.get(&shadow, (KEY *) &key, (REC *) &rec);
+    res = handle_get(&Sp_handle, (KEY *) &key, (REC *) &rec);
     switch(res) {
     case 0:
         NSS_DEBUG("found shadow entry by name %s", name);
-        status = fill_shadow(spbuf, buf, buflen, &shadow, &rec, errnop);
+        status = fill_shadow(spbuf, buf, buflen, shadow, &rec, errnop);
         break;
 
     case DB_NOTFOUND:
@@ -48,6 +149,11 @@ _nss_dbng_getspnam_r(const char* name, struct spwd *spbuf,
         status = NSS_STATUS_NOTFOUND;
         goto cleanup;
 
+    case ENOMEM:
+        *errnop = ENOMEM;
+        status = NSS_STATUS_TRYAGAIN;
+        goto cleanup;
+
     default:
         NSS_DEBUG("unknown status from get: %d", res);
         *errnop = ENOENT;
@@ -56,7 +162,7 @@ _nss_dbng_getspnam_r(const char* name, struct spwd *spbuf,
     }
 
 cleanup:
-    service_cleanup(&shadow);
+    handle_release(&Sp_handle);
     return status;
 }
 
@@ -64,18 +170,15 @@ static enum nss_status
 fill_shadow(struct spwd *spbuf, char *buf, size_t buflen,
             SERVICE *service, SHADOW_REC *rec, int *errnop)
 {
-    if(buflen < service->rec_size(service, (REC *) rec)) {
+    if(buflen < rec->base.block_len) {
         *errnop = ERANGE;
         return NSS_STATUS_TRYAGAIN;
     }
 
-    strcpy(buf, rec->name);
-    spbuf->sp_namp = buf;
-    buf += strlen(rec->name) + 1;
-
-    strcpy(buf, rec->passwd);
-    spbuf->sp_pwdp = buf;
-    buf += strlen(rec->passwd) + 1;
+    /* The stored string block is already laid out as glibc expects. */
+    memcpy(buf, rec->base.block, rec->base.block_len);
+    spbuf->sp_namp = NSS_DBNG_RELOC(buf, rec, rec->name);
+    spbuf->sp_pwdp = NSS_DBNG_RELOC(buf, rec, rec->passwd);
 
     spbuf->sp_lstchg = rec->lstchg;
     spbuf->sp_min = rec->min;
@@ -63,3 +63,4 @@ mv %{buildroot}/usr/include/{,dbng/}dbng.h
 /usr/lib/libdbng.so.0.0.0
 /usr/lib/libdbng.so.0
 /usr/sbin/dbngctl
+/usr/sbin/dbngd